@@ -0,0 +1,319 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICAApplyNode.h"
+#include "ICAApplyEditor.h"
+
+using namespace ICA;
+
+const String ICAApplyEditor::subProcTooltip("An ICA operation can be loaded for each"
+    " input subprocessor. The input selected here is the one that a newly loaded"
+    " operation will be applied to.");
+
+const String ICAApplyEditor::rejectTooltip("Numbers of the components to remove"
+    " (starting from 1), separated by spaces. Use an ICA processor to train and"
+    " inspect the decomposition first.");
+
+const String ICAApplyEditor::recordRemovedTooltip("While recording, also save the removed"
+    " components (and the part of the mixing matrix that maps them to channels) to"
+    " 'ica_removed' within the recording directory, so that the raw data can be"
+    " reconstructed offline. Can't be changed during acquisition, or used with a band-pass filter.");
+
+const String ICAApplyEditor::bandTooltip("Band-pass filter (in Hz) applied to all channels"
+    " of every input after the ICA operation, in the same pass over the data. Enter e.g."
+    " '300-6000', '1-' for a high pass only, '-300' for a low pass only, or leave empty"
+    " for no filter. Can't be used with SIDECAR, since the removed components it saves"
+    " wouldn't add back to the filtered output.");
+
+ICAApplyEditor::ICAApplyEditor(ICAApplyNode* parentNode)
+    : GenericEditor     (parentNode, false)
+    , subProcLabel      ("subProcLabel", "Input:")
+    , subProcComboBox   ("subProcComboBox")
+    , rejectLabel       ("rejectLabel", "Reject:")
+    , rejectTextBox     ("rejectTextBox", "")
+    , recordRemovedButton("SIDECAR", Font("Default", 12, Font::plain))
+    , bandLabel         ("bandLabel", "Band (Hz):")
+    , bandTextBox       ("bandTextBox", "")
+    , currICAIndicator  ("currICAIndicator", "")
+    , clearButton       ("X", Font("Default", 12, Font::plain))
+    , configPathVal     (parentNode->addConfigPathListener(this))
+{
+    desiredWidth = 275;
+
+    subProcLabel.setBounds(10, 30, 50, 20);
+    subProcLabel.setTooltip(subProcTooltip);
+    addAndMakeVisible(subProcLabel);
+
+    subProcComboBox.setBounds(60, 30, 130, 22);
+    subProcComboBox.addListener(this);
+    subProcComboBox.setTooltip(subProcTooltip);
+    addAndMakeVisible(subProcComboBox);
+
+    rejectLabel.setBounds(10, 60, 50, 20);
+    rejectLabel.setTooltip(rejectTooltip);
+    addAndMakeVisible(rejectLabel);
+
+    rejectTextBox.setBounds(60, 60, 65, 20);
+    rejectTextBox.setEditable(true);
+    rejectTextBox.addListener(this);
+    rejectTextBox.setColour(Label::backgroundColourId, Colours::grey);
+    rejectTextBox.setColour(Label::textColourId, Colours::white);
+    rejectTextBox.setTooltip(rejectTooltip);
+    addAndMakeVisible(rejectTextBox);
+
+    recordRemovedButton.setBounds(130, 60, 60, 20);
+    recordRemovedButton.setClickingTogglesState(true);
+    recordRemovedButton.setToggleState(parentNode->getRecordRemoved(), dontSendNotification);
+    recordRemovedButton.addListener(this);
+    recordRemovedButton.setTooltip(recordRemovedTooltip);
+    addAndMakeVisible(recordRemovedButton);
+
+    bandLabel.setBounds(195, 30, 75, 20);
+    bandLabel.setTooltip(bandTooltip);
+    addAndMakeVisible(bandLabel);
+
+    bandTextBox.setBounds(200, 60, 65, 20);
+    bandTextBox.setEditable(true);
+    bandTextBox.addListener(this);
+    bandTextBox.setColour(Label::backgroundColourId, Colours::grey);
+    bandTextBox.setColour(Label::textColourId, Colours::white);
+    bandTextBox.setTooltip(bandTooltip);
+    addAndMakeVisible(bandTextBox);
+
+    currICAIndicator.setBounds(0, 0, 155, 20);
+
+    clearButton.setBounds(155, 0, 20, 20);
+    clearButton.addListener(this);
+    clearButton.setVisible(false);
+
+    currICAArea.setBounds(10, 95, 180, 20);
+    currICAArea.addAndMakeVisible(currICAIndicator);
+    currICAArea.addChildComponent(clearButton);
+    addAndMakeVisible(currICAArea);
+
+    loadButton.addListener(this);
+    loadButton.setBounds(desiredWidth - 50, 5, 15, 15);
+    addAndMakeVisible(loadButton);
+}
+
+
+void ICAApplyEditor::labelTextChanged(Label* labelThatHasChanged)
+{
+    auto node = static_cast<ICAApplyNode*>(getProcessor());
+
+    if (labelThatHasChanged == &rejectTextBox)
+    {
+        SortedSet<int> comps;
+        for (int comp : ICANode::stringToIntSet(labelThatHasChanged->getText().replaceCharacter(',', ' ')))
+        {
+            comps.add(comp - 1); // to 0-based
+        }
+
+        Result res = node->setRejectedComponents(comps);
+        if (res.failed())
+        {
+            CoreServices::sendStatusMessage("Invalid components: " + res.getErrorMessage());
+        }
+
+        updateRejectTextBox();
+    }
+    else if (labelThatHasChanged == &bandTextBox)
+    {
+        String text = labelThatHasChanged->getText().trim();
+        float lowHz = text.upToFirstOccurrenceOf("-", false, false).getFloatValue();
+        float highHz = text.fromFirstOccurrenceOf("-", false, false).getFloatValue();
+
+        Result res = node->setFilterBand(lowHz, highHz);
+        if (res.failed())
+        {
+            CoreServices::sendStatusMessage("Invalid band: " + res.getErrorMessage());
+        }
+
+        updateBandTextBox();
+    }
+}
+
+
+void ICAApplyEditor::comboBoxChanged(ComboBox* comboBoxThatHasChanged)
+{
+    auto node = static_cast<ICAApplyNode*>(getProcessor());
+
+    if (comboBoxThatHasChanged == &subProcComboBox)
+    {
+        node->setCurrSubProc(comboBoxThatHasChanged->getSelectedId());
+        updateRejectTextBox();
+    }
+}
+
+
+void ICAApplyEditor::buttonEvent(Button* button)
+{
+    auto node = static_cast<ICAApplyNode*>(getProcessor());
+
+    if (button == &clearButton)
+    {
+        node->resetICA(subProcComboBox.getSelectedId());
+    }
+    else if (button == &recordRemovedButton)
+    {
+        Result res = node->setRecordRemoved(button->getToggleState());
+        if (res.failed())
+        {
+            CoreServices::sendStatusMessage(res.getErrorMessage());
+            button->setToggleState(node->getRecordRemoved(), dontSendNotification);
+        }
+    }
+    else if (button == &loadButton)
+    {
+        File icaBaseDir = ICANode::getICABaseDir();
+        if (!icaBaseDir.isDirectory())
+        {
+            // default to bin/ica
+            icaBaseDir = File::getSpecialLocation(File::hostApplicationPath)
+                .getParentDirectory().getChildFile("ica");
+        }
+
+        FileChooser fc("Choose a binica config file...", icaBaseDir, "*.sc", true);
+
+        if (fc.browseForFileToOpen())
+        {
+            Result loadRes = node->loadICA(fc.getResult());
+
+            if (loadRes.failed())
+            {
+                CoreServices::sendStatusMessage("ICA load failed: " + loadRes.getErrorMessage());
+            }
+        }
+    }
+}
+
+
+void ICAApplyEditor::valueChanged(Value& value)
+{
+    if (value.refersToSameSourceAs(configPathVal))
+    {
+        String icaDir = File(value.toString()).getParentDirectory().getFileName();
+        currICAIndicator.setText(icaDir, dontSendNotification);
+
+        // "X" should be visible iff there is an ICA operation loaded for the current subproc
+        clearButton.setVisible(!value.toString().isEmpty());
+
+        updateRejectTextBox();
+    }
+}
+
+
+void ICAApplyEditor::updateSettings()
+{
+    auto node = static_cast<ICAApplyNode*>(getProcessor());
+
+    subProcComboBox.clear(dontSendNotification);
+    for (auto& subProcEntry : node->getSubProcInfo())
+    {
+        subProcComboBox.addItem(subProcEntry.second, subProcEntry.first);
+    }
+
+    subProcComboBox.setSelectedId(node->getCurrSubProc(), dontSendNotification);
+    updateRejectTextBox();
+}
+
+
+void ICAApplyEditor::startAcquisition()
+{
+    GenericEditor::startAcquisition();
+    recordRemovedButton.setEnabled(false);
+}
+
+void ICAApplyEditor::stopAcquisition()
+{
+    GenericEditor::stopAcquisition();
+    recordRemovedButton.setEnabled(true);
+}
+
+
+void ICAApplyEditor::saveCustomParameters(XmlElement* xml)
+{
+    GenericEditor::saveCustomParameters(xml);
+
+    xml->setAttribute("Type", "ICAApplyEditor");
+
+    XmlElement* stateNode = xml->createNewChildElement("STATE");
+    stateNode->setAttribute("subproc", subProcComboBox.getSelectedId());
+    stateNode->setAttribute("recordRemoved", recordRemovedButton.getToggleState());
+
+    float lowHz, highHz;
+    static_cast<ICAApplyNode*>(getProcessor())->getFilterBand(lowHz, highHz);
+    stateNode->setAttribute("filterLow", lowHz);
+    stateNode->setAttribute("filterHigh", highHz);
+}
+
+void ICAApplyEditor::loadCustomParameters(XmlElement* xml)
+{
+    GenericEditor::loadCustomParameters(xml);
+
+    forEachXmlChildElementWithTagName(*xml, stateNode, "STATE")
+    {
+        uint32 subProc = stateNode->getIntAttribute("subproc");
+        if (subProc)
+        {
+            subProcComboBox.setSelectedId(subProc);
+        }
+
+        bool recordRemoved = stateNode->getBoolAttribute("recordRemoved", recordRemovedButton.getToggleState());
+        recordRemovedButton.setToggleState(recordRemoved, dontSendNotification);
+        static_cast<ICAApplyNode*>(getProcessor())->setRecordRemoved(recordRemoved);
+
+        Result res = static_cast<ICAApplyNode*>(getProcessor())->setFilterBand(
+            float(stateNode->getDoubleAttribute("filterLow")),
+            float(stateNode->getDoubleAttribute("filterHigh")));
+        if (res.failed())
+        {
+            CoreServices::sendStatusMessage("Band not restored: " + res.getErrorMessage());
+        }
+        updateBandTextBox();
+    }
+}
+
+
+void ICAApplyEditor::updateRejectTextBox()
+{
+    auto node = static_cast<ICAApplyNode*>(getProcessor());
+
+    SortedSet<int> comps;
+    for (int comp : node->getRejectedComponents())
+    {
+        comps.add(comp + 1);
+    }
+
+    rejectTextBox.setText(ICANode::intSetToString(comps), dontSendNotification);
+}
+
+void ICAApplyEditor::updateBandTextBox()
+{
+    auto node = static_cast<ICAApplyNode*>(getProcessor());
+
+    float lowHz, highHz;
+    node->getFilterBand(lowHz, highHz);
+
+    String text;
+    if (lowHz > 0 || highHz > 0)
+    {
+        text = (lowHz > 0 ? String(lowHz) : String()) + "-" + (highHz > 0 ? String(highHz) : String());
+    }
+
+    bandTextBox.setText(text, dontSendNotification);
+}
@@ -0,0 +1,92 @@
+#ifndef ICA_APPLY_EDITOR_H_DEFINED
+#define ICA_APPLY_EDITOR_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <VisualizerEditorHeaders.h>
+
+namespace ICA
+{
+    class ICAApplyNode;
+
+    // Editor for ICAApplyNode. There is no canvas; components to reject
+    // are entered as a list of numbers instead.
+    class ICAApplyEditor
+        : public GenericEditor
+        , public Label::Listener
+        , public ComboBox::Listener
+        , public Value::Listener
+    {
+    public:
+        ICAApplyEditor(ICAApplyNode* parentNode);
+
+        void labelTextChanged(Label* labelThatHasChanged) override;
+
+        void comboBoxChanged(ComboBox* comboBoxThatHasChanged) override;
+
+        void buttonEvent(Button* button) override;
+
+        void valueChanged(Value& value) override;
+
+        void updateSettings() override;
+
+        void startAcquisition() override;
+        void stopAcquisition() override;
+
+        void saveCustomParameters(XmlElement* xml) override;
+        void loadCustomParameters(XmlElement* xml) override;
+
+    private:
+        // display the current subprocessor's rejected components (1-based)
+        void updateRejectTextBox();
+
+        // display the node's filter band
+        void updateBandTextBox();
+
+        Label subProcLabel;
+        ComboBox subProcComboBox;
+        static const String subProcTooltip;
+
+        Label rejectLabel;
+        Label rejectTextBox;
+        static const String rejectTooltip;
+
+        // toggles saving removed components while recording
+        UtilityButton recordRemovedButton;
+        static const String recordRemovedTooltip;
+
+        // band-pass filter applied after ICA, as "<low>-<high>" in Hz (either can be left out)
+        Label bandLabel;
+        Label bandTextBox;
+        static const String bandTooltip;
+
+        // contains currICAIndicator and clearButton.
+        Component currICAArea;
+
+        Label currICAIndicator;
+        UtilityButton clearButton;
+
+        LoadButton loadButton;
+
+        const Value& configPathVal;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ICAApplyEditor);
+    };
+}
+
+#endif // ICA_APPLY_EDITOR_H_DEFINED
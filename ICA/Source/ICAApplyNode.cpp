@@ -0,0 +1,609 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICAApplyNode.h"
+#include "ICAApplyEditor.h"
+
+#include <iostream>
+
+using namespace ICA;
+
+const int ICAApplyNode::filterOrder(4);
+
+ICAApplyNode::ICAApplyNode()
+    : GenericProcessor  ("ICA Apply")
+    , currSubProc       (0)
+    , recordRemoved     (false)
+    , filterLowHz       (0)
+    , filterHighHz      (0)
+{
+    setProcessorType(PROCESSOR_TYPE_FILTER);
+}
+
+AudioProcessorEditor* ICAApplyNode::createEditor()
+{
+    editor = new ICAApplyEditor(this);
+    return editor;
+}
+
+void ICAApplyNode::process(AudioSampleBuffer& buffer)
+{
+    float* const* bufferData = buffer.getArrayOfWritePointers();
+
+    for (auto& subProcEntry : subProcData)
+    {
+        SubProcData& data = subProcEntry.second;
+
+        int nSamps = getNumSamples(data.channelInds[0]);
+
+        // (the recorder only changes when not acquiring, so it can be used even if the lock fails)
+        const ScopedReadTryLock icaOpLock(data.icaMutex);
+        const ApplyPlan* plan = icaOpLock.isLocked() ? data.plan.get() : nullptr;
+        ChannelFilter* filter = data.filter.get();
+        ComponentRecorder* recorder = data.recorder;
+
+        if (recorder)
+        {
+            recorder->beginBlock(plan, nSamps, getTimestamp(data.channelInds[0]));
+        }
+
+        if (filter)
+        {
+            filter->beginBlock();
+        }
+
+        // (the plan's channels are filtered tile by tile as they are written back)
+        if (plan)
+        {
+            plan->apply(bufferData, nSamps, applyScratch,
+                recorder && recorder->isCapturing() ? recorder : nullptr, filter);
+        }
+
+        if (filter)
+        {
+            filter->finishBlock(bufferData, nSamps);
+        }
+    }
+}
+
+bool ICAApplyNode::disable()
+{
+    // report any blocks where bad channels had to be left out (see ApplyPlan)
+    String guardReport(applyScratch.takeGuardReport());
+    if (guardReport.isNotEmpty())
+    {
+        std::cerr << guardReport << std::endl;
+        CoreServices::sendStatusMessage(guardReport);
+    }
+
+    for (auto& subProcEntry : subProcData)
+    {
+        releaseOldFilters(subProcEntry.second);
+    }
+
+    return true;
+}
+
+void ICAApplyNode::updateSettings()
+{
+    int nChans = getNumInputs();
+
+    uint32 newSubProc = 0;
+    subProcInfo.clear();
+
+    std::map<uint32, SubProcData> newSubProcData;
+
+    for (int c = 0; c < nChans; ++c)
+    {
+        const DataChannel* chan = getDataChannel(c);
+        uint16 sourceID = chan->getSourceNodeID();
+        uint16 subProcIdx = chan->getSubProcessorIdx();
+        uint32 sourceFullId = getProcessorFullId(sourceID, subProcIdx);
+
+        if (sourceFullId == currSubProc || newSubProc == 0)
+        {
+            newSubProc = sourceFullId;
+        }
+
+        auto newDataEntry = newSubProcData.find(sourceFullId);
+        if (newDataEntry != newSubProcData.end())
+        {
+            newDataEntry->second.channelInds.add(c);
+            subProcInfo[sourceFullId].channelNames.add(chan->getName());
+        }
+        else
+        {
+            SubProcInfo& newInfo = subProcInfo[sourceFullId];
+            newInfo.sourceID = sourceID;
+            newInfo.subProcIdx = subProcIdx;
+            newInfo.sourceName = chan->getSourceName();
+            newInfo.channelNames.add(chan->getName());
+
+            SubProcData& newData = newSubProcData[sourceFullId];
+            newData.Fs = chan->getSampleRate();
+            newData.channelInds.add(c);
+            newData.icaOp = new ICAOperation();
+            newData.icaConfigPath = "";
+
+            // keep using the existing operation, if any
+            auto oldDataEntry = subProcData.find(sourceFullId);
+            if (oldDataEntry != subProcData.end())
+            {
+                SubProcData& oldData = oldDataEntry->second;
+
+                const ScopedWriteLock icaWriteLock(oldData.icaMutex);
+                newData.icaOp.swapWith(oldData.icaOp);
+                newData.icaConfigPath.referTo(oldData.icaConfigPath);
+            }
+        }
+    }
+
+    int maxSubProcChans = 0;
+
+    for (auto& dataEntry : newSubProcData)
+    {
+        uint32 subProc = dataEntry.first;
+        SubProcData& data = dataEntry.second;
+        int nSubProcChans = data.channelInds.size();
+        maxSubProcChans = jmax(maxSubProcChans, nSubProcChans);
+
+        if (!data.icaOp->isNoop() && data.icaOp->enabledChannels.getLast() >= nSubProcChans)
+        {
+            // can't use, needs too many channels - reset to no-op
+            data.icaOp = new ICAOperation();
+            data.icaConfigPath = "";
+        }
+
+        data.plan = data.icaOp->createPlan(data.channelInds);
+        updateFilter(data);
+
+        if (recordRemoved)
+        {
+            data.recorder = new ComponentRecorder(subProcInfo[subProc], data.Fs, nSubProcChans);
+            if (data.plan)
+            {
+                data.recorder->registerOperator(*data.plan, *data.icaOp);
+            }
+        }
+    }
+
+    subProcData.swap(newSubProcData);
+
+    currSubProc = newSubProc;
+    if (currSubProc == 0)
+    {
+        currICAConfigPath = "";
+    }
+    else
+    {
+        currICAConfigPath.referTo(subProcData[currSubProc].icaConfigPath);
+    }
+
+    applyScratch.ensureSize(maxSubProcChans);
+}
+
+void ICAApplyNode::startRecording()
+{
+    File removedDir = ICANode::getRemovedComponentsDir();
+
+    for (auto& subProcEntry : subProcData)
+    {
+        SubProcData& data = subProcEntry.second;
+        if (data.recorder)
+        {
+            const SubProcInfo& info = subProcInfo[subProcEntry.first];
+            data.recorder->startRecording(removedDir.getChildFile(
+                String(info.sourceID) + "_" + String(info.subProcIdx)));
+        }
+    }
+}
+
+void ICAApplyNode::stopRecording()
+{
+    for (auto& subProcEntry : subProcData)
+    {
+        SubProcData& data = subProcEntry.second;
+        if (data.recorder)
+        {
+            data.recorder->stopRecording();
+        }
+    }
+}
+
+void ICAApplyNode::saveCustomParametersToXml(XmlElement* parentElement)
+{
+    // same format as ICANode, so operations can be moved between the two
+    for (const auto& subProcEntry : subProcData)
+    {
+        uint32 subProc = subProcEntry.first;
+        const SubProcData& data = subProcEntry.second;
+
+        const ScopedReadLock icaLock(data.icaMutex);
+        if (data.icaOp && !data.icaOp->isNoop())
+        {
+            XmlElement* opNode = parentElement->createNewChildElement("ICA_OP");
+
+            opNode->setAttribute("configFile", data.icaConfigPath.toString());
+            opNode->setAttribute("subproc", int(subProc));
+            opNode->setAttribute("subprocChans", ICANode::intSetToString(data.icaOp->enabledChannels));
+            opNode->setAttribute("reject", ICANode::intSetToString(data.icaOp->rejectedComponents));
+
+            XmlElement* mixingNode = opNode->createNewChildElement("MIXING");
+            ICANode::saveMatrixToXml(mixingNode, data.icaOp->getMixing());
+
+            XmlElement* unmixingNode = opNode->createNewChildElement("UNMIXING");
+            ICANode::saveMatrixToXml(unmixingNode, data.icaOp->getUnmixing());
+        }
+    }
+}
+
+void ICAApplyNode::loadCustomParametersFromXml()
+{
+    if (parametersAsXml == nullptr)
+    {
+        return;
+    }
+
+    for (const auto& subProcEntry : subProcData)
+    {
+        uint32 subProc = subProcEntry.first;
+        resetICA(subProc);
+
+        forEachXmlChildElementWithTagName(*parametersAsXml, opNode, "ICA_OP")
+        {
+            if (opNode->getIntAttribute("subproc") != subProc)
+            {
+                continue;
+            }
+
+            String configFile = opNode->getStringAttribute("configFile");
+            SortedSet<int> rejectSet = ICANode::stringToIntSet(opNode->getStringAttribute("reject"));
+
+            ICANode::ICARunInfo loadedInfo;
+            loadedInfo.op = new ICAOperation();
+            loadedInfo.config = configFile;
+
+            Result res = configFile.isEmpty()
+                ? Result::fail("No config file")
+                : ICANode::populateInfoFromConfig(loadedInfo);
+
+            if (res.failed())
+            {
+                // try loading matrices from XML file directly
+                XmlElement* mixingNode = opNode->getChildByName("MIXING");
+                XmlElement* unmixingNode = opNode->getChildByName("UNMIXING");
+
+                if (!mixingNode || !unmixingNode)
+                {
+                    std::cerr << res.getErrorMessage() << std::endl;
+                    continue;
+                }
+
+                loadedInfo.op = new ICAOperation();
+                loadedInfo.op->enabledChannels = ICANode::stringToIntSet(opNode->getStringAttribute("subprocChans"));
+
+                int size = loadedInfo.op->enabledChannels.size();
+                Matrix mixing(size, size);
+                Matrix unmixing(size, size);
+
+                res = ICANode::readMatrixFromXml(mixingNode, mixing);
+                if (res.wasOk())
+                {
+                    res = ICANode::readMatrixFromXml(unmixingNode, unmixing);
+                }
+
+                if (res.wasOk())
+                {
+                    loadedInfo.op->setMatrices(std::move(mixing), std::move(unmixing));
+                }
+            }
+
+            if (res.wasOk())
+            {
+                loadedInfo.op->rejectedComponents.swapWith(rejectSet);
+                res = setICAOp(subProc, loadedInfo.op.release(), configFile);
+            }
+
+            if (res.failed())
+            {
+                std::cerr << "Failed to load ICA operation: " << res.getErrorMessage() << std::endl;
+            }
+        }
+    }
+}
+
+
+Result ICAApplyNode::loadICA(const File& configFile)
+{
+    auto subProcEntry = subProcData.find(currSubProc);
+    if (subProcEntry == subProcData.end())
+    {
+        return Result::fail("No subprocessor selected");
+    }
+
+    ICANode::ICARunInfo loadedInfo;
+    loadedInfo.op = new ICAOperation();
+    loadedInfo.subProc = currSubProc;
+    loadedInfo.config = configFile;
+
+    Result res = ICANode::populateInfoFromConfig(loadedInfo);
+    if (res.failed())
+    {
+        return res;
+    }
+
+    // keep rejecting the same components as the current operation, if there is one
+    SortedSet<int> currRejected = getRejectedComponents();
+    if (currRejected.isEmpty())
+    {
+        loadedInfo.op->rejectedComponents.add(0);
+    }
+    else
+    {
+        loadedInfo.op->rejectedComponents.swapWith(currRejected);
+    }
+
+    return setICAOp(currSubProc, loadedInfo.op.release(), configFile.getFullPathName());
+}
+
+void ICAApplyNode::resetICA(uint32 subProc)
+{
+    auto dataEntry = subProcData.find(subProc);
+    if (dataEntry != subProcData.end())
+    {
+        SubProcData& data = dataEntry->second;
+
+        const ScopedWriteLock icaLock(data.icaMutex);
+        data.icaOp = new ICAOperation();
+        data.plan = nullptr;
+        data.icaConfigPath = "";
+    }
+}
+
+
+const std::map<uint32, SubProcInfo>& ICAApplyNode::getSubProcInfo() const
+{
+    return subProcInfo;
+}
+
+uint32 ICAApplyNode::getCurrSubProc() const
+{
+    return currSubProc;
+}
+
+void ICAApplyNode::setCurrSubProc(uint32 fullId)
+{
+    if (fullId == 0)
+    {
+        currSubProc = fullId;
+        currICAConfigPath = "";
+    }
+    else
+    {
+        auto newSubProcData = subProcData.find(fullId);
+        if (newSubProcData == subProcData.end())
+        {
+            return;
+        }
+        currSubProc = fullId;
+        currICAConfigPath.referTo(newSubProcData->second.icaConfigPath);
+    }
+}
+
+SortedSet<int> ICAApplyNode::getRejectedComponents() const
+{
+    auto subProcEntry = subProcData.find(currSubProc);
+    if (subProcEntry == subProcData.end())
+    {
+        return {};
+    }
+
+    const ScopedReadLock icaLock(subProcEntry->second.icaMutex);
+    return subProcEntry->second.icaOp->rejectedComponents;
+}
+
+Result ICAApplyNode::setRejectedComponents(const SortedSet<int>& comps)
+{
+    auto subProcEntry = subProcData.find(currSubProc);
+    if (subProcEntry == subProcData.end())
+    {
+        return Result::fail("No subprocessor selected");
+    }
+
+    SubProcData& data = subProcEntry->second;
+
+    ScopedPointer<ICAOperation> newOp;
+    {
+        const ScopedReadLock icaLock(data.icaMutex);
+        if (data.icaOp->isNoop())
+        {
+            return Result::fail("No ICA operation loaded");
+        }
+
+        newOp = new ICAOperation(*data.icaOp);
+    }
+
+    if (!comps.isEmpty() && (comps.getFirst() < 0 || comps.getLast() >= newOp->enabledChannels.size()))
+    {
+        return Result::fail("Components must be between 1 and " + String(newOp->enabledChannels.size()));
+    }
+
+    newOp->rejectedComponents = comps;
+    return setICAOp(currSubProc, newOp.release(), data.icaConfigPath.toString());
+}
+
+const Value& ICAApplyNode::addConfigPathListener(Value::Listener* listener)
+{
+    if (listener)
+    {
+        currICAConfigPath.addListener(listener);
+    }
+    return currICAConfigPath;
+}
+
+bool ICAApplyNode::getRecordRemoved() const
+{
+    return recordRemoved;
+}
+
+Result ICAApplyNode::setRecordRemoved(bool record)
+{
+    if (record == recordRemoved || CoreServices::getAcquisitionStatus())
+    {
+        return Result::ok();
+    }
+
+    if (record && hasFilterBand())
+    {
+        return Result::fail("The removed components can't be saved while the output is filtered");
+    }
+
+    recordRemoved = record;
+
+    for (auto& subProcEntry : subProcData)
+    {
+        SubProcData& data = subProcEntry.second;
+
+        ScopedPointer<ComponentRecorder> recorder;
+        if (record)
+        {
+            recorder = new ComponentRecorder(subProcInfo[subProcEntry.first],
+                data.Fs, data.channelInds.size());
+        }
+
+        const ScopedWriteLock icaLock(data.icaMutex);
+        if (recorder && data.plan)
+        {
+            recorder->registerOperator(*data.plan, *data.icaOp);
+        }
+        data.recorder.swapWith(recorder);
+    }
+
+    return Result::ok();
+}
+
+void ICAApplyNode::getFilterBand(float& lowHz, float& highHz) const
+{
+    lowHz = filterLowHz;
+    highHz = filterHighHz;
+}
+
+Result ICAApplyNode::setFilterBand(float lowHz, float highHz)
+{
+    lowHz = jmax(lowHz, 0.0f);
+    highHz = jmax(highHz, 0.0f);
+
+    if (lowHz > 0 && highHz > 0 && lowHz >= highHz)
+    {
+        return Result::fail("The low edge of the band must be below the high edge");
+    }
+
+    if (recordRemoved && (lowHz > 0 || highHz > 0))
+    {
+        return Result::fail("The output can't be filtered while the removed components are saved (SIDECAR)");
+    }
+
+    filterLowHz = lowHz;
+    filterHighHz = highHz;
+
+    for (auto& subProcEntry : subProcData)
+    {
+        updateFilter(subProcEntry.second);
+    }
+
+    return Result::ok();
+}
+
+bool ICAApplyNode::hasFilterBand() const
+{
+    return filterLowHz > 0 || filterHighHz > 0;
+}
+
+void ICAApplyNode::updateFilter(SubProcData& data)
+{
+    ChannelFilter* filter = nullptr;
+
+    std::vector<Biquad> sections = ChannelFilter::designBandpass(filterLowHz, filterHighHz,
+        data.Fs, filterOrder);
+    if (!sections.empty())
+    {
+        std::vector<int> chans(data.channelInds.begin(), data.channelInds.end());
+        filter = data.filters.add(new ChannelFilter(sections, chans));
+    }
+
+    data.filter = filter;
+
+    if (!CoreServices::getAcquisitionStatus())
+    {
+        releaseOldFilters(data);
+    }
+}
+
+void ICAApplyNode::releaseOldFilters(SubProcData& data)
+{
+    ChannelFilter* current = data.filter.get();
+    for (int i = data.filters.size(); --i >= 0;)
+    {
+        if (data.filters[i] != current)
+        {
+            data.filters.remove(i);
+        }
+    }
+}
+
+
+Result ICAApplyNode::setICAOp(uint32 subProc, ICAOperation* op, const String& configPath)
+{
+    ScopedPointer<ICAOperation> newOp(op);
+
+    auto subProcEntry = subProcData.find(subProc);
+    if (subProcEntry == subProcData.end())
+    {
+        return Result::fail("Subprocessor " + String(subProc) + " no longer exists");
+    }
+
+    SubProcData& data = subProcEntry->second;
+
+    if (newOp->enabledChannels.getLast() >= data.channelInds.size())
+    {
+        return Result::fail("Operation needs more channels than are present in subprocessor " + String(subProc));
+    }
+
+    if (newOp->rejectedComponents.getLast() >= newOp->enabledChannels.size())
+    {
+        std::cerr << "Warning: rejected component set in loaded ICA op names nonexistent components" << std::endl;
+        std::cerr << "Defaulting to rejecting first component" << std::endl;
+
+        newOp->rejectedComponents.clearQuick();
+        newOp->rejectedComponents.add(0);
+    }
+
+    // compile outside of the lock
+    ScopedPointer<ApplyPlan> newPlan = newOp->createPlan(data.channelInds);
+
+    const ScopedWriteLock icaLock(data.icaMutex);
+    if (data.recorder && newPlan)
+    {
+        data.recorder->registerOperator(*newPlan, *newOp);
+    }
+
+    data.icaOp.swapWith(newOp);
+    data.plan.swapWith(newPlan);
+    data.icaConfigPath = configPath;
+
+    return Result::ok();
+}
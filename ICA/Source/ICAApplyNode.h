@@ -0,0 +1,131 @@
+#ifndef ICA_APPLY_NODE_H_DEFINED
+#define ICA_APPLY_NODE_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICANode.h"
+
+namespace ICA
+{
+    // Applies previously computed ICA operations (loaded from binica.sc files or
+    // a saved signal chain), without any of the training machinery of ICANode:
+    // no data cache, no downsampling and no ICA thread.
+    class ICAApplyNode : public GenericProcessor
+    {
+    public:
+        ICAApplyNode();
+
+        bool hasEditor() const { return true; }
+        AudioProcessorEditor* createEditor() override;
+
+        void process(AudioSampleBuffer& buffer) override;
+
+        void updateSettings() override;
+
+        bool disable() override;
+
+        void startRecording() override;
+        void stopRecording() override;
+
+        void saveCustomParametersToXml(XmlElement* parentElement) override;
+
+        void loadCustomParametersFromXml() override;
+
+        // load an operation for the current subprocessor
+        Result loadICA(const File& configFile);
+
+        // replace any current ICA transformation with a dummy one that does nothing
+        void resetICA(uint32 subProc);
+
+        // access stuff
+
+        const std::map<uint32, SubProcInfo>& getSubProcInfo() const;
+        uint32 getCurrSubProc() const;
+        void setCurrSubProc(uint32 fullId);
+
+        // of the current subprocessor's operation. empty if there is none.
+        SortedSet<int> getRejectedComponents() const;
+
+        // fails if there is no operation or some of the components don't exist.
+        Result setRejectedComponents(const SortedSet<int>& comps);
+
+        // also returns a reference to the value, so it can be identified in the callback.
+        const Value& addConfigPathListener(Value::Listener* listener);
+
+        // whether to save the removed components while recording (see ComponentRecorder)
+        // can't be changed during acquisition. fails if a band is set (see below).
+        bool getRecordRemoved() const;
+        Result setRecordRemoved(bool record);
+
+        // band-pass filter applied to every channel after the ICA operation (in the same pass
+        // over the data, see ChannelFilter). 0 for either edge = no filter on that side.
+        // fails if the band is invalid, or if the removed components are being saved (they
+        // aren't filtered, so they wouldn't add back to the filtered output).
+        void getFilterBand(float& lowHz, float& highHz) const;
+        Result setFilterBand(float lowHz, float highHz);
+
+        // of each edge of the band (Butterworth)
+        static const int filterOrder;
+
+    private:
+        struct SubProcData
+        {
+            float Fs;
+            SortedSet<int> channelInds; // (indices in this processor)
+
+            ReadWriteLock icaMutex; // controls below variables
+            ScopedPointer<ICAOperation> icaOp;
+            ScopedPointer<ApplyPlan> plan; // compiled icaOp, or null if it is a no-op
+            Value icaConfigPath;
+            ScopedPointer<ComponentRecorder> recorder; // null unless recordRemoved is set
+
+            // (not under icaMutex, so that filtering doesn't depend on getting the lock)
+            Atomic<ChannelFilter*> filter;     // null unless a band is set
+            OwnedArray<ChannelFilter> filters; // the current one and any the audio thread may still be using
+        };
+
+        bool hasFilterBand() const;
+
+        // switch to a filter for the current band for the given subprocessor's channels
+        // (filters that are replaced during acquisition are only deleted once it stops)
+        void updateFilter(SubProcData& data);
+        void releaseOldFilters(SubProcData& data);
+
+        // Replaces the operation of the given subprocessor with op (taking ownership).
+        // Fails if the subprocessor doesn't exist or has too few channels.
+        Result setICAOp(uint32 subProc, ICAOperation* op, const String& configPath);
+
+        // ordered so that combobox is consistent/goes in lexicographic order of subproc
+        std::map<uint32, SubProcInfo> subProcInfo;
+        std::map<uint32, SubProcData> subProcData;
+
+        uint32 currSubProc;
+        Value currICAConfigPath;
+
+        bool recordRemoved;
+
+        float filterLowHz;
+        float filterHighHz;
+
+        ApplyPlan::Scratch applyScratch;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ICAApplyNode);
+    };
+}
+
+#endif // ICA_APPLY_NODE_H_DEFINED
@@ -0,0 +1,864 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICAApplyPlan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+using namespace ICA;
+
+static std::atomic<uint32_t> lastPlanSerial(0);
+
+const float ApplyKernel::sparseMaxDensity(0.4f);
+
+// coefficients smaller than this, relative to the largest of the same component, are dropped
+// from the sparse form (they would be lost to rounding in the sum anyway)
+static const float sparsePruneTolerance = 1e-7f;
+
+// shorter tiles aren't checked for railing, since a few equal samples in a row can be real
+static const int minRailCheckSamples = 32;
+
+/**** HierarchicalFactors ****/
+
+Matrix HierarchicalFactors::composeUnmixing() const
+{
+    Matrix unmixing = localUnmixing;
+    int nSelected = int(selected.size());
+
+    Matrix selectedRows(nSelected, localUnmixing.cols());
+    for (int k = 0; k < nSelected; ++k)
+    {
+        selectedRows.row(k) = localUnmixing.row(selected[k]);
+    }
+
+    Matrix globalRows = globalUnmixing * selectedRows;
+    for (int k = 0; k < nSelected; ++k)
+    {
+        unmixing.row(selected[k]) = globalRows.row(k);
+    }
+
+    return unmixing;
+}
+
+Matrix HierarchicalFactors::composeMixing() const
+{
+    // (T^-1 is the identity except for the inverse of globalUnmixing)
+    Matrix mixing = localMixing;
+    int nSelected = int(selected.size());
+
+    Matrix selectedCols(localMixing.rows(), nSelected);
+    for (int k = 0; k < nSelected; ++k)
+    {
+        selectedCols.col(k) = localMixing.col(selected[k]);
+    }
+
+    Matrix globalCols = selectedCols * globalUnmixing.inverse();
+    for (int k = 0; k < nSelected; ++k)
+    {
+        mixing.col(selected[k]) = globalCols.col(k);
+    }
+
+    return mixing;
+}
+
+
+/**** ApplyKernel ****/
+
+ApplyKernel::ApplyKernel(MatrixConstRef mixing, MatrixConstRef unmixing,
+    const std::vector<int>& rejected, const HierarchicalFactors* factors)
+{
+    int nChans = int(mixing.rows());
+    assert(mixing.cols() == nChans);
+    assert(unmixing.rows() == nChans && unmixing.cols() == nChans);
+
+    std::vector<bool> isRejected(nChans, false);
+    int nRejected = 0;
+    for (int comp : rejected)
+    {
+        if (comp >= 0 && comp < nChans && !isRejected[comp])
+        {
+            isRejected[comp] = true;
+            ++nRejected;
+        }
+    }
+
+    // whether to start from 0 and add components or start from all and subtract them
+    additive = nRejected > nChans / 2;
+
+    std::vector<int> comps;
+    for (int comp = 0; comp < nChans; ++comp)
+    {
+        if (isRejected[comp] != additive)
+        {
+            comps.push_back(comp);
+        }
+    }
+
+    int nComps = int(comps.size());
+    unmixT.resize(nChans, nComps);
+    remixT.resize(nComps, nChans);
+
+    for (int k = 0; k < nComps; ++k)
+    {
+        unmixT.col(k) = unmixing.row(comps[k]).transpose();
+        remixT.row(k) = mixing.col(comps[k]).transpose();
+    }
+
+    if (!additive)
+    {
+        remixT = -remixT;
+    }
+    else
+    {
+        rejUnmixT.resize(nChans, nRejected);
+        for (int comp = 0, k = 0; comp < nChans; ++comp)
+        {
+            if (isRejected[comp])
+            {
+                rejUnmixT.col(k++) = unmixing.row(comp).transpose();
+            }
+        }
+    }
+
+    guardGram.noalias() = unmixing.transpose() * unmixing;
+    guardInvNorm.resize(nChans);
+    for (int j = 0; j < nChans; ++j)
+    {
+        float normSq = guardGram(j, j);
+        guardInvNorm(j) = normSq > 0 ? 1 / normSq : 0;
+    }
+
+    buildSparseForm();
+
+    if (factors && !additive)
+    {
+        buildFactoredForm(*factors, isRejected);
+    }
+}
+
+ApplyKernel::ApplyKernel(MatrixConstRef left, MatrixConstRef right, const Eigen::VectorXf& center)
+    : additive(false)
+    , unmixT  (right.transpose())
+    , remixT  (left.transpose())
+{
+    assert(left.cols() == right.rows() && left.rows() == right.cols());
+    assert(center.size() == 0 || center.size() == right.cols());
+
+    if (center.size() > 0 && right.rows() > 0)
+    {
+        compOffset.noalias() = (right * center).transpose();
+    }
+
+    int nChans = int(right.cols());
+    guardGram.noalias() = right.transpose() * right;
+    guardInvNorm.resize(nChans);
+    for (int j = 0; j < nChans; ++j)
+    {
+        float normSq = guardGram(j, j);
+        guardInvNorm(j) = normSq > 0 ? 1 / normSq : 0;
+    }
+
+    buildSparseForm();
+}
+
+int ApplyKernel::getNumChannels() const
+{
+    return int(unmixT.rows());
+}
+
+bool ApplyKernel::isSparse() const
+{
+    return sparse;
+}
+
+bool ApplyKernel::isFactored() const
+{
+    return factored;
+}
+
+// nonzero entries of each column of coefs (nChans x nComps)
+static void collectTerms(MatrixConstRef coefs, std::vector<int>& begin,
+    std::vector<int>& chans, std::vector<float>& values)
+{
+    begin.assign(1, 0);
+    chans.clear();
+    values.clear();
+
+    for (int k = 0; k < coefs.cols(); ++k)
+    {
+        float threshold = coefs.col(k).cwiseAbs().maxCoeff() * sparsePruneTolerance;
+        for (int c = 0; c < coefs.rows(); ++c)
+        {
+            if (std::abs(coefs(c, k)) > threshold)
+            {
+                chans.push_back(c);
+                values.push_back(coefs(c, k));
+            }
+        }
+        begin.push_back(int(chans.size()));
+    }
+}
+
+void ApplyKernel::SparseTerms::gather(MatrixConstRef in, MatrixRef out) const
+{
+    for (int k = 0; k + 1 < int(begin.size()); ++k)
+    {
+        auto dest = out.col(k);
+        if (begin[k] == begin[k + 1])
+        {
+            dest.setZero();
+            continue;
+        }
+
+        dest = coefs[begin[k]] * in.col(chans[begin[k]]);
+        for (int i = begin[k] + 1; i < begin[k + 1]; ++i)
+        {
+            dest += coefs[i] * in.col(chans[i]);
+        }
+    }
+}
+
+void ApplyKernel::SparseTerms::scatterAdd(MatrixConstRef in, MatrixRef out) const
+{
+    for (int k = 0; k + 1 < int(begin.size()); ++k)
+    {
+        auto source = in.col(k);
+        for (int i = begin[k]; i < begin[k + 1]; ++i)
+        {
+            out.col(chans[i]) += coefs[i] * source;
+        }
+    }
+}
+
+void ApplyKernel::buildSparseForm()
+{
+    int nComps = int(unmixT.cols());
+    if (nComps == 0)
+    {
+        return;
+    }
+
+    collectTerms(unmixT, unmixTerms.begin, unmixTerms.chans, unmixTerms.coefs);
+    collectTerms(remixT.transpose(), remixTerms.begin, remixTerms.chans, remixTerms.coefs);
+
+    size_t numTerms = unmixTerms.coefs.size() + remixTerms.coefs.size();
+    sparse = numTerms <= sparseMaxDensity * 2 * unmixT.size();
+
+    if (!sparse)
+    {
+        unmixTerms = SparseTerms();
+        remixTerms = SparseTerms();
+    }
+}
+
+void ApplyKernel::buildFactoredForm(const HierarchicalFactors& factors, const std::vector<bool>& isRejected)
+{
+    int nChans = getNumChannels();
+    int nSelected = int(factors.selected.size());
+    if (factors.localUnmixing.rows() != nChans || factors.localMixing.rows() != nChans
+        || factors.globalUnmixing.rows() != nSelected)
+    {
+        assert(false);
+        return;
+    }
+
+    std::vector<bool> isSelected(nChans, false);
+    std::vector<int> removedGlobal;
+    for (int k = 0; k < nSelected; ++k)
+    {
+        isSelected[factors.selected[k]] = true;
+        if (isRejected[factors.selected[k]])
+        {
+            removedGlobal.push_back(k);
+        }
+    }
+
+    // (otherwise, all removed components are local ones, which the sparse form handles)
+    if (removedGlobal.empty())
+    {
+        return;
+    }
+
+    std::vector<int> terms;
+    for (int comp = 0; comp < nChans; ++comp)
+    {
+        if (isRejected[comp] && !isSelected[comp])
+        {
+            terms.push_back(comp);
+        }
+    }
+    int nLocal = int(terms.size());
+    terms.insert(terms.end(), factors.selected.begin(), factors.selected.end());
+
+    Matrix localUnmixT(nChans, terms.size());
+    Matrix localRemixT(terms.size(), nChans);
+    for (int k = 0; k < int(terms.size()); ++k)
+    {
+        localUnmixT.col(k) = factors.localUnmixing.row(terms[k]).transpose();
+        localRemixT.row(k) = -factors.localMixing.col(terms[k]).transpose();
+    }
+
+    int nRemoved = int(removedGlobal.size());
+    Matrix globalMixing = factors.globalUnmixing.inverse();
+    Matrix newGlobalUnmixT(nSelected, nRemoved);
+    Matrix newGlobalRemixT(nRemoved, nSelected);
+    for (int g = 0; g < nRemoved; ++g)
+    {
+        newGlobalUnmixT.col(g) = factors.globalUnmixing.row(removedGlobal[g]).transpose();
+        newGlobalRemixT.row(g) = globalMixing.col(removedGlobal[g]).transpose();
+    }
+
+    SparseTerms newUnmixTerms, newRemixTerms;
+    collectTerms(localUnmixT, newUnmixTerms.begin, newUnmixTerms.chans, newUnmixTerms.coefs);
+    collectTerms(localRemixT.transpose(), newRemixTerms.begin, newRemixTerms.chans, newRemixTerms.coefs);
+
+    // multiply-adds per sample, compared with the dense or sparse form
+    size_t cost = newUnmixTerms.coefs.size() + newRemixTerms.coefs.size() + 2 * size_t(nSelected) * nRemoved;
+    size_t currentCost = sparse ? unmixTerms.coefs.size() + remixTerms.coefs.size() : 2 * size_t(unmixT.size());
+    if (cost >= currentCost)
+    {
+        return;
+    }
+
+    sparse = false;
+    factored = true;
+    numFactoredLocal = nLocal;
+    unmixTerms = std::move(newUnmixTerms);
+    remixTerms = std::move(newRemixTerms);
+    globalUnmixT = std::move(newGlobalUnmixT);
+    globalRemixT = std::move(newGlobalRemixT);
+}
+
+
+/**** ApplyPlan ****/
+
+ApplyPlan::ApplyPlan(MatrixConstRef mixing, MatrixConstRef unmixing,
+    const std::vector<int>& rejected, std::vector<int> channels)
+    : ApplyPlan(std::make_shared<ApplyKernel>(mixing, unmixing, rejected), std::move(channels))
+{}
+
+ApplyPlan::ApplyPlan(std::shared_ptr<const ApplyKernel> planKernel, std::vector<int> channels)
+    : chans (std::move(channels))
+    , kernel(std::move(planKernel))
+    , serial(++lastPlanSerial)
+{
+    assert(kernel && kernel->getNumChannels() == int(chans.size()));
+}
+
+void ApplyPlan::apply(float* const* data, int numSamples, Scratch& scratch,
+    RejectedComponentSink* sink, ChannelFilter* filter, InputTap* tap) const
+{
+    int nChans = getNumChannels();
+    int nComps = getNumActiveComponents();
+    int nRejected = getNumRejectedComponents();
+
+    if (isIdentity() || numSamples <= 0)
+    {
+        return;
+    }
+
+    assert(scratch.getMaxChannels() >= nChans);
+
+    int nMaskWords = (nChans + 31) / 32;
+    std::fill(scratch.badMask.begin(), scratch.badMask.begin() + nMaskWords, 0);
+
+    for (int start = 0; start < numSamples; start += tileSize)
+    {
+        int len = std::min(int(tileSize), numSamples - start);
+
+        auto x = scratch.tile.topLeftCorner(len, nChans);
+        auto s = scratch.compTile.topLeftCorner(len, nComps);
+
+        gatherTile(data, start, len, scratch, tap);
+
+        // channel to use the fallback for, if any
+        int badChan = -1;
+        auto g = scratch.guardCoefs.head(len);
+
+        if (scratch.badChans.size() == 1 && kernel->guardInvNorm(scratch.badChans[0]) != 0)
+        {
+            badChan = scratch.badChans[0];
+            g.noalias() = x * kernel->guardGram.col(badChan);
+            g *= kernel->guardInvNorm(badChan);
+        }
+
+        // (the sparse form has no correction for a bad channel, and the factored form
+        // doesn't have the removed components' activations for a sink)
+        bool useSparse = kernel->sparse && badChan == -1;
+        bool useFactored = kernel->factored && badChan == -1 && sink == nullptr;
+
+        if (kernel->additive)
+        {
+            if (sink && nRejected > 0)
+            {
+                auto r = scratch.rejTile.topLeftCorner(len, nRejected);
+                r.noalias() = x * kernel->rejUnmixT;
+                if (badChan != -1)
+                {
+                    r.noalias() -= g * kernel->rejUnmixT.row(badChan);
+                }
+                sink->writeRejected(r);
+            }
+
+            if (nComps == 0) // nothing to add
+            {
+                x.setZero();
+            }
+            else if (useSparse)
+            {
+                kernel->unmixTerms.gather(x, s);
+                x.setZero();
+                kernel->remixTerms.scatterAdd(s, x);
+            }
+            else
+            {
+                s.noalias() = x * kernel->unmixT;
+                if (badChan != -1)
+                {
+                    s.noalias() -= g * kernel->unmixT.row(badChan);
+                }
+                x.noalias() = s * kernel->remixT;
+            }
+        }
+        else if (useFactored)
+        {
+            int nSelected = int(kernel->globalUnmixT.rows());
+            auto f = scratch.compTile.topLeftCorner(len, kernel->numFactoredLocal + nSelected);
+            auto fSelected = f.rightCols(nSelected);
+            auto h = scratch.rejTile.topLeftCorner(len, kernel->globalUnmixT.cols());
+
+            kernel->unmixTerms.gather(x, f);
+            h.noalias() = fSelected * kernel->globalUnmixT;
+            fSelected.noalias() = h * kernel->globalRemixT;
+            kernel->remixTerms.scatterAdd(f, x);
+        }
+        else
+        {
+            if (useSparse)
+            {
+                kernel->unmixTerms.gather(x, s);
+            }
+            else
+            {
+                s.noalias() = x * kernel->unmixT;
+                if (badChan != -1)
+                {
+                    s.noalias() -= g * kernel->unmixT.row(badChan);
+                }
+            }
+
+            if (kernel->compOffset.size() > 0)
+            {
+                s.rowwise() -= kernel->compOffset;
+            }
+
+            if (sink)
+            {
+                sink->writeRejected(s);
+            }
+
+            if (useSparse)
+            {
+                kernel->remixTerms.scatterAdd(s, x);
+            }
+            else
+            {
+                x.noalias() += s * kernel->remixT;
+            }
+        }
+
+        scatterTile(data, start, len, scratch, filter);
+    }
+
+    if (sink)
+    {
+        sink->writeBadChannels(scratch.badMask.data(), nMaskWords);
+    }
+}
+
+void ApplyPlan::crossfade(const ApplyPlan* from, const ApplyPlan* to, float* const* data,
+    int numSamples, Scratch& scratch, int fadePos, int fadeLength)
+{
+    const ApplyPlan* plan = to ? to : from;
+    if (plan == nullptr || numSamples <= 0)
+    {
+        return;
+    }
+
+    if ((from && from->isAdditive()) || (to && to->isAdditive())
+        || (from && to && from->chans != to->chans))
+    {
+        // not supported - just switch
+        assert(false);
+        if (to)
+        {
+            to->apply(data, numSamples, scratch);
+        }
+        return;
+    }
+
+    int nChans = plan->getNumChannels();
+    int nFrom = from ? from->getNumActiveComponents() : 0;
+    int nTo = to ? to->getNumActiveComponents() : 0;
+
+    assert(scratch.getMaxChannels() >= nChans);
+
+    const double pi = 3.14159265358979323846;
+
+    for (int start = 0; start < numSamples; start += tileSize)
+    {
+        int len = std::min(int(tileSize), numSamples - start);
+
+        auto x = scratch.tile.topLeftCorner(len, nChans);
+        auto fromCorrection = scratch.rejTile.topLeftCorner(len, nChans);
+        auto weights = scratch.guardCoefs.head(len); // of the new plan
+
+        // raised cosine from 0 to 1
+        for (int i = 0; i < len; ++i)
+        {
+            int pos = fadePos + start + i + 1;
+            weights(i) = pos >= fadeLength ? 1.0f : float(0.5 - 0.5 * std::cos(pi * pos / fadeLength));
+        }
+
+        plan->gatherTile(data, start, len, scratch);
+
+        if (nFrom > 0)
+        {
+            auto s = scratch.compTile.topLeftCorner(len, nFrom);
+            s.noalias() = x * from->kernel->unmixT;
+            if (from->kernel->compOffset.size() > 0)
+            {
+                s.rowwise() -= from->kernel->compOffset;
+            }
+            s.array().colwise() *= 1 - weights.array();
+            fromCorrection.noalias() = s * from->kernel->remixT;
+        }
+
+        if (nTo > 0)
+        {
+            auto s = scratch.compTile.topLeftCorner(len, nTo);
+            s.noalias() = x * to->kernel->unmixT;
+            if (to->kernel->compOffset.size() > 0)
+            {
+                s.rowwise() -= to->kernel->compOffset;
+            }
+            s.array().colwise() *= weights.array();
+            x.noalias() += s * to->kernel->remixT;
+        }
+
+        if (nFrom > 0)
+        {
+            x += fromCorrection;
+        }
+
+        plan->scatterTile(data, start, len, scratch);
+    }
+}
+
+void ApplyPlan::gatherTile(float* const* data, int start, int len, Scratch& scratch,
+    InputTap* tap) const
+{
+    int nChans = getNumChannels();
+    auto x = scratch.tile.topLeftCorner(len, nChans);
+
+    for (int k = 0; k < nChans; ++k)
+    {
+        std::memcpy(x.col(k).data(), data[chans[k]] + start, len * sizeof(float));
+    }
+
+    // (while the tile is still in cache)
+    if (tap)
+    {
+        tap->readTile(x, chans, start);
+    }
+
+    scratch.badChans.clear();
+    for (int k = 0; k < nChans; ++k)
+    {
+        auto col = x.col(k);
+
+        // (NaN and inf propagate through the sum)
+        float lo = col.minCoeff();
+        float hi = col.maxCoeff();
+        bool finite = std::isfinite(col.sum());
+        bool railing = lo == hi && lo != 0 && len >= minRailCheckSamples;
+
+        if (!finite || railing)
+        {
+            col.setZero();
+            scratch.badChans.push_back(k);
+            scratch.badMask[k / 32] |= uint32_t(1) << (k % 32);
+        }
+    }
+
+    if (!scratch.badChans.empty())
+    {
+        ++scratch.guardedTiles;
+    }
+}
+
+void ApplyPlan::scatterTile(float* const* data, int start, int len, Scratch& scratch,
+    ChannelFilter* filter) const
+{
+    int nChans = getNumChannels();
+    auto x = scratch.tile.topLeftCorner(len, nChans);
+
+    // (leaving bad channels as they were, with their filters running on zeros)
+    auto nextBad = scratch.badChans.begin();
+    for (int k = 0; k < nChans; ++k)
+    {
+        if (nextBad != scratch.badChans.end() && *nextBad == k)
+        {
+            if (filter)
+            {
+                filter->skip(chans[k], len);
+            }
+            ++nextBad;
+            continue;
+        }
+
+        if (filter)
+        {
+            filter->process(chans[k], x.col(k).data(), len);
+        }
+        std::memcpy(data[chans[k]] + start, x.col(k).data(), len * sizeof(float));
+    }
+}
+
+int ApplyPlan::getNumChannels() const
+{
+    return int(chans.size());
+}
+
+int ApplyPlan::getNumActiveComponents() const
+{
+    return int(kernel->unmixT.cols());
+}
+
+int ApplyPlan::getNumRejectedComponents() const
+{
+    return kernel->additive ? int(kernel->rejUnmixT.cols()) : int(kernel->unmixT.cols());
+}
+
+uint32_t ApplyPlan::getSerial() const
+{
+    return serial;
+}
+
+bool ApplyPlan::isAdditive() const
+{
+    return kernel->additive;
+}
+
+const std::vector<int>& ApplyPlan::getChannels() const
+{
+    return chans;
+}
+
+bool ApplyPlan::isIdentity() const
+{
+    return chans.empty() || (!kernel->additive && kernel->unmixT.cols() == 0);
+}
+
+
+/**** ApplyPlan::Scratch ****/
+
+void ApplyPlan::Scratch::ensureSize(int numChans)
+{
+    if (getMaxChannels() < numChans)
+    {
+        tile.resize(tileSize, numChans);
+        compTile.resize(tileSize, numChans);
+        rejTile.resize(tileSize, numChans);
+        guardCoefs.resize(tileSize);
+        badChans.reserve(numChans);
+        badMask.resize((numChans + 31) / 32);
+    }
+}
+
+int ApplyPlan::Scratch::getMaxChannels() const
+{
+    return int(tile.cols());
+}
+
+uint64_t ApplyPlan::Scratch::getNumGuardedTiles() const
+{
+    return guardedTiles;
+}
+
+void ApplyPlan::Scratch::resetGuardCount()
+{
+    guardedTiles = 0;
+}
+
+std::string ApplyPlan::Scratch::takeGuardReport()
+{
+    if (guardedTiles == 0)
+    {
+        return std::string();
+    }
+
+    std::string report = "ICA: left out non-finite or railing channels in " + std::to_string(guardedTiles)
+        + " tiles (of " + std::to_string(tileSize) + " samples)";
+    guardedTiles = 0;
+    return report;
+}
+
+
+/**** ChannelFilter ****/
+
+ChannelFilter::ChannelFilter(const std::vector<Biquad>& sectionsIn, const std::vector<int>& channelsIn)
+    : sections  (sectionsIn)
+    , channels  (channelsIn)
+    , state     (2 * sectionsIn.size() * channelsIn.size(), 0.0)
+    , lastBlock (channelsIn.size(), 0)
+    , block     (0)
+{
+    int maxChan = channels.empty() ? -1 : *std::max_element(channels.begin(), channels.end());
+    slots.assign(maxChan + 1, -1);
+    for (int i = 0; i < int(channels.size()); ++i)
+    {
+        slots[channels[i]] = i;
+    }
+}
+
+std::vector<Biquad> ChannelFilter::designBandpass(double lowHz, double highHz, double sampleRate, int order)
+{
+    // bilinear-transform Butterworth sections (as in the RBJ audio EQ cookbook),
+    // each with the Q of one conjugate pole pair
+    const double pi = 3.14159265358979323846;
+    int nSections = std::max(order / 2, 1);
+    std::vector<Biquad> result;
+
+    for (int edge = 0; edge < 2; ++edge)
+    {
+        bool highPass = edge == 0;
+        double freq = highPass ? lowHz : highHz;
+        if (!(freq > 0) || freq >= sampleRate / 2)
+        {
+            continue;
+        }
+
+        double w0 = 2 * pi * freq / sampleRate;
+        double cosW0 = std::cos(w0);
+
+        for (int k = 0; k < nSections; ++k)
+        {
+            double q = 1 / (2 * std::cos(pi * (2 * k + 1) / (4.0 * nSections)));
+            double alpha = std::sin(w0) / (2 * q);
+            double a0 = 1 + alpha;
+
+            Biquad section;
+            section.b1 = (highPass ? -(1 + cosW0) : 1 - cosW0) / a0;
+            section.b0 = section.b2 = (highPass ? -section.b1 : section.b1) / 2;
+            section.a1 = -2 * cosW0 / a0;
+            section.a2 = (1 - alpha) / a0;
+            result.push_back(section);
+        }
+    }
+
+    return result;
+}
+
+bool ChannelFilter::isEmpty() const
+{
+    return sections.empty() || channels.empty();
+}
+
+void ChannelFilter::beginBlock()
+{
+    // (0 is reserved for "never")
+    if (++block == 0)
+    {
+        block = 1;
+        std::fill(lastBlock.begin(), lastBlock.end(), 0);
+    }
+}
+
+void ChannelFilter::process(int bufferChan, float* samples, int len)
+{
+    if (bufferChan < 0 || bufferChan >= int(slots.size()) || slots[bufferChan] == -1)
+    {
+        return;
+    }
+
+    // (NaN and inf propagate through the sum)
+    float sum = 0;
+    for (int i = 0; i < len; ++i)
+    {
+        sum += samples[i];
+    }
+
+    run(slots[bufferChan], std::isfinite(sum) ? samples : nullptr, len);
+}
+
+void ChannelFilter::skip(int bufferChan, int len)
+{
+    if (bufferChan < 0 || bufferChan >= int(slots.size()) || slots[bufferChan] == -1)
+    {
+        return;
+    }
+
+    run(slots[bufferChan], nullptr, len);
+}
+
+void ChannelFilter::run(int slot, float* samples, int len)
+{
+    lastBlock[slot] = block;
+
+    double* z = &state[2 * sections.size() * slot];
+    for (const Biquad& bq : sections)
+    {
+        double z1 = z[0];
+        double z2 = z[1];
+        for (int i = 0; i < len; ++i)
+        {
+            double in = samples ? samples[i] : 0.0;
+            double out = bq.b0 * in + z1;
+            z1 = bq.b1 * in - bq.a1 * out + z2;
+            z2 = bq.b2 * in - bq.a2 * out;
+            if (samples)
+            {
+                samples[i] = float(out);
+            }
+        }
+        z[0] = z1;
+        z[1] = z2;
+        z += 2;
+    }
+}
+
+void ChannelFilter::finishBlock(float* const* data, int numSamples)
+{
+    for (int i = 0; i < int(channels.size()); ++i)
+    {
+        if (lastBlock[i] != block)
+        {
+            process(channels[i], data[channels[i]], numSamples);
+        }
+    }
+}
+
+void ChannelFilter::reset()
+{
+    std::fill(state.begin(), state.end(), 0.0);
+}
@@ -0,0 +1,344 @@
+#ifndef ICA_APPLY_PLAN_H_DEFINED
+#define ICA_APPLY_PLAN_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Note: this file only depends on Eigen and the standard library (not JUCE or the GUI),
+// so that it can be shared by both processors and by offline tools.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+
+namespace ICA
+{
+    using Matrix = Eigen::MatrixXf;
+    using MatrixMap = Eigen::Map<Eigen::MatrixXf>;
+    using MatrixRef = Eigen::Ref<Eigen::MatrixXf>;
+    using MatrixConstRef = const Eigen::Ref<const Eigen::MatrixXf>&;
+
+    // Optionally receives the activations of the rejected components while a plan is applied
+    // (from the thread that applies it).
+    class RejectedComponentSink
+    {
+    public:
+        virtual ~RejectedComponentSink() {}
+
+        // comps: one tile of samples (in rows) by rejected components (in ascending order, in columns)
+        virtual void writeRejected(MatrixConstRef comps) = 0;
+
+        // after the last tile of a block: which of the plan's channels were left out of at least
+        // one of its tiles (see ApplyPlan), one bit per channel (bit k % 32 of mask[k / 32])
+        virtual void writeBadChannels(const uint32_t* /*mask*/, int /*numWords*/) {}
+    };
+
+    // Optionally receives each tile of a plan's input as it is read, before anything is done
+    // to it (e.g. to capture the raw input without reading the buffer again; see DecimatingCapture).
+    class InputTap
+    {
+    public:
+        virtual ~InputTap() {}
+
+        // tile: samples (in rows) by input channels (in columns) of the block starting at sample
+        // start; channels: the buffer channel of each column. tiles arrive in order.
+        virtual void readTile(MatrixConstRef tile, const std::vector<int>& channels, int start) = 0;
+    };
+
+    // One second-order section, normalized so that a0 = 1.
+    struct Biquad
+    {
+        double b0, b1, b2, a1, a2;
+    };
+
+    // A cascade of biquads (the same for every channel) with its own state for each of a set of
+    // buffer channels. Passed to ApplyPlan::apply, it filters the plan's channels a tile at a
+    // time right after the spatial step, while the tile is still in cache, instead of in a
+    // separate pass over the buffer. Channels the plan doesn't cover are done in finishBlock.
+    // Only used from the thread that applies the plan.
+    class ChannelFilter
+    {
+    public:
+        // channels: buffer channels to filter
+        ChannelFilter(const std::vector<Biquad>& sections, const std::vector<int>& channels);
+
+        // Butterworth filter of the given (even) order at each enabled edge:
+        // a high pass at lowHz if it is > 0, and a low pass at highHz if it is > 0 and below Nyquist.
+        static std::vector<Biquad> designBandpass(double lowHz, double highHz, double sampleRate, int order);
+
+        bool isEmpty() const;
+
+        // call before each block
+        void beginBlock();
+
+        // filter len samples of a buffer channel in place, continuing from where it left off
+        // (does nothing if the channel isn't included). if any of the samples aren't finite,
+        // they are left as they are and the filter runs on zeros instead, so that its state
+        // stays finite.
+        void process(int bufferChan, float* samples, int len);
+
+        // advance a buffer channel's filter by len samples of zeros, without touching the data
+        // (e.g. for a tile where the channel was left out)
+        void skip(int bufferChan, int len);
+
+        // filter any included channels that weren't touched since beginBlock
+        void finishBlock(float* const* data, int numSamples);
+
+        // clear the state of all channels
+        void reset();
+
+    private:
+        // run a channel's filter on samples in place, or on zeros if samples is null
+        void run(int slot, float* samples, int len);
+
+        std::vector<Biquad> sections;
+        std::vector<int> channels;
+        std::vector<int> slots;      // by buffer channel: index into channels, or -1
+        std::vector<double> state;   // 2 per section per channel (transposed direct form II)
+        std::vector<uint32_t> lastBlock; // per channel
+        uint32_t block;
+    };
+
+    // An operation trained in two levels (see ICANode::performGroupedICA): a block-diagonal
+    // decomposition of groups of channels, and a small decomposition of some of its components
+    // that captures what the groups share. The unmixing matrix is T * localUnmixing, where T
+    // is the identity except that T(selected, selected) = globalUnmixing, i.e. the selected
+    // local components are replaced by the global ones and the rest are kept as they are.
+    struct HierarchicalFactors
+    {
+        Matrix localUnmixing;      // nChans x nChans (block-diagonal up to the order of channels)
+        Matrix localMixing;        // its inverse
+        std::vector<int> selected; // local components that the global level was trained on, ascending
+        Matrix globalUnmixing;     // selected.size() x selected.size()
+
+        Matrix composeUnmixing() const;
+        Matrix composeMixing() const;
+    };
+
+    using HierarchicalFactorsPtr = std::shared_ptr<const HierarchicalFactors>;
+
+    // The part of an ApplyPlan that doesn't depend on which buffer channels it applies to:
+    // the reduced matrices for an operation with a given set of rejected components.
+    // Immutable, so any number of plans can share one.
+    class ApplyKernel
+    {
+    public:
+        // rejected: which components (indices into the columns of mixing) to remove.
+        // factors: if the operation was trained in two levels, its factors (see factored form below).
+        ApplyKernel(MatrixConstRef mixing, MatrixConstRef unmixing, const std::vector<int>& rejected,
+            const HierarchicalFactors* factors = nullptr);
+
+        // a general low-rank correction, x <- x + left * (right * (x - center))
+        // (left: nChans x rank, right: rank x nChans, center: nChans or empty for zero), applied
+        // like a subtractive operation whose rejected components are right * (x - center).
+        ApplyKernel(MatrixConstRef left, MatrixConstRef right,
+            const Eigen::VectorXf& center = Eigen::VectorXf());
+
+        int getNumChannels() const;
+
+        // whether this is applied in sparse form (see below)
+        bool isSparse() const;
+
+        // whether this is applied in factored form (see below)
+        bool isFactored() const;
+
+        // use the sparse form if at most this fraction of the coefficients are nonzero
+        static const float sparseMaxDensity;
+
+    private:
+        friend class ApplyPlan;
+
+        // nonzero coefficients of each active component, in channel order:
+        // component k has coefs[i] for channel chans[i], begin[k] <= i < begin[k + 1].
+        struct SparseTerms
+        {
+            // out.col(k) = sum of coefs[i] * in.col(chans[i]) over component k's terms
+            void gather(MatrixConstRef in, MatrixRef out) const;
+
+            // out.col(chans[i]) += coefs[i] * in.col(k) for each of component k's terms
+            void scatterAdd(MatrixConstRef in, MatrixRef out) const;
+
+            std::vector<int> begin;
+            std::vector<int> chans;
+            std::vector<float> coefs;
+        };
+
+        // decide whether to use the sparse form and fill in unmixTerms and remixTerms if so
+        void buildSparseForm();
+
+        // same for the factored form, which replaces the sparse form if it is cheaper
+        void buildFactoredForm(const HierarchicalFactors& factors, const std::vector<bool>& isRejected);
+
+        bool additive;
+
+        Matrix unmixT; // nChans x nComps (transposed rows of the unmixing matrix)
+        Matrix remixT; // nComps x nChans (transposed columns of the mixing matrix, negated if subtractive)
+
+        // for the sink in additive mode (in subtractive mode, the active components are the rejected ones)
+        Matrix rejUnmixT; // nChans x nRejected
+
+        // for a low-rank correction with a center, right * center, which is subtracted from
+        // the components (empty otherwise)
+        Eigen::RowVectorXf compOffset;
+
+        // Fallback for one bad channel j: with x_j zeroed, the value of x_j that minimizes the
+        // total power of all components is -g, where
+        //   g = (x * G.col(j)) / G(j, j),  G = U^T U,
+        // so the components become s - g * unmixT.row(j).
+        Matrix guardGram;                 // nChans x nChans
+        Eigen::VectorXf guardInvNorm;     // 1 / G(j, j), or 0 if channel j has no weight
+
+        // Sparse form: when most of unmixT and remixT is zero (e.g. for the block-diagonal
+        // operations from grouped training), the unmixing and remixing steps skip the zeros
+        // and work on whole tile columns instead. Tiles with a bad channel still use the
+        // dense matrices, which are always kept.
+        bool sparse = false;
+        SparseTerms unmixTerms; // columns of unmixT
+        SparseTerms remixTerms; // rows of remixT
+
+        // Factored form: when global components of a two-level operation are removed, their
+        // rows of the unmixing matrix are dense, but they are a small mix of sparse local
+        // components. So the terms are instead the local components that are removed and then
+        // the selected ones (from the block-diagonal local matrices), and the selected ones'
+        // activations are turned into the removed global components and back in between:
+        //   s_sel <- (s_sel * globalUnmixT) * globalRemixT
+        // i.e. block-diagonal plus low-rank. Tiles with a bad channel or a sink use the dense form.
+        bool factored = false;
+        int numFactoredLocal = 0; // removed local components, before the selected ones
+        Matrix globalUnmixT;      // nSelected x nRemovedGlobal
+        Matrix globalRemixT;      // nRemovedGlobal x nSelected
+    };
+
+    // The "compiled" form of an ICA operation on a specific set of buffer channels,
+    // which is what actually gets applied to the data during acquisition.
+    //
+    // The output on the included channels is M * S * U * x (see README). Since only the
+    // components that are removed (or only the ones that are kept, whichever is fewer)
+    // make a difference, this is done as a low-rank update:
+    //   subtractive: x <- x - M_r * (U_r * x)   (r = rejected components)
+    //   additive:    x <- M_k * (U_k * x)       (k = kept components)
+    // where the reduced matrices are extracted once here rather than on every block.
+    //
+    // Plans are immutable once built, so building can be done on any thread and the
+    // result swapped in. Applying one never allocates.
+    //
+    // Each channel of each tile is checked for non-finite values and for being stuck at a
+    // constant nonzero value (railing) while it is gathered. A bad channel's input is zeroed
+    // before unmixing, so its coefficients drop out of every component for that tile, and its
+    // own output is left as it was (the raw input). If exactly one channel is bad, the
+    // components are also corrected as if it had the value that minimizes their total power;
+    // with more than one, they are only zero-weighted.
+    class ApplyPlan
+    {
+    public:
+        // temporary storage used while applying a plan, one per processing thread.
+        class Scratch
+        {
+        public:
+            // make sure there is room for plans operating on up to numChans channels.
+            // (allocates, so should be called outside of the audio callback)
+            void ensureSize(int numChans);
+
+            int getMaxChannels() const;
+
+            // number of tiles in which at least one channel was bad, since the last reset
+            uint64_t getNumGuardedTiles() const;
+            void resetGuardCount();
+
+            // a message saying in how many tiles bad channels were left out, if there were any
+            // (otherwise empty), and resets the count
+            std::string takeGuardReport();
+
+        private:
+            friend class ApplyPlan;
+
+            Matrix tile;      // tileSize x numChans, input channels in columns
+            Matrix compTile;  // tileSize x numChans, components in columns
+            Matrix rejTile;   // tileSize x numChans, rejected components for the sink in additive mode
+
+            Eigen::VectorXf guardCoefs;   // tileSize, correction for a single bad channel (or crossfade weights)
+            std::vector<int> badChans;    // capacity numChans
+            std::vector<uint32_t> badMask; // channels that were bad in any tile of the current block
+            uint64_t guardedTiles = 0;
+        };
+
+        // channels: for each row of mixing/columns of unmixing, the index of the
+        // buffer channel it applies to.
+        // rejected: which components (indices into the columns of mixing) to remove.
+        ApplyPlan(MatrixConstRef mixing, MatrixConstRef unmixing,
+            const std::vector<int>& rejected, std::vector<int> channels);
+
+        // same, with a kernel that may be shared with other plans (see OperatorStore).
+        // the kernel must be for the same number of channels.
+        ApplyPlan(std::shared_ptr<const ApplyKernel> kernel, std::vector<int> channels);
+
+        // data is indexed by buffer channel (e.g. AudioSampleBuffer::getArrayOfWritePointers())
+        // if sink is non-null, it receives the rejected components of each tile before they are removed,
+        // then the channels that were left out.
+        // if filter is non-null, it is applied to each healthy channel of each tile on the way out
+        // (the caller still has to call beginBlock and finishBlock around this).
+        // if tap is non-null, it gets each tile of the input (not called if this is the identity).
+        void apply(float* const* data, int numSamples, Scratch& scratch,
+            RejectedComponentSink* sink = nullptr, ChannelFilter* filter = nullptr,
+            InputTap* tap = nullptr) const;
+
+        // Apply a blend of two subtractive plans on the same channels, going from <from> to <to>
+        // with a raised cosine over fadeLength samples, of which fadePos have already been
+        // processed. Either may be null (for no change). Bad channels are only zero-weighted.
+        static void crossfade(const ApplyPlan* from, const ApplyPlan* to, float* const* data,
+            int numSamples, Scratch& scratch, int fadePos, int fadeLength);
+
+        int getNumChannels() const;
+
+        // number of components actually used in the low-rank update
+        int getNumActiveComponents() const;
+
+        int getNumRejectedComponents() const;
+
+        // unique (within this process) nonzero identifier of this plan
+        uint32_t getSerial() const;
+
+        bool isAdditive() const;
+
+        const std::vector<int>& getChannels() const;
+
+        // whether applying this plan would not change the data
+        bool isIdentity() const;
+
+        // samples processed at a time - short enough for a tile of a few hundred
+        // channels to stay in L2 between the unmixing and remixing steps
+        static const int tileSize = 256;
+
+    private:
+        // copy a tile into scratch.tile, passing it to tap (if non-null),
+        // then check each channel and zero bad ones
+        void gatherTile(float* const* data, int start, int len, Scratch& scratch,
+            InputTap* tap = nullptr) const;
+
+        // copy scratch.tile back to the healthy channels (filtering them first, if filter is non-null)
+        void scatterTile(float* const* data, int start, int len, Scratch& scratch,
+            ChannelFilter* filter = nullptr) const;
+
+        std::vector<int> chans;
+        std::shared_ptr<const ApplyKernel> kernel;
+        uint32_t serial;
+    };
+}
+
+#endif // ICA_APPLY_PLAN_H_DEFINED
@@ -0,0 +1,355 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICAAsr.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <Eigen/Eigenvalues>
+
+using namespace ICA;
+
+const float AsrEngine::windowSec         (0.5f);
+const float AsrEngine::stepSec           (0.05f);
+const float AsrEngine::cutoff            (5.0f);
+const float AsrEngine::maxBadFraction    (0.66f);
+const float AsrEngine::calibrationSec    (60.0f);
+const float AsrEngine::minCalibrationSec (15.0f);
+
+// frames of input that can be buffered before the worker must catch up
+static const int fifoFrames = 4096;
+
+// median of values (reorders them)
+static double median(std::vector<double>& values)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+
+    auto mid = values.begin() + values.size() / 2;
+    std::nth_element(values.begin(), mid, values.end());
+    return *mid;
+}
+
+static StreamStatsOptions covarianceOnly()
+{
+    StreamStatsOptions options;
+    options.covariance = true;
+    return options;
+}
+
+AsrEngine::AsrEngine(const String& name, const std::vector<int>& chans, int inStride,
+    float sampleRate, const Matrix& calibration, UpdateCallback callback)
+    : Thread            ("ICA ASR " + name)
+    , inputChans        (chans)
+    , stride            (jmax(inStride, 1))
+    , onUpdate          (callback)
+    , strideOffset      (0)
+    , fifo              (fifoFrames * jmax(int(chans.size()), 1))
+    , fifoData          (fifo.getTotalSize())
+    , windowFrames      (jmax(int(windowSec * sampleRate), 1))
+    , stepFrames        (jmax(int(stepSec * sampleRate), 1))
+    , decayPerFrame     (std::exp(-1.0 / (windowSec * sampleRate)))
+    , maxBad            (int(maxBadFraction * chans.size()))
+    , calibrationData   (calibration)
+    , calibrated        (false)
+    , stepStats         (int(chans.size()), covarianceOnly())
+    , correcting        (false)
+{
+    jassert(calibration.rows() == getNumChannels());
+
+    startThread();
+}
+
+AsrEngine::~AsrEngine()
+{
+    stopThread(1000);
+}
+
+int AsrEngine::getNumChannels() const
+{
+    return int(inputChans.size());
+}
+
+const std::vector<int>& AsrEngine::getInputChannels() const
+{
+    return inputChans;
+}
+
+void AsrEngine::pushInput(const float* const* data, int numSamples)
+{
+    int nChans = getNumChannels();
+    int nFrames = (numSamples - strideOffset + stride - 1) / stride;
+    if (nFrames <= 0 || nChans == 0)
+    {
+        strideOffset -= numSamples;
+        return;
+    }
+
+    // if the worker is behind (e.g. still calibrating), skip this block
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(nFrames * nChans, start1, size1, start2, size2);
+
+    if (size1 + size2 == nFrames * nChans)
+    {
+        // since everything is written in whole frames, frames don't wrap around
+        int i = 0;
+        for (int s = strideOffset; s < numSamples; s += stride)
+        {
+            float* dest = &fifoData[i < size1 ? start1 + i : start2 + i - size1];
+            for (int c = 0; c < nChans; ++c)
+            {
+                dest[c] = data[inputChans[c]][s];
+            }
+            i += nChans;
+        }
+
+        fifo.finishedWrite(size1 + size2);
+    }
+
+    strideOffset += nFrames * stride - numSamples;
+}
+
+void AsrEngine::run()
+{
+    if (!calibrated)
+    {
+        calibrate(calibrationData.cast<double>(), windowFrames, stepFrames, cutoff,
+            mean, mixing, threshold, stepThreshold);
+        cov = mixing * mixing;
+        calibrationData.resize(0, 0);
+        calibrated = true;
+    }
+
+    while (!threadShouldExit())
+    {
+        while (processNextChunk() && !threadShouldExit()) {}
+        wait(stepSec * 1000 / 2);
+    }
+}
+
+bool AsrEngine::processNextChunk()
+{
+    int nChans = getNumChannels();
+    if (nChans == 0 || fifo.getNumReady() < stepFrames * nChans)
+    {
+        return false;
+    }
+
+    // (the stats are computed straight from the FIFO, which holds whole frames)
+    stepStats.reset();
+
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(stepFrames * nChans, start1, size1, start2, size2);
+    stepStats.addFrames(&fifoData[start1], size1 / nChans);
+    stepStats.addFrames(&fifoData[start2], size2 / nChans);
+    fifo.finishedRead(size1 + size2);
+
+    // exponentially weighted update (see WhiteningTracker)
+    double keep = std::pow(decayPerFrame, stepFrames);
+    mean = keep * mean + (1 - keep) * stepStats.getMean();
+
+    Eigen::VectorXd offset = stepStats.getMean() - mean;
+    Eigen::MatrixXd stepCov = stepStats.getCovariance() + offset * offset.transpose();
+    cov = keep * cov + (1 - keep) * stepCov;
+
+    bool needsCorrection = computeCorrection(cov, stepCov, mixing, threshold, stepThreshold,
+        maxBad, left, right);
+    if (needsCorrection || correcting)
+    {
+        bool used = onUpdate(*this, left, right, mean.cast<float>());
+        correcting = needsCorrection || !used;
+    }
+
+    return true;
+}
+
+// threshold = diag(median RMS of each row of projected over half-overlapping windows
+// + cutoff * (MAD-based) std) * components^T
+static Eigen::MatrixXd rmsThreshold(const Eigen::MatrixXd& projected, const Eigen::MatrixXd& components,
+    int windowFrames, double cutoff)
+{
+    int nChans = int(projected.rows());
+    int nFrames = int(projected.cols());
+    windowFrames = jlimit(1, jmax(nFrames, 1), windowFrames);
+
+    int hop = jmax(windowFrames / 2, 1);
+    int nRmsWindows = jmax((nFrames - windowFrames) / hop + 1, 1);
+    Eigen::VectorXd thresholds(nChans);
+
+    std::vector<double> rms(nRmsWindows);
+    std::vector<double> deviations(nRmsWindows);
+    for (int c = 0; c < nChans; ++c)
+    {
+        for (int w = 0; w < nRmsWindows; ++w)
+        {
+            auto window = projected.row(c).segment(w * hop, jmin(windowFrames, nFrames));
+            rms[w] = std::sqrt(window.squaredNorm() / double(window.size()));
+        }
+
+        double med = median(rms);
+        for (int w = 0; w < nRmsWindows; ++w)
+        {
+            deviations[w] = std::abs(rms[w] - med);
+        }
+        double robustStd = 1.4826 * median(deviations);
+
+        thresholds(c) = med + cutoff * robustStd;
+    }
+
+    return thresholds.asDiagonal() * components.transpose();
+}
+
+void AsrEngine::calibrate(const Eigen::MatrixXd& data, int windowFrames, int stepFrames,
+    double cutoff, Eigen::VectorXd& mean, Eigen::MatrixXd& mixing,
+    Eigen::MatrixXd& threshold, Eigen::MatrixXd& stepThreshold)
+{
+    int nChans = int(data.rows());
+    int nFrames = int(data.cols());
+    windowFrames = jlimit(1, jmax(nFrames, 1), windowFrames);
+
+    mean = nFrames > 0 ? Eigen::VectorXd(data.rowwise().mean()) : Eigen::VectorXd::Zero(nChans);
+    Eigen::MatrixXd centered = data.colwise() - mean;
+
+    // elementwise median of the covariances of non-overlapping windows
+    // (so that a few bursts in the reference data don't inflate it)
+    int nWindows = jmax(nFrames / windowFrames, 1);
+    std::vector<Eigen::MatrixXd> windowCovs;
+    for (int w = 0; w < nWindows; ++w)
+    {
+        auto window = centered.middleCols(w * windowFrames, jmin(windowFrames, nFrames));
+        windowCovs.push_back(window * window.transpose() / double(window.cols()));
+    }
+
+    Eigen::MatrixXd refCov(nChans, nChans);
+    std::vector<double> values(nWindows);
+    for (int j = 0; j < nChans; ++j)
+    {
+        for (int i = 0; i <= j; ++i)
+        {
+            for (int w = 0; w < nWindows; ++w)
+            {
+                values[w] = windowCovs[w](i, j);
+            }
+            refCov(i, j) = refCov(j, i) = median(values);
+        }
+    }
+    windowCovs.clear();
+
+    mixing = covariancePower(refCov, 0.5);
+
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eig(refCov);
+    const Eigen::MatrixXd& components = eig.eigenvectors();
+    Eigen::MatrixXd projected = components.transpose() * centered;
+
+    threshold = rmsThreshold(projected, components, windowFrames, cutoff);
+    stepThreshold = rmsThreshold(projected, components, stepFrames, cutoff);
+
+    // The components a step is measured along are partly fitted to it (see computeCorrection),
+    // which inflates its variance along the top ones, more so with more channels. So scale the
+    // step thresholds up by how much the steps of the reference data would exceed them.
+    stepFrames = jlimit(1, jmax(nFrames, 1), stepFrames);
+    int nSteps = jmax(nFrames / stepFrames, 1);
+    std::vector<double> excess(nSteps);
+    for (int w = 0; w < nSteps; ++w)
+    {
+        auto step = centered.middleCols(w * stepFrames, jmin(stepFrames, nFrames));
+        Eigen::MatrixXd stepCov = step * step.transpose() / double(step.cols());
+
+        Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> stepEig(refCov + stepCov);
+        const Eigen::MatrixXd& stepComponents = stepEig.eigenvectors();
+        Eigen::VectorXd stepVars = (stepComponents.transpose() * stepCov * stepComponents).diagonal();
+        Eigen::VectorXd thresholdVars = (stepThreshold * stepComponents).colwise().squaredNorm().transpose();
+
+        // (as a ratio of RMS)
+        excess[w] = std::sqrt((stepVars.array() / thresholdVars.array().max(1e-30)).maxCoeff());
+    }
+
+    // median + cutoff * (robust) std, as for the thresholds themselves
+    double med = median(excess);
+    for (double& e : excess)
+    {
+        e = std::abs(e - med);
+    }
+    double scale = med + cutoff * 1.4826 * median(excess);
+
+    if (scale > 1)
+    {
+        stepThreshold *= scale;
+    }
+}
+
+bool AsrEngine::computeCorrection(const Eigen::MatrixXd& cov, const Eigen::MatrixXd& stepCov,
+    const Eigen::MatrixXd& mixing, const Eigen::MatrixXd& threshold,
+    const Eigen::MatrixXd& stepThreshold, int maxBad, Matrix& left, Matrix& right)
+{
+    int nChans = int(cov.rows());
+
+    // principal components of both together, so that a burst that has only just started is
+    // one of them, while the running covariance keeps them from fitting the noise of one step
+    // (eigenvalues in increasing order)
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eig(cov + stepCov);
+    const Eigen::MatrixXd& components = eig.eigenvectors();
+
+    Eigen::VectorXd variances = (components.transpose() * cov * components).diagonal();
+    Eigen::VectorXd stepVars = (components.transpose() * stepCov * components).diagonal();
+
+    // variance each component would have at the threshold
+    Eigen::VectorXd thresholdVars = (threshold * components).colwise().squaredNorm().transpose();
+    Eigen::VectorXd stepThresholdVars = (stepThreshold * components).colwise().squaredNorm().transpose();
+
+    Eigen::VectorXd keep(nChans);
+    int nBad = 0;
+    for (int c = 0; c < nChans; ++c)
+    {
+        bool exceeds = variances(c) >= thresholdVars(c) || stepVars(c) >= stepThresholdVars(c);
+        bool good = !exceeds || c < nChans - maxBad;
+        keep(c) = good ? 1 : 0;
+        nBad += good ? 0 : 1;
+    }
+
+    if (nBad == 0)
+    {
+        left.resize(nChans, 0);
+        right.resize(0, nChans);
+        return false;
+    }
+
+    Eigen::MatrixXd keptMixing = keep.asDiagonal() * components.transpose() * mixing;
+    Eigen::MatrixXd reconstruct = mixing
+        * keptMixing.completeOrthogonalDecomposition().pseudoInverse()
+        * components.transpose();
+
+    // reconstruct - I has rank <= nBad
+    reconstruct -= Eigen::MatrixXd::Identity(nChans, nChans);
+    Eigen::JacobiSVD<Eigen::MatrixXd> svd(reconstruct, Eigen::ComputeThinU | Eigen::ComputeThinV);
+    const Eigen::VectorXd& singularValues = svd.singularValues();
+
+    int rank = 0;
+    double tolerance = std::max(singularValues(0), 1e-30) * 1e-9;
+    while (rank < nBad && rank < nChans && singularValues(rank) > tolerance)
+    {
+        ++rank;
+    }
+
+    left = (svd.matrixU().leftCols(rank) * singularValues.head(rank).asDiagonal()).cast<float>();
+    right = svd.matrixV().leftCols(rank).transpose().cast<float>();
+    return true;
+}
@@ -0,0 +1,153 @@
+#ifndef ICA_ASR_H_DEFINED
+#define ICA_ASR_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ProcessorHeaders.h>
+
+#include <functional>
+
+#include "ICAApplyPlan.h"
+#include "ICAStreamStats.h"
+
+namespace ICA
+{
+    // Artifact subspace reconstruction (Mullen et al., 2015): removes short high-amplitude
+    // bursts, which ICA can't learn, by reconstructing the part of the signal in which the
+    // variance is far above that of reference data from the rest.
+    //
+    // Calibration: the reference covariance C is the elementwise median of the covariances
+    // of windows of the reference data, and M = C^(1/2). For each principal component of C,
+    // the threshold is the median RMS over windows + cutoff * (robust) standard deviation.
+    // A second set of thresholds is computed the same way over windows of one step.
+    //
+    // Processing: the covariance of the input is tracked with a time constant of one window.
+    // At each step, the principal components of it plus the covariance over just that step
+    // whose running variance exceeds their (projected) threshold, or whose variance over the
+    // step exceeds the step threshold, are marked bad (up to a maximum fraction), and the
+    // reconstruction is
+    //   x <- m + M * pinv(K * V^T * M) * V^T * (x - m)
+    // (V: current principal components, K: keeps good ones, m: running mean), which differs from
+    // the identity by a low-rank correction. Since the statistics are of the centered input, so
+    // is the correction: a channel's offset is left as it is rather than reconstructed.
+    //
+    // As with WhiteningTracker, the audio thread only copies every <stride>th input sample of
+    // the included channels into a FIFO; the statistics and eigendecompositions are done on
+    // this decimated stream by a worker thread, which passes each new correction to a
+    // callback. The correction itself is applied at the full rate as an ApplyPlan.
+    //
+    // There is no lookahead (the output isn't delayed), so a burst starts being corrected
+    // once the step it starts in has been read: the start passes through for up to a step,
+    // plus the time to compute the correction and the crossfade to it. Bursts too weak to
+    // stand out in one step are caught as the running covariance builds up, and corrections
+    // only end as it decays, about a window after the burst.
+    class AsrEngine : public Thread
+    {
+    public:
+        // left, right, center: the correction x <- x + left * (right * (x - center)) on the included
+        // channels (see ApplyKernel), or left and right empty for none. Should return false if it
+        // couldn't be used, in which case the next one is sent even if there is no correction.
+        using UpdateCallback = std::function<bool(AsrEngine& source, MatrixConstRef left, MatrixConstRef right,
+            const Eigen::VectorXf& center)>;
+
+        // inputChans: buffer channels to copy (the included channels, in order)
+        // sampleRate: of the downsampled input (i.e. after taking every <stride>th sample)
+        // calibration: included channels x frames of reference data at sampleRate
+        //   (calibration happens on the worker thread)
+        AsrEngine(const String& name, const std::vector<int>& inputChans, int stride,
+            float sampleRate, const Matrix& calibration, UpdateCallback onUpdate);
+        ~AsrEngine();
+
+        int getNumChannels() const;
+
+        // buffer channels the correction applies to
+        const std::vector<int>& getInputChannels() const;
+
+        // Audio thread: copy the input that is about to be processed.
+        void pushInput(const float* const* data, int numSamples);
+
+        // worker thread
+        void run() override;
+
+        // Reference statistics of data (channels x frames). threshold = diag(thresholds) * V^T,
+        // for RMS over windows of windowFrames, and stepThreshold likewise for stepFrames.
+        static void calibrate(const Eigen::MatrixXd& data, int windowFrames, int stepFrames,
+            double cutoff, Eigen::VectorXd& mean, Eigen::MatrixXd& mixing,
+            Eigen::MatrixXd& threshold, Eigen::MatrixXd& stepThreshold);
+
+        // Correction for data with the given running covariance and covariance over the last
+        // step (see above). Returns false if nothing needs to be corrected (left and right are
+        // then empty).
+        static bool computeCorrection(const Eigen::MatrixXd& cov, const Eigen::MatrixXd& stepCov,
+            const Eigen::MatrixXd& mixing, const Eigen::MatrixXd& threshold,
+            const Eigen::MatrixXd& stepThreshold, int maxBad, Matrix& left, Matrix& right);
+
+        // length of windows for calibration and time constant of the running covariance
+        static const float windowSec;
+
+        // how often the correction is updated (also the length of the crossfade between corrections)
+        static const float stepSec;
+
+        // in standard deviations of the reference windows' RMS
+        static const float cutoff;
+
+        // at most this fraction of the components can be reconstructed at once
+        static const float maxBadFraction;
+
+        // amount of reference data to calibrate from (the most recent part of the training cache)
+        static const float calibrationSec;
+        static const float minCalibrationSec;
+
+    private:
+        // worker thread - returns false if there was nothing to process
+        bool processNextChunk();
+
+        const std::vector<int> inputChans;
+        const int stride;
+        const UpdateCallback onUpdate;
+
+        // audio thread state
+        int strideOffset;
+
+        AbstractFifo fifo; // whole interleaved frames
+        HeapBlock<float> fifoData;
+
+        // worker thread state
+        const int windowFrames;
+        const int stepFrames;
+        const double decayPerFrame; // of the running estimates
+        const int maxBad;
+
+        Matrix calibrationData;     // until calibrated
+        bool calibrated;
+
+        Eigen::MatrixXd mixing;     // M
+        Eigen::MatrixXd threshold;  // T
+        Eigen::MatrixXd stepThreshold;
+        Eigen::VectorXd mean;       // running mean
+        Eigen::MatrixXd cov;        // running covariance
+        StreamStats stepStats;
+
+        Matrix left, right;         // current correction
+        bool correcting;            // whether the last correction sent was not empty (or couldn't be used)
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AsrEngine);
+    };
+}
+
+#endif // ICA_ASR_H_DEFINED
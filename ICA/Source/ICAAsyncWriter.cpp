@@ -0,0 +1,277 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICAAsyncWriter.h"
+
+#include <cstring>
+
+using namespace ICA;
+
+/**** PooledWriteBackend ****/
+
+class PooledWriteBackend::WriteJob : public ThreadPoolJob
+{
+public:
+    WriteJob(PooledWriteBackend& ownerIn, int tagIn, const char* dataIn, size_t numBytesIn, int64 offsetIn)
+        : ThreadPoolJob ("ICA write")
+        , owner         (ownerIn)
+        , tag           (tagIn)
+        , data          (dataIn)
+        , numBytes      (numBytesIn)
+        , offset        (offsetIn)
+    {}
+
+    JobStatus runJob() override
+    {
+        Result res = owner.writeAt(data, numBytes, offset);
+
+        {
+            const ScopedLock completedLock(owner.completedMutex);
+            owner.completedTags.add(tag);
+            owner.completedErrors.add(res.getErrorMessage());
+        }
+        owner.writeCompleted.signal();
+
+        return jobHasFinished;
+    }
+
+private:
+    PooledWriteBackend& owner;
+    const int tag;
+    const char* const data;
+    const size_t numBytes;
+    const int64 offset;
+};
+
+PooledWriteBackend::PooledWriteBackend(int numThreads)
+    : pool(numThreads)
+{}
+
+PooledWriteBackend::~PooledWriteBackend()
+{
+    waitForAllJobs();
+}
+
+Result PooledWriteBackend::submit(int tag, const char* data, size_t numBytes, int64 offset)
+{
+    pool.addJob(new WriteJob(*this, tag, data, numBytes, offset), true);
+    return Result::ok();
+}
+
+int PooledWriteBackend::waitForCompletion(Result& res)
+{
+    while (true)
+    {
+        {
+            const ScopedLock completedLock(completedMutex);
+            if (completedTags.size() > 0)
+            {
+                int tag = completedTags.removeAndReturn(0);
+                String error = completedErrors[0];
+                completedErrors.remove(0);
+
+                res = error.isEmpty() ? Result::ok() : Result::fail(error);
+                return tag;
+            }
+        }
+
+        writeCompleted.wait(100);
+    }
+}
+
+void PooledWriteBackend::waitForAllJobs()
+{
+    // (jobs report completion just before they return)
+    while (pool.getNumJobs() > 0)
+    {
+        Thread::sleep(1);
+    }
+}
+
+
+/**** AsyncFileWriter ****/
+
+AsyncFileWriter::AsyncFileWriter(const File& file, bool direct)
+    : status        (Result::ok())
+    , storage       (size_t(bufferSize) * numBuffers + AsyncWriteBackend::ioAlignment)
+    , numPending    (0)
+    , currentBuffer (-1)
+    , currentFill   (0)
+    , bytesSubmitted(0)
+    , finished      (false)
+{
+    // align the buffers within the storage block
+    uintptr_t base = reinterpret_cast<uintptr_t>(storage.get());
+    uintptr_t alignedBase = (base + AsyncWriteBackend::ioAlignment - 1)
+        & ~uintptr_t(AsyncWriteBackend::ioAlignment - 1);
+
+    for (int b = 0; b < numBuffers; ++b)
+    {
+        buffers[b] = storage + (alignedBase - base) + size_t(b) * bufferSize;
+        freeBuffers.add(b);
+    }
+
+    backend = AsyncWriteBackend::open(file, direct, numBuffers, status);
+    if (!backend && status.wasOk())
+    {
+        status = Result::fail("Failed to open " + file.getFileName());
+    }
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+    if (!finished)
+    {
+        finish();
+    }
+}
+
+Result AsyncFileWriter::getStatus() const
+{
+    return status;
+}
+
+bool AsyncFileWriter::write(const void* data, size_t numBytes)
+{
+    jassert(!finished);
+
+    const char* src = static_cast<const char*>(data);
+
+    while (numBytes > 0)
+    {
+        if (!ensureCurrentBuffer())
+        {
+            return false;
+        }
+
+        size_t toCopy = jmin(numBytes, size_t(bufferSize) - currentFill);
+        std::memcpy(buffers[currentBuffer] + currentFill, src, toCopy);
+
+        currentFill += toCopy;
+        src += toCopy;
+        numBytes -= toCopy;
+
+        if (currentFill == size_t(bufferSize) && !submitCurrentBuffer(bufferSize))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+Result AsyncFileWriter::finish()
+{
+    jassert(!finished);
+    finished = true;
+
+    int64 totalSize = bytesSubmitted + int64(currentFill);
+
+    if (status.wasOk() && currentBuffer != -1 && currentFill > 0)
+    {
+        size_t toWrite = currentFill;
+        if (backend->isDirect())
+        {
+            // pad to the alignment; the file is truncated to the real size when closing
+            size_t align = AsyncWriteBackend::ioAlignment;
+            toWrite = (currentFill + align - 1) / align * align;
+            std::memset(buffers[currentBuffer] + currentFill, 0, toWrite - currentFill);
+        }
+
+        submitCurrentBuffer(toWrite);
+    }
+
+    while (numPending > 0)
+    {
+        reclaimBuffer();
+    }
+
+    if (backend)
+    {
+        Result closeRes = backend->close(totalSize);
+        if (status.wasOk())
+        {
+            status = closeRes;
+        }
+        backend = nullptr;
+    }
+
+    return status;
+}
+
+bool AsyncFileWriter::ensureCurrentBuffer()
+{
+    if (status.failed())
+    {
+        return false;
+    }
+
+    if (currentBuffer != -1)
+    {
+        return true;
+    }
+
+    while (freeBuffers.isEmpty())
+    {
+        if (!reclaimBuffer())
+        {
+            return false;
+        }
+    }
+
+    currentBuffer = freeBuffers.removeAndReturn(freeBuffers.size() - 1);
+    currentFill = 0;
+    return true;
+}
+
+bool AsyncFileWriter::submitCurrentBuffer(size_t numBytes)
+{
+    jassert(currentBuffer != -1);
+
+    Result res = backend->submit(currentBuffer, buffers[currentBuffer], numBytes, bytesSubmitted);
+    if (res.failed())
+    {
+        status = res;
+        freeBuffers.add(currentBuffer);
+    }
+    else
+    {
+        ++numPending;
+        bytesSubmitted += numBytes;
+    }
+
+    currentBuffer = -1;
+    currentFill = 0;
+    return status.wasOk();
+}
+
+bool AsyncFileWriter::reclaimBuffer()
+{
+    jassert(numPending > 0);
+
+    Result res = Result::ok();
+    int tag = backend->waitForCompletion(res);
+    --numPending;
+    freeBuffers.add(tag);
+
+    if (res.failed() && status.wasOk())
+    {
+        status = res;
+    }
+
+    return status.wasOk();
+}
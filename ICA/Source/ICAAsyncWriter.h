@@ -0,0 +1,137 @@
+#ifndef ICA_ASYNC_WRITER_H_DEFINED
+#define ICA_ASYNC_WRITER_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ProcessorHeaders.h>
+
+namespace ICA
+{
+    // The platform-specific part of AsyncFileWriter, which just starts writes at given offsets
+    // and reports when they are done. All calls come from the thread that owns the writer.
+    class AsyncWriteBackend
+    {
+    public:
+        virtual ~AsyncWriteBackend() {}
+
+        // Opens (creating or truncating) the file. If direct is true, tries to bypass the OS cache,
+        // in which case all writes must be aligned to ioAlignment (in offset, size and memory).
+        // maxPending: maximum number of writes that will be in progress at once.
+        // Implemented in posix/ and win32/. Returns null on failure.
+        static AsyncWriteBackend* open(const File& file, bool direct, int maxPending, Result& res);
+
+        // Start writing. data must stay valid until the write is returned by waitForCompletion.
+        virtual Result submit(int tag, const char* data, size_t numBytes, int64 offset) = 0;
+
+        // Blocks until a submitted write finishes, and returns its tag.
+        virtual int waitForCompletion(Result& res) = 0;
+
+        // Sets the final size of the file and closes it. All writes must have completed.
+        virtual Result close(int64 size) = 0;
+
+        // whether writes are actually bypassing the OS cache
+        virtual bool isDirect() const = 0;
+
+        static const int ioAlignment = 4096;
+    };
+
+    // Backend for when there is no native asynchronous I/O: does ordinary positioned writes on a
+    // small thread pool. Subclasses just provide the blocking write.
+    class PooledWriteBackend : public AsyncWriteBackend
+    {
+    public:
+        explicit PooledWriteBackend(int numThreads = 2);
+        ~PooledWriteBackend();
+
+        Result submit(int tag, const char* data, size_t numBytes, int64 offset) override;
+        int waitForCompletion(Result& res) override;
+
+    protected:
+        // called on a pool thread
+        virtual Result writeAt(const char* data, size_t numBytes, int64 offset) = 0;
+
+        // wait for any writes that are still running (subclasses should call this before closing)
+        void waitForAllJobs();
+
+    private:
+        class WriteJob;
+
+        ThreadPool pool;
+
+        CriticalSection completedMutex; // controls below variables
+        Array<int> completedTags;
+        StringArray completedErrors;     // (empty if no error)
+        WaitableEvent writeCompleted;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PooledWriteBackend);
+    };
+
+    // Writes a file sequentially through a few large aligned buffers, which are written out in the
+    // background while the next one is filled. With direct = true, bypasses the OS cache where the
+    // platform and file system allow it, so that writing large exports doesn't evict the data that
+    // the rest of the signal chain (e.g. the record node) is using and writing.
+    //
+    // Not thread-safe: all calls should come from one thread.
+    class AsyncFileWriter
+    {
+    public:
+        AsyncFileWriter(const File& file, bool direct = true);
+
+        // finishes writing, if this hasn't been done yet
+        ~AsyncFileWriter();
+
+        // first error that has occurred, if any (including failure to open)
+        Result getStatus() const;
+
+        bool write(const void* data, size_t numBytes);
+
+        // waits for all data to be written, then closes the file. can only be called once.
+        Result finish();
+
+        static const int bufferSize = 1 << 20;
+        static const int numBuffers = 4;
+
+    private:
+        // make sure there is a buffer with room to write into (may block)
+        bool ensureCurrentBuffer();
+
+        // start writing the current buffer (all of it unless it's the last)
+        bool submitCurrentBuffer(size_t numBytes);
+
+        // wait for one write to complete and make its buffer available
+        bool reclaimBuffer();
+
+        ScopedPointer<AsyncWriteBackend> backend;
+        Result status;
+
+        HeapBlock<char> storage;
+        char* buffers[numBuffers];
+        Array<int> freeBuffers;
+        int numPending;
+
+        int currentBuffer; // -1 if none
+        size_t currentFill;
+        int64 bytesSubmitted;
+
+        bool finished;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AsyncFileWriter);
+    };
+}
+
+#endif // ICA_ASYNC_WRITER_H_DEFINED
@@ -0,0 +1,515 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICABinicaFiles.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+
+#include <Eigen/SVD>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#endif
+
+using namespace ICA;
+
+const char* const ICA::binicaChanHintPrefix = "!chans: ";
+const char* const ICA::binicaGainHintPrefix = "!gains: ";
+const char* const ICA::mixingMatrixFilename = "output.mix";
+const char* const ICA::unmixingMatrixFilename = "output.unmix";
+const char* const ICA::factorsFilename = "output.factors";
+
+static bool equalsIgnoreCase(const std::string& a, const char* b)
+{
+    size_t len = std::char_traits<char>::length(b);
+    if (a.size() != len)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// split on whitespace, keeping double-quoted strings together (without the quotes)
+static void addTokens(const std::string& text, std::vector<std::string>& tokens)
+{
+    size_t i = 0;
+    while (i < text.size())
+    {
+        if (std::isspace(static_cast<unsigned char>(text[i])))
+        {
+            ++i;
+            continue;
+        }
+
+        std::string token;
+        if (text[i] == '"')
+        {
+            size_t end = text.find('"', i + 1);
+            token = text.substr(i + 1, end == std::string::npos ? std::string::npos : end - i - 1);
+            i = end == std::string::npos ? text.size() : end + 1;
+        }
+        else
+        {
+            size_t end = i;
+            while (end < text.size() && !std::isspace(static_cast<unsigned char>(text[end])))
+            {
+                ++end;
+            }
+            token = text.substr(i, end - i);
+            i = end;
+        }
+        tokens.push_back(token);
+    }
+}
+
+#ifdef _WIN32
+static std::wstring widenPath(const std::string& path)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, path.data(), int(path.size()), nullptr, 0);
+    std::wstring wide(size_t(length), L'\0');
+    if (length > 0)
+    {
+        MultiByteToWideChar(CP_UTF8, 0, path.data(), int(path.size()), &wide[0], length);
+    }
+    return wide;
+}
+#endif
+
+void ICA::openFile(std::ifstream& stream, const std::string& path, std::ios::openmode mode)
+{
+#ifdef _WIN32
+    stream.open(widenPath(path).c_str(), mode);
+#else
+    stream.open(path, mode);
+#endif
+}
+
+void ICA::openFile(std::ofstream& stream, const std::string& path, std::ios::openmode mode)
+{
+#ifdef _WIN32
+    stream.open(widenPath(path).c_str(), mode);
+#else
+    stream.open(path, mode);
+#endif
+}
+
+bool ICA::readBinicaConfig(const std::string& path, BinicaConfig& config, std::string& error)
+{
+    std::ifstream configStream;
+    openFile(configStream, path);
+    if (!configStream)
+    {
+        error = "Failed to open config file";
+        return false;
+    }
+
+    config = BinicaConfig();
+    const std::string hintPrefix(binicaChanHintPrefix);
+    const std::string gainPrefix(binicaGainHintPrefix);
+
+    std::vector<std::string> configTokens;
+    std::string line;
+    while (std::getline(configStream, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        // handle enabled channels hint
+        if (line.compare(0, hintPrefix.size(), hintPrefix) == 0)
+        {
+            std::istringstream hintStream(line.substr(hintPrefix.size()));
+            std::vector<int> enabledChans;
+            int chan;
+            while (hintStream >> chan)
+            {
+                enabledChans.push_back(chan);
+            }
+
+            std::sort(enabledChans.begin(), enabledChans.end());
+            enabledChans.erase(std::unique(enabledChans.begin(), enabledChans.end()), enabledChans.end());
+            config.enabledChannels.swap(enabledChans);
+        }
+        else if (line.compare(0, gainPrefix.size(), gainPrefix) == 0)
+        {
+            std::istringstream hintStream(line.substr(gainPrefix.size()));
+            std::vector<float> gains;
+            float gain;
+            while (hintStream >> gain)
+            {
+                gains.push_back(gain);
+            }
+            config.channelGains.swap(gains);
+        }
+        else
+        {
+            addTokens(line.substr(0, line.find_first_of("!#%")), configTokens);
+        }
+    }
+
+    if (configStream.bad())
+    {
+        error = "Failed to read config file";
+        return false;
+    }
+
+    size_t nTokens = configTokens.size();
+    if (nTokens % 2 == 1)
+    {
+        error = "Malformed config file";
+        return false;
+    }
+
+    // fields of interest: chans, WeightsOutFile, SphereFile
+    for (size_t i = 0; i + 1 < nTokens; i += 2)
+    {
+        const std::string& key = configTokens[i];
+        const std::string& value = configTokens[i + 1];
+
+        if (equalsIgnoreCase(key, "chans") || equalsIgnoreCase(key, "chan"))
+        {
+            config.numChannels = std::atoi(value.c_str());
+        }
+        else if (equalsIgnoreCase(key, "weightsoutfile"))
+        {
+            config.weightFile = value;
+        }
+        else if (equalsIgnoreCase(key, "spherefile"))
+        {
+            config.sphereFile = value;
+        }
+    }
+
+    if (config.numChannels < 2)
+    {
+        error = "Invalid or missing # of channels";
+        return false;
+    }
+
+    if (!config.enabledChannels.empty() && int(config.enabledChannels.size()) != config.numChannels)
+    {
+        error = "Inconsistent number of channels";
+        return false;
+    }
+
+    if (!config.channelGains.empty() && int(config.channelGains.size()) != config.numChannels)
+    {
+        error = "Inconsistent number of channel gains";
+        return false;
+    }
+
+    return true;
+}
+
+bool ICA::writeBinicaConfig(const std::string& path, const BinicaConfig& config, const std::string& dataFile,
+    int numFrames, const std::string& solverSettings, std::string& error)
+{
+    std::ofstream stream;
+    openFile(stream, path, std::ios::trunc);
+    if (!stream)
+    {
+        error = "Failed to open binica config file";
+        return false;
+    }
+
+    // skips some settings where the default is ok
+    stream << "# binica config file - for details, see https://sccn.ucsd.edu/wiki/Binica \n";
+
+    // hint for loading - write which channels are enabled
+    stream << binicaChanHintPrefix;
+    for (size_t i = 0; i < config.enabledChannels.size(); ++i)
+    {
+        stream << (i > 0 ? " " : "") << config.enabledChannels[i];
+    }
+    stream << '\n';
+
+    // and how the data file was scaled, if it was
+    if (!config.channelGains.empty())
+    {
+        stream << binicaGainHintPrefix << std::setprecision(9);
+        for (float gain : config.channelGains)
+        {
+            stream << gain << ' ';
+        }
+        stream << '\n';
+    }
+
+    stream << "DataFile " << dataFile << '\n';
+    stream << "chans " << config.numChannels << '\n';
+    stream << "frames " << numFrames << '\n';
+    stream << "WeightsOutFile " << config.weightFile << '\n';
+    stream << "SphereFile " << config.sphereFile << '\n';
+    stream << solverSettings;
+    stream << "posact off\n";
+
+    stream.close();
+    if (!stream)
+    {
+        error = "Failed to write to config file";
+        return false;
+    }
+
+    return true;
+}
+
+bool ICA::readRawMatrix(const std::string& path, MatrixRef dest, std::string& error)
+{
+    std::string fn = path.substr(path.find_last_of("/\\") + 1);
+
+    std::ifstream stream;
+    openFile(stream, path, std::ios::binary | std::ios::ate);
+    if (!stream)
+    {
+        error = "Matrix file " + fn + " not found";
+        return false;
+    }
+
+    std::streamoff size = dest.rows() * dest.cols();
+    if (std::streamoff(stream.tellg()) != size * std::streamoff(sizeof(float)))
+    {
+        error = fn + " has incorrect length";
+        return false;
+    }
+
+    Matrix data(dest.rows(), dest.cols());
+    stream.seekg(0);
+    stream.read(reinterpret_cast<char*>(data.data()), size * sizeof(float));
+    if (!stream)
+    {
+        error = "Failed to read " + fn;
+        return false;
+    }
+
+    dest = data;
+    return true;
+}
+
+bool ICA::readFactors(const std::string& path, int numChannels, HierarchicalFactors& factors, std::string& error)
+{
+    std::string fn = path.substr(path.find_last_of("/\\") + 1);
+
+    std::ifstream stream;
+    openFile(stream, path, std::ios::binary | std::ios::ate);
+    if (!stream)
+    {
+        error = "Factors file " + fn + " not found";
+        return false;
+    }
+
+    std::streamoff fileSize = stream.tellg();
+    stream.seekg(0);
+
+    int32_t numSelected = 0;
+    stream.read(reinterpret_cast<char*>(&numSelected), sizeof(numSelected));
+    if (!stream || numSelected < 1 || numSelected > numChannels)
+    {
+        error = fn + " is invalid";
+        return false;
+    }
+
+    std::streamoff n = numChannels;
+    std::streamoff k = numSelected;
+    if (fileSize != std::streamoff(sizeof(int32_t)) * (1 + k) + std::streamoff(sizeof(float)) * (n * n + k * k))
+    {
+        error = fn + " has incorrect length";
+        return false;
+    }
+
+    HierarchicalFactors read;
+    std::vector<int32_t> selected(numSelected);
+    read.localUnmixing.resize(numChannels, numChannels);
+    read.globalUnmixing.resize(numSelected, numSelected);
+
+    stream.read(reinterpret_cast<char*>(selected.data()), k * sizeof(int32_t));
+    stream.read(reinterpret_cast<char*>(read.localUnmixing.data()), n * n * sizeof(float));
+    stream.read(reinterpret_cast<char*>(read.globalUnmixing.data()), k * k * sizeof(float));
+    if (!stream)
+    {
+        error = "Failed to read " + fn;
+        return false;
+    }
+
+    for (int i = 0; i < numSelected; ++i)
+    {
+        if (selected[i] < 0 || selected[i] >= numChannels || (i > 0 && selected[i] <= selected[i - 1]))
+        {
+            error = fn + " is invalid";
+            return false;
+        }
+        read.selected.push_back(selected[i]);
+    }
+
+    read.localMixing = read.localUnmixing.inverse();
+    factors = std::move(read);
+    return true;
+}
+
+bool ICA::writeFactors(const std::string& path, const HierarchicalFactors& factors, std::string& error)
+{
+    std::string fn = path.substr(path.find_last_of("/\\") + 1);
+
+    std::ofstream stream;
+    openFile(stream, path, std::ios::binary | std::ios::trunc);
+    if (!stream)
+    {
+        error = "Failed to open " + fn;
+        return false;
+    }
+
+    int32_t numSelected = int32_t(factors.selected.size());
+    std::vector<int32_t> selected(factors.selected.begin(), factors.selected.end());
+
+    stream.write(reinterpret_cast<const char*>(&numSelected), sizeof(numSelected));
+    stream.write(reinterpret_cast<const char*>(selected.data()), selected.size() * sizeof(int32_t));
+    stream.write(reinterpret_cast<const char*>(factors.localUnmixing.data()),
+        factors.localUnmixing.size() * sizeof(float));
+    stream.write(reinterpret_cast<const char*>(factors.globalUnmixing.data()),
+        factors.globalUnmixing.size() * sizeof(float));
+
+    stream.close();
+    if (!stream)
+    {
+        error = "Failed to write " + fn;
+        return false;
+    }
+
+    return true;
+}
+
+bool ICA::factorsMatch(const HierarchicalFactors& factors, MatrixConstRef unmixing)
+{
+    if (factors.localUnmixing.rows() != unmixing.rows() || factors.localUnmixing.cols() != unmixing.cols())
+    {
+        return false;
+    }
+
+    float scale = unmixing.cwiseAbs().maxCoeff();
+    return (factors.composeUnmixing() - unmixing).cwiseAbs().maxCoeff() <= 1e-4f * scale;
+}
+
+Matrix ICA::computeUnmixing(MatrixConstRef weights, MatrixConstRef sphere)
+{
+    // normalize sphere matrix by largest singular value
+    Eigen::BDCSVD<Matrix> svd(sphere);
+    return weights * (sphere / svd.singularValues()(0));
+}
+
+void ICA::foldChannelGains(MatrixRef unmixing, const std::vector<float>& gains)
+{
+    if (gains.empty())
+    {
+        return;
+    }
+
+    assert(int(gains.size()) == unmixing.cols());
+    unmixing = unmixing * Eigen::Map<const Eigen::VectorXf>(gains.data(), gains.size()).asDiagonal();
+}
+
+bool ICA::loadBinicaResults(const std::string& configPath, BinicaResults& results, std::string& error)
+{
+    BinicaConfig config;
+    if (!readBinicaConfig(configPath, config, error))
+    {
+        return false;
+    }
+
+    int n = config.numChannels;
+    results.enabledChannels = config.enabledChannels;
+    if (results.enabledChannels.empty())
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            results.enabledChannels.push_back(i);
+        }
+    }
+
+    size_t sep = configPath.find_last_of("/\\");
+    std::string configDir = sep == std::string::npos ? std::string() : configPath.substr(0, sep + 1);
+
+    results.mixing.resize(n, n);
+    results.unmixing.resize(n, n);
+    results.factors = nullptr;
+
+    // (not an error if it's missing or stale; the operation just isn't applied in factored form)
+    auto factors = std::make_shared<HierarchicalFactors>();
+    std::string factorsError;
+    if (!readFactors(configDir + factorsFilename, n, *factors, factorsError))
+    {
+        factors = nullptr;
+    }
+
+    std::string matrixError;
+    if (readRawMatrix(configDir + unmixingMatrixFilename, results.unmixing, matrixError)
+        && readRawMatrix(configDir + mixingMatrixFilename, results.mixing, matrixError))
+    {
+        if (factors && factorsMatch(*factors, results.unmixing))
+        {
+            results.factors = factors;
+        }
+        return true;
+    }
+
+    if (factors)
+    {
+        results.unmixing = factors->composeUnmixing();
+        results.mixing = factors->composeMixing();
+        results.factors = factors;
+        return true;
+    }
+
+    // try using weight and sphere files
+    if (config.weightFile.empty() || config.sphereFile.empty())
+    {
+        error = "Invalid or missing weight or sphere file";
+        return false;
+    }
+
+    Matrix weights(n, n);
+    Matrix sphere(n, n);
+    if (!readRawMatrix(configDir + config.weightFile, weights, error)
+        || !readRawMatrix(configDir + config.sphereFile, sphere, error))
+    {
+        return false;
+    }
+
+    results.unmixing = computeUnmixing(weights, sphere);
+    foldChannelGains(results.unmixing, config.channelGains);
+    results.mixing = results.unmixing.inverse();
+    return true;
+}
@@ -0,0 +1,112 @@
+#ifndef ICA_BINICA_FILES_H_DEFINED
+#define ICA_BINICA_FILES_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Reading the files of an ICA run (binica config and output).
+// Like ICAApplyPlan.h, this only depends on Eigen and the standard library,
+// so that offline tools can load decompositions the same way the processors do.
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "ICAApplyPlan.h"
+
+namespace ICA
+{
+    // the fields of a binica.sc file that are needed to load its results
+    struct BinicaConfig
+    {
+        int numChannels = 0;
+        std::vector<int> enabledChannels; // from the hint line written by ICANode (sorted); empty if not present
+        std::vector<float> channelGains;  // from the gains hint line (see below); empty if not present
+        std::string weightFile;           // as written (relative to the config file's directory)
+        std::string sphereFile;
+    };
+
+    // start of line containing enabled channels hint in binica.sc files
+    extern const char* const binicaChanHintPrefix;
+
+    // start of line containing the gain each channel of the data file was multiplied by when
+    // it was exported (so binica sees channels of similar scale). binica's output is in terms
+    // of the scaled data; the gains are folded back in when computing the unmixing matrix.
+    extern const char* const binicaGainHintPrefix;
+
+    // files that the mixing and unmixing matrices are saved to, next to the config file
+    extern const char* const mixingMatrixFilename;
+    extern const char* const unmixingMatrixFilename;
+
+    // file that the factors of an operation trained in two levels are saved to, next to the
+    // config file (see HierarchicalFactors): the number of selected components K (int32), the
+    // selected components (K x int32), then the local unmixing matrix (nChans x nChans) and the
+    // global one (K x K), as raw float32 values (column-major).
+    extern const char* const factorsFilename;
+
+    // Open a file by its UTF-8 path (as from juce::String::toStdString). On Windows, the standard
+    // streams would take a narrow path to be in the ANSI code page, so non-ASCII paths would fail.
+    void openFile(std::ifstream& stream, const std::string& path, std::ios::openmode mode = std::ios::in);
+    void openFile(std::ofstream& stream, const std::string& path, std::ios::openmode mode = std::ios::out);
+
+    // Parse a binica.sc file. Returns false and sets error on failure.
+    bool readBinicaConfig(const std::string& path, BinicaConfig& config, std::string& error);
+
+    // Write a binica.sc file for a run on dataFile (numFrames frames of config.numChannels float32
+    // samples), with the hint lines and the given solver settings (config lines). File names are
+    // relative to the config file's directory.
+    bool writeBinicaConfig(const std::string& path, const BinicaConfig& config, const std::string& dataFile,
+        int numFrames, const std::string& solverSettings, std::string& error);
+
+    // Read a square matrix of raw float32 values (column-major), as saved by ICANode::saveMatrix.
+    // dest must already have the expected size.
+    bool readRawMatrix(const std::string& path, MatrixRef dest, std::string& error);
+
+    // Read and write a factors file (see factorsFilename). Reading fills in localMixing too,
+    // and fails if the file doesn't describe an operation on numChannels channels.
+    bool readFactors(const std::string& path, int numChannels, HierarchicalFactors& factors, std::string& error);
+    bool writeFactors(const std::string& path, const HierarchicalFactors& factors, std::string& error);
+
+    // whether factors compose to (approximately) the given unmixing matrix, e.g. to check that
+    // a factors file is from the same run as the matrices next to it
+    bool factorsMatch(const HierarchicalFactors& factors, MatrixConstRef unmixing);
+
+    // A decomposition as loaded from a binica run directory
+    struct BinicaResults
+    {
+        std::vector<int> enabledChannels; // of the subprocessor's channels
+        Matrix mixing;
+        Matrix unmixing;
+        HierarchicalFactorsPtr factors;   // null unless it was trained in two levels
+    };
+
+    // Load the results of a run from its config file: uses the saved mixing and unmixing
+    // matrices if present, otherwise composes them from the saved factors or computes them
+    // from the weight and sphere files (without saving them). If there is no enabled channels
+    // hint, assumes the first numChannels channels, like ICANode does.
+    bool loadBinicaResults(const std::string& configPath, BinicaResults& results, std::string& error);
+
+    // Unmixing matrix from binica's output: weights * sphere, with the sphere matrix
+    // normalized by its largest singular value.
+    Matrix computeUnmixing(MatrixConstRef weights, MatrixConstRef sphere);
+
+    // Turn an unmixing matrix of scaled data into one of the original data, by scaling
+    // each of its columns by the corresponding gain. Does nothing if gains is empty.
+    void foldChannelGains(MatrixRef unmixing, const std::vector<float>& gains);
+}
+
+#endif // ICA_BINICA_FILES_H_DEFINED
@@ -27,6 +27,9 @@ const int ICACanvas::colourBarHeight = 150;
 
 const int ICACanvas::unitLength = 20;
 
+const int ICACanvas::traceWidth = 600;
+const int ICACanvas::traceHeight = 40;
+
 ICACanvas::ICACanvas(ICANode& proc)
     : node              (proc)
     , configPathVal     (proc.addConfigPathListener(this))
@@ -66,23 +69,8 @@ void ICACanvas::buttonClicked(Button* button)
     int kComp = eButton->getChannelNum() - 1; // to 0-based
     bool selected = eButton->getToggleState();
 
-    ScopedPointer<ScopedWriteLock> icaLock;
-    ICAOperation* op = node.writeICAOperation(icaLock);
-
-    if (!op || op->enabledChannels.size() <= kComp)
-    {
-        // uh-oh, the canvas is out of sync. the valueChanged callback should resolve this.
-        return;
-    }
-
-    if (selected)
-    {
-        op->rejectedComponents.removeValue(kComp);
-    }
-    else
-    {
-        op->rejectedComponents.add(kComp);
-    }
+    // if the canvas is out of sync, this does nothing; the valueChanged callback should resolve it.
+    node.setComponentSelected(kComp, selected);
 }
 
 void ICACanvas::update()
@@ -104,7 +92,17 @@ void ICACanvas::update()
         return;
     }
 
-    canvas.update({ *op, *chanNames });
+    // (op is the candidate, if a new decomposition is being previewed)
+    const SortedSet<int>* candidate = node.getPreviewCandidate();
+    const SortedSet<int>* previewChans = node.getPreviewChannels();
+    if (candidate && previewChans)
+    {
+        canvas.update({ *op, *candidate, *previewChans, *chanNames, true });
+    }
+    else
+    {
+        canvas.update({ *op, op->rejectedComponents, op->enabledChannels, *chanNames, false });
+    }
     viewport.setVisible(true);
 }
 
@@ -192,6 +190,7 @@ ICACanvas::ContentCanvas::ContentCanvas(ICACanvas& visualizer)
     , multiplySign1         ("X 1", L"\u00d7")
     , componentSelectionArea(visualizer)
     , multiplySign2         ("X 2", L"\u00d7")
+    , previewArea           (visualizer)
     , visualizer            (visualizer)
 {
     mixingInfo.setTopLeftPosition(30, 30);
@@ -206,6 +205,8 @@ ICACanvas::ContentCanvas::ContentCanvas(ICACanvas& visualizer)
     addAndMakeVisible(multiplySign2);
 
     addAndMakeVisible(unmixingInfo);
+
+    addAndMakeVisible(previewArea);
 }
 
 void ICACanvas::ContentCanvas::update(UpdateInfo info)
@@ -228,8 +229,12 @@ void ICACanvas::ContentCanvas::update(UpdateInfo info)
         componentSelectionArea.getBounds().getTopRight().translated(multiplySign2.getWidth(), 0));
     unmixingInfo.update(info);
 
+    int matricesBottom = jmax(mixingInfo.getBottom(), componentSelectionArea.getBottom(), unmixingInfo.getBottom());
+    previewArea.setTopLeftPosition(mixingInfo.getX(), matricesBottom + 30);
+    previewArea.update(info);
+
     // make sure everything fits
-    setSize(unmixingInfo.getRight(), mixingInfo.getBottom());
+    setSize(jmax(unmixingInfo.getRight(), previewArea.getRight()), previewArea.getBottom());
 }
 
 
@@ -283,14 +288,14 @@ void ICACanvas::ContentCanvas::MixingInfo::update(UpdateInfo info)
     matrixColourBar.resetRange();
     normColourBar.resetRange();
 
-    int nComps = info.op.mixing.cols();
-    jassert(nComps == info.op.mixing.rows());
+    int nComps = info.op.getMixing().cols();
+    jassert(nComps == info.op.getMixing().rows());
 
     matrixView.setSize(nComps * unitLength, nComps * unitLength);
-    matrixView.setData(info.op.mixing);
+    matrixView.setData(info.op.getMixing());
 
     normView.setSize(nComps * unitLength, unitLength);
-    normView.setData(info.op.mixing.colwise().norm());
+    normView.setData(info.op.getMixing().colwise().norm());
 
     // layout
     StringArray usedChannelNames;
@@ -393,7 +398,7 @@ ICACanvas::ContentCanvas::ComponentSelectionArea::ComponentSelectionArea(ICACanv
 
 void ICACanvas::ContentCanvas::ComponentSelectionArea::update(UpdateInfo info)
 {
-    int nComps = info.op.mixing.cols();
+    int nComps = info.op.getMixing().cols();
 
     background.setSize(nComps * unitLength, nComps * unitLength);
 
@@ -422,7 +427,7 @@ void ICACanvas::ContentCanvas::ComponentSelectionArea::update(UpdateInfo info)
         btn->setToggleState(true, dontSendNotification);
     }
 
-    for (int cOff : info.op.rejectedComponents)
+    for (int cOff : info.rejected)
     {
         componentButtons[cOff]->setToggleState(false, dontSendNotification);
     }
@@ -500,11 +505,11 @@ void ICACanvas::ContentCanvas::UnmixingInfo::update(UpdateInfo info)
 {
     colourBar.resetRange();
 
-    int nComps = info.op.unmixing.rows();
-    jassert(nComps == info.op.unmixing.cols());
+    int nComps = info.op.getUnmixing().rows();
+    jassert(nComps == info.op.getUnmixing().cols());
 
     matrixView.setSize(nComps * unitLength, nComps * unitLength);
-    matrixView.setData(info.op.unmixing);
+    matrixView.setData(info.op.getUnmixing());
 
     title.setSize(jmax(matrixView.getWidth(), getNaturalWidth(title)), title.getHeight());
 
@@ -565,4 +570,174 @@ void ICACanvas::ContentCanvas::UnmixingInfo::update(UpdateInfo info)
     colourBar.setTopLeftPosition(rightEdge + unitLength * 3 / 2, title.getBottom() - colourBarY);
 
     setSize(colourBar.getRight(), jmax(colourBar.getBottom(), matrixView.getBottom() + labelHeight));
-}
\ No newline at end of file
+}
+
+ICACanvas::ContentCanvas::PreviewArea::PreviewArea(ICACanvas& visualizer)
+    : title         ("Preview title", "PREVIEW")
+    , previewButton ("PREVIEW", getSmallFont())
+    , applyButton   ("APPLY", getSmallFont())
+    , discardButton ("DISCARD", getSmallFont())
+    , legend        ("Preview legend", "current: white, candidate: orange")
+    , visualizer    (visualizer)
+    , previewVersion(visualizer.node.getPreviewVersion())
+{
+    formatLargeLabel(title);
+    title.setSize(getNaturalWidth(title) + 10, title.getHeight());
+    title.setTopLeftPosition(0, 0);
+    addAndMakeVisible(title);
+
+    previewButton.setClickingTogglesState(true);
+    previewButton.setTooltip("Try out a different selection of components on live data"
+        " before applying it. While previewing, component selections only change the candidate,"
+        " and a decomposition that is loaded or trained becomes the candidate.");
+    previewButton.setBounds(title.getRight() + 10, 5, 70, unitLength);
+    previewButton.addListener(this);
+    addAndMakeVisible(previewButton);
+
+    applyButton.setBounds(previewButton.getRight() + 3, 5, 70, unitLength);
+    applyButton.addListener(this);
+    addChildComponent(applyButton);
+
+    discardButton.setBounds(applyButton.getRight() + 3, 5, 70, unitLength);
+    discardButton.addListener(this);
+    addChildComponent(discardButton);
+
+    legend.setFont(getSmallFont());
+    legend.setColour(Label::textColourId, Colours::white);
+    legend.setBounds(0, title.getBottom(), traceWidth, unitLength);
+    addChildComponent(legend);
+
+    traceView.setTopLeftPosition(0, legend.getBottom());
+    addChildComponent(traceView);
+}
+
+void ICACanvas::ContentCanvas::PreviewArea::update(UpdateInfo info)
+{
+    previewButton.setToggleState(info.previewing, dontSendNotification);
+    applyButton.setVisible(info.previewing);
+    discardButton.setVisible(info.previewing);
+    legend.setVisible(info.previewing);
+    traceView.setVisible(info.previewing);
+
+    if (!info.previewing)
+    {
+        stopTimer();
+        traceView.current.resize(0, 0);
+        traceView.candidate.resize(0, 0);
+        setSize(discardButton.getRight(), title.getBottom());
+        return;
+    }
+
+    traceView.chanNames.clearQuick();
+    for (int chan : info.previewChans)
+    {
+        traceView.chanNames.add(info.chanNames[chan]);
+    }
+
+    traceView.setSize(traceWidth, traceView.chanNames.size() * traceHeight);
+    setSize(jmax(discardButton.getRight(), traceView.getRight()), traceView.getBottom());
+
+    startTimerHz(20);
+}
+
+void ICACanvas::ContentCanvas::PreviewArea::buttonClicked(Button* button)
+{
+    ICANode& node = visualizer.node;
+
+    if (button == &previewButton)
+    {
+        if (previewButton.getToggleState())
+        {
+            Result res = node.startPreview();
+            if (res.failed())
+            {
+                CoreServices::sendStatusMessage("Preview failed: " + res.getErrorMessage());
+            }
+        }
+        else
+        {
+            node.stopPreview();
+        }
+    }
+    else if (button == &applyButton)
+    {
+        node.promotePreview();
+    }
+    else if (button == &discardButton)
+    {
+        node.stopPreview();
+    }
+
+    visualizer.update();
+}
+
+void ICACanvas::ContentCanvas::PreviewArea::timerCallback()
+{
+    ICANode& node = visualizer.node;
+
+    // a new decomposition became the candidate
+    int version = node.getPreviewVersion();
+    if (version != previewVersion)
+    {
+        previewVersion = version;
+        visualizer.update();
+        return;
+    }
+
+    if (!node.getPreviewSnapshot(traceView.current, traceView.candidate))
+    {
+        if (!node.isPreviewing())
+        {
+            // stopped from elsewhere (e.g. a new operation was loaded)
+            stopTimer();
+            visualizer.update();
+        }
+        return;
+    }
+
+    traceView.repaint();
+}
+
+void ICACanvas::ContentCanvas::PreviewArea::TraceView::paint(Graphics& g)
+{
+    g.fillAll(Colours::black);
+
+    int nFrames = current.rows();
+    int nChans = current.cols();
+
+    if (nFrames < 2 || candidate.rows() != nFrames || candidate.cols() != nChans)
+    {
+        return;
+    }
+
+    float xScale = float(getWidth()) / (nFrames - 1);
+
+    for (int c = 0; c < nChans; ++c)
+    {
+        // use the same scale for both, so they can be compared
+        float absMax = jmax(current.col(c).lpNorm<Eigen::Infinity>(),
+            candidate.col(c).lpNorm<Eigen::Infinity>());
+        float yScale = absMax > 0 ? traceHeight / (2.2f * absMax) : 0.0f;
+        float yMid = (c + 0.5f) * traceHeight;
+
+        Path currentPath, candidatePath;
+        currentPath.startNewSubPath(0, yMid - current(0, c) * yScale);
+        candidatePath.startNewSubPath(0, yMid - candidate(0, c) * yScale);
+
+        for (int f = 1; f < nFrames; ++f)
+        {
+            currentPath.lineTo(f * xScale, yMid - current(f, c) * yScale);
+            candidatePath.lineTo(f * xScale, yMid - candidate(f, c) * yScale);
+        }
+
+        g.setColour(Colours::white.withAlpha(0.7f));
+        g.strokePath(currentPath, PathStrokeType(1.0f));
+
+        g.setColour(Colours::orange);
+        g.strokePath(candidatePath, PathStrokeType(1.0f));
+
+        g.setColour(Colours::grey);
+        g.setFont(getSmallFont());
+        g.drawSingleLineText(chanNames[c], 3, c * traceHeight + 12);
+    }
+}
@@ -103,7 +103,10 @@ namespace ICA
         struct UpdateInfo
         {
             const ICAOperation& op;
+            const SortedSet<int>& rejected; // the candidate's, if previewing
+            const SortedSet<int>& previewChans; // channels shown in the preview
             const StringArray& chanNames;
+            bool previewing;
         };
 
         // hierarchical singleton struct of displayed components
@@ -175,6 +178,40 @@ namespace ICA
 
             } unmixingInfo;
 
+            // shows live output with the candidate components next to the current output
+            struct PreviewArea : public Component, public Button::Listener, public Timer
+            {
+                PreviewArea(ICACanvas& visualizer);
+
+                void update(UpdateInfo info);
+
+                void buttonClicked(Button* button) override;
+
+                // get new data from the node
+                void timerCallback() override;
+
+                struct TraceView : public Component
+                {
+                    void paint(Graphics& g) override;
+
+                    Matrix current;   // frames x channels
+                    Matrix candidate;
+                    StringArray chanNames;
+                };
+
+                Label title;
+                UtilityButton previewButton;
+                UtilityButton applyButton;
+                UtilityButton discardButton;
+                Label legend;
+                TraceView traceView;
+
+            private:
+                ICACanvas& visualizer;
+                int previewVersion; // of the node when last updated
+
+            } previewArea;
+
         private:
 
             static void formatLargeLabel(Label& label, int width = 0);
@@ -194,6 +231,10 @@ namespace ICA
         // width of colourBar and side length of each matrix entry
         static const int unitLength;
 
+        // size of the preview traces
+        static const int traceWidth;
+        static const int traceHeight;
+
         JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ICACanvas);
     };
 }
\ No newline at end of file
@@ -0,0 +1,163 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICAChannelGroups.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace ICA;
+
+ChannelGroups ICA::groupChannels(const Eigen::MatrixXd& cov, int maxGroupSize)
+{
+    int n = int(cov.rows());
+    maxGroupSize = std::max(maxGroupSize, 1);
+
+    // |correlation| between channels
+    Eigen::ArrayXd invStd = cov.diagonal().array().sqrt().inverse();
+    Eigen::MatrixXd correlation = (invStd.matrix().asDiagonal() * cov * invStd.matrix().asDiagonal()).cwiseAbs();
+    for (int j = 0; j < n; ++j)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            if (!std::isfinite(correlation(i, j)))
+            {
+                correlation(i, j) = 0;
+            }
+        }
+    }
+
+    ChannelGroups groups(n);
+    for (int c = 0; c < n; ++c)
+    {
+        groups[c].push_back(c);
+    }
+
+    // merge the most similar pair of groups that fits until there are none left.
+    // similarity holds the average linkage between live groups (Lance-Williams update).
+    Eigen::MatrixXd similarity = correlation;
+    std::vector<bool> live(n, true);
+    while (true)
+    {
+        int bestA = -1;
+        int bestB = -1;
+        double bestSim = -1;
+
+        for (int b = 0; b < n; ++b)
+        {
+            if (!live[b]) { continue; }
+
+            for (int a = 0; a < b; ++a)
+            {
+                if (live[a] && similarity(a, b) > bestSim
+                    && int(groups[a].size() + groups[b].size()) <= maxGroupSize)
+                {
+                    bestA = a;
+                    bestB = b;
+                    bestSim = similarity(a, b);
+                }
+            }
+        }
+
+        // (don't merge groups that are completely uncorrelated here; that's left to the end)
+        if (bestA == -1 || bestSim <= 0)
+        {
+            break;
+        }
+
+        double sizeA = double(groups[bestA].size());
+        double sizeB = double(groups[bestB].size());
+        for (int k = 0; k < n; ++k)
+        {
+            if (live[k] && k != bestA && k != bestB)
+            {
+                double sim = (sizeA * similarity(bestA, k) + sizeB * similarity(bestB, k)) / (sizeA + sizeB);
+                similarity(bestA, k) = similarity(k, bestA) = sim;
+            }
+        }
+
+        groups[bestA].insert(groups[bestA].end(), groups[bestB].begin(), groups[bestB].end());
+        groups[bestB].clear();
+        live[bestB] = false;
+    }
+
+    ChannelGroups merged;
+    std::vector<int> singles;
+    for (int g = 0; g < n; ++g)
+    {
+        if (groups[g].size() > 1)
+        {
+            merged.push_back(std::move(groups[g]));
+        }
+        else if (groups[g].size() == 1)
+        {
+            singles.push_back(groups[g][0]);
+        }
+    }
+
+    // place single channels where they fit best, by mean correlation with the group
+    std::vector<int> unplaced;
+    for (int chan : singles)
+    {
+        int bestGroup = -1;
+        double bestSim = -1;
+        for (int g = 0; g < int(merged.size()); ++g)
+        {
+            if (int(merged[g].size()) >= maxGroupSize)
+            {
+                continue;
+            }
+
+            double sim = 0;
+            for (int other : merged[g])
+            {
+                sim += correlation(chan, other);
+            }
+            sim /= merged[g].size();
+
+            if (sim > bestSim)
+            {
+                bestGroup = g;
+                bestSim = sim;
+            }
+        }
+
+        if (bestGroup == -1)
+        {
+            unplaced.push_back(chan);
+        }
+        else
+        {
+            merged[bestGroup].push_back(chan);
+        }
+    }
+
+    // the rest go together in order (only the last can be left alone)
+    for (int start = 0; start < int(unplaced.size()); start += maxGroupSize)
+    {
+        int end = std::min(start + maxGroupSize, int(unplaced.size()));
+        merged.emplace_back(unplaced.begin() + start, unplaced.begin() + end);
+    }
+
+    for (auto& group : merged)
+    {
+        std::sort(group.begin(), group.end());
+    }
+    std::sort(merged.begin(), merged.end());
+
+    return merged;
+}
@@ -0,0 +1,43 @@
+#ifndef ICA_CHANNEL_GROUPS_H_DEFINED
+#define ICA_CHANNEL_GROUPS_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Splitting a large set of channels into groups that can be decomposed independently
+// (see ICANode::performGroupedICA).
+
+#include <vector>
+
+#include <Eigen/Dense>
+
+namespace ICA
+{
+    using ChannelGroups = std::vector<std::vector<int>>;
+
+    // Agglomerative (average-linkage) clustering of channels by the absolute correlation
+    // computed from cov, never merging past maxGroupSize channels. Channels left on their
+    // own are then added to the group they are most correlated with that still has room,
+    // or paired up with each other.
+    //
+    // Returns disjoint groups covering all channels (indices into cov), each in increasing
+    // order, sorted by first channel. Channels with zero or non-finite variance are
+    // uncorrelated with everything.
+    ChannelGroups groupChannels(const Eigen::MatrixXd& cov, int maxGroupSize);
+}
+
+#endif // ICA_CHANNEL_GROUPS_H_DEFINED
@@ -0,0 +1,252 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICAComponentLibrary.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <sstream>
+
+using namespace ICA;
+
+static const char* const libraryHeader =
+    "# ICA component library: source, channels, spectral signature, topography (tab-separated)";
+
+template <typename T>
+static void writeList(std::ostream& stream, const std::vector<T>& values)
+{
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        stream << (i > 0 ? " " : "") << values[i];
+    }
+}
+
+template <typename T>
+static std::vector<T> readList(const std::string& text)
+{
+    std::istringstream stream(text);
+    std::vector<T> values;
+    T value;
+    while (stream >> value)
+    {
+        values.push_back(value);
+    }
+    return values;
+}
+
+ComponentFingerprint ICA::makeFingerprint(MatrixConstRef mixing, int comp, const std::vector<int>& channels,
+    const std::vector<float>& spectrum, const std::string& source)
+{
+    assert(int(channels.size()) == mixing.rows() && comp >= 0 && comp < mixing.cols());
+
+    ComponentFingerprint fingerprint;
+    fingerprint.source = source;
+    fingerprint.channels = channels;
+    fingerprint.spectrum = spectrum;
+
+    Eigen::VectorXf topography = mixing.col(comp);
+    float norm = topography.norm();
+    if (norm > 0)
+    {
+        topography /= norm;
+    }
+    fingerprint.topography.assign(topography.data(), topography.data() + topography.size());
+
+    return fingerprint;
+}
+
+bool ComponentLibrary::parse(const std::string& text, std::string& error)
+{
+    entries.clear();
+
+    std::istringstream stream(text);
+    std::string line;
+    int lineNum = 0;
+    while (std::getline(stream, line))
+    {
+        ++lineNum;
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::vector<std::string> fields;
+        std::istringstream lineStream(line);
+        std::string field;
+        while (std::getline(lineStream, field, '\t'))
+        {
+            fields.push_back(field);
+        }
+
+        ComponentFingerprint entry;
+        if (fields.size() == 4)
+        {
+            entry.source = fields[0];
+            entry.channels = readList<int>(fields[1]);
+            entry.spectrum = readList<float>(fields[2]);
+            entry.topography = readList<float>(fields[3]);
+        }
+
+        if (entry.channels.empty() || entry.channels.size() != entry.topography.size()
+            || !std::is_sorted(entry.channels.begin(), entry.channels.end()))
+        {
+            error = "Malformed entry on line " + std::to_string(lineNum);
+            entries.clear();
+            return false;
+        }
+
+        entries.push_back(std::move(entry));
+    }
+
+    return true;
+}
+
+std::string ComponentLibrary::format() const
+{
+    std::ostringstream stream;
+    stream << libraryHeader << '\n';
+    stream.precision(7);
+
+    for (const ComponentFingerprint& entry : entries)
+    {
+        stream << entry.source << '\t';
+        writeList(stream, entry.channels);
+        stream << '\t';
+        writeList(stream, entry.spectrum);
+        stream << '\t';
+        writeList(stream, entry.topography);
+        stream << '\n';
+    }
+
+    return stream.str();
+}
+
+int ComponentLibrary::getNumEntries() const
+{
+    return int(entries.size());
+}
+
+void ComponentLibrary::replaceSource(const std::string& source, const std::vector<ComponentFingerprint>& newEntries)
+{
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+        [&](const ComponentFingerprint& entry) { return entry.source == source; }), entries.end());
+
+    entries.insert(entries.end(), newEntries.begin(), newEntries.end());
+
+    if (int(entries.size()) > maxEntries)
+    {
+        entries.erase(entries.begin(), entries.end() - maxEntries);
+    }
+}
+
+std::vector<int> ComponentLibrary::match(MatrixConstRef mixing, const std::vector<int>& channels,
+    const std::vector<std::vector<float>>& spectra, float minSimilarity, float maxSpectralDistance) const
+{
+    int nChans = int(channels.size());
+    int nComps = int(mixing.cols());
+    assert(mixing.rows() == nChans);
+    assert(spectra.empty() || int(spectra.size()) == nComps);
+
+    // unit-norm topographies, so that products are cosine similarities
+    auto normalizeRows = [](Matrix& m)
+    {
+        Eigen::VectorXf norms = m.rowwise().norm();
+        for (int r = 0; r < m.rows(); ++r)
+        {
+            if (norms(r) > 0)
+            {
+                m.row(r) /= norms(r);
+            }
+        }
+    };
+
+    Matrix comps = mixing.transpose();
+    normalizeRows(comps);
+
+    // library entries on the same channels (in the same order)
+    std::vector<const ComponentFingerprint*> used;
+    Matrix library(entries.size(), nChans);
+    for (const ComponentFingerprint& entry : entries)
+    {
+        int row = int(used.size());
+        bool covered = true;
+        for (int k = 0; k < nChans && covered; ++k)
+        {
+            auto pos = std::lower_bound(entry.channels.begin(), entry.channels.end(), channels[k]);
+            covered = pos != entry.channels.end() && *pos == channels[k];
+            if (covered)
+            {
+                library(row, k) = entry.topography[pos - entry.channels.begin()];
+            }
+        }
+
+        if (covered)
+        {
+            used.push_back(&entry);
+        }
+    }
+
+    std::vector<int> matches;
+    if (used.empty() || nChans < 2)
+    {
+        return matches;
+    }
+
+    Matrix usedLibrary = library.topRows(used.size());
+    normalizeRows(usedLibrary);
+
+    // entries x components
+    Matrix similarity = (usedLibrary * comps.transpose()).cwiseAbs();
+
+    for (int c = 0; c < nComps; ++c)
+    {
+        for (int e = 0; e < int(used.size()); ++e)
+        {
+            if (!(similarity(e, c) >= minSimilarity))
+            {
+                continue;
+            }
+
+            const std::vector<float>& entrySpectrum = used[e]->spectrum;
+            if (!spectra.empty() && !spectra[c].empty() && spectra[c].size() == entrySpectrum.size())
+            {
+                float dist2 = 0;
+                for (size_t i = 0; i < entrySpectrum.size(); ++i)
+                {
+                    float d = spectra[c][i] - entrySpectrum[i];
+                    dist2 += d * d;
+                }
+
+                if (!(std::sqrt(dist2) <= maxSpectralDistance))
+                {
+                    continue;
+                }
+            }
+
+            matches.push_back(c);
+            break;
+        }
+    }
+
+    return matches;
+}
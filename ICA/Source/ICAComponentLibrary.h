@@ -0,0 +1,81 @@
+#ifndef ICA_COMPONENT_LIBRARY_H_DEFINED
+#define ICA_COMPONENT_LIBRARY_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Fingerprints of rejected components, kept across sessions, so that components of a new
+// decomposition that look like ones rejected before can be rejected automatically.
+
+#include <string>
+#include <vector>
+
+#include "ICAApplyPlan.h"
+
+namespace ICA
+{
+    // What a component looks like, independent of the decomposition it came from.
+    struct ComponentFingerprint
+    {
+        std::string source;            // the run it was taken from (e.g. path of its config file)
+        std::vector<int> channels;     // of the subprocessor, in increasing order
+        std::vector<float> topography; // its mixing column on those channels, with unit norm
+        std::vector<float> spectrum;   // spectral signature (see ComponentLibrary::match), or empty
+    };
+
+    // Fingerprint of one component of a decomposition. mixing: channels x components, over the
+    // given channels; spectrum may be empty. The sign of the topography is arbitrary.
+    ComponentFingerprint makeFingerprint(MatrixConstRef mixing, int comp, const std::vector<int>& channels,
+        const std::vector<float>& spectrum, const std::string& source);
+
+    // A list of fingerprints, saved as tab-separated text with one entry per line.
+    // (reading and writing the file is left to the caller)
+    class ComponentLibrary
+    {
+    public:
+        // replaces the contents with those of saved text. empty text is an empty library.
+        bool parse(const std::string& text, std::string& error);
+
+        std::string format() const;
+
+        int getNumEntries() const;
+
+        // replace the entries from the given source with the given ones (which may be none).
+        // the oldest entries are dropped past maxEntries.
+        void replaceSource(const std::string& source, const std::vector<ComponentFingerprint>& newEntries);
+
+        // Components of a decomposition (mixing: channels x components, over the given channels)
+        // that match an entry: the absolute cosine similarity of their topographies is at least
+        // minSimilarity and, if both have a spectral signature, the signatures are within
+        // maxSpectralDistance (Euclidean). spectra has one signature per component, or is empty.
+        // (topographies aren't mean-centered, since a component that is common to all channels,
+        // like a noisy reference, has a mostly constant topography.)
+        //
+        // Entries that don't cover all of the channels are skipped. All components are compared
+        // to all entries with one matrix product. Returns the matching components in order.
+        std::vector<int> match(MatrixConstRef mixing, const std::vector<int>& channels,
+            const std::vector<std::vector<float>>& spectra,
+            float minSimilarity, float maxSpectralDistance) const;
+
+        static const int maxEntries = 512;
+
+    private:
+        std::vector<ComponentFingerprint> entries; // oldest first
+    };
+}
+
+#endif // ICA_COMPONENT_LIBRARY_H_DEFINED
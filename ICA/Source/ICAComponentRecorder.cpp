@@ -0,0 +1,509 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICAComponentRecorder.h"
+#include "ICANode.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+using namespace ICA;
+
+// how much data can be buffered before the writer thread must catch up
+static const float fifoLengthSec = 1.0f;
+
+// floats read from the FIFO at a time by the writer thread
+static const int readChunkSize = 1 << 14;
+
+ComponentRecorder::ComponentRecorder(const String& name, float fs, int numChans)
+    : Thread            ("ICA recorder " + name)
+    , sampleRate        (fs)
+    , maskWords         ((numChans + 31) / 32)
+    , fifo              (jmax(int(fs * fifoLengthSec) * (numChans + 1), readChunkSize))
+    , fifoData          (fifo.getTotalSize())
+    , shouldRecord      (0)
+    , wasRecording      (false)
+    , capturing         (false)
+    , newSessionPending (false)
+    , pendingDropped    (0)
+    , haveHeader        (false)
+    , segmentOpen       (false)
+    , segmentIndex      (0)
+    , segmentSerial     (0)
+    , segmentComps      (0)
+    , segmentStartFrame (0)
+    , segmentStartTimestamp(0)
+    , framesWritten     (0)
+    , framesDropped     (0)
+    , segmentBadBlocks  (0)
+    , frameBuffer       (readChunkSize)
+{
+    startThread();
+}
+
+ComponentRecorder::~ComponentRecorder()
+{
+    stopThread(2000);
+}
+
+void ComponentRecorder::registerOperator(const ApplyPlan& plan, const ICAOperation& op)
+{
+    OperatorInfo info;
+    info.channels = op.enabledChannels;
+
+    int nChans = op.enabledChannels.size();
+    for (int comp : op.rejectedComponents)
+    {
+        if (comp < nChans)
+        {
+            info.rejected.add(comp);
+        }
+    }
+
+    info.rejMixing.resize(nChans, info.rejected.size());
+    for (int k = 0; k < info.rejected.size(); ++k)
+    {
+        info.rejMixing.col(k) = op.getMixing().col(info.rejected[k]);
+    }
+
+    const ScopedLock infoLock(infoMutex);
+    operators[plan.getSerial()] = info;
+
+    // in case plans are registered but never recorded, don't keep too many around
+    while (operators.size() > 16)
+    {
+        operators.erase(operators.begin());
+    }
+}
+
+void ComponentRecorder::startRecording(const File& dir)
+{
+    {
+        const ScopedLock infoLock(infoMutex);
+        nextSessionDir = dir;
+    }
+    shouldRecord = 1;
+}
+
+void ComponentRecorder::stopRecording()
+{
+    shouldRecord = 0;
+}
+
+
+void ComponentRecorder::beginBlock(const ApplyPlan* plan, int numSamples, int64 timestamp)
+{
+    capturing = false;
+
+    if (shouldRecord.get() == 0)
+    {
+        wasRecording = false;
+        newSessionPending = false;
+        pendingDropped = 0;
+        return;
+    }
+
+    if (!wasRecording)
+    {
+        wasRecording = true;
+        newSessionPending = true;
+    }
+
+    BlockHeader newHeader;
+    newHeader.serial = plan ? plan->getSerial() : 0;
+    newHeader.numComps = plan ? plan->getNumRejectedComponents() : 0;
+    newHeader.newSession = newSessionPending ? 1 : 0;
+    newHeader.timestamp = timestamp;
+
+    bool pushed;
+    if (pendingDropped == 0 && fifo.getFreeSpace() >= headerSize + numSamples * newHeader.numComps + maskWords)
+    {
+        newHeader.numFrames = numSamples;
+        pushed = pushHeader(newHeader);
+
+        // (the components and mask are only written for blocks the plan is applied to)
+        capturing = pushed && newHeader.numComps > 0 && numSamples > 0;
+    }
+    else
+    {
+        // the writer isn't keeping up. just record how much is missing
+        // (including earlier blocks that didn't even get a header).
+        newHeader.numFrames = -(pendingDropped + numSamples);
+        pushed = pushHeader(newHeader);
+    }
+
+    if (pushed)
+    {
+        newSessionPending = false;
+        pendingDropped = 0;
+    }
+    else
+    {
+        // (so the missing frames are still marked and the session still starts later)
+        pendingDropped += numSamples;
+    }
+}
+
+bool ComponentRecorder::isCapturing() const
+{
+    return capturing;
+}
+
+void ComponentRecorder::writeRejected(MatrixConstRef comps)
+{
+    if (!capturing)
+    {
+        return;
+    }
+
+    int nFrames = int(comps.rows());
+    int nComps = int(comps.cols());
+
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(nFrames * nComps, start1, size1, start2, size2);
+    jassert(size1 + size2 == nFrames * nComps); // space was checked in beginBlock
+
+    // interleave
+    int i = 0;
+    for (int f = 0; f < nFrames; ++f)
+    {
+        for (int c = 0; c < nComps; ++c, ++i)
+        {
+            fifoData[i < size1 ? start1 + i : start2 + i - size1] = comps(f, c);
+        }
+    }
+
+    fifo.finishedWrite(size1 + size2);
+}
+
+void ComponentRecorder::writeBadChannels(const uint32_t* mask, int numWords)
+{
+    if (!capturing)
+    {
+        return;
+    }
+
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(maskWords, start1, size1, start2, size2);
+    jassert(size1 + size2 == maskWords); // space was checked in beginBlock
+
+    for (int i = 0; i < maskWords; ++i)
+    {
+        uint32 word = i < numWords ? mask[i] : 0;
+        std::memcpy(&fifoData[i < size1 ? start1 + i : start2 + i - size1], &word, sizeof(float));
+    }
+
+    fifo.finishedWrite(size1 + size2);
+    capturing = false;
+}
+
+bool ComponentRecorder::pushHeader(const BlockHeader& newHeader)
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(headerSize, start1, size1, start2, size2);
+    if (size1 + size2 < headerSize)
+    {
+        return false;
+    }
+
+    int32 fields[headerSize] = {
+        int32(newHeader.serial),
+        newHeader.numFrames,
+        newHeader.numComps,
+        newHeader.newSession,
+        int32(newHeader.timestamp & 0xffffffff),
+        int32(newHeader.timestamp >> 32)
+    };
+
+    for (int i = 0; i < headerSize; ++i)
+    {
+        std::memcpy(&fifoData[i < size1 ? start1 + i : start2 + i - size1], &fields[i], sizeof(float));
+    }
+
+    fifo.finishedWrite(headerSize);
+    return true;
+}
+
+
+void ComponentRecorder::run()
+{
+    while (!threadShouldExit())
+    {
+        while (writeNextBlock()) {}
+
+        if (shouldRecord.get() == 0 && !haveHeader && fifo.getNumReady() == 0)
+        {
+            closeSegment();
+        }
+
+        wait(20);
+    }
+
+    while (writeNextBlock()) {}
+    closeSegment();
+}
+
+bool ComponentRecorder::writeNextBlock()
+{
+    if (!haveHeader)
+    {
+        if (fifo.getNumReady() < headerSize)
+        {
+            return false;
+        }
+
+        int32 fields[headerSize];
+        readFloats(reinterpret_cast<float*>(fields), headerSize);
+
+        header.serial = uint32(fields[0]);
+        header.numFrames = fields[1];
+        header.numComps = fields[2];
+        header.newSession = fields[3];
+        header.timestamp = (int64(fields[5]) << 32) | int64(uint32(fields[4]));
+        haveHeader = true;
+
+        if (header.newSession)
+        {
+            closeSegment();
+
+            const ScopedLock infoLock(infoMutex);
+            sessionDir = nextSessionDir;
+            segmentIndex = 0;
+            framesWritten = 0;
+
+            Result res = sessionDir.createDirectory();
+            if (res.failed())
+            {
+                std::cerr << "Failed to create directory for removed ICA components ("
+                    << res.getErrorMessage() << ")" << std::endl;
+            }
+        }
+
+        if (header.numFrames >= 0 && (!segmentOpen || header.serial != segmentSerial))
+        {
+            closeSegment();
+            openSegment();
+        }
+    }
+
+    if (header.numFrames < 0)
+    {
+        // keep the samples aligned with the recording, but mark them as missing
+        int nFrames = -header.numFrames;
+        if (segmentStream != nullptr)
+        {
+            const float nan = std::numeric_limits<float>::quiet_NaN();
+            for (int i = 0; i < nFrames * segmentComps; ++i)
+            {
+                segmentStream->write(&nan, sizeof(float));
+            }
+        }
+
+        framesDropped += nFrames;
+        framesWritten += nFrames;
+        haveHeader = false;
+        return true;
+    }
+
+    int numFloats = header.numFrames * header.numComps;
+    bool hasMask = numFloats > 0;
+    if (fifo.getNumReady() < numFloats + (hasMask ? maskWords : 0))
+    {
+        return false; // wait for the rest
+    }
+
+    for (int remaining = numFloats; remaining > 0; )
+    {
+        int chunk = jmin(remaining, readChunkSize);
+        readFloats(frameBuffer, chunk);
+
+        if (segmentStream != nullptr)
+        {
+            segmentStream->write(frameBuffer, chunk * sizeof(float));
+        }
+
+        remaining -= chunk;
+    }
+
+    if (hasMask)
+    {
+        readFloats(frameBuffer, maskWords);
+        saveBadChannels(reinterpret_cast<const uint32*>(frameBuffer.getData()));
+    }
+
+    framesWritten += header.numFrames;
+    haveHeader = false;
+    return true;
+}
+
+void ComponentRecorder::saveBadChannels(const uint32* mask)
+{
+    if (std::all_of(mask, mask + maskWords, [](uint32 word) { return word == 0; }))
+    {
+        return;
+    }
+
+    ++segmentBadBlocks;
+
+    if (badChanStream == nullptr)
+    {
+        if (!sessionDir.isDirectory())
+        {
+            return;
+        }
+
+        File badChanFile = getSegmentFile(".badchans");
+        badChanFile.deleteFile();
+
+        badChanStream = new FileOutputStream(badChanFile);
+        if (badChanStream->failedToOpen())
+        {
+            std::cerr << "Failed to open " << badChanFile.getFullPathName() << std::endl;
+            badChanStream = nullptr;
+            return;
+        }
+    }
+
+    badChanStream->writeInt64(framesWritten - segmentStartFrame);
+    badChanStream->writeInt(header.numFrames);
+    for (int i = 0; i < maskWords; ++i)
+    {
+        badChanStream->writeInt(int(mask[i]));
+    }
+}
+
+void ComponentRecorder::openSegment()
+{
+    segmentOpen = true;
+    segmentSerial = header.serial;
+    segmentComps = header.numComps;
+    segmentStartFrame = framesWritten;
+    segmentStartTimestamp = header.timestamp;
+    framesDropped = 0;
+    segmentBadBlocks = 0;
+
+    {
+        const ScopedLock infoLock(infoMutex);
+        auto infoEntry = operators.find(segmentSerial);
+        if (infoEntry != operators.end())
+        {
+            segmentInfo = infoEntry->second;
+
+            // older plans won't be applied again
+            operators.erase(operators.begin(), infoEntry);
+        }
+        else
+        {
+            segmentInfo = OperatorInfo();
+        }
+    }
+
+    if (segmentComps == 0 || !sessionDir.isDirectory())
+    {
+        return;
+    }
+
+    File compsFile = getSegmentFile(".components");
+    compsFile.deleteFile();
+
+    segmentStream = new FileOutputStream(compsFile);
+    if (segmentStream->failedToOpen())
+    {
+        std::cerr << "Failed to open " << compsFile.getFullPathName() << std::endl;
+        segmentStream = nullptr;
+    }
+
+    if (segmentInfo.rejMixing.cols() == segmentComps)
+    {
+        Result res = ICANode::saveMatrix(getSegmentFile(".mix"), segmentInfo.rejMixing);
+        if (res.failed())
+        {
+            std::cerr << res.getErrorMessage() << std::endl;
+        }
+    }
+}
+
+void ComponentRecorder::closeSegment()
+{
+    if (!segmentOpen)
+    {
+        return;
+    }
+
+    segmentOpen = false;
+
+    if (segmentStream != nullptr)
+    {
+        segmentStream->flush();
+        segmentStream = nullptr;
+    }
+
+    if (badChanStream != nullptr)
+    {
+        badChanStream->flush();
+        badChanStream = nullptr;
+    }
+
+    if (!sessionDir.isDirectory())
+    {
+        return;
+    }
+
+    XmlElement xml("ICA_REMOVED_SEGMENT");
+    xml.setAttribute("startSample", String(segmentStartFrame));
+    xml.setAttribute("startTimestamp", String(segmentStartTimestamp));
+    xml.setAttribute("numSamples", String(framesWritten - segmentStartFrame));
+    xml.setAttribute("droppedSamples", String(framesDropped));
+    xml.setAttribute("sampleRate", sampleRate);
+    xml.setAttribute("numRejected", segmentComps);
+    xml.setAttribute("operatorKnown", segmentInfo.rejMixing.cols() == segmentComps);
+    xml.setAttribute("subprocChans", ICANode::intSetToString(segmentInfo.channels));
+    xml.setAttribute("reject", ICANode::intSetToString(segmentInfo.rejected));
+    xml.setAttribute("badChannelBlocks", String(segmentBadBlocks));
+    xml.setAttribute("badChannelMaskWords", maskWords);
+
+    if (!xml.writeToFile(getSegmentFile(".xml"), String()))
+    {
+        std::cerr << "Failed to write info for removed ICA components" << std::endl;
+    }
+
+    if (framesDropped > 0)
+    {
+        std::cerr << "Warning: " << framesDropped << " samples of removed ICA components were dropped" << std::endl;
+    }
+
+    ++segmentIndex;
+}
+
+File ComponentRecorder::getSegmentFile(const String& extension) const
+{
+    return sessionDir.getChildFile("segment_" + String(segmentIndex) + extension);
+}
+
+void ComponentRecorder::readFloats(float* dest, int num)
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(num, start1, size1, start2, size2);
+    jassert(size1 + size2 == num);
+
+    std::memcpy(dest, fifoData + start1, size1 * sizeof(float));
+    std::memcpy(dest + size1, fifoData + start2, size2 * sizeof(float));
+
+    fifo.finishedRead(size1 + size2);
+}
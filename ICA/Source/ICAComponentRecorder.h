@@ -0,0 +1,147 @@
+#ifndef ICA_COMPONENT_RECORDER_H_DEFINED
+#define ICA_COMPONENT_RECORDER_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ProcessorHeaders.h>
+
+#include <map>
+
+#include "ICAApplyPlan.h"
+
+namespace ICA
+{
+    struct ICAOperation;
+
+    // Saves the activations of the rejected components of one subprocessor while recording,
+    // so that the raw data can be reconstructed offline as cleaned + M_r * s_r.
+    //
+    // The audio thread pushes a small header for each block (which plan was applied, how
+    // many samples, timestamp) followed by the rejected components, interleaved, and the mask
+    // of channels that were left out (see ApplyPlan) into a FIFO. A background thread drains
+    // it to disk. Each time the plan changes, a new "segment" is started in the output directory:
+    //   segment_<n>.xml         info: start sample/timestamp, # of samples, channels, rejected components
+    //   segment_<n>.mix         M_r, little-endian float32, column-major (nChans x nRejected)
+    //   segment_<n>.components  s_r, little-endian float32, one frame of nRejected values per sample
+    //   segment_<n>.badchans    only if channels were left out: for each such block, its first sample
+    //                           (int64, from the start of the segment), # of samples (int32) and the mask
+    //                           (badChannelMaskWords x uint32, bit k % 32 of word k / 32 for channel k of
+    //                           subprocChans), little-endian. Reconstruction doesn't hold for those samples
+    //                           of those channels, which were passed through unchanged.
+    // Samples that passed through unchanged (e.g. no operation) form segments with no rejected components.
+    class ComponentRecorder : public Thread, public RejectedComponentSink
+    {
+    public:
+        // numChans: # of channels in the subprocessor (an upper bound on # of rejected components)
+        ComponentRecorder(const String& name, float sampleRate, int numChans);
+        ~ComponentRecorder();
+
+        // Make the operation a plan was built from known, so that its segments can be described.
+        // Must be called before the plan is first applied (not from the audio thread).
+        void registerOperator(const ApplyPlan& plan, const ICAOperation& op);
+
+        // Start or stop recording into the given directory (not from the audio thread).
+        void startRecording(const File& dir);
+        void stopRecording();
+
+        // Audio thread: call once per block, with the plan that is about to be applied
+        // to it or null if the block will be passed through unchanged.
+        void beginBlock(const ApplyPlan* plan, int numSamples, int64 timestamp);
+
+        // Audio thread: whether the current block's rejected components should be written,
+        // i.e. whether this should be passed as the sink when applying the plan.
+        bool isCapturing() const;
+
+        void writeRejected(MatrixConstRef comps) override;
+        void writeBadChannels(const uint32_t* mask, int numWords) override;
+
+        // writer thread
+        void run() override;
+
+    private:
+        struct OperatorInfo
+        {
+            SortedSet<int> channels;
+            SortedSet<int> rejected;
+            Matrix rejMixing;
+        };
+
+        struct BlockHeader
+        {
+            uint32 serial;      // of the applied plan, or 0 if passed through
+            int32 numFrames;    // negative = this many frames were dropped
+            int32 numComps;     // rejected components per frame
+            int32 newSession;   // nonzero for the first block after recording starts
+            int64 timestamp;
+        };
+
+        // header size in floats
+        static const int headerSize = 6;
+
+        // audio thread
+        bool pushHeader(const BlockHeader& newHeader);
+
+        // writer thread - returns false if there was nothing (complete) to write
+        bool writeNextBlock();
+        void saveBadChannels(const uint32* mask); // of the current block
+        void openSegment(); // based on the current header
+        void closeSegment();
+        File getSegmentFile(const String& extension) const;
+        void readFloats(float* dest, int num);
+
+        const float sampleRate;
+        const int maskWords; // per block
+
+        AbstractFifo fifo;
+        HeapBlock<float> fifoData;
+
+        Atomic<int> shouldRecord;
+
+        // audio thread state
+        bool wasRecording;
+        bool capturing;
+        bool newSessionPending; // until a header that starts the session is pushed
+        int pendingDropped;     // frames dropped without even a header, to report with the next one
+
+        // writer thread state
+        bool haveHeader;
+        BlockHeader header;
+        File sessionDir;
+        bool segmentOpen;
+        int segmentIndex;
+        uint32 segmentSerial;
+        int segmentComps;
+        int64 segmentStartFrame;
+        int64 segmentStartTimestamp;
+        int64 framesWritten;
+        int64 framesDropped;
+        ScopedPointer<FileOutputStream> segmentStream;
+        ScopedPointer<FileOutputStream> badChanStream; // opened when first needed
+        int64 segmentBadBlocks;
+        OperatorInfo segmentInfo;
+        HeapBlock<float> frameBuffer;
+
+        CriticalSection infoMutex; // controls below variables
+        std::map<uint32, OperatorInfo> operators;
+        File nextSessionDir;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ComponentRecorder);
+    };
+}
+
+#endif // ICA_COMPONENT_RECORDER_H_DEFINED
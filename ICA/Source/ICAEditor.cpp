@@ -31,14 +31,54 @@ const String ICAEditor::durationTooltip("At least 2 minutes of training is"
     " recommended for best results. After the buffer fills with training data,"
     " it will continue to stay updated with new samples while discarding old samples.");
 
+const String ICAEditor::autoSelectTooltip("When on, START holds out the most recent"
+    " 20% of the buffer and trains on several lengths of the rest with several solver"
+    " settings, then uses the cheapest one that explains the held-out data nearly as well"
+    " as the best. The scores are saved to 'eval/evaluation.tsv' in the run's directory,"
+    " and the shortest training length that was good enough is shown in the status bar.");
+
 const String ICAEditor::dirSuffixTooltip("Output of the ICA run will be saved"
     " to 'ica/ICA_<timestamp>_<suffix>' within the current recordings directory.");
 
 const String ICAEditor::resetTooltip("Reset cache; a new run will only use data"
     " from after the reset.");
 
+const String ICAEditor::recordRemovedTooltip("While recording, also save the removed"
+    " components (and the part of the mixing matrix that maps them to channels) to"
+    " 'ica_removed' within the recording directory, so that the raw data can be"
+    " reconstructed offline. Can't be changed during acquisition.");
+
+const String ICAEditor::trackTooltip("Keep the rotation of the current ICA operation"
+    " fixed, but keep updating its whitening from the covariance of the last few minutes of"
+    " input (after a 30 s baseline), so that it follows slow changes in channel gains"
+    " without retraining. The matrices are updated every 5 seconds.");
+
+const String ICAEditor::asrTooltip("Remove high-amplitude bursts from the selected channels"
+    " (artifact subspace reconstruction) before applying ICA. The last minute of data in"
+    " the buffer (at least 15 s) is used as clean reference data, so it should be collected"
+    " while the subject is at rest; the input should be high-pass filtered. Turns off when"
+    " the signal chain changes and isn't saved.");
+
+const String ICAEditor::historyTooltip("When on, a quarter of the training data is taken"
+    " from the cache's history, which keeps 2 s of every 16 s of data that has left the buffer"
+    " (up to 8 minutes back), so that the decomposition also fits the earlier part of the session."
+    " The rest is the most recent data.");
+
+const String ICAEditor::diskTooltip("When on, the buffer is emptied while recording and"
+    " training data is read back from the recorded files instead, to save memory. Requires the"
+    " binary format and a Record Node before this processor. Takes effect when recording starts;"
+    " ASR needs the buffer, so it can't be calibrated in the meantime.");
+
+const String ICAEditor::libraryTooltip("When on, the components you reject are remembered"
+    " for this input across sessions (by their topography and spectrum), and components of new"
+    " or loaded decompositions that match them are rejected automatically.");
+
+const String ICAEditor::hierTooltip("When on, runs that split many channels into groups also"
+    " train on the strongest components of all groups together, so that sources spread over"
+    " several groups are separated too.");
+
 ICAEditor::ICAEditor(ICANode* parentNode)
-    : VisualizerEditor  (parentNode, 220, false)
+    : VisualizerEditor  (parentNode, 310, false)
     , subProcLabel      ("subProcLabel", "Input:")
     , subProcComboBox   ("subProcComboBox")
     , durationLabel     ("durationLabel", "Train for")
@@ -47,9 +87,17 @@ ICAEditor::ICAEditor(ICANode* parentNode)
     , collectedIndicator("collectedIndicator", "")
     , startButton       ("START", Font("Default", 12, Font::plain))
     , runningIndicator  ("runningIndicator", "Running...")
+    , autoSelectButton  ("AUTO", Font("Default", 12, Font::plain))
     , dirSuffixLabel    ("dirSuffixLabel", "Suffix:")
     , dirSuffixTextBox  ("dirSuffixTextBox", parentNode->getDirSuffix())
     , resetButton       ("RESET", Font("Default", 12, Font::plain))
+    , recordRemovedButton("SIDECAR", Font("Default", 12, Font::plain))
+    , trackButton       ("TRACK", Font("Default", 12, Font::plain))
+    , historyButton     ("HIST", Font("Default", 12, Font::plain))
+    , diskButton        ("DISK", Font("Default", 12, Font::plain))
+    , libraryButton     ("LIB", Font("Default", 12, Font::plain))
+    , hierButton        ("HIER", Font("Default", 12, Font::plain))
+    , asrButton         ("ASR", Font("Default", 12, Font::plain))
     , currICAIndicator  ("currICAIndicator", "")
     , clearButton       ("X", Font("Default", 12, Font::plain))
     , configPathVal     (parentNode->addConfigPathListener(this))
@@ -103,6 +151,13 @@ ICAEditor::ICAEditor(ICANode* parentNode)
     progressStartArea.addChildComponent(runningIndicator);
     addAndMakeVisible(progressStartArea);
 
+    autoSelectButton.setBounds(215, 55, 40, 20);
+    autoSelectButton.setClickingTogglesState(true);
+    autoSelectButton.setToggleState(parentNode->getAutoSelect(), dontSendNotification);
+    autoSelectButton.addListener(this);
+    autoSelectButton.setTooltip(autoSelectTooltip);
+    addAndMakeVisible(autoSelectButton);
+
     dirSuffixLabel.setBounds(10, 80, 50, 20);
     dirSuffixLabel.setTooltip(dirSuffixTooltip);
     addAndMakeVisible(dirSuffixLabel);
@@ -119,14 +174,63 @@ ICAEditor::ICAEditor(ICANode* parentNode)
     resetButton.addListener(this);
     resetButton.setTooltip(resetTooltip);
     addAndMakeVisible(resetButton);
+
+    recordRemovedButton.setBounds(195, 80, 60, 20);
+    recordRemovedButton.setClickingTogglesState(true);
+    recordRemovedButton.setToggleState(parentNode->getRecordRemoved(), dontSendNotification);
+    recordRemovedButton.addListener(this);
+    recordRemovedButton.setTooltip(recordRemovedTooltip);
+    addAndMakeVisible(recordRemovedButton);
     
+    trackButton.setBounds(210, 105, 45, 20);
+    trackButton.setClickingTogglesState(true);
+    trackButton.setToggleState(parentNode->getTrackWhitening(), dontSendNotification);
+    trackButton.addListener(this);
+    trackButton.setTooltip(trackTooltip);
+    addAndMakeVisible(trackButton);
+
+    historyButton.setBounds(260, 55, 40, 20);
+    historyButton.setClickingTogglesState(true);
+    historyButton.setToggleState(parentNode->getUseHistory(), dontSendNotification);
+    historyButton.addListener(this);
+    historyButton.setTooltip(historyTooltip);
+    addAndMakeVisible(historyButton);
+
+    diskButton.setBounds(260, 80, 40, 20);
+    diskButton.setClickingTogglesState(true);
+    diskButton.setToggleState(parentNode->getTrainFromRecording(), dontSendNotification);
+    diskButton.addListener(this);
+    diskButton.setTooltip(diskTooltip);
+    addAndMakeVisible(diskButton);
+
+    libraryButton.setBounds(260, 105, 40, 20);
+    libraryButton.setClickingTogglesState(true);
+    libraryButton.setToggleState(parentNode->getUseLibrary(), dontSendNotification);
+    libraryButton.addListener(this);
+    libraryButton.setTooltip(libraryTooltip);
+    addAndMakeVisible(libraryButton);
+
+    hierButton.setBounds(260, 30, 40, 22);
+    hierButton.setClickingTogglesState(true);
+    hierButton.setToggleState(parentNode->getHierarchical(), dontSendNotification);
+    hierButton.addListener(this);
+    hierButton.setTooltip(hierTooltip);
+    addAndMakeVisible(hierButton);
+
+    asrButton.setBounds(200, 30, 55, 22);
+    asrButton.setClickingTogglesState(true);
+    asrButton.setToggleState(parentNode->getAsrEnabled(), dontSendNotification);
+    asrButton.addListener(this);
+    asrButton.setTooltip(asrTooltip);
+    addAndMakeVisible(asrButton);
+
     currICAIndicator.setBounds(0, 0, 175, 20);
 
     clearButton.setBounds(175, 0, 20, 20);
     clearButton.addListener(this);
     clearButton.setVisible(!currICAIndicator.getText().isEmpty());
 
-    currICAArea.setBounds(10, 105, 210, 20);
+    currICAArea.setBounds(10, 105, 195, 20);
     currICAArea.addAndMakeVisible(currICAIndicator);
     currICAArea.addChildComponent(clearButton);
     addAndMakeVisible(currICAArea);
@@ -204,6 +308,43 @@ void ICAEditor::buttonEvent(Button* button)
     {
         icaNode->resetICA(subProcComboBox.getSelectedId());
     }
+    else if (button == &autoSelectButton)
+    {
+        icaNode->setAutoSelect(button->getToggleState());
+    }
+    else if (button == &trackButton)
+    {
+        icaNode->setTrackWhitening(button->getToggleState());
+    }
+    else if (button == &historyButton)
+    {
+        icaNode->setUseHistory(button->getToggleState());
+    }
+    else if (button == &diskButton)
+    {
+        icaNode->setTrainFromRecording(button->getToggleState());
+    }
+    else if (button == &libraryButton)
+    {
+        icaNode->setUseLibrary(button->getToggleState());
+    }
+    else if (button == &hierButton)
+    {
+        icaNode->setHierarchical(button->getToggleState());
+    }
+    else if (button == &asrButton)
+    {
+        Result res = icaNode->setAsrEnabled(button->getToggleState());
+        if (res.failed())
+        {
+            CoreServices::sendStatusMessage("ASR: " + res.getErrorMessage());
+            asrButton.setToggleState(false, dontSendNotification);
+        }
+    }
+    else if (button == &recordRemovedButton)
+    {
+        icaNode->setRecordRemoved(button->getToggleState());
+    }
     else if (button == &loadButton)
     {
         File icaBaseDir = ICANode::getICABaseDir();
@@ -272,6 +413,23 @@ void ICAEditor::updateSettings()
 
     uint32 currSubProc = icaNode->getCurrSubProc();
     subProcComboBox.setSelectedId(currSubProc, dontSendNotification);
+
+    asrButton.setToggleState(icaNode->getAsrEnabled(), dontSendNotification);
+}
+
+
+void ICAEditor::startAcquisition()
+{
+    VisualizerEditor::startAcquisition();
+    recordRemovedButton.setEnabled(false);
+    diskButton.setEnabled(false);
+}
+
+void ICAEditor::stopAcquisition()
+{
+    VisualizerEditor::stopAcquisition();
+    recordRemovedButton.setEnabled(true);
+    diskButton.setEnabled(true);
 }
 
 
@@ -285,6 +443,13 @@ void ICAEditor::saveCustomParameters(XmlElement* xml)
     stateNode->setAttribute("subproc", subProcComboBox.getSelectedId());
     stateNode->setAttribute("trainLength", durationTextBox.getText());
     stateNode->setAttribute("suffix", dirSuffixTextBox.getText());
+    stateNode->setAttribute("recordRemoved", recordRemovedButton.getToggleState());
+    stateNode->setAttribute("autoSelect", autoSelectButton.getToggleState());
+    stateNode->setAttribute("trackWhitening", trackButton.getToggleState());
+    stateNode->setAttribute("useHistory", historyButton.getToggleState());
+    stateNode->setAttribute("trainFromRecording", diskButton.getToggleState());
+    stateNode->setAttribute("useLibrary", libraryButton.getToggleState());
+    stateNode->setAttribute("hierarchical", hierButton.getToggleState());
 }
 
 void ICAEditor::loadCustomParameters(XmlElement* xml)
@@ -301,5 +466,33 @@ void ICAEditor::loadCustomParameters(XmlElement* xml)
 
         durationTextBox.setText(stateNode->getStringAttribute("trainLength", durationTextBox.getText()), sendNotification);
         dirSuffixTextBox.setText(stateNode->getStringAttribute("suffix", dirSuffixTextBox.getText()), sendNotification);
+
+        bool recordRemoved = stateNode->getBoolAttribute("recordRemoved", recordRemovedButton.getToggleState());
+        recordRemovedButton.setToggleState(recordRemoved, dontSendNotification);
+        static_cast<ICANode*>(getProcessor())->setRecordRemoved(recordRemoved);
+
+        bool autoSelect = stateNode->getBoolAttribute("autoSelect", autoSelectButton.getToggleState());
+        autoSelectButton.setToggleState(autoSelect, dontSendNotification);
+        static_cast<ICANode*>(getProcessor())->setAutoSelect(autoSelect);
+
+        bool trackWhitening = stateNode->getBoolAttribute("trackWhitening", trackButton.getToggleState());
+        trackButton.setToggleState(trackWhitening, dontSendNotification);
+        static_cast<ICANode*>(getProcessor())->setTrackWhitening(trackWhitening);
+
+        bool useHistory = stateNode->getBoolAttribute("useHistory", historyButton.getToggleState());
+        historyButton.setToggleState(useHistory, dontSendNotification);
+        static_cast<ICANode*>(getProcessor())->setUseHistory(useHistory);
+
+        bool fromRecording = stateNode->getBoolAttribute("trainFromRecording", diskButton.getToggleState());
+        diskButton.setToggleState(fromRecording, dontSendNotification);
+        static_cast<ICANode*>(getProcessor())->setTrainFromRecording(fromRecording);
+
+        bool useLibrary = stateNode->getBoolAttribute("useLibrary", libraryButton.getToggleState());
+        libraryButton.setToggleState(useLibrary, dontSendNotification);
+        static_cast<ICANode*>(getProcessor())->setUseLibrary(useLibrary);
+
+        bool hierarchical = stateNode->getBoolAttribute("hierarchical", hierButton.getToggleState());
+        hierButton.setToggleState(hierarchical, dontSendNotification);
+        static_cast<ICANode*>(getProcessor())->setHierarchical(hierarchical);
     }
 }
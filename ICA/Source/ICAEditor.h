@@ -47,6 +47,9 @@ namespace ICA
 
         void updateSettings() override;
 
+        void startAcquisition() override;
+        void stopAcquisition() override;
+
         void saveCustomParameters(XmlElement* xml) override;
         void loadCustomParameters(XmlElement* xml) override;
 
@@ -111,6 +114,10 @@ namespace ICA
         // visible while ICA is running
         Label runningIndicator;
 
+        // toggles evaluating several settings on held-out data when running
+        UtilityButton autoSelectButton;
+        static const String autoSelectTooltip;
+
         Label dirSuffixLabel;
         Label dirSuffixTextBox;
         static const String dirSuffixTooltip;
@@ -119,6 +126,34 @@ namespace ICA
         UtilityButton resetButton;
         static const String resetTooltip;
 
+        // toggles saving removed components while recording
+        UtilityButton recordRemovedButton;
+        static const String recordRemovedTooltip;
+
+        // toggles tracking whitening (see WhiteningTracker)
+        UtilityButton trackButton;
+        static const String trackTooltip;
+
+        // toggles mixing in data from the cache's history tier when training
+        UtilityButton historyButton;
+        static const String historyTooltip;
+
+        // toggles training from the record node's files instead of the cache while recording
+        UtilityButton diskButton;
+        static const String diskTooltip;
+
+        // toggles the library of rejected components (see ComponentLibrary)
+        UtilityButton libraryButton;
+        static const String libraryTooltip;
+
+        // toggles the second level of grouped training (see ICANode::performGlobalICA)
+        UtilityButton hierButton;
+        static const String hierTooltip;
+
+        // toggles burst correction (see AsrEngine) - not saved, since it calibrates on the cache
+        UtilityButton asrButton;
+        static const String asrTooltip;
+
         // contains currICAIndicator and clearButton.
         Component currICAArea;
 
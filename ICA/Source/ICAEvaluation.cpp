@@ -0,0 +1,183 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICAEvaluation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+using namespace ICA;
+
+/**** HeldOutEvaluator ****/
+
+HeldOutEvaluator::HeldOutEvaluator(MatrixConstRef dataIn)
+    : data(dataIn)
+{
+    data.colwise() -= data.rowwise().mean();
+}
+
+int HeldOutEvaluator::getNumChannels() const
+{
+    return int(data.rows());
+}
+
+void HeldOutEvaluator::score(CandidateEvaluation& candidate) const
+{
+    if (!candidate.valid || candidate.unmixing.rows() != data.rows())
+    {
+        candidate.valid = false;
+        return;
+    }
+
+    Eigen::PartialPivLU<Eigen::MatrixXd> lu(candidate.unmixing.cast<double>());
+    double logAbsDet = lu.matrixLU().diagonal().array().abs().log().sum();
+    if (!std::isfinite(logAbsDet))
+    {
+        // singular
+        candidate.valid = false;
+        return;
+    }
+
+    Matrix comps = candidate.unmixing * data;
+
+    candidate.logLikelihood = logLikelihood(comps, logAbsDet);
+    candidate.mutualInfo = mutualInfo(comps, logAbsDet);
+}
+
+double HeldOutEvaluator::logLikelihood(MatrixConstRef comps, double logAbsDet) const
+{
+    // log p(u) = -u - 2 log(1 + e^-u), which is symmetric
+    double sum = 0;
+    for (int c = 0; c < comps.cols(); ++c)
+    {
+        for (int r = 0; r < comps.rows(); ++r)
+        {
+            double u = std::abs(comps(r, c));
+            sum += -u - 2 * std::log1p(std::exp(-u));
+        }
+    }
+
+    return logAbsDet + sum / comps.cols();
+}
+
+double HeldOutEvaluator::mutualInfo(MatrixConstRef comps, double logAbsDet) const
+{
+    int nSamps = int(comps.cols());
+    int m = std::max(1, int(std::lround(std::sqrt(double(nSamps)))));
+    if (nSamps <= m)
+    {
+        return 0;
+    }
+
+    double entropySum = 0;
+    std::vector<float> sorted(nSamps);
+    for (int r = 0; r < comps.rows(); ++r)
+    {
+        for (int c = 0; c < nSamps; ++c)
+        {
+            sorted[c] = comps(r, c);
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        // (guard against repeated values)
+        double minSpacing = std::max(double(sorted.back() - sorted.front()), 1e-30) / nSamps * 1e-3;
+
+        double sum = 0;
+        for (int i = 0; i + m < nSamps; ++i)
+        {
+            double spacing = std::max(double(sorted[i + m] - sorted[i]), minSpacing);
+            sum += std::log(double(nSamps + 1) / m * spacing);
+        }
+        entropySum += sum / (nSamps - m);
+    }
+
+    return entropySum - logAbsDet;
+}
+
+
+/**** selection ****/
+
+double ICA::amariDistance(MatrixConstRef unmixing, MatrixConstRef otherMixing)
+{
+    int n = int(unmixing.rows());
+    if (n < 2)
+    {
+        return 0;
+    }
+
+    Eigen::ArrayXXd p = (unmixing.cast<double>() * otherMixing.cast<double>()).array().abs();
+
+    double rowSum = (p.rowwise().sum() / p.rowwise().maxCoeff() - 1).sum();
+    double colSum = (p.colwise().sum() / p.colwise().maxCoeff() - 1).sum();
+
+    return (rowSum + colSum) / (2.0 * n * (n - 1));
+}
+
+int ICA::selectCandidate(std::vector<CandidateEvaluation>& candidates,
+    double tolerance, double minStability, int* bestIndex)
+{
+    int best = -1;
+    for (int i = 0; i < int(candidates.size()); ++i)
+    {
+        if (candidates[i].valid && (best == -1
+            || candidates[i].logLikelihood > candidates[best].logLikelihood))
+        {
+            best = i;
+        }
+    }
+
+    if (bestIndex != nullptr)
+    {
+        *bestIndex = best;
+    }
+
+    if (best == -1)
+    {
+        return -1;
+    }
+
+    const CandidateEvaluation& bestCand = candidates[best];
+    Matrix bestMixing = bestCand.unmixing.inverse();
+    double threshold = bestCand.logLikelihood - tolerance * bestCand.unmixing.rows();
+
+    int chosen = best;
+    for (int i = 0; i < int(candidates.size()); ++i)
+    {
+        CandidateEvaluation& cand = candidates[i];
+        if (!cand.valid)
+        {
+            continue;
+        }
+
+        cand.stability = i == best ? 1.0 : 1.0 - amariDistance(cand.unmixing, bestMixing);
+
+        if (cand.logLikelihood < threshold || cand.stability < minStability)
+        {
+            continue;
+        }
+
+        const CandidateEvaluation& chosenCand = candidates[chosen];
+        if (std::make_tuple(cand.trainFrames, cand.solverCost, cand.runSeconds)
+            < std::make_tuple(chosenCand.trainFrames, chosenCand.solverCost, chosenCand.runSeconds))
+        {
+            chosen = i;
+        }
+    }
+
+    return chosen;
+}
@@ -0,0 +1,83 @@
+#ifndef ICA_EVALUATION_H_DEFINED
+#define ICA_EVALUATION_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Scoring decompositions on data they weren't trained on, to compare training lengths
+// and solver settings (see ICANode::evaluateICA).
+
+#include <vector>
+
+#include "ICAApplyPlan.h"
+
+namespace ICA
+{
+    // One trained decomposition being compared to others on the same held-out data.
+    struct CandidateEvaluation
+    {
+        // cost of the configuration, in order of precedence (lower is cheaper):
+        int trainFrames = 0;    // amount of training data (i.e. time spent collecting it)
+        int solverCost = 0;     // rank of the solver settings
+        double runSeconds = 0;  // measured time to train
+
+        bool valid = false;     // false if training failed
+        Matrix unmixing;        // as output by binica (weights * sphere), without normalization
+
+        // filled in by HeldOutEvaluator::score:
+        double logLikelihood = 0; // Infomax log-likelihood, mean nats per sample (higher is better)
+        double mutualInfo = 0;    // mutual information of the components, up to a constant (lower is better)
+
+        // filled in by selectCandidate: agreement with the best candidate's components,
+        // as 1 - (normalized Amari distance); 1 = same up to scaling and permutation.
+        double stability = 0;
+    };
+
+    class HeldOutEvaluator
+    {
+    public:
+        // data: channels x samples (the mean of each channel is removed)
+        explicit HeldOutEvaluator(MatrixConstRef data);
+
+        // fills in logLikelihood and mutualInfo
+        void score(CandidateEvaluation& candidate) const;
+
+        int getNumChannels() const;
+
+    private:
+        // with the logistic source density binica assumes (when extended is off)
+        double logLikelihood(MatrixConstRef comps, double logAbsDet) const;
+
+        // sum of the components' marginal entropies (m-spacing estimate) - log|det W|.
+        // the joint entropy of the data is the same for all candidates, so it's left out.
+        double mutualInfo(MatrixConstRef comps, double logAbsDet) const;
+
+        Matrix data;
+    };
+
+    // Normalized Amari distance (0 to 1) between an unmixing matrix and the inverse of another
+    // unmixing matrix; 0 iff they are the same up to scaling and permutation of components.
+    double amariDistance(MatrixConstRef unmixing, MatrixConstRef otherMixing);
+
+    // Choose the cheapest candidate whose log-likelihood is within tolerance (nats per sample
+    // per channel) of the best and whose stability is at least minStability.
+    // Also fills in the stability of each valid candidate. Returns -1 if none are valid.
+    int selectCandidate(std::vector<CandidateEvaluation>& candidates,
+        double tolerance, double minStability, int* bestIndex = nullptr);
+}
+
+#endif // ICA_EVALUATION_H_DEFINED
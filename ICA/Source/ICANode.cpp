@@ -18,6 +18,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "ICANode.h"
 #include "ICAEditor.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <utility>
 
@@ -28,20 +30,72 @@ using namespace ICA;
 // static members
 const float ICANode::icaTargetFs    (500.0f);
 
-const String ICANode::chanHintPrefix("!chans: ");
+const float ICANode::previewLengthSec(2.0f);
 
 const String ICANode::inputFilename("input.floatdata");
 const String ICANode::configFilename("binica.sc");
 const String ICANode::weightFilename("output.wts");
 const String ICANode::sphereFilename("output.sph");
-const String ICANode::mixingFilename("output.mix");
-const String ICANode::unmixingFilename("output.unmix");
+const String ICANode::mixingFilename(mixingMatrixFilename);
+const String ICANode::unmixingFilename(unmixingMatrixFilename);
+
+const String ICANode::evalDirname("eval");
+const String ICANode::evalResultsFilename("evaluation.tsv");
+
+const ICANode::SolverPreset ICANode::solverPresets[] =
+{
+    { "fast",     "maxsteps 128\nannealstep 0.9\n" },
+    { "default",  "maxsteps 512\nannealstep 0.98\n" },
+    { "extended", "maxsteps 512\nannealstep 0.98\nextended 1\n" }
+};
+const int ICANode::numSolverPresets    (sizeof(solverPresets) / sizeof(solverPresets[0]));
+const int ICANode::defaultSolverPreset (1);
+
+const float ICANode::evalTrainFractions[] = { 0.25f, 0.5f, 1.0f };
+const int ICANode::numEvalTrainFractions  (sizeof(evalTrainFractions) / sizeof(evalTrainFractions[0]));
+const float ICANode::heldOutFraction      (0.2f);
+const double ICANode::evalTolerance       (0.01);
+const double ICANode::evalMinStability    (0.8);
+
+const String ICANode::channelStatsFilename  ("channel_stats.tsv");
+const String ICANode::componentStatsFilename("component_stats.tsv");
+const float ICANode::lineFreqs[] = { 50.0f, 60.0f };
+const int ICANode::numLineFreqs  (sizeof(lineFreqs) / sizeof(lineFreqs[0]));
+
+const float ICANode::libraryMinSimilarity      (0.9f);
+const float ICANode::libraryMaxSpectralDistance(0.2f);
+const int ICANode::libraryUpdateDelayMs        (2000);
+
+const int ICANode::maxGroupChannels   (64);
+const String ICANode::groupDirname    ("groups");
+const String ICANode::groupsFilename  ("groups.tsv");
+const int ICANode::maxGlobalComponents(64);
+const String ICANode::globalName      ("global");
+const String ICANode::libraryDirname  ("ica_library");
+
+const int ICANode::gainEstimateSamples(4096);
+
+const float ICANode::historyEpochSec  (2.0f);
+const int ICANode::historyKeepEvery   (8);
+const float ICANode::historySec       (60.0f);
+const float ICANode::historyFraction  (0.25f);
+
+const String ICANode::recordingStructureFilename("structure.oebin");
+const String ICANode::recordingDataFilename     ("continuous.dat");
+const int ICANode::recordingStartSlackMs        (5000);
 
 ICANode::ICANode()
     : GenericProcessor  ("ICA")
     , Thread            ("ICA Computation")
     , icaSamples        (int(icaTargetFs * 240))
-    , componentBuffer   (16, 1024)
+    , recordRemoved     (false)
+    , autoSelect        (false)
+    , trackWhitening    (false)
+    , asrEnabled        (false)
+    , useHistory        (false)
+    , trainFromRecording(false)
+    , useLibrary        (false)
+    , hierarchical      (false)
     , currSubProc       (0)
     , icaRunning        (var(false))
 {
@@ -54,6 +108,9 @@ ICANode::~ICANode()
     {
         stopThread(500);
     }
+
+    stopTimer();
+    saveLibraryUpdates();
 }
 
 AudioProcessorEditor* ICANode::createEditor()
@@ -78,7 +135,12 @@ void ICANode::resetICA(uint32 subProc, bool block)
     auto dataEntry = subProcData.find(subProc);
     if (dataEntry != subProcData.end())
     {
-        SubProcData& data = dataEntry->second;
+        SubProcData& data = *dataEntry->second;
+
+        // (destroyed after the lock is released)
+        ScopedPointer<PreviewEngine> oldPreview;
+        ScopedPointer<ICAOperation> oldCandidate;
+        ScopedPointer<WhiteningTracker> oldTracker;
 
         ScopedPointer<ScopedWriteLock> blockingLock;
         ScopedPointer<ScopedWriteTryLock> tryLock;
@@ -100,7 +162,11 @@ void ICANode::resetICA(uint32 subProc, bool block)
         }
 
         data.icaOp = new ICAOperation();
+        data.plan = nullptr;
         data.icaConfigPath = "";
+        oldPreview.swapWith(data.preview);
+        oldCandidate.swapWith(data.candidateOp);
+        oldTracker.swapWith(data.tracker);
     }
 }
 
@@ -114,8 +180,9 @@ void ICANode::resetCache(uint32 subProc)
     auto dataEntry = subProcData.find(subProc);
     if (dataEntry != subProcData.end())
     {
-        AudioBufferFifo::LockHandle bufHandle(*dataEntry->second.dataCache);
+        AudioBufferFifo::LockHandle bufHandle(*dataEntry->second->dataCache);
         bufHandle.reset();
+        dataEntry->second->recordedSamples = 0;
     }
 }
 
@@ -124,112 +191,112 @@ bool ICANode::disable()
     // clear data caches
     for (auto& subProcEntry : subProcData)
     {
-        AudioBufferFifo& dataCache = *subProcEntry.second.dataCache;
+        AudioBufferFifo& dataCache = *subProcEntry.second->dataCache;
         AudioBufferFifo::LockHandle hCache(dataCache);
         hCache.reset();
     }
 
+    // report any blocks where bad channels had to be left out (see ApplyPlan)
+    String guardReport(applyScratch.takeGuardReport());
+    if (guardReport.isNotEmpty())
+    {
+        std::cerr << guardReport << std::endl;
+        CoreServices::sendStatusMessage(guardReport);
+    }
+
     return true;
 }
 
 void ICANode::process(AudioSampleBuffer& buffer)
 {
-    // should only do anything on the first buffer, since "buffer" 
-    // should always be the same length during acquisition
-    componentBuffer.setSize(componentBuffer.getNumChannels(), buffer.getNumSamples(), false, false, true);
+    float* const* bufferData = buffer.getArrayOfWritePointers();
 
     // process each subprocessor individually
     for (auto& subProcEntry : subProcData)
     {
-        SubProcData& data = subProcEntry.second;
+        SubProcData& data = *subProcEntry.second;
 
         jassert(data.channelInds.size() > 0);
         int nSamps = getNumSamples(data.channelInds[0]);
 
-        // add data to cache, if possible
+        // add data to cache, if possible. the samples of the channels the plan reads are taken
+        // from its tiles as it goes (see DecimatingCapture), unless the input is changed first.
         AudioBufferFifo::TryLockHandle hCache(*data.dataCache);
+        bool onDisk = cacheOnDisk.get() != 0;
+        DecimatingCapture* capture = hCache.isLocked() && !onDisk ? data.capture.get() : nullptr;
 
-        if (hCache.isLocked())
+        if (onDisk && hCache.isLocked())
         {
-            int s;
-            for (s = data.dsOffset; s < nSamps; s += data.dsStride)
-            {
-                hCache.copySample(buffer, data.channelInds, s);
-            }
-
-            data.dsOffset = s - nSamps;
+            // (the data is read back from the recording instead)
+            data.recordedSamples += nSamps;
+            hCache.setExternalProgress(data.recordedSamples / data.dsStride, icaSamples);
         }
 
-        // do ICA!
-        const ScopedReadTryLock icaOpLock(data.icaMutex);
-        if (!icaOpLock.isLocked() || data.icaOp->isNoop())
+        if (capture)
         {
-            continue;
+            capture->beginBlock(hCache, bufferData, nSamps);
         }
 
-        const ICAOperation& op = *data.icaOp;
-        
-        const SortedSet<int>& icaChansRel = op.enabledChannels;
-        int nChans = icaChansRel.size(); // also number of total components
+        // do ICA!
+        // (the recorder only changes when not acquiring, so it can be used even if the lock fails)
+        const ScopedReadTryLock icaOpLock(data.icaMutex);
+        const ApplyPlan* plan = icaOpLock.isLocked() ? data.plan.get() : nullptr;
+        ComponentRecorder* recorder = data.recorder;
 
-        // whether to start from 0 and add components or start from all and subtract them
-        bool additive = op.rejectedComponents.size() > nChans / 2;
-        
-        SortedSet<int> comps;
-        if (additive)
+        // remove bursts first (the engine sees the uncorrected input, like the cache)
+        if (icaOpLock.isLocked() && data.asr)
         {
-            for (int i = 0; i < nChans; ++i)
+            if (capture)
             {
-                comps.add(i);
+                capture->finishBlock();
             }
 
-            comps.removeValuesIn(op.rejectedComponents);
+            data.asr->pushInput(bufferData, nSamps);
+
+            int fadeLength = jmax(int(AsrEngine::stepSec * data.Fs), 1);
+            if (data.asrFadePos < fadeLength)
+            {
+                ApplyPlan::crossfade(data.asrPrevPlan, data.asrPlan, bufferData, nSamps,
+                    applyScratch, data.asrFadePos, fadeLength);
+                data.asrFadePos = jmin(data.asrFadePos + nSamps, fadeLength);
+            }
+            else if (data.asrPlan)
+            {
+                data.asrPlan->apply(bufferData, nSamps, applyScratch);
+            }
         }
-        else
+
+        if (recorder)
         {
-            comps = op.rejectedComponents;
+            recorder->beginBlock(plan, nSamps, getTimestamp(data.channelInds[0]));
         }
 
-        int nComps = comps.size();
-
-        for (int comp : comps)
+        if (plan == nullptr)
         {
-            componentBuffer.clear(comp, 0, nSamps);
-
-            // unmix into the components
-            for (int kChan = 0; kChan < nChans; ++kChan)
+            if (capture)
             {
-                int chan = data.channelInds[icaChansRel[kChan]];
-
-                componentBuffer.addFrom(comp, 0, buffer, chan, 0, nSamps, op.unmixing(comp, kChan));
+                capture->finishBlock();
             }
+            continue;
         }
 
-        if (additive)
+        if (data.preview)
         {
-            // clear channels before adding components we want to keep
-            for (int kChan = 0; kChan < nChans; ++kChan)
-            {
-                buffer.clear(data.channelInds[icaChansRel[kChan]], 0, nSamps);
-            }
+            data.preview->pushInput(bufferData, nSamps);
         }
 
-        for (int comp : comps)
+        if (data.tracker)
         {
-            // remix back into channels
-            for (int kChan = 0; kChan < nChans; ++kChan)
-            {
-                int chan = data.channelInds[icaChansRel[kChan]];
+            data.tracker->pushInput(bufferData, nSamps);
+        }
 
-                if (additive)
-                {
-                    buffer.addFrom(chan, 0, componentBuffer, comp, 0, nSamps, op.mixing(kChan, comp));
-                }
-                else
-                {
-                    buffer.addFrom(chan, 0, componentBuffer, comp, 0, nSamps, -op.mixing(kChan, comp));
-                }
-            }
+        plan->apply(bufferData, nSamps, applyScratch,
+            recorder && recorder->isCapturing() ? recorder : nullptr, nullptr, capture);
+
+        // (e.g. channels the plan doesn't read, or all of them if it is the identity)
+        if (capture)
+        {
+            capture->finishBlock();
         }
     }
 }
@@ -239,6 +306,16 @@ void ICANode::updateSettings()
 {
     jassert(!CoreServices::getAcquisitionStatus()); // just to be sure...
 
+    // (trackers are rebuilt below. ASR is turned off, since the cache it calibrates from is reset.)
+    for (auto& dataEntry : subProcData)
+    {
+        dataEntry.second->tracker = nullptr;
+        dataEntry.second->asr = nullptr;
+        dataEntry.second->asrPlan = nullptr;
+        dataEntry.second->asrPrevPlan = nullptr;
+    }
+    asrEnabled = false;
+
     int nChans = getNumInputs();
 
     // refresh subprocessor data
@@ -246,7 +323,7 @@ void ICANode::updateSettings()
     //subProcData.clear();
     subProcInfo.clear();
 
-    std::map<uint32, SubProcData> newSubProcData;
+    SubProcTable<SubProcData>::Map newSubProcData;
 
     for (int c = 0; c < nChans; ++c)
     {
@@ -267,7 +344,7 @@ void ICANode::updateSettings()
         auto newDataEntry = newSubProcData.find(sourceFullId);
         if (newDataEntry != newSubProcData.end()) // found in new map
         {
-            newDataEntry->second.channelInds.add(c);
+            newDataEntry->second->channelInds.add(c);
             subProcInfo[sourceFullId].channelNames.add(chan->getName());
         }
         else // not found in new map
@@ -280,11 +357,12 @@ void ICANode::updateSettings()
             newInfo.sourceName = chan->getSourceName();
             newInfo.channelNames.add(chan->getName());
 
-            SubProcData& newData = newSubProcData[sourceFullId];
+            newSubProcData[sourceFullId] = std::make_shared<SubProcData>();
+            SubProcData& newData = *newSubProcData[sourceFullId];
 
             newData.Fs = chan->getSampleRate();
             newData.dsStride = jmax(int(newData.Fs / icaTargetFs), 1);
-            newData.dsOffset = 0;
+            newData.recordedSamples = 0;
             newData.channelInds.add(c);
             newData.icaOp = new ICAOperation(); // null operation by default
             newData.icaConfigPath = "";
@@ -293,19 +371,21 @@ void ICANode::updateSettings()
             auto oldDataEntry = subProcData.find(sourceFullId);
             if (oldDataEntry != subProcData.end()) // found in old map
             {
-                // copy data from old map, to reuse cahce and 
-                // potentially keep using existing icaOperation
-                SubProcData& oldData = oldDataEntry->second;
+                // share the cache and copy the operation from the old entry, to reuse the data
+                // and potentially keep using the operation. (an ICA run may still be using the
+                // old entry, so it is left as it was.)
+                // (the plan gets rebuilt below, since the channel indices may have changed)
+                SubProcData& oldData = *oldDataEntry->second;
                 newData.dataCache = oldData.dataCache;
 
-                // the ICA op really shouldn't be being used now, but just in case...
-                const ScopedWriteLock icaWriteLock(oldData.icaMutex);
-                newData.icaOp.swapWith(oldData.icaOp);
+                const ScopedReadLock icaReadLock(oldData.icaMutex);
+                newData.icaOp = new ICAOperation(*oldData.icaOp);
                 newData.icaConfigPath.referTo(oldData.icaConfigPath);
             }
             else
             {
-                newData.dataCache = new AudioBufferFifo(1, icaSamples);
+                newData.dataCache = std::make_shared<AudioBufferFifo>(1, icaSamples,
+                    int(historySec / historyEpochSec), int(historyEpochSec * icaTargetFs), historyKeepEvery);
             }
         }
     }
@@ -316,13 +396,17 @@ void ICANode::updateSettings()
     for (auto& dataEntry : newSubProcData)
     {
         uint32 subProc = dataEntry.first;
-        SubProcData& data = dataEntry.second;
+        SubProcData& data = *dataEntry.second;
+        data.info = subProcInfo[subProc];
         int nChans = data.channelInds.size();
         maxSubProcChans = jmax(maxSubProcChans, nChans);
 
         AudioBufferFifo::LockHandle dataHandle(*data.dataCache);
         dataHandle.resetWithSize(nChans, icaSamples);
 
+        std::vector<int> cacheChans(data.channelInds.begin(), data.channelInds.end());
+        data.capture = new DecimatingCapture(cacheChans, data.dsStride);
+
         // if there is an existing icaOp, see whether it can be reused
         // (requires that the enabled channels are in the range of channels in this subproc)
 
@@ -332,10 +416,28 @@ void ICANode::updateSettings()
             data.icaOp = new ICAOperation();
             data.icaConfigPath = "";
         }
+
+        data.plan = data.icaOp->createPlan(data.channelInds);
+
+        if (trackWhitening)
+        {
+            data.tracker = createTracker(data, *data.icaOp);
+        }
+
+        if (recordRemoved)
+        {
+            data.recorder = new ComponentRecorder(data.info, data.Fs, nChans);
+            if (data.plan)
+            {
+                data.recorder->registerOperator(*data.plan, *data.icaOp);
+            }
+        }
     }
 
-    subProcData.swap(newSubProcData);
-    
+    // (the old entries are destroyed at the end of this function, or when an ICA run that is
+    // still using one is done with it)
+    SubProcTable<SubProcData>::Map oldSubProcData = subProcData.replace(std::move(newSubProcData));
+
     currSubProc = newSubProc;
 
     if (currSubProc == 0)
@@ -345,13 +447,76 @@ void ICANode::updateSettings()
     }
     else
     {
-        SubProcData& data = subProcData[currSubProc];
+        SubProcData& data = *subProcData.find(currSubProc)->second;
         currICAConfigPath.referTo(data.icaConfigPath);
         currPctFull.referTo(data.dataCache->getPctFull());
     }
 
     // ensure space for maximum # of components
-    componentBuffer.setSize(maxSubProcChans, componentBuffer.getNumSamples());
+    applyScratch.ensureSize(maxSubProcChans);
+}
+
+
+void ICANode::startRecording()
+{
+    if (trainFromRecording)
+    {
+        // which recordings are usable: this one (not an older one), made by a processor before
+        // this one (the chain is fixed during acquisition)
+        recordingStartTime = Time::getCurrentTime() - RelativeTime::milliseconds(recordingStartSlackMs);
+        upstreamNodeIDs.clear();
+        for (GenericProcessor* node = getSourceNode(); node != nullptr; node = node->getSourceNode())
+        {
+            upstreamNodeIDs.add(node->getNodeId());
+        }
+
+        // free the caches (including their history tiers) while the same data is going to disk
+        for (auto& subProcEntry : subProcData)
+        {
+            SubProcData& data = *subProcEntry.second;
+            AudioBufferFifo::LockHandle hCache(*data.dataCache);
+            hCache.resetWithSize(data.channelInds.size(), 0);
+            data.recordedSamples = 0;
+        }
+        cacheOnDisk = 1; // (after the resize, so the progress isn't set on a full cache)
+    }
+
+    File removedDir = getRemovedComponentsDir();
+
+    for (auto& subProcEntry : subProcData)
+    {
+        SubProcData& data = *subProcEntry.second;
+        if (data.recorder)
+        {
+            const SubProcInfo& info = subProcInfo[subProcEntry.first];
+            data.recorder->startRecording(removedDir.getChildFile(
+                String(info.sourceID) + "_" + String(info.subProcIdx)));
+        }
+    }
+}
+
+void ICANode::stopRecording()
+{
+    if (cacheOnDisk.get() != 0)
+    {
+        // start collecting in memory again
+        cacheOnDisk = 0;
+        for (auto& subProcEntry : subProcData)
+        {
+            SubProcData& data = *subProcEntry.second;
+            AudioBufferFifo::LockHandle hCache(*data.dataCache);
+            hCache.resetWithSize(data.channelInds.size(), icaSamples);
+        }
+    }
+
+    for (auto& subProcEntry : subProcData)
+    {
+        SubProcData& data = *subProcEntry.second;
+        if (data.recorder)
+        {
+            data.recorder->stopRecording();
+        }
+    }
 }
 
 
@@ -360,7 +525,7 @@ void ICANode::saveCustomParametersToXml(XmlElement* parentElement)
     for (const auto& subProcEntry : subProcData)
     {
         uint32 subProc = subProcEntry.first;
-        const SubProcData& data = subProcEntry.second;
+        const SubProcData& data = *subProcEntry.second;
 
         const ScopedReadLock icaLock(data.icaMutex);
         if (data.icaOp && !data.icaOp->isNoop())
@@ -374,10 +539,10 @@ void ICANode::saveCustomParametersToXml(XmlElement* parentElement)
 
             // add base64-encoded matrices
             XmlElement* mixingNode = opNode->createNewChildElement("MIXING");
-            saveMatrixToXml(mixingNode, data.icaOp->mixing);
+            saveMatrixToXml(mixingNode, data.icaOp->getMixing());
 
             XmlElement* unmixingNode = opNode->createNewChildElement("UNMIXING");
-            saveMatrixToXml(unmixingNode, data.icaOp->unmixing);
+            saveMatrixToXml(unmixingNode, data.icaOp->getUnmixing());
         }
     }
 }
@@ -432,17 +597,18 @@ void ICANode::loadCustomParametersFromXml()
                     int size = loadedInfo.op->enabledChannels.size();
 
                     loadedInfo.nChannels = size;
-                    loadedInfo.op->mixing.resize(size, size);
-                    loadedInfo.op->unmixing.resize(size, size);
+                    Matrix mixing(size, size);
+                    Matrix unmixing(size, size);
 
-                    res = readMatrixFromXml(mixingNode, loadedInfo.op->mixing);
+                    res = readMatrixFromXml(mixingNode, mixing);
                     if (res.wasOk())
                     {
-                        res = readMatrixFromXml(unmixingNode, loadedInfo.op->unmixing);
+                        res = readMatrixFromXml(unmixingNode, unmixing);
                     }
 
                     if (res.wasOk())
                     {
+                        loadedInfo.op->setMatrices(std::move(mixing), std::move(unmixing));
                         res = setNewICAOp(loadedInfo);
                     }
 
@@ -473,10 +639,15 @@ void ICANode::setTrainDurationSec(float dur)
     jassert(dur > 0);
     icaSamples = int(dur * icaTargetFs);
 
-    // actually resize data caches
+    // actually resize data caches (unless they are on disk for now)
+    if (cacheOnDisk.get() != 0)
+    {
+        return;
+    }
+
     for (auto& subProcEntry : subProcData)
     {
-        SubProcData& data = subProcEntry.second;
+        SubProcData& data = *subProcEntry.second;
         AudioBufferFifo::LockHandle hCache(*data.dataCache);
         hCache.resizeKeepingData(icaSamples);
     }
@@ -493,6 +664,183 @@ void ICANode::setDirSuffix(const String& suffix)
     icaDirSuffix = suffix.isEmpty() ? String() : "_" + suffix;
 }
 
+bool ICANode::getRecordRemoved() const
+{
+    return recordRemoved;
+}
+
+void ICANode::setRecordRemoved(bool record)
+{
+    if (record == recordRemoved || CoreServices::getAcquisitionStatus())
+    {
+        return;
+    }
+
+    recordRemoved = record;
+
+    for (auto& subProcEntry : subProcData)
+    {
+        SubProcData& data = *subProcEntry.second;
+
+        ScopedPointer<ComponentRecorder> recorder;
+        if (record)
+        {
+            recorder = new ComponentRecorder(subProcInfo[subProcEntry.first],
+                data.Fs, data.channelInds.size());
+        }
+
+        // (the old recorder, if any, is destroyed outside of the lock)
+        const ScopedWriteLock icaLock(data.icaMutex);
+        if (recorder && data.plan)
+        {
+            recorder->registerOperator(*data.plan, *data.icaOp);
+        }
+        data.recorder.swapWith(recorder);
+    }
+}
+
+bool ICANode::getAutoSelect() const
+{
+    return autoSelect;
+}
+
+void ICANode::setAutoSelect(bool autoSel)
+{
+    autoSelect = autoSel;
+}
+
+bool ICANode::getTrackWhitening() const
+{
+    return trackWhitening;
+}
+
+void ICANode::setTrackWhitening(bool track)
+{
+    if (track == trackWhitening)
+    {
+        return;
+    }
+
+    trackWhitening = track;
+
+    for (auto& subProcEntry : subProcData)
+    {
+        SubProcData& data = *subProcEntry.second;
+
+        ScopedPointer<WhiteningTracker> tracker;
+        const ICAOperation* trackedOp = nullptr;
+
+        if (track)
+        {
+            const ScopedReadLock icaLock(data.icaMutex);
+            trackedOp = data.icaOp;
+            tracker = createTracker(data, *trackedOp);
+        }
+
+        // (the old tracker, if any, is destroyed outside of the lock)
+        const ScopedWriteLock icaLock(data.icaMutex);
+        if (data.icaOp != trackedOp && track)
+        {
+            // operation was replaced in the meantime, and got its own tracker
+            continue;
+        }
+        data.tracker.swapWith(tracker);
+    }
+}
+
+bool ICANode::getAsrEnabled() const
+{
+    return asrEnabled;
+}
+
+Result ICANode::setAsrEnabled(bool enable)
+{
+    if (enable == asrEnabled)
+    {
+        return Result::ok();
+    }
+
+    // calibrate everything first, so that either all subprocessors or none are corrected
+    std::map<uint32, ScopedPointer<AsrEngine>> newEngines;
+    if (enable)
+    {
+        for (auto& subProcEntry : subProcData)
+        {
+            Result res = createAsr(*subProcEntry.second, newEngines[subProcEntry.first]);
+            if (res.failed())
+            {
+                return res;
+            }
+        }
+    }
+
+    asrEnabled = enable;
+
+    for (auto& subProcEntry : subProcData)
+    {
+        SubProcData& data = *subProcEntry.second;
+
+        // (destroyed outside of the lock)
+        ScopedPointer<AsrEngine> oldAsr;
+        ScopedPointer<ApplyPlan> oldPlan;
+        ScopedPointer<ApplyPlan> oldPrevPlan;
+
+        const ScopedWriteLock icaLock(data.icaMutex);
+        oldAsr.swapWith(data.asr);
+        oldPlan.swapWith(data.asrPlan);
+        oldPrevPlan.swapWith(data.asrPrevPlan);
+        data.asr.swapWith(newEngines[subProcEntry.first]);
+    }
+
+    return Result::ok();
+}
+
+bool ICANode::getUseHistory() const
+{
+    return useHistory;
+}
+
+void ICANode::setUseHistory(bool use)
+{
+    useHistory = use;
+}
+
+bool ICANode::getTrainFromRecording() const
+{
+    return trainFromRecording;
+}
+
+void ICANode::setTrainFromRecording(bool fromRecording)
+{
+    // (startRecording and stopRecording decide where the data goes, so it can't change under them)
+    if (CoreServices::getAcquisitionStatus())
+    {
+        return;
+    }
+
+    trainFromRecording = fromRecording;
+}
+
+bool ICANode::getUseLibrary() const
+{
+    return useLibrary;
+}
+
+void ICANode::setUseLibrary(bool use)
+{
+    useLibrary = use;
+}
+
+bool ICANode::getHierarchical() const
+{
+    return hierarchical;
+}
+
+void ICANode::setHierarchical(bool hier)
+{
+    hierarchical = hier;
+}
+
 const std::map<uint32, SubProcInfo>& ICANode::getSubProcInfo() const
 {
     return subProcInfo;
@@ -505,6 +853,12 @@ uint32 ICANode::getCurrSubProc() const
 
 void ICANode::setCurrSubProc(uint32 fullId)
 {
+    if (fullId != currSubProc)
+    {
+        // only the current subprocessor can be previewed
+        stopPreview();
+    }
+
     if (fullId == 0)
     {
         currSubProc = fullId;
@@ -519,8 +873,8 @@ void ICANode::setCurrSubProc(uint32 fullId)
             return;
         }
         currSubProc = fullId;
-        currICAConfigPath.referTo(newSubProcData->second.icaConfigPath);
-        currPctFull.referTo(newSubProcData->second.dataCache->getPctFull());
+        currICAConfigPath.referTo(newSubProcData->second->icaConfigPath);
+        currPctFull.referTo(newSubProcData->second->dataCache->getPctFull());
     }
 }
 
@@ -572,8 +926,10 @@ const ICAOperation* ICANode::readICAOperation(ScopedPointer<ScopedReadLock>& loc
         return nullptr;
     }
 
-    lock = new ScopedReadLock(subProcEntry->second.icaMutex);
-    const ICAOperation* op = subProcEntry->second.icaOp;
+    const SubProcData& data = *subProcEntry->second;
+
+    lock = new ScopedReadLock(data.icaMutex);
+    const ICAOperation* op = data.candidateOp ? data.candidateOp.get() : data.icaOp.get();
     if (op->isNoop())
     {
         lock = nullptr;
@@ -583,39 +939,347 @@ const ICAOperation* ICANode::readICAOperation(ScopedPointer<ScopedReadLock>& loc
     return op;
 }
 
-ICAOperation* ICANode::writeICAOperation(ScopedPointer<ScopedWriteLock>& lock) const
+void ICANode::setComponentSelected(int comp, bool selected)
 {
     auto subProcEntry = subProcData.find(currSubProc);
     if (subProcEntry == subProcData.end())
     {
-        return nullptr;
+        return;
     }
 
-    lock = new ScopedWriteLock(subProcEntry->second.icaMutex);
-    ICAOperation* op = subProcEntry->second.icaOp;
-    if (op->isNoop())
+    SubProcData& data = *subProcEntry->second;
+
+    // build the new plan before taking the write lock, to block processing for as little time as possible.
+    // (if the whitening tracker replaces the matrices in the meantime, the plan is built again from the
+    // new ones; if a new operation replaces this one, the component index no longer refers to the same
+    // component, so nothing is changed)
+    const ICAOperation* selectedOp = nullptr;
+    while (true)
     {
-        lock = nullptr;
-        return nullptr;
+        ScopedPointer<ApplyPlan> newPlan;
+        OperatorMatricesPtr plannedMatrices;
+        {
+            const ScopedReadLock icaLock(data.icaMutex);
+            const ICAOperation* op = data.candidateOp ? data.candidateOp.get() : data.icaOp.get();
+            if (op->isNoop() || comp < 0 || comp >= op->enabledChannels.size())
+            {
+                return; // out of range
+            }
+
+            ICAOperation newOp(*op);
+            if (data.preview)
+            {
+                newOp.rejectedComponents = data.candidateRejected;
+            }
+
+            if (newOp.rejectedComponents.contains(comp) != selected)
+            {
+                return; // nothing to change
+            }
+
+            if (selected)
+            {
+                newOp.rejectedComponents.removeValue(comp);
+            }
+            else
+            {
+                newOp.rejectedComponents.add(comp);
+            }
+
+            if (data.preview)
+            {
+                // the output doesn't change, just the candidate.
+                // (candidateRejected is only used on the message thread, so the read lock is enough)
+                data.candidateRejected = newOp.rejectedComponents;
+                data.preview->setCandidate(newOp.createLocalPlan(&data.previewChans));
+                return;
+            }
+
+            if (selectedOp && data.icaOp != selectedOp)
+            {
+                return; // replaced in the meantime
+            }
+
+            selectedOp = data.icaOp;
+            plannedMatrices = data.icaOp->matrices;
+            newPlan = newOp.createPlan(data.channelInds);
+
+            if (data.recorder && newPlan)
+            {
+                data.recorder->registerOperator(*newPlan, newOp);
+            }
+        }
+
+        {
+            const ScopedWriteLock icaLock(data.icaMutex);
+            if (data.icaOp != selectedOp)
+            {
+                return; // replaced in the meantime
+            }
+
+            if (data.icaOp->matrices != plannedMatrices)
+            {
+                continue; // tracker updated the matrices in the meantime
+            }
+
+            if (selected)
+            {
+                data.icaOp->rejectedComponents.removeValue(comp);
+            }
+            else
+            {
+                data.icaOp->rejectedComponents.add(comp);
+            }
+
+            data.plan.swapWith(newPlan);
+        }
+
+        break;
     }
 
-    return op;
+    updateLibrary(currSubProc);
 }
 
 
-File ICANode::getICABaseDir()
+Result ICANode::startPreview()
 {
-    if (!CoreServices::getRecordingStatus())
+    auto subProcEntry = subProcData.find(currSubProc);
+    if (subProcEntry == subProcData.end())
     {
-        // see what the next recording dir will be
-        // (in case it has changed or no recording has been done yet)
-        CoreServices::RecordNode::createNewrecordingDir();
+        return Result::fail("No input selected");
     }
 
-    return CoreServices::RecordNode::getRecordingPath().getParentDirectory().getChildFile("ica");
-}
+    SubProcData& data = *subProcEntry->second;
 
-// ICA thread
+    // the engine is set up outside of the write lock
+    ScopedPointer<PreviewEngine> newPreview;
+    SortedSet<int> candidate;
+    const ICAOperation* previewedOp;
+    {
+        const ScopedReadLock icaLock(data.icaMutex);
+        if (data.preview)
+        {
+            return Result::ok(); // already previewing
+        }
+
+        previewedOp = data.icaOp;
+        if (previewedOp->isNoop())
+        {
+            return Result::fail("No ICA operation to preview");
+        }
+
+        newPreview = createPreview(data, previewedOp->enabledChannels,
+            previewedOp->createLocalPlan(), previewedOp->createLocalPlan());
+        candidate = previewedOp->rejectedComponents;
+    }
+
+    const ScopedWriteLock icaLock(data.icaMutex);
+    if (data.icaOp != previewedOp)
+    {
+        // (newPreview can be destroyed under the lock here, this should be very rare)
+        return Result::fail("ICA operation changed, try again");
+    }
+
+    data.candidateRejected.swapWith(candidate);
+    data.previewChans = previewedOp->enabledChannels;
+    data.preview.swapWith(newPreview);
+    return Result::ok();
+}
+
+PreviewEngine* ICANode::createPreview(const SubProcData& data, const SortedSet<int>& chans,
+    ApplyPlan* currentPlan, ApplyPlan* candidatePlan)
+{
+    std::vector<int> inputChans;
+    for (int chan : chans)
+    {
+        inputChans.push_back(data.channelInds[chan]);
+    }
+
+    int historyFrames = jmax(int(previewLengthSec * data.Fs / data.dsStride), 1);
+
+    return new PreviewEngine(data.info, inputChans, data.dsStride,
+        historyFrames, currentPlan, candidatePlan);
+}
+
+void ICANode::stopPreview()
+{
+    auto subProcEntry = subProcData.find(currSubProc);
+    if (subProcEntry == subProcData.end())
+    {
+        return;
+    }
+
+    SubProcData& data = *subProcEntry->second;
+
+    {
+        const ScopedReadLock icaLock(data.icaMutex);
+        if (!data.preview)
+        {
+            return;
+        }
+    }
+
+    // (destroyed after the lock is released)
+    ScopedPointer<PreviewEngine> oldPreview;
+    ScopedPointer<ICAOperation> oldCandidate;
+
+    const ScopedWriteLock icaLock(data.icaMutex);
+    oldPreview.swapWith(data.preview);
+    oldCandidate.swapWith(data.candidateOp);
+}
+
+void ICANode::promotePreview()
+{
+    auto subProcEntry = subProcData.find(currSubProc);
+    if (subProcEntry == subProcData.end())
+    {
+        return;
+    }
+
+    SubProcData& data = *subProcEntry->second;
+
+    // as in setComponentSelected, build the plan before taking the write lock
+    // (and for a new decomposition, everything else setNewICAOp would)
+    ScopedPointer<ApplyPlan> newPlan;
+    SortedSet<int> newRejected;
+    ScopedPointer<ICAOperation> newOp;
+    ScopedPointer<WhiteningTracker> tracker;
+    String newConfigPath;
+    const ICAOperation* promotedCandidate;
+    const ICAOperation* previewedOp;
+    OperatorMatricesPtr previewedMatrices;
+    {
+        const ScopedReadLock icaLock(data.icaMutex);
+        if (!data.preview)
+        {
+            return;
+        }
+
+        promotedCandidate = data.candidateOp;
+        previewedOp = data.icaOp;
+        previewedMatrices = data.icaOp->matrices;
+        newOp = new ICAOperation(promotedCandidate ? *promotedCandidate : *data.icaOp);
+        newOp->rejectedComponents = data.candidateRejected;
+        newPlan = newOp->createPlan(data.channelInds);
+
+        if (data.recorder && newPlan)
+        {
+            data.recorder->registerOperator(*newPlan, *newOp);
+        }
+
+        if (promotedCandidate && trackWhitening)
+        {
+            tracker = createTracker(data, *newOp);
+        }
+
+        newRejected = data.candidateRejected;
+        newConfigPath = data.candidateConfigPath;
+    }
+
+    // (destroyed after the lock is released)
+    ScopedPointer<PreviewEngine> oldPreview;
+    ScopedPointer<ICAOperation> oldCandidate;
+
+    {
+        const ScopedWriteLock icaLock(data.icaMutex);
+        if (!data.preview || data.candidateOp != promotedCandidate || data.icaOp != previewedOp
+            || data.icaOp->matrices != previewedMatrices)
+        {
+            return; // operation, its matrices or candidate were replaced in the meantime
+        }
+
+        if (promotedCandidate)
+        {
+            data.icaOp.swapWith(newOp);
+            data.tracker.swapWith(tracker);
+            data.icaConfigPath = newConfigPath;
+        }
+        else
+        {
+            data.icaOp->rejectedComponents.swapWith(newRejected);
+        }
+
+        data.plan.swapWith(newPlan);
+        oldPreview.swapWith(data.preview);
+        oldCandidate.swapWith(data.candidateOp);
+    }
+
+    updateLibrary(currSubProc);
+}
+
+bool ICANode::isPreviewing() const
+{
+    auto subProcEntry = subProcData.find(currSubProc);
+    if (subProcEntry == subProcData.end())
+    {
+        return false;
+    }
+
+    const ScopedReadLock icaLock(subProcEntry->second->icaMutex);
+    return subProcEntry->second->preview != nullptr;
+}
+
+const SortedSet<int>* ICANode::getPreviewCandidate() const
+{
+    auto subProcEntry = subProcData.find(currSubProc);
+    if (subProcEntry == subProcData.end() || !subProcEntry->second->preview)
+    {
+        return nullptr;
+    }
+
+    return &subProcEntry->second->candidateRejected;
+}
+
+const SortedSet<int>* ICANode::getPreviewChannels() const
+{
+    auto subProcEntry = subProcData.find(currSubProc);
+    if (subProcEntry == subProcData.end() || !subProcEntry->second->preview)
+    {
+        return nullptr;
+    }
+
+    return &subProcEntry->second->previewChans;
+}
+
+int ICANode::getPreviewVersion() const
+{
+    return previewVersion.get();
+}
+
+bool ICANode::getPreviewSnapshot(Matrix& current, Matrix& candidate) const
+{
+    auto subProcEntry = subProcData.find(currSubProc);
+    if (subProcEntry == subProcData.end())
+    {
+        return false;
+    }
+
+    const SubProcData& data = *subProcEntry->second;
+
+    const ScopedReadLock icaLock(data.icaMutex);
+    return data.preview && data.preview->getSnapshot(current, candidate);
+}
+
+
+File ICANode::getICABaseDir()
+{
+    if (!CoreServices::getRecordingStatus())
+    {
+        // see what the next recording dir will be
+        // (in case it has changed or no recording has been done yet)
+        CoreServices::RecordNode::createNewrecordingDir();
+    }
+
+    return CoreServices::RecordNode::getRecordingPath().getParentDirectory().getChildFile("ica");
+}
+
+File ICANode::getRemovedComponentsDir()
+{
+    String time = Time::getCurrentTime().formatted("%Y-%m-%d_%H-%M-%S");
+    return CoreServices::RecordNode::getRecordingPath().getChildFile("ica_removed").getChildFile(time);
+}
+
+// ICA thread
 
 void ICANode::run()
 {
@@ -623,6 +1287,9 @@ void ICANode::run()
 
     ICARunInfo info;
 
+    // (only checked once per run)
+    auto performStep = autoSelect ? &ICANode::evaluateICA : &ICANode::performICA;
+
     // a little precarious since all the subfunctions have to have the exact same signature
     // (aside from their names)
     // could make it more flexible by using std::function, but that's probably worth avoiding.
@@ -630,9 +1297,10 @@ void ICANode::run()
     {
         &ICANode::prepareICA,
         &ICANode::writeCacheData,
-        &ICANode::performICA,
+        performStep,
         &ICANode::processResults,
         &ICANode::setRejectedCompsBasedOnCurrent,
+        &ICANode::applyLibrary,
         &ICANode::setNewICAOp
     })
     {
@@ -666,29 +1334,14 @@ Result ICANode::prepareICA(ICARunInfo& info)
         return Result::fail("No subprocessor selected");
     }
 
-    auto subProcEntry = subProcData.find(info.subProc);
-    if (subProcEntry == subProcData.end())
+    std::shared_ptr<SubProcData> data = subProcData.acquire(info.subProc);
+    if (!data)
     {
         return Result::fail("Subprocessor " + String(info.subProc) + " no longer exists");
     }
 
-    const SubProcData& currSubProcData = subProcEntry->second;
-
     // enabled channels = which channels of current subprocessor are enabled
-    const SortedSet<int>& subProcChans = currSubProcData.channelInds;
-    int nSubProcChans = subProcChans.size();
-
-    GenericEditor* ed = getEditor();
-    for (int c = 0; c < nSubProcChans; ++c)
-    {
-        bool p, r, a;
-        int chan = subProcChans[c];
-        ed->getChannelSelectionState(chan, &p, &r, &a);
-        if (p)
-        {
-            info.op->enabledChannels.add(c);
-        }
-    }
+    info.op->enabledChannels = getSelectedChannels(*data);
 
     if (info.op->enabledChannels.size() < 2)
     {
@@ -734,14 +1387,60 @@ Result ICANode::prepareICA(ICARunInfo& info)
     return Result::ok();
 }
 
+SortedSet<int> ICANode::getSelectedChannels(const SubProcData& data) const
+{
+    SortedSet<int> selected;
+    const SortedSet<int>& subProcChans = data.channelInds;
+    int nSubProcChans = subProcChans.size();
+
+    GenericEditor* ed = getEditor();
+    for (int c = 0; c < nSubProcChans; ++c)
+    {
+        bool p, r, a;
+        int chan = subProcChans[c];
+        ed->getChannelSelectionState(chan, &p, &r, &a);
+        if (p)
+        {
+            selected.add(c);
+        }
+    }
+
+    return selected;
+}
+
 Result ICANode::writeCacheData(ICARunInfo& info)
 {
-    AudioBufferFifo& dataCache = *subProcData[info.subProc].dataCache;
+    // (updateSettings may replace the entry meanwhile; its cache is then reset, so it isn't full)
+    std::shared_ptr<const SubProcData> data = subProcData.acquire(info.subProc);
+    if (!data)
+    {
+        return Result::fail("Subprocessor " + String(info.subProc) + " no longer exists");
+    }
+
+    AudioBufferFifo& dataCache = *data->dataCache;
+    info.sampleRate = data->Fs / data->dsStride;
 
     File icaDir = info.config.getParentDirectory();
     File inputFile = icaDir.getChildFile(inputFilename);
 
-    while (true)
+    // (the covariance is only needed to group channels)
+    StreamStatsOptions statsOptions = getStatsOptions(info.sampleRate);
+    statsOptions.covariance = info.op->enabledChannels.size() > maxGroupChannels;
+    StreamStats stats(info.op->enabledChannels.size(), statsOptions);
+
+    // (while recording with trainFromRecording on, the cache is empty)
+    bool fromRecording = cacheOnDisk.get() != 0;
+    if (fromRecording)
+    {
+        Result diskRes = writeRecordedData(info, *data, inputFile, stats);
+        if (diskRes.failed())
+        {
+            return Result::fail("Failed to read training data from the recording ("
+                + diskRes.getErrorMessage().trimEnd() + ")");
+        }
+    }
+
+    while (!fromRecording)
     {
         if (currentThreadShouldExit()) { return Result::ok(); }
 
@@ -763,11 +1462,15 @@ Result ICANode::writeCacheData(ICARunInfo& info)
         }
 
         // alright, it's really full, we can write it out
-        Result writeRes = hData.writeChannelsToFile(inputFile, info.op->enabledChannels);
+        // (with history, the file is still in chronological order, so the held-out data
+        // for evaluateICA is still the most recent)
+        hData.estimateChannelGains(info.op->enabledChannels, gainEstimateSamples, info.channelGains);
+        Result writeRes = hData.writeChannelsToFile(inputFile, info.op->enabledChannels, &stats,
+            useHistory ? historyFraction : 0.0f, info.channelGains.data());
         if (writeRes.wasOk())
         {
             info.nSamples = dataCache.getNumSamples();
-            return Result::ok();
+            break;
         }
         else
         {
@@ -775,144 +1478,1247 @@ Result ICANode::writeCacheData(ICARunInfo& info)
                 + writeRes.getErrorMessage().trimEnd() + ")");
         }
     }
-}
-
-Result ICANode::performICA(ICARunInfo& info)
-{
-    // Write config file. For now, not configurable, but maybe can be in the future.
-
-    { // scope in which configStream exists
-        FileOutputStream configStream(info.config);
-        if (configStream.failedToOpen())
-        {
-            return Result::fail("Failed to open binica config file");
-        }
 
-        // skips some settings where the default is ok
-        configStream << "# binica config file - for details, see https://sccn.ucsd.edu/wiki/Binica \n";
+    // save statistics of the data and warn about channels that look broken
+    StringArray labels;
+    StringArray badChans;
+    Eigen::VectorXd variance = stats.getVariance();
+    const StringArray& channelNames = data->info.channelNames;
 
-        // hint for loading - write which channels are enabled
-        configStream << chanHintPrefix << intSetToString(info.op->enabledChannels) << '\n';
-
-        configStream << "DataFile " << inputFilename << '\n';
-        configStream << "chans " << info.nChannels << '\n';
-        configStream << "frames " << info.nSamples << '\n';
-        configStream << "WeightsOutFile " << weightFilename << '\n';
-        configStream << "SphereFile " << sphereFilename << '\n';
-        configStream << "maxsteps 512\n";
-        configStream << "posact off\n";
-        configStream << "annealstep 0.98\n";
-        configStream.flush();
+    for (int k = 0; k < info.op->enabledChannels.size(); ++k)
+    {
+        int chan = info.op->enabledChannels[k];
+        labels.add(chan < channelNames.size() ? channelNames[chan] : String(chan + 1));
 
-        Result status = configStream.getStatus();
-        if (status.failed())
+        if (!(variance(k) > 0) || !std::isfinite(variance(k)))
         {
-            return Result::fail("Failed to write to config file ("
-                + status.getErrorMessage().trimEnd() + ")");
+            badChans.add(labels[k]);
         }
     }
 
-    info.weight = info.config.getParentDirectory().getChildFile(weightFilename);
-    info.sphere = info.config.getParentDirectory().getChildFile(sphereFilename);
-    
-    // do it!
-    ICAProcess proc(info.config);
-
-    while (proc.isRunning())
-    {
-        if (currentThreadShouldExit()) { return Result::ok(); }
-        sleep(200);
-    }
-
-    if (proc.failedToRun())
+    Result statsRes = saveStatsTable(icaDir.getChildFile(channelStatsFilename), stats, labels);
+    if (statsRes.failed())
     {
-        return Result::fail("ICA failed to start");
+        std::cerr << "Warning: failed to save channel statistics (" << statsRes.getErrorMessage() << ")" << std::endl;
     }
 
-    int32 exitCode = proc.getExitCode();
-    if (exitCode != 0)
+    if (!badChans.isEmpty())
     {
-        return Result::fail("ICA failed with exit code " + String(exitCode));
+        CoreServices::sendStatusMessage("Warning: flat or non-finite channels in ICA data: "
+            + badChans.joinIntoString(", "));
     }
 
-    return Result::ok();
-}
-
-Result ICANode::processResults(ICARunInfo& info)
-{
-    if (info.op->unmixing.size() == 0) // skip this if we already have an unmixing matrix
+    if (statsOptions.covariance)
     {
-        // load weight and sphere matrices into Eigen Map objects
-        int size = info.nChannels;
-        int sizeSq = size * size;
+        info.covariance = stats.getCovariance();
+        info.groups = groupChannels(info.covariance, maxGroupChannels);
 
-        Matrix weights(size, size);
-        Result res = readMatrix(info.weight, weights);
-        if (res.failed())
+        FileOutputStream groupsStream(icaDir.getChildFile(groupsFilename));
+        if (groupsStream.openedOk())
         {
-            return res;
-        }
-
-        if (currentThreadShouldExit()) { return Result::ok(); }
+            groupsStream.setPosition(0);
+            groupsStream.truncate();
 
-        Matrix sphere(size, size);
-        res = readMatrix(info.sphere, sphere);
-        if (res.failed())
+            groupsStream << "channel\tgroup\n";
+            for (int g = 0; g < int(info.groups.size()); ++g)
+            {
+                for (int k : info.groups[g])
+                {
+                    groupsStream << labels[k] << '\t' << (g + 1) << '\n';
+                }
+            }
+        }
+        else
         {
-            return res;
+            std::cerr << "Warning: failed to save channel groups" << std::endl;
         }
+    }
 
-        if (currentThreadShouldExit()) { return Result::ok(); }
-
-        // now just need to convert this to mixing and unmixing
+    return Result::ok();
+}
 
-        // normalize sphere matrix by largest singular value
-        Eigen::BDCSVD<Matrix> svd(sphere);
-        Matrix normSphere = sphere / svd.singularValues()(0);
+Result ICANode::writeRecordedData(ICARunInfo& info, const SubProcData& data, const File& dest,
+    StreamStats& stats)
+{
+    const SortedSet<int>& channels = info.op->enabledChannels;
+    int numOutChans = channels.size();
 
-        info.op->unmixing = weights * normSphere;
+    File datFile;
+    int nFileChans;
+    Array<int> fileChans;
+    Array<float> bitVolts;
+    Result findRes = findRecordedStream(data.info, channels, recordingStartTime, upstreamNodeIDs,
+        datFile, nFileChans, fileChans, bitVolts);
+    if (findRes.failed())
+    {
+        return findRes;
     }
 
-    info.op->mixing = info.op->unmixing.inverse();
-
-    if (currentThreadShouldExit()) { return Result::ok(); }
-
-    // write final matrices to output files
-    File icaDir = info.config.getParentDirectory();
+    // (the record node is still appending to it, so only map what is there now)
+    MemoryMappedFile mapped(datFile, MemoryMappedFile::readOnly);
+    if (mapped.getData() == nullptr)
+    {
+        return Result::fail("Could not map " + datFile.getFullPathName());
+    }
 
-    Result res = saveMatrix(icaDir.getChildFile(unmixingFilename), info.op->unmixing);
-    if (res.failed())
+    int64 numFrames = int64(mapped.getSize()) / (int64(nFileChans) * sizeof(int16));
+    int64 neededFrames = int64(icaSamples) * data.dsStride;
+    if (numFrames < neededFrames)
     {
-        return res;
+        return Result::fail("Not enough data recorded yet");
     }
 
-    res = saveMatrix(icaDir.getChildFile(mixingFilename), info.op->mixing);
-    if (res.failed())
+    // (this can be large, so write it without going through the OS cache)
+    AsyncFileWriter writer(dest);
+    if (writer.getStatus().failed())
     {
-        return res;
+        return writer.getStatus();
     }
 
-    return Result::ok();
-}
+    // take every dsStride-th frame of the most recent data, as the cache would have
+    const int16* frames = static_cast<const int16*>(mapped.getData());
+    int64 firstFrame = numFrames - neededFrames;
 
-Result ICANode::setRejectedCompsBasedOnCurrent(ICARunInfo& info)
-{
-    auto subProcEntry = subProcData.find(info.subProc);
-    if (subProcEntry == subProcData.end())
+    // (gains as in AudioBufferFifo::Handle::estimateChannelGains)
+    int gainStride = jmax(1, icaSamples / gainEstimateSamples) * data.dsStride;
+    info.channelGains.resize(numOutChans);
+    std::vector<float> samples;
+    for (int k = 0; k < numOutChans; ++k)
     {
-        return Result::fail("Subprocessor " + String(info.subProc) + " does not exist");
+        samples.clear();
+        for (int64 f = firstFrame; f < numFrames; f += gainStride)
+        {
+            samples.push_back(frames[f * nFileChans + fileChans[k]] * bitVolts[k]);
+        }
+        info.channelGains[k] = robustGain(samples);
     }
 
-    SubProcData& thisSubProcData = subProcEntry->second;
+    const int chunkSamps = 4096;
+    HeapBlock<float> chunk(chunkSamps * numOutChans);
 
-    while (true)
+    for (int s = 0; s < icaSamples; s += chunkSamps)
     {
         if (currentThreadShouldExit()) { return Result::ok(); }
 
-        const ScopedReadTryLock icaLock(thisSubProcData.icaMutex);
-        if (!icaLock.isLocked())
+        int nChunk = jmin(chunkSamps, icaSamples - s);
+        for (int i = 0; i < nChunk; ++i)
         {
-            continue;
+            const int16* frame = frames + (firstFrame + int64(s + i) * data.dsStride) * nFileChans;
+            for (int k = 0; k < numOutChans; ++k)
+            {
+                chunk[i * numOutChans + k] = frame[fileChans[k]] * bitVolts[k];
+            }
+        }
+
+        stats.addFrames(chunk, nChunk);
+
+        for (int i = 0; i < nChunk; ++i)
+        {
+            for (int k = 0; k < numOutChans; ++k)
+            {
+                chunk[i * numOutChans + k] *= info.channelGains[k];
+            }
+        }
+
+        // (native byte order, which is little-endian on all supported platforms)
+        if (!writer.write(chunk, nChunk * numOutChans * sizeof(float)))
+        {
+            return writer.finish();
+        }
+    }
+
+    Result writeRes = writer.finish();
+    if (writeRes.wasOk())
+    {
+        info.nSamples = icaSamples;
+    }
+    return writeRes;
+}
+
+Result ICANode::findRecordedStream(const SubProcInfo& info, const SortedSet<int>& channels,
+    Time startTime, const SortedSet<int>& upstreamIDs, File& datFile, int& nFileChans,
+    Array<int>& fileChans, Array<float>& bitVolts)
+{
+    File recordingDir = CoreServices::RecordNode::getRecordingPath();
+
+    // (newest first, in case there are several experiments)
+    Array<File> structureFiles;
+    recordingDir.findChildFiles(structureFiles, File::findFiles, true, recordingStructureFilename);
+    std::sort(structureFiles.begin(), structureFiles.end(), [](const File& a, const File& b)
+    {
+        return a.getLastModificationTime() > b.getLastModificationTime();
+    });
+
+    // name of a processor that records the stream after this one, if one was skipped
+    String downstreamRecorder;
+
+    for (const File& structureFile : structureFiles)
+    {
+        if (structureFile.getLastModificationTime() < startTime)
+        {
+            break; // (this and the rest are from earlier recordings)
+        }
+
+        var structure;
+        if (JSON::parse(structureFile.loadFileAsString(), structure).failed())
+        {
+            continue;
+        }
+
+        const Array<var>* streams = structure["continuous"].getArray();
+        if (streams == nullptr)
+        {
+            continue;
+        }
+
+        for (const var& stream : *streams)
+        {
+            if (int(stream["source_processor_id"]) != info.sourceID ||
+                int(stream["source_processor_sub_idx"]) != info.subProcIdx)
+            {
+                continue;
+            }
+
+            // the recorded data must be this processor's input, not its (cleaned) output
+            var recordedID = stream["recorded_processor_id"];
+            if (recordedID.isVoid() || !upstreamIDs.contains(int(recordedID)))
+            {
+                downstreamRecorder = recordedID.isVoid() ? String("an unknown processor")
+                    : stream["recorded_processor"].toString() + " (" + recordedID.toString() + ")";
+                continue;
+            }
+
+            const Array<var>* fileChanInfo = stream["channels"].getArray();
+            nFileChans = stream["num_channels"];
+            if (fileChanInfo == nullptr || nFileChans <= 0)
+            {
+                return Result::fail("Invalid stream description in " + structureFile.getFullPathName());
+            }
+
+            // map each of our channels to its column in the file
+            fileChans.clearQuick();
+            bitVolts.clearQuick();
+            for (int chan : channels)
+            {
+                int col;
+                for (col = 0; col < fileChanInfo->size(); ++col)
+                {
+                    const var& chanInfo = fileChanInfo->getReference(col);
+                    var sourceIndex = chanInfo["source_processor_index"];
+                    if ((sourceIndex.isVoid() ? col : int(sourceIndex)) == chan)
+                    {
+                        break;
+                    }
+                }
+
+                if (col >= jmin(fileChanInfo->size(), nFileChans))
+                {
+                    return Result::fail("Channel " + info.channelNames[chan] + " is not being recorded");
+                }
+
+                fileChans.add(col);
+                bitVolts.add(float(fileChanInfo->getReference(col)["bit_volts"]));
+            }
+
+            String folder = stream["folder_name"].toString().trimCharactersAtEnd("/");
+            datFile = structureFile.getParentDirectory().getChildFile("continuous")
+                .getChildFile(folder).getChildFile(recordingDataFilename);
+
+            if (!datFile.existsAsFile())
+            {
+                return Result::fail("Recorded data file not found: " + datFile.getFullPathName());
+            }
+
+            return Result::ok();
+        }
+    }
+
+    if (downstreamRecorder.isNotEmpty())
+    {
+        return Result::fail("The recording of " + info.sourceName + " is made by " + downstreamRecorder
+            + ", which is not before the ICA processor; move the Record Node before it to train from disk");
+    }
+
+    return Result::fail("No recording (in binary format) of " + info.sourceName + " found in "
+        + recordingDir.getFullPathName());
+}
+
+Result ICANode::performICA(ICARunInfo& info)
+{
+    if (info.groups.size() > 1)
+    {
+        return performGroupedICA(info);
+    }
+
+    // Write config file. For now, not configurable, but maybe can be in the future.
+    Result res = writeConfig(info.config, info.op->enabledChannels, inputFilename, info.nSamples,
+        weightFilename, sphereFilename, solverPresets[defaultSolverPreset], info.channelGains);
+    if (res.failed())
+    {
+        return res;
+    }
+
+    info.weight = info.config.getParentDirectory().getChildFile(weightFilename);
+    info.sphere = info.config.getParentDirectory().getChildFile(sphereFilename);
+    
+    // do it!
+    return runBinica(info.config);
+}
+
+Result ICANode::evaluateICA(ICARunInfo& info)
+{
+    int nChans = info.nChannels;
+    int nHeldOut = int(info.nSamples * heldOutFraction);
+    int nTrainMax = info.nSamples - nHeldOut;
+
+    // fewer samples than this would be pointless to train on
+    int minTrain = nChans * nChans;
+
+    if (nHeldOut < nChans || nTrainMax < minTrain)
+    {
+        CoreServices::sendStatusMessage("Not enough data to evaluate ICA settings; running with defaults");
+        return performICA(info);
+    }
+
+    if (info.groups.size() > 1)
+    {
+        CoreServices::sendStatusMessage("ICA settings aren't evaluated for channel groups; running with defaults");
+        return performICA(info);
+    }
+
+    File icaDir = info.config.getParentDirectory();
+    File inputFile = icaDir.getChildFile(inputFilename);
+    File evalDir = icaDir.getChildFile(evalDirname);
+
+    Result res = evalDir.createDirectory();
+    if (res.failed())
+    {
+        return Result::fail("Failed to make evaluation directory ("
+            + res.getErrorMessage().trimEnd() + ")");
+    }
+
+    // held-out data is the most recent part of the cache
+    ScopedPointer<HeldOutEvaluator> evaluator;
+    {
+        Matrix heldOut(nChans, nHeldOut);
+        res = readFrames(inputFile, nChans, nTrainMax, nHeldOut, heldOut.data());
+        if (res.failed())
+        {
+            return res;
+        }
+        evaluator = new HeldOutEvaluator(heldOut);
+    }
+
+    // set up a run for each combination, training on the data just before the held-out part
+    struct EvalRun
+    {
+        String name;
+        String trainFile;
+        int preset;
+        File config;
+        ScopedPointer<ICAProcess> proc;
+        double startMs = 0;
+        bool finished = false;
+    };
+
+    OwnedArray<EvalRun> runs;
+    std::vector<CandidateEvaluation> candidates;
+
+    for (int f = 0; f < numEvalTrainFractions; ++f)
+    {
+        int nTrain = roundToInt(nTrainMax * evalTrainFractions[f]);
+        if (nTrain < minTrain)
+        {
+            continue;
+        }
+
+        String trainFile = "train_" + String(nTrain) + ".floatdata";
+        res = copyFrames(inputFile, evalDir.getChildFile(trainFile), nChans, nTrainMax - nTrain, nTrain);
+        if (res.failed())
+        {
+            return res;
+        }
+
+        for (int p = 0; p < numSolverPresets; ++p)
+        {
+            EvalRun* run = runs.add(new EvalRun());
+            run->name = String(solverPresets[p].name) + "_" + String(nTrain);
+            run->trainFile = trainFile;
+            run->preset = p;
+            run->config = evalDir.getChildFile(run->name + ".sc");
+
+            res = writeConfig(run->config, info.op->enabledChannels, trainFile, nTrain,
+                run->name + ".wts", run->name + ".sph", solverPresets[p], info.channelGains);
+            if (res.failed())
+            {
+                return res;
+            }
+
+            candidates.emplace_back();
+            candidates.back().trainFrames = nTrain;
+            candidates.back().solverCost = p;
+        }
+
+        if (currentThreadShouldExit()) { return Result::ok(); }
+    }
+
+    // run them, leaving some cores for acquisition
+    const int maxConcurrent = jmax(1, SystemStats::getNumCpus() / 2);
+    int nStarted = 0;
+    int nFinished = 0;
+    int nRunning = 0;
+
+    while (nFinished < runs.size())
+    {
+        if (currentThreadShouldExit()) { return Result::ok(); }
+
+        for (; nRunning < maxConcurrent && nStarted < runs.size(); ++nStarted, ++nRunning)
+        {
+            EvalRun& run = *runs[nStarted];
+            run.startMs = Time::getMillisecondCounterHiRes();
+            run.proc = new ICAProcess(run.config);
+        }
+
+        for (int r = 0; r < nStarted; ++r)
+        {
+            EvalRun& run = *runs[r];
+            if (run.finished || run.proc->isRunning())
+            {
+                continue;
+            }
+
+            CandidateEvaluation& cand = candidates[r];
+            cand.runSeconds = (Time::getMillisecondCounterHiRes() - run.startMs) / 1000;
+
+            Result runRes = getBinicaResult(*run.proc);
+            if (runRes.wasOk())
+            {
+                Matrix weights(nChans, nChans);
+                Matrix sphere(nChans, nChans);
+                runRes = readMatrix(evalDir.getChildFile(run.name + ".wts"), weights);
+                if (runRes.wasOk())
+                {
+                    runRes = readMatrix(evalDir.getChildFile(run.name + ".sph"), sphere);
+                }
+
+                if (runRes.wasOk())
+                {
+                    cand.unmixing = weights * sphere;
+                    cand.valid = true;
+                    evaluator->score(cand);
+                }
+            }
+
+            if (runRes.failed())
+            {
+                std::cerr << "ICA evaluation run " << run.name << " failed: " << runRes.getErrorMessage() << std::endl;
+            }
+
+            run.proc = nullptr;
+            run.finished = true;
+            ++nFinished;
+            --nRunning;
+        }
+
+        if (nFinished < runs.size())
+        {
+            sleep(200);
+        }
+    }
+
+    int best;
+    int chosen = selectCandidate(candidates, evalTolerance, evalMinStability, &best);
+
+    // save a table of the results
+    {
+        FileOutputStream resultsStream(evalDir.getChildFile(evalResultsFilename));
+        if (resultsStream.openedOk())
+        {
+            resultsStream.setPosition(0);
+            resultsStream.truncate();
+
+            resultsStream << "run\ttrain_sec\tsolver\trun_sec\tlog_likelihood\tmutual_info\tstability\tresult\n";
+            for (int r = 0; r < runs.size(); ++r)
+            {
+                const CandidateEvaluation& cand = candidates[r];
+                String result = !cand.valid ? "failed" : r == chosen ? "chosen" : r == best ? "best" : "";
+
+                resultsStream << runs[r]->name << '\t'
+                    << String(cand.trainFrames / icaTargetFs, 1) << '\t'
+                    << solverPresets[runs[r]->preset].name << '\t'
+                    << String(cand.runSeconds, 1) << '\t'
+                    << String(cand.logLikelihood, 4) << '\t'
+                    << String(cand.mutualInfo, 4) << '\t'
+                    << String(cand.stability, 3) << '\t'
+                    << result << '\n';
+            }
+        }
+        else
+        {
+            std::cerr << "Warning: failed to save ICA evaluation results" << std::endl;
+        }
+    }
+
+    if (chosen == -1)
+    {
+        return Result::fail("All evaluation runs failed");
+    }
+
+    // make the chosen run the output of this one, as if it had been run from here
+    const EvalRun& chosenRun = *runs[chosen];
+    const CandidateEvaluation& chosenCand = candidates[chosen];
+
+    res = writeConfig(info.config, info.op->enabledChannels, evalDirname + "/" + chosenRun.trainFile,
+        chosenCand.trainFrames, weightFilename, sphereFilename, solverPresets[chosenRun.preset],
+        info.channelGains);
+    if (res.failed())
+    {
+        return res;
+    }
+
+    info.weight = icaDir.getChildFile(weightFilename);
+    info.sphere = icaDir.getChildFile(sphereFilename);
+    info.nSamples = chosenCand.trainFrames;
+
+    if (!evalDir.getChildFile(chosenRun.name + ".wts").copyFileTo(info.weight)
+        || !evalDir.getChildFile(chosenRun.name + ".sph").copyFileTo(info.sphere))
+    {
+        return Result::fail("Failed to copy results of evaluation run " + chosenRun.name);
+    }
+
+    CoreServices::sendStatusMessage("ICA: using " + String(solverPresets[chosenRun.preset].name)
+        + " settings; recommended training length " + String(chosenCand.trainFrames / icaTargetFs, 0) + " s");
+
+    return Result::ok();
+}
+
+Result ICANode::performGroupedICA(ICARunInfo& info)
+{
+    int nChans = info.nChannels;
+    int nGroups = int(info.groups.size());
+
+    File icaDir = info.config.getParentDirectory();
+    File groupDir = icaDir.getChildFile(groupDirname);
+
+    Result res = groupDir.createDirectory();
+    if (res.failed())
+    {
+        return Result::fail("Failed to make channel group directory ("
+            + res.getErrorMessage().trimEnd() + ")");
+    }
+
+    StringArray names;
+    Array<File> dataFiles;
+    for (int g = 0; g < nGroups; ++g)
+    {
+        names.add("group_" + String(g + 1));
+        dataFiles.add(groupDir.getChildFile(names[g] + ".floatdata"));
+    }
+
+    res = splitChannels(icaDir.getChildFile(inputFilename), nChans, info.nSamples, info.groups, dataFiles);
+    if (res.failed())
+    {
+        return res;
+    }
+
+    // (a single channel is its own component)
+    Array<int> toRun;
+    for (int g = 0; g < nGroups; ++g)
+    {
+        if (info.groups[g].size() < 2)
+        {
+            continue;
+        }
+
+        // (the groups are in channel order, so the gains line up with groupChans)
+        SortedSet<int> groupChans;
+        std::vector<float> groupGains;
+        for (int k : info.groups[g])
+        {
+            groupChans.add(info.op->enabledChannels[k]);
+            if (!info.channelGains.empty())
+            {
+                groupGains.push_back(info.channelGains[k]);
+            }
+        }
+
+        res = writeConfig(groupDir.getChildFile(names[g] + ".sc"), groupChans, dataFiles[g].getFileName(),
+            info.nSamples, names[g] + ".wts", names[g] + ".sph", solverPresets[defaultSolverPreset], groupGains);
+        if (res.failed())
+        {
+            return res;
+        }
+
+        toRun.add(g);
+    }
+
+    CoreServices::sendStatusMessage("ICA: training " + String(nGroups) + " groups of up to "
+        + String(maxGroupChannels) + " channels");
+
+    // run them, leaving some cores for acquisition (as in evaluateICA)
+    const int maxConcurrent = jmax(1, SystemStats::getNumCpus() / 2);
+    OwnedArray<ICAProcess> procs;
+    int nFinished = 0;
+
+    while (nFinished < toRun.size())
+    {
+        if (currentThreadShouldExit()) { return Result::ok(); }
+
+        while (procs.size() < toRun.size() && procs.size() - nFinished < maxConcurrent)
+        {
+            procs.add(new ICAProcess(groupDir.getChildFile(names[toRun[procs.size()]] + ".sc")));
+        }
+
+        for (int r = 0; r < procs.size(); ++r)
+        {
+            if (procs[r] == nullptr || procs[r]->isRunning())
+            {
+                continue;
+            }
+
+            Result runRes = getBinicaResult(*procs[r]);
+            if (runRes.failed())
+            {
+                return Result::fail("Channel " + names[toRun[r]].replace("_", " ") + ": "
+                    + runRes.getErrorMessage());
+            }
+
+            procs.set(r, nullptr);
+            ++nFinished;
+        }
+
+        if (nFinished < toRun.size())
+        {
+            sleep(200);
+        }
+    }
+
+    // combine into block-diagonal matrices (with the same layout as each group's files)
+    Matrix weights = Matrix::Zero(nChans, nChans);
+    Matrix sphere = Matrix::Zero(nChans, nChans);
+
+    for (int g = 0; g < nGroups; ++g)
+    {
+        const std::vector<int>& group = info.groups[g];
+        int size = int(group.size());
+
+        Matrix groupWeights = Matrix::Identity(size, size);
+        Matrix groupSphere = Matrix::Identity(size, size);
+        if (size > 1)
+        {
+            res = readMatrix(groupDir.getChildFile(names[g] + ".wts"), groupWeights);
+            if (res.wasOk())
+            {
+                res = readMatrix(groupDir.getChildFile(names[g] + ".sph"), groupSphere);
+            }
+
+            if (res.failed())
+            {
+                return res;
+            }
+        }
+
+        for (int j = 0; j < size; ++j)
+        {
+            for (int i = 0; i < size; ++i)
+            {
+                weights(group[i], group[j]) = groupWeights(i, j);
+                sphere(group[i], group[j]) = groupSphere(i, j);
+            }
+        }
+    }
+
+    info.weight = icaDir.getChildFile(weightFilename);
+    info.sphere = icaDir.getChildFile(sphereFilename);
+
+    res = saveMatrix(info.weight, weights);
+    if (res.wasOk())
+    {
+        res = saveMatrix(info.sphere, sphere);
+    }
+
+    if (res.failed())
+    {
+        return res;
+    }
+
+    // config for loading the combined result (rerunning it would train all channels at once)
+    res = writeConfig(info.config, info.op->enabledChannels, inputFilename, info.nSamples,
+        weightFilename, sphereFilename, solverPresets[defaultSolverPreset], info.channelGains);
+    if (res.failed() || !hierarchical)
+    {
+        return res;
+    }
+
+    return performGlobalICA(info, weights, sphere);
+}
+
+Result ICANode::performGlobalICA(ICARunInfo& info, MatrixConstRef weights, MatrixConstRef sphere)
+{
+    int nChans = info.nChannels;
+    int nGroups = int(info.groups.size());
+    if (info.covariance.rows() != nChans)
+    {
+        jassertfalse;
+        return Result::ok();
+    }
+
+    // the block-diagonal decomposition, of the scaled training data and of the original data
+    Matrix localUnmixingScaled = computeUnmixing(weights, sphere);
+    Matrix localUnmixing = localUnmixingScaled;
+    foldChannelGains(localUnmixing, info.channelGains);
+    Matrix localMixing = localUnmixing.inverse();
+
+    if (currentThreadShouldExit()) { return Result::ok(); }
+
+    // variance of each component, and the power it contributes to the channels
+    Eigen::MatrixXd unmixingD = localUnmixing.cast<double>();
+    Eigen::VectorXd compVar = (unmixingD * info.covariance).cwiseProduct(unmixingD).rowwise().sum();
+    Eigen::VectorXd energy = compVar.cwiseProduct(
+        localMixing.cast<double>().colwise().squaredNorm().transpose());
+
+    // the strongest few of each group (each group's components are in its channels' rows)
+    int perGroup = jmax(2, maxGlobalComponents / nGroups);
+    std::vector<int> selected;
+    for (const std::vector<int>& group : info.groups)
+    {
+        std::vector<int> comps;
+        for (int comp : group)
+        {
+            if (compVar(comp) > 0 && std::isfinite(compVar(comp)))
+            {
+                comps.push_back(comp);
+            }
+        }
+
+        int nKeep = jmin(perGroup, int(comps.size()));
+        std::partial_sort(comps.begin(), comps.begin() + nKeep, comps.end(),
+            [&energy](int a, int b) { return energy(a) > energy(b); });
+        selected.insert(selected.end(), comps.begin(), comps.begin() + nKeep);
+    }
+    std::sort(selected.begin(), selected.end());
+
+    int nSelected = int(selected.size());
+    if (nSelected < 2)
+    {
+        return Result::ok();
+    }
+
+    // their activations on the training data, each scaled to unit variance like channels
+    // are (the gains are folded back in below)
+    std::vector<float> compGains(nSelected);
+    Matrix selectedUnmixing(nSelected, nChans);
+    SortedSet<int> compInds;
+    for (int k = 0; k < nSelected; ++k)
+    {
+        compGains[k] = float(1 / std::sqrt(compVar(selected[k])));
+        selectedUnmixing.row(k) = localUnmixingScaled.row(selected[k]) * compGains[k];
+        compInds.add(k);
+    }
+
+    File icaDir = info.config.getParentDirectory();
+    File groupDir = icaDir.getChildFile(groupDirname);
+    File dataFile = groupDir.getChildFile(globalName + ".floatdata");
+    File config = groupDir.getChildFile(globalName + ".sc");
+
+    Result res = transformFrames(icaDir.getChildFile(inputFilename), nChans, info.nSamples,
+        selectedUnmixing, dataFile);
+    if (res.wasOk())
+    {
+        res = writeConfig(config, compInds, dataFile.getFileName(), info.nSamples, globalName + ".wts",
+            globalName + ".sph", solverPresets[defaultSolverPreset], compGains);
+    }
+
+    if (res.failed())
+    {
+        return res;
+    }
+
+    CoreServices::sendStatusMessage("ICA: training " + String(nSelected) + " components across groups");
+
+    res = runBinica(config);
+    if (res.failed() || currentThreadShouldExit())
+    {
+        return res;
+    }
+
+    Matrix globalWeights(nSelected, nSelected);
+    Matrix globalSphere(nSelected, nSelected);
+    res = readMatrix(groupDir.getChildFile(globalName + ".wts"), globalWeights);
+    if (res.wasOk())
+    {
+        res = readMatrix(groupDir.getChildFile(globalName + ".sph"), globalSphere);
+    }
+
+    if (res.failed())
+    {
+        return res;
+    }
+
+    auto factors = std::make_shared<HierarchicalFactors>();
+    factors->globalUnmixing = computeUnmixing(globalWeights, globalSphere);
+    foldChannelGains(factors->globalUnmixing, compGains);
+    factors->localUnmixing = std::move(localUnmixing);
+    factors->localMixing = std::move(localMixing);
+    factors->selected = std::move(selected);
+
+    // (readResults saves these, since the weight and sphere files are just the first level)
+    Matrix unmixing = factors->composeUnmixing();
+    Matrix mixing = factors->composeMixing();
+    info.op->setMatrices(std::move(mixing), std::move(unmixing), std::move(factors));
+    return Result::ok();
+}
+
+Result ICANode::runBinica(const File& config)
+{
+    ICAProcess proc(config);
+
+    while (proc.isRunning())
+    {
+        if (currentThreadShouldExit()) { return Result::ok(); }
+        sleep(200);
+    }
+
+    return getBinicaResult(proc);
+}
+
+Result ICANode::getBinicaResult(const ICAProcess& proc)
+{
+    if (proc.failedToRun())
+    {
+        return Result::fail("ICA failed to start");
+    }
+
+    int32 exitCode = proc.getExitCode();
+    if (exitCode != 0)
+    {
+        return Result::fail("ICA failed with exit code " + String(exitCode));
+    }
+
+    return Result::ok();
+}
+
+Result ICANode::writeConfig(const File& config, const SortedSet<int>& enabledChannels,
+    const String& dataFile, int nSamples, const String& weightFile, const String& sphereFile,
+    const SolverPreset& solver, const std::vector<float>& channelGains)
+{
+    BinicaConfig binicaConfig;
+    binicaConfig.numChannels = enabledChannels.size();
+    binicaConfig.enabledChannels.assign(enabledChannels.begin(), enabledChannels.end());
+    binicaConfig.channelGains = channelGains;
+    binicaConfig.weightFile = weightFile.toStdString();
+    binicaConfig.sphereFile = sphereFile.toStdString();
+
+    std::string error;
+    if (!writeBinicaConfig(config.getFullPathName().toStdString(), binicaConfig, dataFile.toStdString(),
+        nSamples, solver.settings, error))
+    {
+        return Result::fail(error);
+    }
+
+    return Result::ok();
+}
+
+Result ICANode::readFrames(const File& source, int nChannels, int startFrame, int nFrames, float* dest)
+{
+    FileInputStream stream(source);
+    if (stream.failedToOpen())
+    {
+        return Result::fail("Failed to open " + source.getFileName());
+    }
+
+    const int64 frameBytes = int64(nChannels) * sizeof(float);
+    if (!stream.setPosition(startFrame * frameBytes))
+    {
+        return Result::fail("Failed to read " + source.getFileName());
+    }
+
+    // (read in chunks, since read takes an int)
+    char* destBytes = reinterpret_cast<char*>(dest);
+    int64 remaining = nFrames * frameBytes;
+    while (remaining > 0)
+    {
+        int toRead = int(jmin(remaining, int64(1) << 30));
+        if (stream.read(destBytes, toRead) != toRead)
+        {
+            return Result::fail("Failed to read " + source.getFileName());
+        }
+        destBytes += toRead;
+        remaining -= toRead;
+    }
+
+    return Result::ok();
+}
+
+Result ICANode::copyFrames(const File& source, const File& dest, int nChannels, int startFrame, int nFrames)
+{
+    FileInputStream stream(source);
+    const int64 frameBytes = int64(nChannels) * sizeof(float);
+    if (stream.failedToOpen() || !stream.setPosition(startFrame * frameBytes))
+    {
+        return Result::fail("Failed to read " + source.getFileName());
+    }
+
+    AsyncFileWriter writer(dest);
+    if (writer.getStatus().failed())
+    {
+        return writer.getStatus();
+    }
+
+    const int chunkBytes = 1 << 20;
+    HeapBlock<char> chunk(chunkBytes);
+
+    for (int64 remaining = nFrames * frameBytes; remaining > 0; )
+    {
+        int toCopy = int(jmin(remaining, int64(chunkBytes)));
+        if (stream.read(chunk, toCopy) != toCopy)
+        {
+            return Result::fail("Failed to read " + source.getFileName());
+        }
+
+        if (!writer.write(chunk, toCopy))
+        {
+            break;
+        }
+        remaining -= toCopy;
+    }
+
+    return writer.finish();
+}
+
+Result ICANode::splitChannels(const File& source, int nChannels, int nFrames,
+    const ChannelGroups& groups, const Array<File>& dests)
+{
+    jassert(int(groups.size()) == dests.size());
+
+    FileInputStream stream(source);
+    if (stream.failedToOpen())
+    {
+        return Result::fail("Failed to read " + source.getFileName());
+    }
+
+    OwnedArray<AsyncFileWriter> writers;
+    for (const File& dest : dests)
+    {
+        AsyncFileWriter* writer = writers.add(new AsyncFileWriter(dest));
+        if (writer->getStatus().failed())
+        {
+            return writer->getStatus();
+        }
+    }
+
+    const int chunkFrames = 4096;
+    HeapBlock<float> chunk(chunkFrames * nChannels);
+    HeapBlock<float> groupChunk(chunkFrames * nChannels);
+
+    for (int start = 0; start < nFrames; start += chunkFrames)
+    {
+        int n = jmin(chunkFrames, nFrames - start);
+        int numBytes = n * nChannels * int(sizeof(float));
+        if (stream.read(chunk, numBytes) != numBytes)
+        {
+            return Result::fail("Failed to read " + source.getFileName());
+        }
+
+        for (int g = 0; g < int(groups.size()); ++g)
+        {
+            const std::vector<int>& group = groups[g];
+            int size = int(group.size());
+            for (int i = 0; i < n; ++i)
+            {
+                for (int k = 0; k < size; ++k)
+                {
+                    groupChunk[i * size + k] = chunk[i * nChannels + group[k]];
+                }
+            }
+
+            if (!writers[g]->write(groupChunk, n * size * sizeof(float)))
+            {
+                return writers[g]->finish();
+            }
+        }
+    }
+
+    for (AsyncFileWriter* writer : writers)
+    {
+        Result res = writer->finish();
+        if (res.failed())
+        {
+            return res;
+        }
+    }
+
+    return Result::ok();
+}
+
+Result ICANode::transformFrames(const File& source, int nChannels, int nFrames,
+    MatrixConstRef coefs, const File& dest)
+{
+    jassert(coefs.cols() == nChannels);
+
+    FileInputStream stream(source);
+    if (stream.failedToOpen())
+    {
+        return Result::fail("Failed to read " + source.getFileName());
+    }
+
+    AsyncFileWriter writer(dest);
+    if (writer.getStatus().failed())
+    {
+        return writer.getStatus();
+    }
+
+    // (one column per frame, so chunks are contiguous in both)
+    const int chunkFrames = 4096;
+    int nOut = int(coefs.rows());
+    Matrix chunk(nChannels, chunkFrames);
+    Matrix outChunk(nOut, chunkFrames);
+
+    for (int start = 0; start < nFrames; start += chunkFrames)
+    {
+        int n = jmin(chunkFrames, nFrames - start);
+        int numBytes = n * nChannels * int(sizeof(float));
+        if (stream.read(chunk.data(), numBytes) != numBytes)
+        {
+            return Result::fail("Failed to read " + source.getFileName());
+        }
+
+        outChunk.leftCols(n).noalias() = coefs * chunk.leftCols(n);
+
+        if (!writer.write(outChunk.data(), n * nOut * sizeof(float)))
+        {
+            return writer.finish();
+        }
+    }
+
+    return writer.finish();
+}
+
+Result ICANode::processResults(ICARunInfo& info)
+{
+    Result res = readResults(info);
+    if (res.failed() || currentThreadShouldExit())
+    {
+        return res;
+    }
+
+    // (just informational, so don't fail the run)
+    Result statsRes = writeComponentStats(info);
+    if (statsRes.failed())
+    {
+        std::cerr << "Warning: failed to save component statistics (" << statsRes.getErrorMessage() << ")" << std::endl;
+    }
+
+    return Result::ok();
+}
+
+Result ICANode::writeComponentStats(const ICARunInfo& info)
+{
+    File icaDir = info.config.getParentDirectory();
+    File inputFile = icaDir.getChildFile(inputFilename);
+    const Matrix& unmixing = info.op->getUnmixing();
+
+    int nChans = info.nChannels;
+    if (info.nSamples <= 0 || unmixing.rows() != nChans || !inputFile.existsAsFile())
+    {
+        return Result::fail("No training data");
+    }
+
+    StreamStats stats(nChans, getStatsOptions(info.sampleRate));
+
+    // (the input file was scaled by the channel gains)
+    Matrix fileUnmixing = unmixing;
+    if (!info.channelGains.empty())
+    {
+        std::vector<float> inverseGains;
+        for (float gain : info.channelGains)
+        {
+            inverseGains.push_back(1 / gain);
+        }
+        foldChannelGains(fileUnmixing, inverseGains);
+    }
+
+    // unmix a chunk of frames at a time (both interleaved, i.e. channels x frames)
+    const int chunkFrames = 4096;
+    Matrix frames(nChans, chunkFrames);
+    Matrix comps(nChans, chunkFrames);
+
+    for (int start = 0; start < info.nSamples; start += chunkFrames)
+    {
+        if (currentThreadShouldExit()) { return Result::ok(); }
+
+        int nFrames = jmin(chunkFrames, info.nSamples - start);
+        Result res = readFrames(inputFile, nChans, start, nFrames, frames.data());
+        if (res.failed())
+        {
+            return res;
+        }
+
+        comps.leftCols(nFrames).noalias() = fileUnmixing * frames.leftCols(nFrames);
+        stats.addFrames(comps.data(), nFrames);
+    }
+
+    StringArray labels;
+    for (int c = 1; c <= nChans; ++c)
+    {
+        labels.add(String(c));
+    }
+
+    return saveStatsTable(icaDir.getChildFile(componentStatsFilename), stats, labels);
+}
+
+Result ICANode::saveStatsTable(const File& dest, const StreamStats& stats, const StringArray& labels)
+{
+    FileOutputStream stream(dest);
+    if (!stream.openedOk())
+    {
+        return stream.getStatus();
+    }
+
+    stream.setPosition(0);
+    stream.truncate();
+
+    stream << "name\tmean\tstd\tkurtosis\tmin\tmax";
+    for (int f = 0; f < numLineFreqs; ++f)
+    {
+        stream << "\tline" << String(lineFreqs[f], 0);
+    }
+    stream << "\tdiff\n";
+
+    Eigen::VectorXd mean = stats.getMean();
+    Eigen::VectorXd stdDev = stats.getVariance().cwiseSqrt();
+    Eigen::VectorXd kurtosis = stats.getKurtosis();
+    Eigen::VectorXd minVals = stats.getMin();
+    Eigen::VectorXd maxVals = stats.getMax();
+
+    std::vector<Eigen::VectorXd> lineRatios;
+    for (int f = 0; f < numLineFreqs; ++f)
+    {
+        lineRatios.push_back(stats.getLineRatio(f));
+    }
+    Eigen::VectorXd diffRatios = stats.getDiffRatio();
+
+    for (int k = 0; k < stats.getNumChannels(); ++k)
+    {
+        stream << labels[k] << '\t'
+            << String(mean(k), 4) << '\t'
+            << String(stdDev(k), 4) << '\t'
+            << String(kurtosis(k), 3) << '\t'
+            << String(minVals(k), 4) << '\t'
+            << String(maxVals(k), 4);
+
+        for (int f = 0; f < numLineFreqs; ++f)
+        {
+            stream << '\t' << String(lineRatios[f](k), 4);
+        }
+        stream << '\t' << String(diffRatios(k), 4) << '\n';
+    }
+
+    stream.flush();
+    return stream.getStatus();
+}
+
+StreamStatsOptions ICANode::getStatsOptions(float sampleRate)
+{
+    StreamStatsOptions options;
+    options.sampleRate = sampleRate;
+
+    options.lineFreqs.assign(lineFreqs, lineFreqs + numLineFreqs);
+
+    return options;
+}
+
+Result ICANode::readResults(ICARunInfo& info)
+{
+    Matrix unmixing = info.op->getUnmixing();
+    if (unmixing.size() == 0) // skip this if we already have an unmixing matrix
+    {
+        // load weight and sphere matrices into Eigen Map objects
+        int size = info.nChannels;
+        int sizeSq = size * size;
+
+        Matrix weights(size, size);
+        Result res = readMatrix(info.weight, weights);
+        if (res.failed())
+        {
+            return res;
+        }
+
+        if (currentThreadShouldExit()) { return Result::ok(); }
+
+        Matrix sphere(size, size);
+        res = readMatrix(info.sphere, sphere);
+        if (res.failed())
+        {
+            return res;
+        }
+
+        if (currentThreadShouldExit()) { return Result::ok(); }
+
+        // now just need to convert this to mixing and unmixing
+        unmixing = computeUnmixing(weights, sphere);
+
+        // (in terms of the data before it was scaled for training)
+        foldChannelGains(unmixing, info.channelGains);
+    }
+
+    Matrix mixing = unmixing.inverse();
+
+    if (currentThreadShouldExit()) { return Result::ok(); }
+
+    HierarchicalFactorsPtr factors = info.op->matrices ? info.op->matrices->factors : nullptr;
+    info.op->setMatrices(std::move(mixing), std::move(unmixing), factors);
+
+    // write final matrices to output files
+    File icaDir = info.config.getParentDirectory();
+
+    Result res = saveMatrix(icaDir.getChildFile(unmixingFilename), info.op->getUnmixing());
+    if (res.failed())
+    {
+        return res;
+    }
+
+    res = saveMatrix(icaDir.getChildFile(mixingFilename), info.op->getMixing());
+    if (res.failed())
+    {
+        return res;
+    }
+
+    // (and don't leave factors of a previous run next to these)
+    File factorsFile = icaDir.getChildFile(factorsFilename);
+    if (!factors)
+    {
+        factorsFile.deleteFile();
+        return Result::ok();
+    }
+
+    std::string error;
+    if (!writeFactors(factorsFile.getFullPathName().toStdString(), *factors, error))
+    {
+        return Result::fail(error);
+    }
+
+    return Result::ok();
+}
+
+Result ICANode::setRejectedCompsBasedOnCurrent(ICARunInfo& info)
+{
+    std::shared_ptr<SubProcData> data = subProcData.acquire(info.subProc);
+    if (!data)
+    {
+        return Result::fail("Subprocessor " + String(info.subProc) + " does not exist");
+    }
+
+    SubProcData& thisSubProcData = *data;
+
+    while (true)
+    {
+        if (currentThreadShouldExit()) { return Result::ok(); }
+
+        const ScopedReadTryLock icaLock(thisSubProcData.icaMutex);
+        if (!icaLock.isLocked())
+        {
+            continue;
         }
 
         const ICAOperation& op = *thisSubProcData.icaOp;
@@ -929,50 +2735,340 @@ Result ICANode::setRejectedCompsBasedOnCurrent(ICARunInfo& info)
     }
 }
 
-Result ICANode::setNewICAOp(ICARunInfo& info)
+Result ICANode::applyLibrary(ICARunInfo& info)
+{
+    if (!useLibrary)
+    {
+        return Result::ok();
+    }
+
+    std::shared_ptr<SubProcData> data = subProcData.acquire(info.subProc);
+    if (!data)
+    {
+        return Result::fail("Subprocessor " + String(info.subProc) + " does not exist");
+    }
+
+    // (so that selections made just before the run count)
+    saveLibraryUpdates();
+
+    ComponentLibrary library;
+    std::string error;
+    {
+        const ScopedLock libraryLock(libraryMutex);
+        File libraryFile = getLibraryFile(data->info);
+        if (!library.parse(libraryFile.loadFileAsString().toStdString(), error))
+        {
+            // (not worth failing the run over)
+            std::cerr << "Warning: failed to load component library (" << error << ")" << std::endl;
+            return Result::ok();
+        }
+    }
+
+    if (library.getNumEntries() == 0)
+    {
+        return Result::ok();
+    }
+
+    int nComps = info.op->enabledChannels.size();
+    std::vector<int> channels(info.op->enabledChannels.begin(), info.op->enabledChannels.end());
+    std::vector<std::vector<float>> spectra = readComponentSpectra(
+        info.config.getParentDirectory().getChildFile(componentStatsFilename), nComps);
+
+    std::vector<int> matches = library.match(info.op->getMixing(), channels, spectra,
+        libraryMinSimilarity, libraryMaxSpectralDistance);
+
+    if (!matches.empty())
+    {
+        info.op->rejectedComponents.clearQuick();
+        for (int comp : matches)
+        {
+            info.op->rejectedComponents.add(comp);
+        }
+
+        CoreServices::sendStatusMessage("ICA: rejected " + String(int(matches.size()))
+            + " component(s) matching the library");
+    }
+
+    return Result::ok();
+}
+
+void ICANode::updateLibrary(uint32 subProc)
+{
+    auto subProcEntry = subProcData.find(subProc);
+    if (!useLibrary || subProcEntry == subProcData.end())
+    {
+        return;
+    }
+
+    SubProcData& data = *subProcEntry->second;
+
+    LibraryUpdate update;
+    update.libraryFile = getLibraryFile(data.info);
+    update.configFile = File(data.icaConfigPath.toString());
+    {
+        const ScopedReadLock icaLock(data.icaMutex);
+        if (data.icaOp->isNoop() || !update.configFile.existsAsFile())
+        {
+            return; // no run to attribute the fingerprints to
+        }
+
+        update.mixing = data.icaOp->getMixing();
+        update.channels.assign(data.icaOp->enabledChannels.begin(), data.icaOp->enabledChannels.end());
+        update.rejected = data.icaOp->rejectedComponents;
+    }
+
+    {
+        const ScopedLock libraryLock(libraryMutex);
+
+        // (only the last selection of a run is saved)
+        auto pending = std::find_if(pendingLibraryUpdates.begin(), pendingLibraryUpdates.end(),
+            [&update](const LibraryUpdate& other)
+        {
+            return other.libraryFile == update.libraryFile && other.configFile == update.configFile;
+        });
+
+        if (pending != pendingLibraryUpdates.end())
+        {
+            *pending = std::move(update);
+        }
+        else
+        {
+            pendingLibraryUpdates.push_back(std::move(update));
+        }
+    }
+
+    startTimer(libraryUpdateDelayMs);
+}
+
+void ICANode::timerCallback()
+{
+    stopTimer();
+    saveLibraryUpdates();
+}
+
+void ICANode::saveLibraryUpdates()
+{
+    // (held throughout, so that updates of the same library are written in order)
+    const ScopedLock libraryLock(libraryMutex);
+
+    for (const LibraryUpdate& update : pendingLibraryUpdates)
+    {
+        std::string source = update.configFile.getFullPathName().toStdString();
+        std::vector<std::vector<float>> spectra = readComponentSpectra(
+            update.configFile.getParentDirectory().getChildFile(componentStatsFilename),
+            int(update.mixing.cols()));
+
+        std::vector<ComponentFingerprint> fingerprints;
+        for (int comp : update.rejected)
+        {
+            fingerprints.push_back(makeFingerprint(update.mixing, comp, update.channels,
+                spectra.empty() ? std::vector<float>() : spectra[comp], source));
+        }
+
+        Result res = update.libraryFile.getParentDirectory().createDirectory();
+        ComponentLibrary library;
+        std::string error;
+        if (res.failed() || !library.parse(update.libraryFile.loadFileAsString().toStdString(), error))
+        {
+            std::cerr << "Warning: failed to load component library ("
+                << (res.failed() ? res.getErrorMessage().toStdString() : error) << ")" << std::endl;
+            continue;
+        }
+
+        library.replaceSource(source, fingerprints);
+
+        // (written to a temporary file, which then replaces the library)
+        if (!update.libraryFile.replaceWithText(String(library.format())))
+        {
+            std::cerr << "Warning: failed to save component library" << std::endl;
+        }
+    }
+
+    pendingLibraryUpdates.clear();
+}
+
+File ICANode::getLibraryFile(const SubProcInfo& info)
+{
+    String name = info.sourceName + "_" + String(info.subProcIdx);
+
+    return File::getSpecialLocation(File::userApplicationDataDirectory)
+        .getChildFile("open-ephys").getChildFile(libraryDirname)
+        .getChildFile(File::createLegalFileName(name) + ".tsv");
+}
+
+std::vector<std::vector<float>> ICANode::readComponentSpectra(const File& statsFile, int nComps)
+{
+    std::vector<std::vector<float>> spectra;
+
+    StringArray lines;
+    statsFile.readLines(lines);
+    lines.removeEmptyStrings();
+    if (lines.size() != nComps + 1)
+    {
+        return spectra;
+    }
+
+    // (older tables don't have all of the columns)
+    StringArray header = StringArray::fromTokens(lines[0], "\t", "");
+    Array<int> columns;
+    columns.add(header.indexOf("diff"));
+    for (int f = 0; f < numLineFreqs; ++f)
+    {
+        columns.add(header.indexOf("line" + String(lineFreqs[f], 0)));
+    }
+
+    if (columns.contains(-1))
+    {
+        return spectra;
+    }
+
+    for (int k = 1; k <= nComps; ++k)
+    {
+        StringArray fields = StringArray::fromTokens(lines[k], "\t", "");
+        std::vector<float> spectrum;
+        for (int col : columns)
+        {
+            if (col >= fields.size())
+            {
+                return {};
+            }
+            spectrum.push_back(fields[col].getFloatValue());
+        }
+        spectra.push_back(spectrum);
+    }
+
+    return spectra;
+}
+
+Result ICANode::setNewICAOp(ICARunInfo& info)
+{
+    std::shared_ptr<SubProcData> data = subProcData.acquire(info.subProc);
+    if (!data)
+    {
+        return Result::fail("Subprocessor " + String(info.subProc) + " no longer exists");
+    }
+
+    SubProcData& currSubProcData = *data;
+
+    if (info.op->enabledChannels.getLast() >= currSubProcData.channelInds.size())
+    {
+        return Result::fail("Operation needs more channels than are present in subprocessor " + info.subProc);
+    }
+
+    // see whether current rejected components are invalid
+    if (info.op->rejectedComponents.getLast() >= info.op->enabledChannels.size())
+    {
+        std::cerr << "Warning: rejected component set in loaded ICA op names nonexistent components" << std::endl;
+        std::cerr << "Defaulting to rejecting first component" << std::endl;
+
+        info.op->rejectedComponents.clearQuick();
+        info.op->rejectedComponents.add(0);
+    }
+
+    // while previewing, this becomes the candidate instead
+    if (setCandidateICAOp(currSubProcData, info))
+    {
+        return Result::ok();
+    }
+
+    // (an entry's channels don't change. if updateSettings replaces it meanwhile, the new
+    // operation is dropped along with it.)
+    ScopedPointer<ApplyPlan> newPlan = info.op->createPlan(currSubProcData.channelInds);
+
+    // any preview was of the old operation (destroyed after the lock is released)
+    ScopedPointer<PreviewEngine> oldPreview;
+    ScopedPointer<ICAOperation> oldCandidate;
+
+    // (the old one is swapped into here)
+    ScopedPointer<WhiteningTracker> tracker;
+    if (trackWhitening)
+    {
+        tracker = createTracker(currSubProcData, *info.op);
+    }
+
+    while (true)
+    {
+        if (currentThreadShouldExit()) { return Result::ok(); }
+
+        const ScopedWriteTryLock icaLock(currSubProcData.icaMutex);
+        if (!icaLock.isLocked())
+        {
+            continue;
+        }
+
+        ScopedPointer<ICAOperation>& oldOp = currSubProcData.icaOp;
+
+        if (currSubProcData.recorder && newPlan)
+        {
+            currSubProcData.recorder->registerOperator(*newPlan, *info.op);
+        }
+
+        oldOp.swapWith(info.op);
+        currSubProcData.plan.swapWith(newPlan);
+        oldPreview.swapWith(currSubProcData.preview);
+        oldCandidate.swapWith(currSubProcData.candidateOp);
+        currSubProcData.tracker.swapWith(tracker);
+        currSubProcData.icaConfigPath = info.config.getFullPathName();
+
+        return Result::ok();
+    }
+}
+
+bool ICANode::setCandidateICAOp(SubProcData& data, ICARunInfo& info)
 {
-    auto subProcEntry = subProcData.find(info.subProc);
-    if (subProcEntry == subProcData.end())
+    // build the new engine outside the write lock, as in startPreview
+    // (the old engine and candidate are destroyed after it is released)
+    ScopedPointer<PreviewEngine> newPreview;
+    ScopedPointer<ICAOperation> oldCandidate;
+    SortedSet<int> chans;
+    const ICAOperation* previewedOp;
     {
-        return Result::fail("Subprocessor " + String(info.subProc) + " no longer exists");
-    }
+        const ScopedReadLock icaLock(data.icaMutex);
+        if (!data.preview || data.icaOp->isNoop() || info.op->isNoop())
+        {
+            return false;
+        }
 
-    SubProcData& currSubProcData = subProcEntry->second;
+        previewedOp = data.icaOp;
+        chans = previewedOp->enabledChannels;
+        for (int chan : info.op->enabledChannels)
+        {
+            chans.add(chan);
+        }
 
-    if (info.op->enabledChannels.getLast() >= currSubProcData.channelInds.size())
-    {
-        return Result::fail("Operation needs more channels than are present in subprocessor " + info.subProc);
+        newPreview = createPreview(data, chans, previewedOp->createLocalPlan(&chans),
+            info.op->createLocalPlan(&chans));
     }
 
     while (true)
     {
-        if (currentThreadShouldExit()) { return Result::ok(); }
+        // (the caller returns too)
+        if (currentThreadShouldExit()) { return true; }
 
-        const ScopedWriteTryLock icaLock(currSubProcData.icaMutex);
+        const ScopedWriteTryLock icaLock(data.icaMutex);
         if (!icaLock.isLocked())
         {
             continue;
         }
 
-        ScopedPointer<ICAOperation>& oldOp = currSubProcData.icaOp;
-
-        // see whether current rejected components are invalid
-        if (info.op->rejectedComponents.getLast() >= info.op->enabledChannels.size())
+        if (!data.preview || data.icaOp != previewedOp)
         {
-            std::cerr << "Warning: rejected component set in loaded ICA op names nonexistent components" << std::endl;
-            std::cerr << "Defaulting to rejecting first component" << std::endl;
-
-            info.op->rejectedComponents.clearQuick();
-            info.op->rejectedComponents.add(0);
+            return false; // stopped in the meantime, so apply it as usual
         }
 
-        oldOp.swapWith(info.op);
-        currSubProcData.icaConfigPath = info.config.getFullPathName();
-
-        return Result::ok();
+        data.preview.swapWith(newPreview);
+        data.candidateRejected = info.op->rejectedComponents;
+        data.candidateConfigPath = info.config.getFullPathName();
+        data.previewChans.swapWith(chans);
+        oldCandidate.swapWith(data.candidateOp);
+        data.candidateOp.swapWith(info.op);
+        break;
     }
-}
 
+    ++previewVersion;
+    CoreServices::sendStatusMessage("ICA: new operation is being previewed, press APPLY to use it");
+    return true;
+}
 
 Result ICANode::loadICA(const File& configFile, uint32 subProc, const SortedSet<int>* rejectSet)
 {
@@ -993,6 +3089,10 @@ Result ICANode::loadICA(const File& configFile, uint32 subProc, const SortedSet<
         else
         {
             res = setRejectedCompsBasedOnCurrent(loadedInfo);
+            if (res.wasOk())
+            {
+                res = applyLibrary(loadedInfo);
+            }
         }
     }
 
@@ -1005,67 +3105,184 @@ Result ICANode::loadICA(const File& configFile, uint32 subProc, const SortedSet<
 }
 
 
-Result ICANode::populateInfoFromConfig(ICARunInfo& info)
+WhiteningTracker* ICANode::createTracker(SubProcData& data, const ICAOperation& op)
 {
-    FileInputStream configStream(info.config);
-    if (configStream.failedToOpen())
+    if (op.isNoop())
     {
-        return Result::fail("Failed to open config file ("
-            + configStream.getStatus().getErrorMessage().trimEnd() + ")");
+        return nullptr;
     }
 
-    StringArray configTokens;
-    while (!configStream.isExhausted())
+    std::vector<int> inputChans;
+    for (int chan : op.enabledChannels)
     {
-        String line = configStream.readNextLine();
+        inputChans.push_back(data.channelInds[chan]);
+    }
 
-        Result res = configStream.getStatus();
-        if (res.failed())
+    // (for an operation trained in two levels, the first level is tracked, so that it stays
+    // block-diagonal and the operation can still be applied in factored form)
+    HierarchicalFactorsPtr factors = op.matrices ? op.matrices->factors : nullptr;
+
+    // (entries of subProcData don't move, and the tracker is destroyed before its entry)
+    SubProcData* dataPtr = &data;
+    return new WhiteningTracker(data.info, inputChans, data.dsStride,
+        data.Fs / data.dsStride, factors ? factors->localUnmixing : op.getUnmixing(),
+        [this, dataPtr, factors](WhiteningTracker& source, MatrixConstRef unmixing)
         {
-            return Result::fail("Failed to read config file ("
-                + res.getErrorMessage().trimEnd() + ")");
-        }
+            updateWhitening(*dataPtr, source, unmixing, factors);
+        });
+}
+
+void ICANode::updateWhitening(SubProcData& data, WhiteningTracker& source, MatrixConstRef unmixing,
+    const HierarchicalFactorsPtr& factors)
+{
+    // as in setComponentSelected, build the plan before taking the write lock.
+    // try locks, since the thread that owns the tracker may be waiting to destroy it.
+    OperatorMatricesPtr newMatrices;
+    if (factors)
+    {
+        // (the global level stays as it was trained)
+        auto newFactors = std::make_shared<HierarchicalFactors>(*factors);
+        newFactors->localUnmixing = unmixing;
+        newFactors->localMixing = newFactors->localUnmixing.inverse();
+        newMatrices = OperatorStore::getInstance().getMatrices(newFactors->composeMixing(),
+            newFactors->composeUnmixing(), std::move(newFactors));
+    }
+    else
+    {
+        Matrix newUnmixing(unmixing);
+        Matrix newMixing = newUnmixing.inverse();
+        newMatrices = OperatorStore::getInstance().getMatrices(std::move(newMixing), std::move(newUnmixing));
+    }
 
-        // handle enabled channels hint
-        if (line.startsWith(chanHintPrefix))
+    ScopedPointer<ApplyPlan> newPlan;
+    SortedSet<int> plannedRejected;
+    {
+        const ScopedReadTryLock icaLock(data.icaMutex);
+        if (!icaLock.isLocked() || data.tracker != &source || data.preview)
         {
-            SortedSet<int> enabledChans = stringToIntSet(line.fromFirstOccurrenceOf(chanHintPrefix, false, false));
-            info.op->enabledChannels.swapWith(enabledChans);
+            return;
         }
-        else
+
+        plannedRejected = data.icaOp->rejectedComponents;
+        ICAOperation newOp(*data.icaOp);
+        newOp.matrices = newMatrices;
+        newPlan = newOp.createPlan(data.channelInds);
+
+        if (data.recorder && newPlan)
         {
-            StringArray tokens = StringArray::fromTokens(line.initialSectionNotContaining("!#%"), true);
-            configTokens.addArray(tokens);
+            data.recorder->registerOperator(*newPlan, newOp);
         }
     }
 
-    int nTokens = configTokens.size();
-    if (nTokens % 2 == 1)
+    const ScopedWriteTryLock icaLock(data.icaMutex);
+    if (!icaLock.isLocked() || data.tracker != &source || data.preview
+        || data.icaOp->rejectedComponents != plannedRejected)
     {
-        return Result::fail("Malformed config file");
+        return;
     }
 
-    // fields of interest: chans, WeightsOutFile, SphereFile
-    // all are required.
-    File configDir = info.config.getParentDirectory();
+    // (the operation object stays the same, so e.g. startPreview isn't disrupted)
+    data.icaOp->matrices.swap(newMatrices);
+    data.plan.swapWith(newPlan);
+}
 
-    for (const String* tok = configTokens.begin(); tok < configTokens.end() - 1; tok += 2)
+Result ICANode::createAsr(SubProcData& data, ScopedPointer<AsrEngine>& asr)
+{
+    SortedSet<int> chans = getSelectedChannels(data);
+    if (chans.size() < 2)
     {
-        if (tok->equalsIgnoreCase("chans") || tok->equalsIgnoreCase("chan"))
-        {
-            info.nChannels = tok[1].getIntValue();
-        }
-        else if (tok->equalsIgnoreCase("weightsoutfile"))
-        {
-            info.weight = configDir.getChildFile(tok[1]);
-        }
-        else if (tok->equalsIgnoreCase("spherefile"))
+        asr = nullptr;
+        return Result::ok();
+    }
+
+    float sampleRate = data.Fs / data.dsStride;
+    Matrix calibration;
+    {
+        AudioBufferFifo::LockHandle hCache(*data.dataCache);
+        hCache.copyRecent(chans, int(AsrEngine::calibrationSec * sampleRate), calibration);
+    }
+
+    if (calibration.cols() < AsrEngine::minCalibrationSec * sampleRate)
+    {
+        return Result::fail("Collect at least " + String(AsrEngine::minCalibrationSec)
+            + " s of data in the cache before enabling ASR");
+    }
+
+    std::vector<int> inputChans;
+    for (int chan : chans)
+    {
+        inputChans.push_back(data.channelInds[chan]);
+    }
+
+    // (entries of subProcData don't move, and the engine is destroyed before its entry)
+    SubProcData* dataPtr = &data;
+    asr = new AsrEngine(data.info, inputChans, data.dsStride, sampleRate, calibration,
+        [this, dataPtr](AsrEngine& source, MatrixConstRef left, MatrixConstRef right,
+            const Eigen::VectorXf& center)
         {
-            info.sphere = configDir.getChildFile(tok[1]);
-        }
+            return updateAsr(*dataPtr, source, left, right, center);
+        });
+
+    return Result::ok();
+}
+
+bool ICANode::updateAsr(SubProcData& data, AsrEngine& source, MatrixConstRef left, MatrixConstRef right,
+    const Eigen::VectorXf& center)
+{
+    // as in updateWhitening, build the plan before taking the (try) write lock.
+    ScopedPointer<ApplyPlan> newPlan;
+    if (left.cols() > 0)
+    {
+        newPlan = new ApplyPlan(std::make_shared<const ApplyKernel>(left, right, center),
+            source.getInputChannels());
+    }
+
+    // (the plan being faded out, if any, is destroyed outside of the lock)
+    ScopedPointer<ApplyPlan> oldPlan;
+
+    const ScopedWriteTryLock icaLock(data.icaMutex);
+    if (!icaLock.isLocked() || data.asr != &source)
+    {
+        return false;
+    }
+
+    oldPlan.swapWith(data.asrPrevPlan);
+    data.asrPrevPlan.swapWith(data.asrPlan);
+    data.asrPlan.swapWith(newPlan);
+    data.asrFadePos = 0;
+    return true;
+}
+
+Result ICANode::populateInfoFromConfig(ICARunInfo& info)
+{
+    BinicaConfig config;
+    std::string error;
+    if (!readBinicaConfig(info.config.getFullPathName().toStdString(), config, error))
+    {
+        return Result::fail(error);
+    }
+
+    info.nChannels = config.numChannels;
+
+    SortedSet<int> enabledChans;
+    for (int chan : config.enabledChannels)
+    {
+        enabledChans.add(chan);
+    }
+    info.op->enabledChannels.swapWith(enabledChans);
+    info.channelGains = config.channelGains;
+
+    File configDir = info.config.getParentDirectory();
+
+    if (!config.weightFile.empty())
+    {
+        info.weight = configDir.getChildFile(config.weightFile);
     }
 
-    if (info.nChannels < 2) { return Result::fail("Invalid or missing # of channels"); }
+    if (!config.sphereFile.empty())
+    {
+        info.sphere = configDir.getChildFile(config.sphereFile);
+    }
 
     if (info.op->enabledChannels.isEmpty())
     {
@@ -1077,10 +3294,6 @@ Result ICANode::populateInfoFromConfig(ICARunInfo& info)
             info.op->enabledChannels.add(i);
         }
     }
-    else if (info.op->enabledChannels.size() != info.nChannels)
-    {
-        return Result::fail("Inconsistent number of channels");
-    }
 
     // see whether we can use existing mixing and unmixing files
     File mixingFile   = configDir.getChildFile(mixingFilename);
@@ -1089,19 +3302,45 @@ Result ICANode::populateInfoFromConfig(ICARunInfo& info)
     if (!info.weight.existsAsFile()) { return Result::fail("Invalid or missing weight file"); }
     if (!info.sphere.existsAsFile()) { return Result::fail("Invalid or missing sphere file"); }
 
-    info.op->unmixing.resize(info.nChannels, info.nChannels);
-    info.op->mixing.resize(info.nChannels, info.nChannels);
+    Matrix unmixing(info.nChannels, info.nChannels);
+    Matrix mixing(info.nChannels, info.nChannels);
+
+    // (if they're missing or from another run, the operation is just applied in full)
+    auto factors = std::make_shared<HierarchicalFactors>();
+    std::string factorsError;
+    if (!readFactors(configDir.getChildFile(factorsFilename).getFullPathName().toStdString(),
+        info.nChannels, *factors, factorsError))
+    {
+        factors = nullptr;
+    }
 
-    Result res = readMatrix(unmixingFile, info.op->unmixing);
+    Result res = readMatrix(unmixingFile, unmixing);
     if (res.wasOk())
     {
-        res = readMatrix(mixingFile, info.op->mixing);
+        res = readMatrix(mixingFile, mixing);
     }
 
-    if (res.failed())
+    if (res.wasOk())
+    {
+        if (factors && !factorsMatch(*factors, unmixing))
+        {
+            factors = nullptr;
+        }
+        info.op->setMatrices(std::move(mixing), std::move(unmixing), std::move(factors));
+    }
+    else if (factors)
+    {
+        // (the weight and sphere files only have the first level)
+        unmixing = factors->composeUnmixing();
+        mixing = factors->composeMixing();
+        info.op->setMatrices(std::move(mixing), std::move(unmixing), std::move(factors));
+        res = readResults(info);
+    }
+    else
     {
         // try using weight and sphere files
-        res = processResults(info);
+        info.op->matrices = nullptr;
+        res = readResults(info);
     }
 
     return res;
@@ -1112,15 +3351,15 @@ Result ICANode::saveMatrix(const File& dest, MatrixConstRef mat)
 {
     String fn = dest.getFileName();
 
-    FileOutputStream stream(dest);
+    AsyncFileWriter writer(dest);
 
-    if (stream.failedToOpen())
+    if (writer.getStatus().failed())
     {
         return Result::fail("Failed to open " + fn);
     }
 
-    stream.write(mat.data(), mat.size() * sizeof(float));
-    Result status = stream.getStatus();
+    writer.write(mat.data(), mat.size() * sizeof(float));
+    Result status = writer.finish();
     if (status.failed())
     {
         return Result::fail("Failed to write " + fn
@@ -1133,40 +3372,14 @@ Result ICANode::saveMatrix(const File& dest, MatrixConstRef mat)
 
 Result ICANode::readMatrix(const File& source, MatrixRef dest)
 {
-    String fn = source.getFileName();
-
-    if (!source.existsAsFile())
-    {
-        return Result::fail("Matrix file " + fn + " not found");
-    }
-
-    FileInputStream stream(source);
-    if (stream.failedToOpen())
-    {
-        return Result::fail("Failed to open " + fn
-            + " (" + stream.getStatus().getErrorMessage().trimEnd() + ")");
-    }
-
-    int size = int(dest.rows());
-    jassert(dest.cols() == size); // should always be a square matrix
-
-    if (stream.getTotalLength() != size * size * sizeof(float))
-    {
-        return Result::fail(fn + " has incorrect length");
-    }
+    jassert(dest.cols() == dest.rows()); // should always be a square matrix
 
-    HeapBlock<float> destBlock(size * size);
-    stream.read(destBlock, size * size * sizeof(float));
-
-    Result status = stream.getStatus();
-    if (status.failed())
+    std::string error;
+    if (!readRawMatrix(source.getFullPathName().toStdString(), dest, error))
     {
-        return Result::fail("Failed to read " + fn
-            + " (" + status.getErrorMessage().trimEnd() + ")");
+        return Result::fail(error);
     }
 
-    dest = MatrixMap(destBlock, size, size);
-
     return Result::ok();
 }
 
@@ -1240,6 +3453,74 @@ SortedSet<int> ICANode::stringToIntSet(const String& string)
 }
 
 
+/**** ICAOperation ****/
+
+const Matrix& ICAOperation::getMixing() const
+{
+    static const Matrix empty;
+    return matrices ? matrices->mixing : empty;
+}
+
+const Matrix& ICAOperation::getUnmixing() const
+{
+    static const Matrix empty;
+    return matrices ? matrices->unmixing : empty;
+}
+
+const HierarchicalFactors* ICAOperation::getFactors() const
+{
+    return matrices ? matrices->factors.get() : nullptr;
+}
+
+void ICAOperation::setMatrices(Matrix mixing, Matrix unmixing, HierarchicalFactorsPtr factors)
+{
+    matrices = OperatorStore::getInstance().getMatrices(std::move(mixing), std::move(unmixing),
+        std::move(factors));
+}
+
+ApplyPlan* ICAOperation::createPlan(const SortedSet<int>& subProcChans) const
+{
+    if (isNoop() || !matrices)
+    {
+        jassert(isNoop());
+        return nullptr;
+    }
+
+    std::vector<int> bufferChans;
+    for (int chan : enabledChannels)
+    {
+        jassert(chan < subProcChans.size());
+        bufferChans.push_back(subProcChans[chan]);
+    }
+
+    std::vector<int> rejected(rejectedComponents.begin(), rejectedComponents.end());
+
+    return new ApplyPlan(OperatorStore::getInstance().getKernel(matrices, rejected),
+        std::move(bufferChans));
+}
+
+ApplyPlan* ICAOperation::createLocalPlan(const SortedSet<int>* copiedChans) const
+{
+    if (isNoop() || !matrices)
+    {
+        jassert(isNoop());
+        return nullptr;
+    }
+
+    std::vector<int> localChans;
+    for (int c = 0; c < enabledChannels.size(); ++c)
+    {
+        localChans.push_back(copiedChans ? copiedChans->indexOf(enabledChannels[c]) : c);
+        jassert(localChans.back() >= 0);
+    }
+
+    std::vector<int> rejected(rejectedComponents.begin(), rejectedComponents.end());
+
+    return new ApplyPlan(OperatorStore::getInstance().getKernel(matrices, rejected),
+        std::move(localChans));
+}
+
+
 /**** SubProcInfo ****/
 
 bool SubProcInfo::operator==(const SubProcInfo& other) const
@@ -1255,8 +3536,13 @@ SubProcInfo::operator String() const
 
 /****  AudioBufferFifo ****/
 
-AudioBufferFifo::AudioBufferFifo(int numChans, int numSamps)
-    : data(new AudioSampleBuffer(numChans, numSamps))
+AudioBufferFifo::AudioBufferFifo(int numChans, int numSamps,
+    int historyEpochsIn, int historyEpochFramesIn, int historyKeepEveryIn)
+    : data              (new AudioSampleBuffer(numChans, numSamps))
+    , historyEpochs     (jmax(historyEpochsIn, 0))
+    , historyEpochFrames(jmax(historyEpochFramesIn, 1))
+    , historyKeepEvery  (jmax(historyKeepEveryIn, 1))
+    , history           (numChans, historyEpochs * historyEpochFrames)
 {
     reset();
 }
@@ -1282,6 +3568,55 @@ void AudioBufferFifo::reset()
     startPoint = 0;
     numWritten = 0;
     pctFull = 0;
+
+    historyStart = 0;
+    historyCount = 0;
+    numArchived = 0;
+}
+
+void AudioBufferFifo::archiveOldest(int numSamps)
+{
+    int bufSamps = data->getNumSamples();
+    if (historyEpochs == 0 || bufSamps == 0)
+    {
+        return;
+    }
+
+    jassert(numSamps <= numWritten);
+
+    for (int done = 0; done < numSamps;)
+    {
+        int64 epoch = numArchived / historyEpochFrames;
+        int posInEpoch = int(numArchived % historyEpochFrames);
+        int source = (startPoint + done) % bufSamps;
+
+        // up to the end of the epoch or the buffer, whichever is first
+        int n = jmin(numSamps - done, historyEpochFrames - posInEpoch, bufSamps - source);
+
+        if (epoch % historyKeepEvery == 0)
+        {
+            if (posInEpoch == 0 && historyCount == historyEpochs)
+            {
+                // make room by dropping the oldest epoch
+                historyStart = (historyStart + 1) % historyEpochs;
+                --historyCount;
+            }
+
+            int dest = ((historyStart + historyCount) % historyEpochs) * historyEpochFrames + posInEpoch;
+            for (int c = 0; c < data->getNumChannels(); ++c)
+            {
+                history.copyFrom(c, dest, *data, c, source, n);
+            }
+
+            if (posInEpoch + n == historyEpochFrames)
+            {
+                ++historyCount;
+            }
+        }
+
+        numArchived += n;
+        done += n;
+    }
 }
 
 
@@ -1311,38 +3646,68 @@ void AudioBufferFifo::Handle::resetWithSize(int numChans, int numSamps)
 
     jassert(numChans >= 0 && numSamps >= 0);
     fifo.data->setSize(numChans, numSamps);
+
+    // (with no recent samples nothing is ever archived, so don't hold on to the history tier either)
+    int historySamps = numSamps == 0 ? 0 : fifo.historyEpochs * fifo.historyEpochFrames;
+    fifo.history.setSize(numChans, historySamps);
     fifo.reset();
 }
 
+int AudioBufferFifo::Handle::getNumHistorySamples() const
+{
+    if (!isValid()) { return 0; }
+
+    return fifo.historyCount * fifo.historyEpochFrames;
+}
 
-void AudioBufferFifo::Handle::copySample(const AudioSampleBuffer& source,
-    const SortedSet<int>& channels, int sample)
+void AudioBufferFifo::Handle::setExternalProgress(int64 numSamps, int targetSamps)
 {
     if (!isValid()) { return; }
 
-    int numSamps = fifo.data->getNumSamples();
-    if (numSamps < 1) { return; }
+    jassert(fifo.data->getNumSamples() == 0);
+    fifo.pctFull = targetSamps <= 0 ? 0 : int(100 * jmin(double(numSamps) / targetSamps, 1.0));
+}
 
-    int numChans = fifo.data->getNumChannels();
-    jassert(channels.size() == numChans);
 
-    int destSample = (fifo.startPoint + fifo.numWritten) % numSamps;
+void AudioBufferFifo::Handle::writeFrames(const float* const* sources, int stride, int numFrames)
+{
+    if (!isValid()) { return; }
+
+    int numSamps = fifo.data->getNumSamples();
+    if (numSamps < 1 || numFrames < 1) { return; }
+
+    // save what's about to be overwritten to the history tier first
+    // (if there are more new frames than fit, the ones overwritten within this call are just lost)
+    fifo.archiveOldest(jlimit(0, fifo.numWritten, fifo.numWritten + numFrames - numSamps));
 
-    for (int c = 0; c < numChans; ++c)
+    // one channel at a time, so the writes to each channel are sequential
+    int destStart = (fifo.startPoint + fifo.numWritten) % numSamps;
+    for (int c = 0; c < fifo.data->getNumChannels(); ++c)
     {
-        int sourceChan = channels[c];
-        jassert(sourceChan >= 0 && sourceChan < source.getNumChannels());
-        fifo.data->setSample(c, destSample, source.getSample(sourceChan, sample));
+        const float* source = sources[c];
+        float* dest = fifo.data->getWritePointer(c);
+
+        int destSample = destStart;
+        for (int i = 0; i < numFrames; ++i)
+        {
+            dest[destSample] = source[i * stride];
+            if (++destSample == numSamps)
+            {
+                destSample = 0;
+            }
+        }
     }
 
-    if (fifo.numWritten < numSamps)
+    // once full, the oldest frames are overwritten
+    int total = fifo.numWritten + numFrames;
+    if (total > numSamps)
     {
-        fifo.numWritten++;
+        fifo.startPoint = (fifo.startPoint + total - numSamps) % numSamps;
+        fifo.numWritten = numSamps;
     }
     else
     {
-        jassert(destSample == fifo.startPoint);
-        fifo.startPoint = (fifo.startPoint + 1) % numSamps;
+        fifo.numWritten = total;
     }
 
     fifo.updateFullStatus();
@@ -1391,7 +3756,8 @@ void AudioBufferFifo::Handle::resizeKeepingData(int numSamps)
 }
 
 
-Result AudioBufferFifo::Handle::writeChannelsToFile(const File& file, const SortedSet<int>& channels)
+Result AudioBufferFifo::Handle::writeChannelsToFile(const File& file, const SortedSet<int>& channels,
+    StreamStats* stats, float historyFraction, const float* gains)
 {
     if (!isValid())
     {
@@ -1399,37 +3765,142 @@ Result AudioBufferFifo::Handle::writeChannelsToFile(const File& file, const Sort
         return Result::fail("Invalid handle to data cache");
     }
 
-    FileOutputStream stream(file);
-    if (!stream.openedOk())
+    // (this can be large, so write it without going through the OS cache)
+    AsyncFileWriter writer(file);
+    if (writer.getStatus().failed())
     {
-        return stream.getStatus();
+        return writer.getStatus();
     }
 
     jassert(isFull()); // should only be called when the FIFO is full...
 
     int numChans = fifo.data->getNumChannels();
     int numSamps = fifo.data->getNumSamples();
+    int numOutChans = channels.size();
 
     for (int chan : channels)
     {
         jassert(chan >= 0 && chan < numChans);
     }
 
-    for (int s = 0; s < numSamps; ++s)
+    // what to write, as contiguous ranges of either buffer
+    struct Segment
+    {
+        const AudioSampleBuffer* source;
+        int start;
+        int length;
+    };
+    std::vector<Segment> segments;
+
+    // whole epochs of history, evenly spaced and oldest first
+    int epochFrames = fifo.historyEpochFrames;
+    int numEpochs = jmin(fifo.historyCount, int(numSamps * jlimit(0.0f, 1.0f, historyFraction)) / epochFrames);
+    for (int k = 0; k < numEpochs; ++k)
+    {
+        int epoch = (fifo.historyStart + int((2 * k + 1) * int64(fifo.historyCount) / (2 * numEpochs))) % fifo.historyEpochs;
+        segments.push_back({ &fifo.history, epoch * epochFrames, epochFrames });
+    }
+
+    // then the most recent samples
+    int numHistory = numEpochs * epochFrames;
+    int recentStart = (fifo.startPoint + numHistory) % numSamps;
+    int recentLength = numSamps - numHistory;
+    int firstLength = jmin(recentLength, numSamps - recentStart);
+    segments.push_back({ fifo.data.get(), recentStart, firstLength });
+    if (firstLength < recentLength)
     {
-        int samp = (fifo.startPoint + s) % numSamps;
+        segments.push_back({ fifo.data.get(), 0, recentLength - firstLength });
+    }
+
+    // interleave a chunk of samples at a time
+    const int chunkSamps = 4096;
+    HeapBlock<float> chunk(chunkSamps * numOutChans);
 
-        for (int chan : channels)
+    for (const Segment& segment : segments)
+    {
+        for (int s = 0; s < segment.length; s += chunkSamps)
         {
-            if (!stream.writeFloat(fifo.data->getSample(chan, samp)))
+            int nChunk = jmin(chunkSamps, segment.length - s);
+
+            for (int k = 0; k < numOutChans; ++k)
+            {
+                const float* chanData = segment.source->getReadPointer(channels[k], segment.start + s);
+                for (int i = 0; i < nChunk; ++i)
+                {
+                    chunk[i * numOutChans + k] = chanData[i];
+                }
+            }
+
+            if (stats)
+            {
+                stats->addFrames(chunk, nChunk);
+            }
+
+            if (gains)
+            {
+                for (int i = 0; i < nChunk; ++i)
+                {
+                    for (int k = 0; k < numOutChans; ++k)
+                    {
+                        chunk[i * numOutChans + k] *= gains[k];
+                    }
+                }
+            }
+
+            // (native byte order, which is little-endian on all supported platforms)
+            if (!writer.write(chunk, nChunk * numOutChans * sizeof(float)))
             {
-                return stream.getStatus();
+                return writer.finish();
             }
         }
     }
 
-    stream.flush();
-    return stream.getStatus();
+    return writer.finish();
+}
+
+void AudioBufferFifo::Handle::estimateChannelGains(const SortedSet<int>& channels, int maxSamples,
+    std::vector<float>& gains)
+{
+    gains.assign(channels.size(), 1.0f);
+    int numSamps = isValid() ? jmin(fifo.numWritten, fifo.data->getNumSamples()) : 0;
+    if (numSamps == 0 || maxSamples < 1)
+    {
+        return;
+    }
+
+    // (the order doesn't matter, so just sample the buffer evenly)
+    int stride = jmax(1, numSamps / maxSamples);
+    std::vector<float> samples;
+    for (int k = 0; k < channels.size(); ++k)
+    {
+        const float* chanData = fifo.data->getReadPointer(channels[k]);
+        samples.clear();
+        for (int i = 0; i < numSamps; i += stride)
+        {
+            samples.push_back(chanData[i]);
+        }
+        gains[k] = robustGain(samples);
+    }
+}
+
+int AudioBufferFifo::Handle::copyRecent(const SortedSet<int>& channels, int numSamps, Matrix& dest)
+{
+    int bufSamps = fifo.data->getNumSamples();
+    int n = isValid() && bufSamps > 0 ? jlimit(0, fifo.numWritten, numSamps) : 0;
+    dest.resize(channels.size(), n);
+
+    int start = n > 0 ? (fifo.startPoint + fifo.numWritten - n) % bufSamps : 0;
+    for (int k = 0; k < channels.size(); ++k)
+    {
+        jassert(channels[k] >= 0 && channels[k] < fifo.data->getNumChannels());
+        const float* chanData = fifo.data->getReadPointer(channels[k]);
+        for (int i = 0; i < n; ++i)
+        {
+            dest(k, i) = chanData[(start + i) % bufSamps];
+        }
+    }
+
+    return n;
 }
 
 bool AudioBufferFifo::Handle::isValid() const
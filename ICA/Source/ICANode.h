@@ -23,25 +23,40 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <map>
 #include <Eigen/Dense>
 
+#include "ICAApplyPlan.h"
+#include "ICAAsyncWriter.h"
+#include "ICABinicaFiles.h"
+#include "ICAChannelGroups.h"
+#include "ICAComponentLibrary.h"
+#include "ICAComponentRecorder.h"
+#include "ICAEvaluation.h"
+#include "ICAOperatorStore.h"
+#include "ICAPreview.h"
+#include "ICAStreamStats.h"
+#include "ICASubProcTable.h"
+#include "ICATileCapture.h"
+#include "ICAWhiteningTracker.h"
+#include "ICAAsr.h"
+
 namespace ICA
 {
-    using Matrix = Eigen::MatrixXf;
-    using MatrixMap = Eigen::Map<Eigen::MatrixXf>;
-    using MatrixRef = Eigen::Ref<Eigen::MatrixXf>;
-    using MatrixConstRef = const Eigen::Ref<const Eigen::MatrixXf>&;
-
     // to cache input data to be used to compute ICA
     // modifications must be done through a handle which is secured by a mutex.
+    // Cache of the most recent numSamps samples of each channel, plus an optional
+    // long-horizon history tier: as samples are overwritten, every <historyKeepEvery>th
+    // epoch of <historyEpochFrames> samples is copied into a ring of historyEpochs epochs,
+    // so it covers historyKeepEvery times as long as its size.
     class AudioBufferFifo
     {
     public:
-        explicit AudioBufferFifo(int numChans = 0, int numSamps = 0);
+        explicit AudioBufferFifo(int numChans = 0, int numSamps = 0,
+            int historyEpochs = 0, int historyEpochFrames = 0, int historyKeepEvery = 1);
 
         int getNumSamples() const;
 
         const Value& getPctFull() const;
 
-        class Handle
+        class Handle : public FrameSink
         {
         protected:
             Handle(AudioBufferFifo& fifoIn);
@@ -49,18 +64,41 @@ namespace ICA
         public:
             bool isFull() const;
 
+            // (also clears the history tier)
             void reset();
+            // (a size of 0 also releases the history tier, until the next nonzero size)
             void resetWithSize(int numChans, int numSamps);
 
-            // copy one sample of another audio buffer
-            void copySample(const AudioSampleBuffer& source, const SortedSet<int>& channels, int sample);
+            // number of samples in complete epochs of the history tier
+            int getNumHistorySamples() const;
+
+            // for when the data is kept elsewhere and this has been resized to 0:
+            // show numSamps of targetSamps as collected
+            void setExternalProgress(int64 numSamps, int targetSamps);
+
+            // append frames (see DecimatingCapture), with one source per channel of the cache
+            void writeFrames(const float* const* sources, int stride, int numFrames) override;
 
             // changes the size of the buffer while keeping as much data as possible
             void resizeKeepingData(int numSamps);
 
-            // write all samples of the given channels to the given file in column-major order.
+            // write getNumSamples() samples of the given channels to the given file in column-major order.
+            // up to historyFraction of them are whole epochs of the history tier, spread evenly over
+            // it, and the rest are the most recent samples; they are written in chronological order.
             // expects that the FIFO is already full.
-            Result writeChannelsToFile(const File& file, const SortedSet<int>& channels);
+            // if stats is non-null, the data is also added to it as it is written.
+            // if gains is non-null, each channel is multiplied by its gain as it is written
+            // (but not in stats).
+            Result writeChannelsToFile(const File& file, const SortedSet<int>& channels,
+                StreamStats* stats = nullptr, float historyFraction = 0, const float* gains = nullptr);
+
+            // a robust gain for each of the given channels (see robustGain), from up to
+            // maxSamples evenly spaced samples of each.
+            void estimateChannelGains(const SortedSet<int>& channels, int maxSamples, std::vector<float>& gains);
+
+            // copy the most recent numSamps samples (or as many as there are) of the given
+            // channels to dest (channels x samples). returns the number of samples copied.
+            int copyRecent(const SortedSet<int>& channels, int numSamps, Matrix& dest);
 
         private:
             // whether operations should be permitted
@@ -91,11 +129,23 @@ namespace ICA
 
         void reset();
 
+        // pass the oldest numSamps samples to the history tier before they are overwritten
+        void archiveOldest(int numSamps);
+
         ScopedPointer<AudioSampleBuffer> data;
         CriticalSection mutex;
 
         int startPoint;
         int numWritten;
+
+        const int historyEpochs;
+        const int historyEpochFrames;
+        const int historyKeepEvery;
+
+        AudioSampleBuffer history; // numChans x (historyEpochs * historyEpochFrames)
+        int historyStart;          // oldest complete epoch
+        int historyCount;          // number of complete epochs
+        int64 numArchived;         // samples passed to archiveOldest since reset
         Value pctFull; // for display - rounded down to int
         
         JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AudioBufferFifo);
@@ -122,8 +172,7 @@ namespace ICA
     // this allows it to be loaded in similar but nonidentical signal chains.
     struct ICAOperation
     {
-        Matrix mixing;
-        Matrix unmixing;
+        OperatorMatricesPtr matrices;     // shared with any identical operations (see OperatorStore)
         SortedSet<int> enabledChannels;   // of this subprocessor's channels, which to include in ica
         SortedSet<int> rejectedComponents;
 
@@ -132,10 +181,31 @@ namespace ICA
             return enabledChannels.isEmpty();
         }
 
+        // empty if the matrices haven't been set
+        const Matrix& getMixing() const;
+        const Matrix& getUnmixing() const;
+
+        // uses the stored copy of these matrices if there is one.
+        // factors, if given, must compose to the same matrices (see HierarchicalFactors).
+        void setMatrices(Matrix mixing, Matrix unmixing, HierarchicalFactorsPtr factors = nullptr);
+
+        // null unless the operation was trained in two levels
+        const HierarchicalFactors* getFactors() const;
+
+        // compile this operation for a subprocessor whose channels have the given indices
+        // in the processor's buffer. returns null if this is a no-op.
+        ApplyPlan* createPlan(const SortedSet<int>& subProcChans) const;
+
+        // same, but for a copy of just the enabled channels, in order (e.g. for previews), or
+        // of the given subprocessor channels, in order (which must include the enabled ones).
+        ApplyPlan* createLocalPlan(const SortedSet<int>* copiedChans = nullptr) const;
+
         JUCE_LEAK_DETECTOR(ICAOperation);
     };
 
-    class ICANode : public GenericProcessor, public Thread
+    class ICAProcess;
+
+    class ICANode : public GenericProcessor, public Thread, private Timer
     {
     public:
         ICANode();
@@ -164,6 +234,9 @@ namespace ICA
 
         void updateSettings() override;
 
+        void startRecording() override;
+        void stopRecording() override;
+
         // Thread function - does an ICA run.
         void run() override;
 
@@ -181,6 +254,51 @@ namespace ICA
         String getDirSuffix() const;
         void setDirSuffix(const String& suffix);
 
+        // whether to save the removed components while recording (see ComponentRecorder)
+        // can't be changed during acquisition.
+        bool getRecordRemoved() const;
+        void setRecordRemoved(bool record);
+
+        // whether runs compare several training lengths and solver settings on held-out
+        // data and use the cheapest one that scores close to the best (see evaluateICA)
+        bool getAutoSelect() const;
+        void setAutoSelect(bool autoSel);
+
+        // whether to keep the rotation of each operation fixed but update its whitening
+        // from the recent input covariance (see WhiteningTracker). turning this off keeps
+        // the most recent matrices.
+        bool getTrackWhitening() const;
+        void setTrackWhitening(bool track);
+
+        // whether to remove high-amplitude bursts from the selected channels before ICA is
+        // applied, using the most recent data in the cache as reference (see AsrEngine).
+        // fails if there isn't enough cached data yet. turned off when settings are updated.
+        bool getAsrEnabled() const;
+        Result setAsrEnabled(bool enable);
+
+        // whether runs train on a mix of the most recent data and epochs sampled from the
+        // cache's history tier (historyFraction of the training length, if there is enough),
+        // rather than just the most recent data.
+        bool getUseHistory() const;
+        void setUseHistory(bool use);
+
+        // whether, while recording, to stop filling the data caches and instead read the
+        // training data back from the files the record node is writing (which must be
+        // upstream of this processor). takes effect when recording starts.
+        bool getTrainFromRecording() const;
+        void setTrainFromRecording(bool fromRecording);
+
+        // whether to keep a library of the components rejected on each input (see
+        // getLibraryFile), and reject components of new decompositions that match it.
+        bool getUseLibrary() const;
+        void setUseLibrary(bool use);
+
+        // whether runs that split the channels into groups also train a small decomposition of
+        // the strongest components of all groups, to capture sources that span several groups
+        // (see performGlobalICA). the result is applied in factored form (see ApplyKernel).
+        bool getHierarchical() const;
+        void setHierarchical(bool hier);
+
         const std::map<uint32, SubProcInfo>& getSubProcInfo() const;
         uint32 getCurrSubProc() const;
         void setCurrSubProc(uint32 fullId);
@@ -199,43 +317,141 @@ namespace ICA
 
         // returns null if there is no input or no real operation (i.e. operation is a no-op)
         // otherwise, returns the current operation and makes a lock in the passed-in pointer for its mutex.
+        // while previewing a new decomposition, returns that instead.
         const ICAOperation* readICAOperation(ScopedPointer<ScopedReadLock>& lock) const;
 
-        // similar to above
-        ICAOperation* writeICAOperation(ScopedPointer<ScopedWriteLock>& lock) const;
+        // keep or reject a component of the current operation (and recompile it)
+        // while previewing, changes the candidate instead.
+        void setComponentSelected(int comp, bool selected);
+
+        /**** preview of a candidate operation (for the current subprocessor) ****/
+
+        // start with the current rejected components as the candidate.
+        // fails if there is no operation. while previewing, a decomposition that is loaded
+        // or trained for this subprocessor becomes the candidate instead of being applied.
+        Result startPreview();
+
+        // discard the candidate
+        void stopPreview();
+
+        // make the candidate the current operation (in a single plan swap) and stop previewing.
+        void promotePreview();
+
+        bool isPreviewing() const;
+
+        // while previewing, the candidate's rejected components; otherwise null.
+        // only valid while holding the lock from readICAOperation.
+        const SortedSet<int>* getPreviewCandidate() const;
+
+        // while previewing, the channels shown (those of the current and candidate operations);
+        // otherwise null. only valid while holding the lock from readICAOperation.
+        const SortedSet<int>* getPreviewChannels() const;
+
+        // changes whenever a new decomposition becomes the candidate
+        int getPreviewVersion() const;
+
+        // most recent output (downsampled) of the current and candidate operations (see PreviewEngine)
+        bool getPreviewSnapshot(Matrix& current, Matrix& candidate) const;
 
         // get root directory of ICA results
         static File getICABaseDir();
 
+        // directory to save removed components in, for a recording that is starting now
+        // (contains a subdirectory for each subprocessor)
+        static File getRemovedComponentsDir();
+
+        /**** also used by ICAApplyNode to load operations ****/
+
+        // for temporary storage while calculating ICA operation
+        struct ICARunInfo
+        {
+            uint32 subProc;
+            int nSamples = 0;
+            int nChannels = 0;
+            float sampleRate = 0; // of the cached data
+            ChannelGroups groups; // to train separately (indices into enabled channels), or empty
+            std::vector<float> channelGains; // that the training data was multiplied by, or empty
+            Eigen::MatrixXd covariance; // of the enabled channels, if it was computed to group them
+            File config;
+            File weight;
+            File sphere;
+            ScopedPointer<ICAOperation> op;
+        };
+
+        // For use when loading data. Uses .sc config file to fill in
+        // other information (including the transformation itself)
+        static Result populateInfoFromConfig(ICARunInfo& info);
+
+        // Read in output from binica (weight and sphere files) and compute the mixing
+        // and unmixing matrices, unless the unmixing matrix is already present.
+        // Also saves both to files next to the config file (and the operation's factors, if any).
+        static Result readResults(ICARunInfo& info);
+
+        // Helper to save processed ICA transformation
+        static Result saveMatrix(const File &dest, MatrixConstRef mat);
+
+        // Helper to read ICA output
+        static Result readMatrix(const File& source, MatrixRef dest);
+
+        // for encoding matrices in XML
+        static void saveMatrixToXml(XmlElement* xml, MatrixConstRef mat);
+        static Result readMatrixFromXml(const XmlElement* xml, MatrixRef dest);
+
+        // for encoding sets of channels etc. in XML
+        static String intSetToString(const SortedSet<int>& set);
+        static SortedSet<int> stringToIntSet(const String& string);
+
     private:
         /**** member types ****/
 
+        // (see SubProcTable for which threads may use it how)
         struct SubProcData
         {
+            SubProcInfo info; // (copy of the entry in subProcInfo, for use off the message thread)
+
             float Fs;
             int dsStride; // = Fs / icaTargetFs (rounded to an int)
-            int dsOffset;
+
+            // fills dataCache, in the same pass as plan when possible
+            ScopedPointer<DecimatingCapture> capture;
+
+            // while cacheOnDisk, samples received since recording started (under the cache lock)
+            int64 recordedSamples;
 
             SortedSet<int> channelInds; // (indices in this processor)
 
             // for colllecting data for ICA during acquisition
-            ScopedPointer<AudioBufferFifo> dataCache;
+            // (shared with the entry that replaces this one, if it has the same channels)
+            std::shared_ptr<AudioBufferFifo> dataCache;
 
             ReadWriteLock icaMutex; // controls below variables
             ScopedPointer<ICAOperation> icaOp;
+            ScopedPointer<ApplyPlan> plan; // compiled icaOp, or null if it is a no-op
             Value icaConfigPath;    // full path of current ICA transformatiion config file, if any
+            ScopedPointer<ComponentRecorder> recorder; // null unless recordRemoved is set
+            ScopedPointer<PreviewEngine> preview;      // null unless previewing
+            SortedSet<int> candidateRejected;          // (while previewing)
+            SortedSet<int> previewChans;               // (while previewing) channels copied to preview
+            ScopedPointer<ICAOperation> candidateOp;   // (while previewing) new decomposition, or null
+            String candidateConfigPath;                // (for candidateOp)
+
+            // burst correction (null unless asrEnabled and there is a correction). after each
+            // update, the output crossfades from asrPrevPlan to asrPlan over one ASR step.
+            ScopedPointer<ApplyPlan> asrPlan;
+            ScopedPointer<ApplyPlan> asrPrevPlan;
+            int asrFadePos = 0;
+            ScopedPointer<AsrEngine> asr;               // null unless asrEnabled
+
+            // null unless trackWhitening is set and there is an operation.
+            // (last, so it's stopped before anything it refers to is destroyed)
+            ScopedPointer<WhiteningTracker> tracker;
         };
 
-        // for temporary storage while calculating ICA operation
-        struct ICARunInfo
+        // settings written to binica config files, besides the data and output files
+        struct SolverPreset
         {
-            uint32 subProc;
-            int nSamples = 0;
-            int nChannels = 0;
-            File config;
-            File weight;
-            File sphere;
-            ScopedPointer<ICAOperation> op;
+            const char* name;
+            const char* settings; // config lines
         };
 
         /***** nonstatic member functions ****/
@@ -243,17 +459,111 @@ namespace ICA
         // Populate the info struct
         Result prepareICA(ICARunInfo& info);
 
+        // channels of the given subprocessor's data that are selected in the editor
+        // (indices within the subprocessor)
+        SortedSet<int> getSelectedChannels(const SubProcData& data) const;
+
         // Write data for ICA to input.floatdata file
         Result writeCacheData(ICARunInfo& info);
         
         // Call the binica executable on our sample data
+        // (or do performGroupedICA, if the channels were split into groups)
         Result performICA(ICARunInfo& info);
 
+        // Run binica separately on each group of channels in info.groups (several at once),
+        // and combine the results into block-diagonal weight and sphere files, so that the
+        // output looks like that of a single run.
+        Result performGroupedICA(ICARunInfo& info);
+
+        // Second level of a grouped run, if hierarchical is on: select the strongest few
+        // components of each group from the block-diagonal result (given as the combined
+        // weight and sphere matrices), run binica on their activations, and set info.op
+        // to the composed operation along with its factors.
+        Result performGlobalICA(ICARunInfo& info, MatrixConstRef weights, MatrixConstRef sphere);
+
+        // Instead of performICA (when autoSelect is on): hold out the most recent part of
+        // the cached data and run binica on several lengths of the rest with each solver preset.
+        // Each result is scored on the held-out data (see HeldOutEvaluator), and the cheapest
+        // one that is close enough to the best is used as the output of this run.
+        Result evaluateICA(ICARunInfo& info);
+
+        // Run binica and wait for it to finish (or for the thread to be told to exit)
+        Result runBinica(const File& config);
+
+        // Interpret the exit status of a binica process that has finished
+        static Result getBinicaResult(const ICAProcess& proc);
+
+        // Write a binica config file. File names are relative to the config file's directory.
+        static Result writeConfig(const File& config, const SortedSet<int>& enabledChannels,
+            const String& dataFile, int nSamples, const String& weightFile, const String& sphereFile,
+            const SolverPreset& solver, const std::vector<float>& channelGains);
+
+        // For writeCacheData while cacheOnDisk: write the last icaSamples (decimated) samples of the
+        // enabled channels from the recording of the subprocessor to dest, like the cache would.
+        Result writeRecordedData(ICARunInfo& info, const SubProcData& data, const File& dest,
+            StreamStats& stats);
+
+        // Find the continuous data file of the current recording of a subprocessor, with the
+        // binary record engine, from its structure file. Also gets the number of channels in
+        // the file and, for each of the given channels, its column and bit-volts. Only recordings
+        // started since startTime and made by one of upstreamIDs (processors before this one) are used.
+        static Result findRecordedStream(const SubProcInfo& info, const SortedSet<int>& channels,
+            Time startTime, const SortedSet<int>& upstreamIDs, File& datFile, int& nFileChans,
+            Array<int>& fileChans, Array<float>& bitVolts);
+
+        // Read frames of an interleaved float file written by writeCacheData
+        static Result readFrames(const File& source, int nChannels, int startFrame, int nFrames, float* dest);
+
+        // Copy frames of an interleaved float file to a new file
+        static Result copyFrames(const File& source, const File& dest, int nChannels, int startFrame, int nFrames);
+
+        // Write each group of channels of an interleaved float file to its own file
+        static Result splitChannels(const File& source, int nChannels, int nFrames,
+            const ChannelGroups& groups, const Array<File>& dests);
+
+        // Write linear combinations of the channels of an interleaved float file (one per row
+        // of coefs) to a new interleaved file
+        static Result transformFrames(const File& source, int nChannels, int nFrames,
+            MatrixConstRef coefs, const File& dest);
+
         // Read in output from binica and compute fields of ICAOutput
+        // (see readResults - this is a member so that it fits into the run() sequence)
+        // Also saves statistics of the components of the training data.
         Result processResults(ICARunInfo& info);
 
+        // Save statistics of the training data's components (see componentStatsFilename)
+        static Result writeComponentStats(const ICARunInfo& info);
+
+        // Save a table of per-channel statistics, with one row per channel of stats
+        static Result saveStatsTable(const File& dest, const StreamStats& stats, const StringArray& labels);
+
+        static StreamStatsOptions getStatsOptions(float sampleRate);
+
         Result setRejectedCompsBasedOnCurrent(ICARunInfo& info);
 
+        // If useLibrary is on, reject the components that match the library of the
+        // subprocessor instead, if there are any
+        Result applyLibrary(ICARunInfo& info);
+
+        // If useLibrary is on, save fingerprints of the rejected components of the subprocessor's
+        // current operation to its library, replacing any that were saved from the same run.
+        // Call on the message thread after the rejected components change. The save happens
+        // later (see libraryUpdateDelayMs), so that a series of clicks only writes once.
+        void updateLibrary(uint32 subProc);
+
+        // writes any updates queued by updateLibrary
+        void saveLibraryUpdates();
+
+        // saves the queued library updates
+        void timerCallback() override;
+
+        // where the library of a subprocessor is kept (across sessions), by source name and index
+        static File getLibraryFile(const SubProcInfo& info);
+
+        // spectral signature of each component (diff ratio and line noise ratios, see StreamStats)
+        // from a component statistics table; empty if the table is missing or doesn't match.
+        static std::vector<std::vector<float>> readComponentSpectra(const File& statsFile, int nComps);
+
         // Tries to set the ICA operation described in info (i.e. on the correct
         // subprocessor, with the matrices, enabled channels, and rejected components
         // in the pointed-to operation.
@@ -265,30 +575,38 @@ namespace ICA
         // first component.
         Result setNewICAOp(ICARunInfo& info);
 
+        // If the subprocessor is being previewed, make info.op the candidate (which leaves
+        // info.op null) and return true; otherwise, do nothing and return false.
+        bool setCandidateICAOp(SubProcData& data, ICARunInfo& info);
+
+        // Preview engine for the given channels of a subprocessor (see PreviewEngine)
+        PreviewEngine* createPreview(const SubProcData& data, const SortedSet<int>& chans,
+            ApplyPlan* currentPlan, ApplyPlan* candidatePlan);
+
         // Load ICA for a specific subprocessor.
         // If rejectSet is non-null, it will be *swapped* into the resulting operation's
         // rejected components, if possible.
         Result loadICA(const File& configFile, uint32 subProc, const SortedSet<int>* rejectSet = nullptr);
-        
-        // For use when loading data. Uses .sc config file to fill in
-        // other information (including the transformation itself)
-        Result populateInfoFromConfig(ICARunInfo& info);
 
-        /**** static member functions ****/
+        // make a tracker for the given operation of the given subprocessor's data
+        // (or null if it is a no-op). does not need the lock, but op must not change meanwhile.
+        WhiteningTracker* createTracker(SubProcData& data, const ICAOperation& op);
 
-        // Helper to save processed ICA transformation
-        static Result saveMatrix(const File &dest, MatrixConstRef mat);
-
-        // Helper to read ICA output
-        static Result readMatrix(const File& source, MatrixRef dest);
+        // callback from a tracker: replace the matrices of the current operation, unless the
+        // tracker has been replaced, a preview is in progress or the selected components change
+        // meanwhile (the next update will come soon). unmixing is the tracker's output, which is
+        // the first level of the operation if factors (of the tracked operation) isn't null.
+        void updateWhitening(SubProcData& data, WhiteningTracker& source, MatrixConstRef unmixing,
+            const HierarchicalFactorsPtr& factors);
 
-        // for encoding matrices in XML
-        static void saveMatrixToXml(XmlElement* xml, MatrixConstRef mat);
-        static Result readMatrixFromXml(const XmlElement* xml, MatrixRef dest);
+        // calibrate an ASR engine on the cached data of the given subprocessor's selected channels
+        // (or return null if there are fewer than 2 of them). fails if there isn't enough data.
+        Result createAsr(SubProcData& data, ScopedPointer<AsrEngine>& asr);
 
-        // for encoding sets of channels etc. in XML
-        static String intSetToString(const SortedSet<int>& set);
-        static SortedSet<int> stringToIntSet(const String& string);
+        // callback from an ASR engine: compile its new correction and start fading to it.
+        // returns false if it couldn't be used (e.g. the lock was busy).
+        bool updateAsr(SubProcData& data, AsrEngine& source, MatrixConstRef left, MatrixConstRef right,
+            const Eigen::VectorXf& center);
 
 
         /**** nonstatic data members ****/
@@ -297,9 +615,49 @@ namespace ICA
 
         String icaDirSuffix; // updated from editor
 
+        bool recordRemoved; // updated from editor
+
+        bool autoSelect; // updated from editor
+
+        bool trackWhitening; // updated from editor
+
+        bool asrEnabled; // updated from editor
+
+        bool useHistory; // updated from editor
+
+        bool trainFromRecording; // updated from editor
+
+        bool useLibrary; // updated from editor
+        CriticalSection libraryMutex; // for reading and writing library files and pendingLibraryUpdates
+
+        // what updateLibrary saves: the selection of a run, as of the last change
+        struct LibraryUpdate
+        {
+            File libraryFile;
+            File configFile;
+            Matrix mixing;
+            std::vector<int> channels;
+            SortedSet<int> rejected;
+        };
+
+        std::vector<LibraryUpdate> pendingLibraryUpdates;
+
+        bool hierarchical; // updated from editor
+
+        // nonzero while recording with trainFromRecording on: the data caches are
+        // released, and runs read their data from the recording instead
+        Atomic<int> cacheOnDisk;
+
+        // which recordings findRecordedStream may use, as of when cacheOnDisk was last set
+        Time recordingStartTime;
+        SortedSet<int> upstreamNodeIDs;
+
+        // see getPreviewVersion
+        Atomic<int> previewVersion;
+
         // ordered so that combobox is consistent/goes in lexicographic order of subproc
         std::map<uint32, SubProcInfo> subProcInfo;
-        std::map<uint32, SubProcData> subProcData;
+        SubProcTable<SubProcData> subProcData;
 
         // relevant to state of editor and canvas
         uint32 currSubProc;      // full source ID of selected subproc
@@ -307,17 +665,17 @@ namespace ICA
         Value currPctFull;
         Value icaRunning;
 
-        // temporary storage for ICA components
-        AudioSampleBuffer componentBuffer;
-        
+        // temporary storage for applying ICA plans
+        ApplyPlan::Scratch applyScratch;
+
 
         /**** static constants ****/
 
-        // frequency at which samples are taken for ICA
+        // frequency at which samples are taken for ICA (and for previews)
         static const float icaTargetFs;
 
-        // start of line containing enabled channels hint in binica.sc files
-        static const String chanHintPrefix;
+        // length of preview shown on the canvas
+        static const float previewLengthSec;
 
         static const String inputFilename;
         static const String configFilename;
@@ -326,6 +684,60 @@ namespace ICA
         static const String mixingFilename;
         static const String unmixingFilename;
 
+        // for evaluateICA:
+        static const String evalDirname;
+        static const String evalResultsFilename;
+
+        static const SolverPreset solverPresets[]; // in increasing order of cost
+        static const int numSolverPresets;
+        static const int defaultSolverPreset;      // used when not evaluating
+
+        static const float evalTrainFractions[];   // of the data that isn't held out
+        static const int numEvalTrainFractions;
+        static const float heldOutFraction;        // of the cache
+        static const double evalTolerance;         // see selectCandidate
+        static const double evalMinStability;
+
+        // statistics of the training data, next to the config file
+        static const String channelStatsFilename;
+        static const String componentStatsFilename;
+        static const float lineFreqs[]; // reported in the statistics
+        static const int numLineFreqs;
+
+        // library matching (see ComponentLibrary::match)
+        static const String libraryDirname; // in the user's application data, under open-ephys
+        static const float libraryMinSimilarity;
+        static const float libraryMaxSpectralDistance;
+        static const int libraryUpdateDelayMs;
+
+        // runs with more enabled channels than this are split into groups of at most this many
+        // correlated channels, which are trained separately (see groupChannels)
+        static const int maxGroupChannels;
+        static const String groupDirname;
+        static const String groupsFilename;
+
+        // with hierarchical on, the second level is trained on up to about this many components
+        // (an equal number from each group, at least 2)
+        static const int maxGlobalComponents;
+        static const String globalName; // of its files in the group directory
+
+        // the training data is normalized to a similar scale on each channel, so that binica's
+        // steps are well-conditioned; each channel's gain is estimated from this many samples
+        static const int gainEstimateSamples;
+
+        // history tier of each data cache: every <historyKeepEvery>th epoch of <historyEpochSec>
+        // that leaves the cache is kept, up to historySec in total.
+        static const float historyEpochSec;
+        static const int historyKeepEvery;
+        static const float historySec;
+        static const float historyFraction; // of the training data, when useHistory is on
+
+        // written by the binary record engine next to each recording's data
+        static const String recordingStructureFilename;
+        static const String recordingDataFilename;
+        // how long before startRecording a recording's structure file may have been written
+        static const int recordingStartSlackMs;
+
         JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ICANode);
     };
 
@@ -0,0 +1,177 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICAOperatorStore.h"
+
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+using namespace ICA;
+
+// FNV-1a
+static const uint64_t hashBasis = 14695981039346656037ull;
+
+static uint64_t hashBytes(const void* data, size_t size, uint64_t hash)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static uint64_t hashMatrix(MatrixConstRef mat, uint64_t hash)
+{
+    int64_t dims[] = { mat.rows(), mat.cols() };
+    hash = hashBytes(dims, sizeof(dims), hash);
+
+    // (stored matrices are always contiguous)
+    for (int c = 0; c < mat.cols(); ++c)
+    {
+        hash = hashBytes(mat.col(c).data(), mat.rows() * sizeof(float), hash);
+    }
+    return hash;
+}
+
+// (localMixing is left out, since it is the inverse of localUnmixing)
+static uint64_t hashFactors(const HierarchicalFactors* factors, uint64_t hash)
+{
+    unsigned char present = factors ? 1 : 0;
+    hash = hashBytes(&present, sizeof(present), hash);
+    if (factors)
+    {
+        hash = hashMatrix(factors->localUnmixing, hash);
+        hash = hashBytes(factors->selected.data(), factors->selected.size() * sizeof(int), hash);
+        hash = hashMatrix(factors->globalUnmixing, hash);
+    }
+    return hash;
+}
+
+static bool sameContents(const Matrix& a, const Matrix& b)
+{
+    return a.rows() == b.rows() && a.cols() == b.cols()
+        && std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+}
+
+static bool sameContents(const HierarchicalFactors* a, const HierarchicalFactors* b)
+{
+    if (!a || !b)
+    {
+        return a == b;
+    }
+
+    return a == b || (sameContents(a->localUnmixing, b->localUnmixing) && a->selected == b->selected
+        && sameContents(a->globalUnmixing, b->globalUnmixing));
+}
+
+
+/**** OperatorMatrices ****/
+
+OperatorMatrices::OperatorMatrices(Matrix mixingIn, Matrix unmixingIn,
+    HierarchicalFactorsPtr factorsIn, uint64_t contentHash)
+    : mixing  (std::move(mixingIn))
+    , unmixing(std::move(unmixingIn))
+    , factors (std::move(factorsIn))
+    , hash    (contentHash)
+{}
+
+
+/**** OperatorStore ****/
+
+OperatorStore& OperatorStore::getInstance()
+{
+    static OperatorStore instance;
+    return instance;
+}
+
+OperatorMatricesPtr OperatorStore::getMatrices(Matrix mixing, Matrix unmixing,
+    HierarchicalFactorsPtr factors)
+{
+    uint64_t hash = hashFactors(factors.get(), hashMatrix(unmixing, hashMatrix(mixing, hashBasis)));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    removeExpired();
+
+    auto range = matricesByHash.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        OperatorMatricesPtr existing = it->second.lock();
+        if (existing && sameContents(existing->mixing, mixing) && sameContents(existing->unmixing, unmixing)
+            && sameContents(existing->factors.get(), factors.get()))
+        {
+            return existing;
+        }
+    }
+
+    auto added = std::make_shared<const OperatorMatrices>(std::move(mixing), std::move(unmixing),
+        std::move(factors), hash);
+    matricesByHash.emplace(hash, added);
+    return added;
+}
+
+std::shared_ptr<const ApplyKernel> OperatorStore::getKernel(const OperatorMatricesPtr& matrices,
+    const std::vector<int>& rejected)
+{
+    if (!matrices)
+    {
+        return nullptr;
+    }
+
+    uint64_t hash = hashBytes(&matrices->hash, sizeof(matrices->hash), hashBasis);
+    hash = hashBytes(rejected.data(), rejected.size() * sizeof(int), hash);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    removeExpired();
+
+    auto range = kernelsByHash.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        const KernelEntry& entry = it->second;
+        if (entry.matrices.lock() == matrices && entry.rejected == rejected)
+        {
+            if (auto existing = entry.kernel.lock())
+            {
+                return existing;
+            }
+        }
+    }
+
+    // compile without holding the lock (if another thread adds the same one meanwhile,
+    // there will just be two copies until one is released)
+    lock.unlock();
+    auto added = std::make_shared<const ApplyKernel>(matrices->mixing, matrices->unmixing, rejected,
+        matrices->factors.get());
+    lock.lock();
+
+    kernelsByHash.emplace(hash, KernelEntry{ matrices, rejected, added });
+    return added;
+}
+
+void OperatorStore::removeExpired()
+{
+    for (auto it = matricesByHash.begin(); it != matricesByHash.end();)
+    {
+        it = it->second.expired() ? matricesByHash.erase(it) : std::next(it);
+    }
+
+    for (auto it = kernelsByHash.begin(); it != kernelsByHash.end();)
+    {
+        it = it->second.kernel.expired() ? kernelsByHash.erase(it) : std::next(it);
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef ICA_OPERATOR_STORE_H_DEFINED
+#define ICA_OPERATOR_STORE_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Process-wide storage for the matrices of ICA operations and their compiled kernels,
+// so that operations with identical matrices (e.g. the same decomposition loaded onto
+// several mirrored subprocessors or processors) share one copy of each.
+
+#include <mutex>
+#include <unordered_map>
+
+#include "ICAApplyPlan.h"
+
+namespace ICA
+{
+    // The mixing and unmixing matrices of an operation. Immutable once stored.
+    struct OperatorMatrices
+    {
+        OperatorMatrices(Matrix mixing, Matrix unmixing, HierarchicalFactorsPtr factors, uint64_t hash);
+
+        const Matrix mixing;
+        const Matrix unmixing;
+        const HierarchicalFactorsPtr factors; // if it was trained in two levels (may be null)
+        const uint64_t hash; // of the contents of both matrices and the factors
+    };
+
+    using OperatorMatricesPtr = std::shared_ptr<const OperatorMatrices>;
+
+    // Entries are held weakly: they are removed once nothing else refers to them.
+    // Thread safe, but not for use on the audio thread (lookups lock a mutex and may allocate).
+    class OperatorStore
+    {
+    public:
+        static OperatorStore& getInstance();
+
+        // Returns the stored matrices equal to mixing, unmixing and factors (compared by contents),
+        // adding them if there are none.
+        OperatorMatricesPtr getMatrices(Matrix mixing, Matrix unmixing,
+            HierarchicalFactorsPtr factors = nullptr);
+
+        // Returns the kernel for the given stored matrices and rejected components, compiling
+        // and adding it if there is none. rejected must be sorted with no duplicates.
+        std::shared_ptr<const ApplyKernel> getKernel(const OperatorMatricesPtr& matrices,
+            const std::vector<int>& rejected);
+
+    private:
+        OperatorStore() {}
+
+        struct KernelEntry
+        {
+            std::weak_ptr<const OperatorMatrices> matrices;
+            std::vector<int> rejected;
+            std::weak_ptr<const ApplyKernel> kernel;
+        };
+
+        // drop entries that are no longer used (called with the mutex held)
+        void removeExpired();
+
+        std::mutex mutex;
+
+        // keyed by content hash
+        std::unordered_multimap<uint64_t, std::weak_ptr<const OperatorMatrices>> matricesByHash;
+
+        // keyed by hash of the matrices' hash and the rejected components
+        std::unordered_multimap<uint64_t, KernelEntry> kernelsByHash;
+
+        OperatorStore(const OperatorStore&) = delete;
+        OperatorStore& operator=(const OperatorStore&) = delete;
+    };
+}
+
+#endif // ICA_OPERATOR_STORE_H_DEFINED
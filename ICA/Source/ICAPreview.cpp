@@ -0,0 +1,212 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICAPreview.h"
+
+#include <cstring>
+
+using namespace ICA;
+
+// frames of input that can be buffered before the worker must catch up
+static const int fifoFrames = 4096;
+
+PreviewEngine::PreviewEngine(const String& name, const std::vector<int>& chans, int inStride,
+    int historyFrames, ApplyPlan* currentPlan, ApplyPlan* candidatePlan)
+    : Thread            ("ICA preview " + name)
+    , inputChans        (chans)
+    , stride            (jmax(inStride, 1))
+    , strideOffset      (0)
+    , fifo              (fifoFrames * jmax(int(chans.size()), 1))
+    , fifoData          (fifo.getTotalSize())
+    , current           (currentPlan)
+    , candidate         (candidatePlan)
+    , currentData       (ApplyPlan::tileSize * chans.size())
+    , candidateData     (ApplyPlan::tileSize * chans.size())
+    , currentChans      (chans.size())
+    , candidateChans    (chans.size())
+    , currentHistory    (Matrix::Zero(historyFrames, chans.size()))
+    , candidateHistory  (Matrix::Zero(historyFrames, chans.size()))
+    , historyPos        (0)
+    , historyCount      (0)
+{
+    int nChans = getNumChannels();
+    scratch.ensureSize(nChans);
+
+    for (int c = 0; c < nChans; ++c)
+    {
+        currentChans[c] = currentData + c * ApplyPlan::tileSize;
+        candidateChans[c] = candidateData + c * ApplyPlan::tileSize;
+    }
+
+    startThread();
+}
+
+PreviewEngine::~PreviewEngine()
+{
+    stopThread(500);
+}
+
+int PreviewEngine::getNumChannels() const
+{
+    return int(inputChans.size());
+}
+
+void PreviewEngine::setCandidate(ApplyPlan* candidatePlan)
+{
+    // (the old plan is destroyed outside of the lock)
+    ScopedPointer<ApplyPlan> newPlan(candidatePlan);
+
+    const ScopedLock planLock(planMutex);
+    candidate.swapWith(newPlan);
+}
+
+void PreviewEngine::pushInput(const float* const* data, int numSamples)
+{
+    int nChans = getNumChannels();
+    int nFrames = (numSamples - strideOffset + stride - 1) / stride;
+    if (nFrames <= 0 || nChans == 0)
+    {
+        strideOffset -= numSamples;
+        return;
+    }
+
+    // if the worker is behind, just skip this block (it's only for display)
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(nFrames * nChans, start1, size1, start2, size2);
+
+    if (size1 + size2 == nFrames * nChans)
+    {
+        // since everything is written in whole frames, frames don't wrap around
+        int i = 0;
+        for (int s = strideOffset; s < numSamples; s += stride)
+        {
+            float* dest = &fifoData[i < size1 ? start1 + i : start2 + i - size1];
+            for (int c = 0; c < nChans; ++c)
+            {
+                dest[c] = data[inputChans[c]][s];
+            }
+            i += nChans;
+        }
+
+        fifo.finishedWrite(size1 + size2);
+    }
+
+    strideOffset += nFrames * stride - numSamples;
+}
+
+bool PreviewEngine::getSnapshot(Matrix& currentOut, Matrix& candidateOut) const
+{
+    const ScopedLock historyLock(historyMutex);
+
+    if (historyCount == 0)
+    {
+        return false;
+    }
+
+    int nChans = getNumChannels();
+    int nHistory = int(currentHistory.rows());
+
+    currentOut.resize(historyCount, nChans);
+    candidateOut.resize(historyCount, nChans);
+
+    // unwrap the ring buffers
+    int oldest = (historyPos - historyCount + nHistory) % nHistory;
+    int nFirst = jmin(historyCount, nHistory - oldest);
+    int nSecond = historyCount - nFirst;
+
+    currentOut.topRows(nFirst) = currentHistory.middleRows(oldest, nFirst);
+    candidateOut.topRows(nFirst) = candidateHistory.middleRows(oldest, nFirst);
+
+    if (nSecond > 0)
+    {
+        currentOut.bottomRows(nSecond) = currentHistory.topRows(nSecond);
+        candidateOut.bottomRows(nSecond) = candidateHistory.topRows(nSecond);
+    }
+
+    return true;
+}
+
+
+void PreviewEngine::run()
+{
+    while (!threadShouldExit())
+    {
+        while (processNextChunk() && !threadShouldExit()) {}
+        wait(30);
+    }
+}
+
+bool PreviewEngine::processNextChunk()
+{
+    int nChans = getNumChannels();
+    if (nChans == 0)
+    {
+        return false;
+    }
+
+    int nFrames = jmin(fifo.getNumReady() / nChans, int(ApplyPlan::tileSize));
+    if (nFrames == 0)
+    {
+        return false;
+    }
+
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(nFrames * nChans, start1, size1, start2, size2);
+
+    // deinterleave into both output buffers
+    int i = 0;
+    for (int f = 0; f < nFrames; ++f)
+    {
+        const float* src = &fifoData[i < size1 ? start1 + i : start2 + i - size1];
+        for (int c = 0; c < nChans; ++c)
+        {
+            currentChans[c][f] = candidateChans[c][f] = src[c];
+        }
+        i += nChans;
+    }
+
+    fifo.finishedRead(size1 + size2);
+
+    {
+        const ScopedLock planLock(planMutex);
+        if (current)
+        {
+            current->apply(currentChans, nFrames, scratch);
+        }
+
+        if (candidate)
+        {
+            candidate->apply(candidateChans, nFrames, scratch);
+        }
+    }
+
+    const ScopedLock historyLock(historyMutex);
+
+    int nHistory = int(currentHistory.rows());
+    for (int f = 0; f < nFrames; ++f)
+    {
+        for (int c = 0; c < nChans; ++c)
+        {
+            currentHistory(historyPos, c) = currentChans[c][f];
+            candidateHistory(historyPos, c) = candidateChans[c][f];
+        }
+        historyPos = (historyPos + 1) % nHistory;
+    }
+
+    historyCount = jmin(historyCount + nFrames, nHistory);
+    return true;
+}
@@ -0,0 +1,95 @@
+#ifndef ICA_PREVIEW_H_DEFINED
+#define ICA_PREVIEW_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ProcessorHeaders.h>
+
+#include "ICAApplyPlan.h"
+
+namespace ICA
+{
+    // Shows what a candidate ICA operation would do to live data, next to the current one,
+    // without affecting the processor's output.
+    //
+    // The audio thread only copies every <stride>th input sample of the included channels
+    // into a FIFO. A worker thread applies both the current and the candidate plan to these
+    // samples (since plans have no memory, this is the same as downsampling their outputs)
+    // and keeps the most recent outputs for display.
+    //
+    // Plans given to this must be built for the copied channels only
+    // (see ICAOperation::createLocalPlan). Null means passthrough.
+    class PreviewEngine : public Thread
+    {
+    public:
+        // inputChans: buffer channels to copy (the included channels, in order)
+        // historyFrames: # of (downsampled) frames to keep for display
+        PreviewEngine(const String& name, const std::vector<int>& inputChans, int stride,
+            int historyFrames, ApplyPlan* currentPlan, ApplyPlan* candidatePlan);
+        ~PreviewEngine();
+
+        int getNumChannels() const;
+
+        // replaces the candidate plan (taking ownership), e.g. when its rejected components change.
+        void setCandidate(ApplyPlan* candidatePlan);
+
+        // Audio thread: copy the data that is about to be processed by the current plan.
+        void pushInput(const float* const* data, int numSamples);
+
+        // Copy the saved outputs of each plan, oldest first (frames x channels).
+        // Returns false if there is no data yet.
+        bool getSnapshot(Matrix& current, Matrix& candidate) const;
+
+        // worker thread
+        void run() override;
+
+    private:
+        // worker thread - returns false if there was nothing to process
+        bool processNextChunk();
+
+        const std::vector<int> inputChans;
+        const int stride;
+
+        // audio thread state
+        int strideOffset;
+
+        AbstractFifo fifo; // whole interleaved frames
+        HeapBlock<float> fifoData;
+
+        CriticalSection planMutex; // controls below variables
+        ScopedPointer<ApplyPlan> current;
+        ScopedPointer<ApplyPlan> candidate;
+
+        // worker thread state
+        ApplyPlan::Scratch scratch;
+        HeapBlock<float> currentData;   // planar, ApplyPlan::tileSize samples per channel
+        HeapBlock<float> candidateData;
+        HeapBlock<float*> currentChans;
+        HeapBlock<float*> candidateChans;
+
+        CriticalSection historyMutex; // controls below variables
+        Matrix currentHistory;   // ring buffers, historyFrames x channels
+        Matrix candidateHistory;
+        int historyPos;          // next frame to write
+        int historyCount;        // valid frames
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PreviewEngine);
+    };
+}
+
+#endif // ICA_PREVIEW_H_DEFINED
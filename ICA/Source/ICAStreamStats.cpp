@@ -0,0 +1,384 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICAStreamStats.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <Eigen/Eigenvalues>
+
+using namespace ICA;
+
+StreamStats::StreamStats(int numChans, const StreamStatsOptions& options)
+    : nChans    (numChans)
+    , opts      (options)
+    , lineWindow(std::max(int(std::lround(options.sampleRate)), 1))
+    , tile      (std::max(options.lag, 0) + tileSize, numChans)
+{
+    if (opts.covariance)
+    {
+        covSum.resize(nChans, nChans);
+    }
+
+    if (opts.lag > 0)
+    {
+        lagSum.resize(nChans, nChans);
+    }
+
+    const double pi = 3.14159265358979323846;
+    for (float freq : opts.lineFreqs)
+    {
+        Eigen::VectorXf cosTable(lineWindow);
+        Eigen::VectorXf sinTable(lineWindow);
+        for (int i = 0; i < lineWindow; ++i)
+        {
+            double phase = 2 * pi * freq * i / opts.sampleRate;
+            cosTable(i) = float(std::cos(phase));
+            sinTable(i) = float(std::sin(phase));
+        }
+        lineCos.push_back(cosTable);
+        lineSin.push_back(sinTable);
+    }
+
+    lineRe.resize(opts.lineFreqs.size());
+    lineIm.resize(opts.lineFreqs.size());
+    linePower.resize(opts.lineFreqs.size());
+
+    reset();
+}
+
+int StreamStats::getNumChannels() const
+{
+    return nChans;
+}
+
+int64_t StreamStats::getCount() const
+{
+    return count;
+}
+
+void StreamStats::reset()
+{
+    count = 0;
+    shift = Eigen::VectorXf::Zero(nChans);
+
+    sum1 = sum2 = sum3 = sum4 = Eigen::ArrayXd::Zero(nChans);
+    diffSum2 = Eigen::ArrayXd::Zero(nChans);
+    lastSample = Eigen::VectorXf::Zero(nChans);
+    minVal = Eigen::ArrayXd::Constant(nChans, std::numeric_limits<double>::infinity());
+    maxVal = -minVal;
+
+    covSum.setZero();
+    lagSum.setZero();
+    lagCount = 0;
+
+    windowPos = 0;
+    completeWindows = 0;
+    for (size_t f = 0; f < opts.lineFreqs.size(); ++f)
+    {
+        lineRe[f] = Eigen::VectorXd::Zero(nChans);
+        lineIm[f] = Eigen::VectorXd::Zero(nChans);
+        linePower[f] = Eigen::ArrayXd::Zero(nChans);
+    }
+}
+
+void StreamStats::addChannels(const float* const* channels, int numSamples)
+{
+    int lag = std::max(opts.lag, 0);
+    for (int start = 0; start < numSamples; start += tileSize)
+    {
+        int len = std::min(int(tileSize), numSamples - start);
+        for (int c = 0; c < nChans; ++c)
+        {
+            std::memcpy(&tile(lag, c), channels[c] + start, len * sizeof(float));
+        }
+        addTile(len);
+    }
+}
+
+void StreamStats::addFrames(const float* frames, int numFrames)
+{
+    int lag = std::max(opts.lag, 0);
+    for (int start = 0; start < numFrames; start += tileSize)
+    {
+        int len = std::min(int(tileSize), numFrames - start);
+        Eigen::Map<const Matrix> framesIn(frames + int64_t(start) * nChans, nChans, len);
+        tile.middleRows(lag, len) = framesIn.transpose();
+        addTile(len);
+    }
+}
+
+void StreamStats::addBlock(MatrixConstRef block)
+{
+    assert(block.cols() == nChans);
+
+    int lag = std::max(opts.lag, 0);
+    int numSamples = int(block.rows());
+    for (int start = 0; start < numSamples; start += tileSize)
+    {
+        int len = std::min(int(tileSize), numSamples - start);
+        tile.middleRows(lag, len) = block.middleRows(start, len);
+        addTile(len);
+    }
+}
+
+void StreamStats::addTile(int len)
+{
+    int lag = std::max(opts.lag, 0);
+    auto x = tile.middleRows(lag, len);
+
+    if (count == 0)
+    {
+        shift = x.row(0).transpose();
+    }
+
+    x.rowwise() -= shift.transpose();
+
+    // moments and extrema (per tile in single precision, then added up in double)
+    auto xa = x.array();
+    sum1 += xa.colwise().sum().transpose().cast<double>();
+    sum2 += xa.square().colwise().sum().transpose().cast<double>();
+    sum3 += (xa.square() * xa).colwise().sum().transpose().cast<double>();
+    sum4 += xa.square().square().colwise().sum().transpose().cast<double>();
+
+    // first differences, including the one from the last tile
+    if (count > 0)
+    {
+        diffSum2 += (x.row(0).transpose() - lastSample).array().square().cast<double>();
+    }
+    if (len > 1)
+    {
+        diffSum2 += (x.bottomRows(len - 1) - x.topRows(len - 1)).array().square()
+            .colwise().sum().transpose().cast<double>();
+    }
+    lastSample = x.row(len - 1).transpose();
+
+    Eigen::ArrayXd shiftD = shift.cast<double>().array();
+    minVal = minVal.min(xa.colwise().minCoeff().transpose().cast<double>() + shiftD);
+    maxVal = maxVal.max(xa.colwise().maxCoeff().transpose().cast<double>() + shiftD);
+
+    if (opts.covariance)
+    {
+        covSum.noalias() += (x.transpose() * x).cast<double>();
+    }
+
+    if (lag > 0)
+    {
+        // pairs (t, t - lag) for which t - lag was also seen
+        int first = int(std::max(int64_t(0), lag - count));
+        if (first < len)
+        {
+            auto now = tile.middleRows(lag + first, len - first);
+            auto before = tile.middleRows(first, len - first);
+            lagSum.noalias() += (now.transpose() * before).cast<double>();
+            lagCount += len - first;
+        }
+
+        // keep the last <lag> rows for the next tile
+        for (int c = 0; c < nChans; ++c)
+        {
+            float* col = tile.col(c).data();
+            std::memmove(col, col + len, lag * sizeof(float));
+        }
+    }
+
+    // line noise
+    for (int done = 0; done < len && !opts.lineFreqs.empty();)
+    {
+        int n = std::min(len - done, lineWindow - windowPos);
+        auto seg = x.middleRows(done, n);
+
+        for (size_t f = 0; f < opts.lineFreqs.size(); ++f)
+        {
+            lineRe[f] += (seg.transpose() * lineCos[f].segment(windowPos, n)).cast<double>();
+            lineIm[f] += (seg.transpose() * lineSin[f].segment(windowPos, n)).cast<double>();
+        }
+
+        done += n;
+        windowPos += n;
+
+        if (windowPos == lineWindow)
+        {
+            // power of a sinusoid with this DFT coefficient
+            double scale = 2.0 / (double(lineWindow) * lineWindow);
+            for (size_t f = 0; f < opts.lineFreqs.size(); ++f)
+            {
+                linePower[f] += scale * (lineRe[f].array().square() + lineIm[f].array().square());
+                lineRe[f].setZero();
+                lineIm[f].setZero();
+            }
+            windowPos = 0;
+            ++completeWindows;
+        }
+    }
+
+    count += len;
+}
+
+Eigen::VectorXd StreamStats::getShiftedMean() const
+{
+    return count > 0 ? Eigen::VectorXd(sum1 / double(count)) : Eigen::VectorXd::Zero(nChans);
+}
+
+Eigen::VectorXd StreamStats::getMean() const
+{
+    return getShiftedMean() + shift.cast<double>();
+}
+
+Eigen::VectorXd StreamStats::getVariance() const
+{
+    if (count == 0)
+    {
+        return Eigen::VectorXd::Zero(nChans);
+    }
+
+    Eigen::ArrayXd d = getShiftedMean().array();
+    return (sum2 / double(count) - d.square()).max(0.0).matrix();
+}
+
+Eigen::VectorXd StreamStats::getKurtosis() const
+{
+    if (count == 0)
+    {
+        return Eigen::VectorXd::Zero(nChans);
+    }
+
+    // central moments from the moments about the shift
+    double n = double(count);
+    Eigen::ArrayXd d = getShiftedMean().array();
+    Eigen::ArrayXd d2 = d.square();
+    Eigen::ArrayXd m2 = sum2 / n - d2;
+    Eigen::ArrayXd m4 = sum4 / n - 4 * d * sum3 / n + 6 * d2 * sum2 / n - 3 * d2.square();
+
+    // (0 for constant channels)
+    return (m2 > 0).select(m4 / m2.square() - 3, 0.0).matrix();
+}
+
+Eigen::VectorXd StreamStats::getMin() const
+{
+    return minVal.matrix();
+}
+
+Eigen::VectorXd StreamStats::getMax() const
+{
+    return maxVal.matrix();
+}
+
+Eigen::VectorXd StreamStats::getLineRatio(int freqIndex) const
+{
+    assert(freqIndex >= 0 && freqIndex < int(opts.lineFreqs.size()));
+
+    Eigen::ArrayXd var = getVariance().array();
+    if (completeWindows == 0)
+    {
+        return Eigen::VectorXd::Zero(nChans);
+    }
+
+    Eigen::ArrayXd power = linePower[freqIndex] / completeWindows;
+    return (var > 0).select(power / var, 0.0).matrix();
+}
+
+Eigen::VectorXd StreamStats::getDiffRatio() const
+{
+    Eigen::ArrayXd var = getVariance().array();
+    if (count < 2)
+    {
+        return Eigen::VectorXd::Zero(nChans);
+    }
+
+    Eigen::ArrayXd diffPower = diffSum2 / double(count - 1);
+    return (var > 0).select(diffPower / (2 * var), 0.0).matrix();
+}
+
+Eigen::MatrixXd StreamStats::getCovariance() const
+{
+    assert(opts.covariance);
+    if (count == 0)
+    {
+        return Eigen::MatrixXd::Zero(nChans, nChans);
+    }
+
+    Eigen::VectorXd d = getShiftedMean();
+    return covSum / double(count) - d * d.transpose();
+}
+
+Eigen::MatrixXd StreamStats::getLaggedCovariance() const
+{
+    assert(opts.lag > 0);
+    if (lagCount == 0)
+    {
+        return Eigen::MatrixXd::Zero(nChans, nChans);
+    }
+
+    Eigen::VectorXd d = getShiftedMean();
+    return lagSum / double(lagCount) - d * d.transpose();
+}
+
+
+Eigen::MatrixXd ICA::covariancePower(const Eigen::MatrixXd& cov, double power)
+{
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eig(cov);
+
+    Eigen::VectorXd vals = eig.eigenvalues();
+    double floor = std::max(vals.maxCoeff(), 1e-30) * 1e-9;
+    vals = vals.cwiseMax(floor).array().pow(power).matrix();
+
+    return eig.eigenvectors() * vals.asDiagonal() * eig.eigenvectors().transpose();
+}
+
+float ICA::robustGain(std::vector<float>& samples)
+{
+    if (samples.empty())
+    {
+        return 1.0f;
+    }
+
+    // (std::nth_element doesn't promise anything if there are NaNs)
+    for (float x : samples)
+    {
+        if (!std::isfinite(x))
+        {
+            return 1.0f;
+        }
+    }
+
+    auto mid = samples.begin() + samples.size() / 2;
+    std::nth_element(samples.begin(), mid, samples.end());
+    float median = *mid;
+
+    double sum2 = 0;
+    for (float& x : samples)
+    {
+        x = std::abs(x - median);
+        sum2 += double(x) * x;
+    }
+
+    std::nth_element(samples.begin(), mid, samples.end());
+    double scale = 1.4826 * *mid;
+
+    if (!(scale > 0))
+    {
+        // (about the median rather than the mean, which is close enough for a gain)
+        scale = std::sqrt(sum2 / samples.size());
+    }
+
+    return scale > 0 && std::isfinite(scale) ? float(1 / scale) : 1.0f;
+}
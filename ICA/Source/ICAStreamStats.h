@@ -0,0 +1,149 @@
+#ifndef ICA_STREAM_STATS_H_DEFINED
+#define ICA_STREAM_STATS_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// One-pass statistics of multichannel data (training data, components, running input).
+
+#include <vector>
+
+#include "ICAApplyPlan.h"
+
+namespace ICA
+{
+    // what to accumulate besides the moments and extrema
+    struct StreamStatsOptions
+    {
+        bool covariance = false;
+
+        // if > 0, also accumulate the covariance between x(t) and x(t - lag)
+        int lag = 0;
+
+        // for line noise ratios: the sample rate and the line frequencies to look at
+        // (in Hz). the power at each frequency is measured in 1-second windows.
+        float sampleRate = 0;
+        std::vector<float> lineFreqs;
+    };
+
+    // Accumulates per-channel moments, extrema and line noise power and, optionally, the
+    // covariance and lagged covariance of a stream of data, a block at a time.
+    //
+    // Input is gathered into tiles of samples x channels (like ApplyPlan), and all of the
+    // statistics are computed from each tile while it is in cache, with Eigen's vectorized
+    // reductions and matrix products. Sums are kept in double precision, relative to the
+    // first sample of each channel to avoid cancellation.
+    //
+    // Non-finite input makes the statistics of that channel (and its covariances) non-finite.
+    class StreamStats
+    {
+    public:
+        explicit StreamStats(int numChans, const StreamStatsOptions& options = StreamStatsOptions());
+
+        int getNumChannels() const;
+
+        // number of samples so far
+        int64_t getCount() const;
+
+        void reset();
+
+        // channels: one pointer per channel, each to numSamples contiguous samples
+        // (e.g. AudioSampleBuffer::getArrayOfReadPointers())
+        void addChannels(const float* const* channels, int numSamples);
+
+        // frames: numFrames interleaved frames of all channels (as in the ICA input files)
+        void addFrames(const float* frames, int numFrames);
+
+        // block: samples x channels
+        void addBlock(MatrixConstRef block);
+
+        // results, one entry per channel
+
+        Eigen::VectorXd getMean() const;
+        Eigen::VectorXd getVariance() const;  // (population)
+        Eigen::VectorXd getKurtosis() const;  // excess kurtosis (0 for Gaussian data)
+        Eigen::VectorXd getMin() const;
+        Eigen::VectorXd getMax() const;
+
+        // fraction of the variance at lineFreqs[freqIndex] (0 if there are no complete windows yet)
+        Eigen::VectorXd getLineRatio(int freqIndex) const;
+
+        // mean square of the first difference over twice the variance: about 1 for white noise,
+        // near 0 for slow signals and up to 2 for signals near the Nyquist frequency
+        Eigen::VectorXd getDiffRatio() const;
+
+        // only if enabled in the options
+        Eigen::MatrixXd getCovariance() const;
+
+        // E[(x(t) - mean) (x(t - lag) - mean)^T]; only if lag > 0
+        Eigen::MatrixXd getLaggedCovariance() const;
+
+        // samples gathered at a time
+        static const int tileSize = ApplyPlan::tileSize;
+
+    private:
+        // accumulate the len samples at row <lag> of the tile
+        void addTile(int len);
+
+        // mean relative to the shift
+        Eigen::VectorXd getShiftedMean() const;
+
+        const int nChans;
+        const StreamStatsOptions opts;
+
+        int64_t count;
+        Eigen::VectorXf shift;   // subtracted from all samples before summing
+
+        // sums of powers of (x - shift)
+        Eigen::ArrayXd sum1, sum2, sum3, sum4;
+
+        // sum of squared first differences, and the last sample (shifted) to continue from
+        Eigen::ArrayXd diffSum2;
+        Eigen::VectorXf lastSample;
+        Eigen::ArrayXd minVal, maxVal;
+
+        Eigen::MatrixXd covSum;
+        Eigen::MatrixXd lagSum;
+        int64_t lagCount;
+
+        // line noise: per frequency, a table of cos and sin over one window, the running
+        // sums over the current window, and the sum of the power over complete windows
+        int lineWindow;
+        int windowPos;
+        int completeWindows;
+        std::vector<Eigen::VectorXf> lineCos, lineSin;
+        std::vector<Eigen::VectorXd> lineRe, lineIm;
+        std::vector<Eigen::ArrayXd> linePower;
+
+        // (lag + tileSize) x nChans; the first <lag> rows hold the end of the last tile (shifted)
+        Matrix tile;
+    };
+
+    // Symmetric power of a covariance matrix, e.g. 0.5 for the square root or -0.5 for the
+    // whitening matrix. Eigenvalues are floored relative to the largest, so that it stays
+    // finite and invertible if some channels are flat.
+    Eigen::MatrixXd covariancePower(const Eigen::MatrixXd& cov, double power);
+
+    // Gain that brings a sample of a channel's data to unit scale, robustly: the reciprocal of
+    // the median absolute deviation (scaled to match the standard deviation of Gaussian data),
+    // or of the RMS deviation from the median if more than half of the samples are the same
+    // (e.g. a mostly-flat aux channel). 1 if that is zero or the data is not finite.
+    // Reorders samples.
+    float robustGain(std::vector<float>& samples);
+}
+
+#endif // ICA_STREAM_STATS_H_DEFINED
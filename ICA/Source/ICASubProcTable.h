@@ -0,0 +1,84 @@
+#ifndef ICA_SUBPROC_TABLE_H_DEFINED
+#define ICA_SUBPROC_TABLE_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The per-subprocessor state of a processor and the rules for sharing it between threads.
+// Like ICAApplyPlan.h, this only depends on the standard library, so that ica_soak drives
+// the same code as ICANode.
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace ICA
+{
+    // Entries of type Data, keyed by subprocessor ID.
+    //
+    // - The message thread owns the table. It reads the map without locking, and never adds or
+    //   removes entries in place: when the subprocessors change, it builds a new map (moving over
+    //   or sharing what can be kept) and swaps it in with replace.
+    // - The audio thread iterates over the current map. It must not be running during replace
+    //   (i.e. the caller holds the callback lock, or acquisition is stopped).
+    // - Any other thread (e.g. an ICA run) gets entries with acquire, which keeps the entry alive
+    //   even if the map is replaced while it is using it. It should look its entry up again
+    //   rather than keep it for long, since a replaced entry is no longer processed.
+    //
+    // The members of each entry are protected by the entry's own locks.
+    template <typename Data>
+    class SubProcTable
+    {
+    public:
+        using Map = std::map<uint32_t, std::shared_ptr<Data>>;
+        using iterator = typename Map::iterator;
+        using const_iterator = typename Map::const_iterator;
+
+        // (message and audio threads)
+        iterator begin() { return map.begin(); }
+        iterator end() { return map.end(); }
+        const_iterator begin() const { return map.begin(); }
+        const_iterator end() const { return map.end(); }
+        iterator find(uint32_t id) { return map.find(id); }
+        const_iterator find(uint32_t id) const { return map.find(id); }
+        size_t size() const { return map.size(); }
+
+        // Makes newMap the current map, and returns the old one, for the caller to destroy
+        // after releasing any locks. (message thread)
+        Map replace(Map newMap)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            map.swap(newMap);
+            return newMap;
+        }
+
+        // The current entry of a subprocessor, or null if there is none. (any thread)
+        std::shared_ptr<Data> acquire(uint32_t id) const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto entry = map.find(id);
+            return entry == map.end() ? nullptr : entry->second;
+        }
+
+    private:
+        Map map;
+        mutable std::mutex mutex; // held while other threads read the map, and while it is replaced
+    };
+}
+
+#endif // ICA_SUBPROC_TABLE_H_DEFINED
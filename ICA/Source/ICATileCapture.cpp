@@ -0,0 +1,109 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICATileCapture.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace ICA;
+
+DecimatingCapture::DecimatingCapture(const std::vector<int>& channelsIn, int strideIn)
+    : channels  (channelsIn)
+    , stride    (std::max(strideIn, 1))
+    , sources   (channelsIn.size(), nullptr)
+    , sink      (nullptr)
+    , data      (nullptr)
+    , numSamples(0)
+    , nextSample(0)
+{
+    int maxChan = channels.empty() ? -1 : *std::max_element(channels.begin(), channels.end());
+    slots.assign(maxChan + 1, -1);
+    for (int i = 0; i < int(channels.size()); ++i)
+    {
+        slots[channels[i]] = i;
+    }
+}
+
+void DecimatingCapture::beginBlock(FrameSink& sinkIn, const float* const* dataIn, int numSamplesIn)
+{
+    sink = &sinkIn;
+    data = dataIn;
+    numSamples = numSamplesIn;
+}
+
+void DecimatingCapture::readTile(MatrixConstRef tile, const std::vector<int>& tileChannels, int start)
+{
+    int end = start + int(tile.rows());
+    if (sink == nullptr || nextSample >= end)
+    {
+        return;
+    }
+
+    // (earlier samples may have been changed by the plan already)
+    assert(nextSample >= start);
+
+    for (int i = 0; i < int(channels.size()); ++i)
+    {
+        sources[i] = data[channels[i]] + nextSample;
+    }
+
+    for (int k = 0; k < int(tileChannels.size()); ++k)
+    {
+        int chan = tileChannels[k];
+        if (chan < int(slots.size()) && slots[chan] != -1)
+        {
+            sources[slots[chan]] = tile.col(k).data() + (nextSample - start);
+        }
+    }
+
+    capture(end);
+}
+
+void DecimatingCapture::finishBlock()
+{
+    if (sink == nullptr)
+    {
+        return;
+    }
+
+    if (nextSample < numSamples)
+    {
+        for (int i = 0; i < int(channels.size()); ++i)
+        {
+            sources[i] = data[channels[i]] + nextSample;
+        }
+
+        capture(numSamples);
+    }
+
+    nextSample -= numSamples;
+    sink = nullptr;
+    data = nullptr;
+}
+
+int DecimatingCapture::getStride() const
+{
+    return stride;
+}
+
+void DecimatingCapture::capture(int end)
+{
+    int numFrames = (end - 1 - nextSample) / stride + 1;
+    sink->writeFrames(sources.data(), stride, numFrames);
+    nextSample += numFrames * stride;
+}
@@ -0,0 +1,82 @@
+#ifndef ICA_TILE_CAPTURE_H_DEFINED
+#define ICA_TILE_CAPTURE_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Capturing decimated input for the training cache in the same pass as applying a plan.
+
+#include <vector>
+
+#include "ICAApplyPlan.h"
+
+namespace ICA
+{
+    // Somewhere to put frames of several channels (e.g. ICANode's data cache).
+    class FrameSink
+    {
+    public:
+        virtual ~FrameSink() {}
+
+        // append numFrames frames, taking channel c of frame i from sources[c][i * stride]
+        virtual void writeFrames(const float* const* sources, int stride, int numFrames) = 0;
+    };
+
+    // Takes every <stride>th sample of a set of buffer channels (continuing across blocks) and
+    // writes them to a FrameSink. As an InputTap, it takes the samples of the channels a plan
+    // reads from the plan's tiles, which are already in cache, and the rest from the buffer,
+    // so that capturing doesn't need another pass over the input.
+    //
+    // For each block: beginBlock, then optionally apply a plan with this as its tap, then
+    // finishBlock, which captures whatever wasn't covered by tiles from the buffer. So if
+    // something else is going to change the input before (or instead of) the plan, call
+    // finishBlock before that. Doesn't allocate after construction.
+    class DecimatingCapture : public InputTap
+    {
+    public:
+        // channels: buffer channels, in the order of the sink's channels
+        DecimatingCapture(const std::vector<int>& channels, int stride);
+
+        // the sink must stay valid until finishBlock
+        void beginBlock(FrameSink& sink, const float* const* data, int numSamples);
+
+        void readTile(MatrixConstRef tile, const std::vector<int>& tileChannels, int start) override;
+
+        void finishBlock();
+
+        int getStride() const;
+
+    private:
+        // capture up to sample end (exclusive) of the current block, with sources already
+        // pointing at sample nextSample
+        void capture(int end);
+
+        const std::vector<int> channels;
+        const int stride;
+        std::vector<int> slots;            // by buffer channel: index into channels, or -1
+        std::vector<const float*> sources; // by index into channels
+
+        // (only set between beginBlock and finishBlock)
+        FrameSink* sink;
+        const float* const* data;
+        int numSamples;
+
+        int nextSample; // in the current block; carries over as an offset into the next
+    };
+}
+
+#endif // ICA_TILE_CAPTURE_H_DEFINED
@@ -0,0 +1,283 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ICAWhiteningTracker.h"
+
+#include <cmath>
+
+using namespace ICA;
+
+const float WhiteningTracker::baselineSec      (30.0f);
+const float WhiteningTracker::timeConstantSec  (120.0f);
+const float WhiteningTracker::updateIntervalSec(5.0f);
+
+// frames of input that can be buffered before the worker must catch up
+static const int fifoFrames = 4096;
+
+// frames processed at a time by the worker
+static const int chunkFrames = 256;
+
+// the given rows and columns of m
+static Eigen::MatrixXd submatrix(const Eigen::MatrixXd& m, const std::vector<int>& rows,
+    const std::vector<int>& cols)
+{
+    Eigen::MatrixXd sub(rows.size(), cols.size());
+    for (int j = 0; j < int(cols.size()); ++j)
+    {
+        for (int i = 0; i < int(rows.size()); ++i)
+        {
+            sub(i, j) = m(rows[i], cols[j]);
+        }
+    }
+    return sub;
+}
+
+static StreamStatsOptions covarianceOnly()
+{
+    StreamStatsOptions options;
+    options.covariance = true;
+    return options;
+}
+
+WhiteningTracker::WhiteningTracker(const String& name, const std::vector<int>& chans, int inStride,
+    float sampleRate, MatrixConstRef unmixing, UpdateCallback callback)
+    : Thread            ("ICA whitening " + name)
+    , inputChans        (chans)
+    , stride            (jmax(inStride, 1))
+    , onUpdate          (callback)
+    , strideOffset      (0)
+    , fifo              (fifoFrames * jmax(int(chans.size()), 1))
+    , fifoData          (fifo.getTotalSize())
+    , baselineFrames    (jmax(int(baselineSec * sampleRate), 1))
+    , updateFrames      (jmax(int(updateIntervalSec * sampleRate), 1))
+    , decayPerFrame     (std::exp(-1.0 / (timeConstantSec * sampleRate)))
+    , learnedUnmixing   (unmixing.cast<double>())
+    , baselineStats     (int(chans.size()), covarianceOnly())
+    , chunkStats        (int(chans.size()), covarianceOnly())
+    , baselineFramesLeft(baselineFrames)
+    , framesUntilUpdate (updateFrames)
+{
+    jassert(unmixing.rows() == getNumChannels() && unmixing.cols() == getNumChannels());
+
+    // group channels that share a component (union-find), then each component goes with the
+    // group of its channels (a component without any stays zero)
+    int nChans = getNumChannels();
+    std::vector<int> parent(nChans);
+    for (int c = 0; c < nChans; ++c)
+    {
+        parent[c] = c;
+    }
+
+    auto findRoot = [&parent](int c)
+    {
+        while (parent[c] != c)
+        {
+            c = parent[c] = parent[parent[c]];
+        }
+        return c;
+    };
+
+    std::vector<int> firstChan(nChans, -1); // by component
+    for (int r = 0; r < nChans; ++r)
+    {
+        for (int c = 0; c < nChans; ++c)
+        {
+            if (learnedUnmixing(r, c) == 0)
+            {
+                continue;
+            }
+
+            if (firstChan[r] < 0)
+            {
+                firstChan[r] = c;
+            }
+            else
+            {
+                parent[findRoot(c)] = findRoot(firstChan[r]);
+            }
+        }
+    }
+
+    std::vector<int> blockOfRoot(nChans, -1);
+    for (int c = 0; c < nChans; ++c)
+    {
+        int& block = blockOfRoot[findRoot(c)];
+        if (block < 0)
+        {
+            block = int(blocks.size());
+            blocks.emplace_back();
+        }
+        blocks[block].chans.push_back(c);
+    }
+
+    for (int r = 0; r < nChans; ++r)
+    {
+        if (firstChan[r] >= 0)
+        {
+            blocks[blockOfRoot[findRoot(firstChan[r])]].comps.push_back(r);
+        }
+    }
+
+    startThread();
+}
+
+WhiteningTracker::~WhiteningTracker()
+{
+    stopThread(500);
+}
+
+int WhiteningTracker::getNumChannels() const
+{
+    return int(inputChans.size());
+}
+
+void WhiteningTracker::pushInput(const float* const* data, int numSamples)
+{
+    int nChans = getNumChannels();
+    int nFrames = (numSamples - strideOffset + stride - 1) / stride;
+    if (nFrames <= 0 || nChans == 0)
+    {
+        strideOffset -= numSamples;
+        return;
+    }
+
+    // if the worker is behind, skip this block (it only affects the estimate slightly)
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(nFrames * nChans, start1, size1, start2, size2);
+
+    if (size1 + size2 == nFrames * nChans)
+    {
+        // since everything is written in whole frames, frames don't wrap around
+        int i = 0;
+        for (int s = strideOffset; s < numSamples; s += stride)
+        {
+            float* dest = &fifoData[i < size1 ? start1 + i : start2 + i - size1];
+            for (int c = 0; c < nChans; ++c)
+            {
+                dest[c] = data[inputChans[c]][s];
+            }
+            i += nChans;
+        }
+
+        fifo.finishedWrite(size1 + size2);
+    }
+
+    strideOffset += nFrames * stride - numSamples;
+}
+
+
+void WhiteningTracker::run()
+{
+    while (!threadShouldExit())
+    {
+        while (processNextChunk() && !threadShouldExit()) {}
+        wait(100);
+    }
+}
+
+bool WhiteningTracker::processNextChunk()
+{
+    int nChans = getNumChannels();
+    if (nChans == 0)
+    {
+        return false;
+    }
+
+    int nFrames = jmin(fifo.getNumReady() / nChans, chunkFrames);
+    if (baselineFramesLeft > 0)
+    {
+        nFrames = jmin(nFrames, baselineFramesLeft);
+    }
+
+    if (nFrames == 0)
+    {
+        return false;
+    }
+
+    // (the stats are computed straight from the FIFO, which holds whole frames)
+    StreamStats& stats = baselineFramesLeft > 0 ? baselineStats : chunkStats;
+    if (baselineFramesLeft == 0)
+    {
+        chunkStats.reset();
+    }
+
+    int start1, size1, start2, size2;
+    fifo.prepareToRead(nFrames * nChans, start1, size1, start2, size2);
+    stats.addFrames(&fifoData[start1], size1 / nChans);
+    stats.addFrames(&fifoData[start2], size2 / nChans);
+    fifo.finishedRead(size1 + size2);
+
+    if (baselineFramesLeft > 0)
+    {
+        baselineFramesLeft -= nFrames;
+        if (baselineFramesLeft == 0)
+        {
+            mean = baselineStats.getMean();
+            cov = baselineStats.getCovariance();
+
+            // U = R * C0^(-1/2)  =>  R = U * C0^(1/2), for each block
+            for (Block& block : blocks)
+            {
+                block.rotation = submatrix(learnedUnmixing, block.comps, block.chans)
+                    * covariancePower(submatrix(cov, block.chans, block.chans), 0.5);
+            }
+        }
+        return true;
+    }
+
+    // exponentially weighted update, a chunk at a time
+    double keep = std::pow(decayPerFrame, nFrames);
+    mean = keep * mean + (1 - keep) * chunkStats.getMean();
+
+    // (covariance of the chunk around the new running mean)
+    Eigen::VectorXd offset = chunkStats.getMean() - mean;
+    cov = keep * cov + (1 - keep) * (chunkStats.getCovariance() + offset * offset.transpose());
+
+    framesUntilUpdate -= nFrames;
+    if (framesUntilUpdate <= 0)
+    {
+        framesUntilUpdate += updateFrames;
+
+        Matrix unmixing = computeUnmixing();
+        if (unmixing.allFinite())
+        {
+            onUpdate(*this, unmixing);
+        }
+    }
+
+    return true;
+}
+
+Matrix WhiteningTracker::computeUnmixing() const
+{
+    int nChans = getNumChannels();
+    Matrix unmixing = Matrix::Zero(nChans, nChans);
+    for (const Block& block : blocks)
+    {
+        Eigen::MatrixXd blockUnmixing = block.rotation
+            * covariancePower(submatrix(cov, block.chans, block.chans), -0.5);
+
+        for (int j = 0; j < int(block.chans.size()); ++j)
+        {
+            for (int i = 0; i < int(block.comps.size()); ++i)
+            {
+                unmixing(block.comps[i], block.chans[j]) = float(blockUnmixing(i, j));
+            }
+        }
+    }
+    return unmixing;
+}
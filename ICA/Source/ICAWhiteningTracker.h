@@ -0,0 +1,119 @@
+#ifndef ICA_WHITENING_TRACKER_H_DEFINED
+#define ICA_WHITENING_TRACKER_H_DEFINED
+
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ProcessorHeaders.h>
+
+#include <functional>
+
+#include "ICAApplyPlan.h"
+#include "ICAStreamStats.h"
+
+namespace ICA
+{
+    // Adapts an ICA operation to slow changes in channel gains and covariance without retraining.
+    //
+    // The learned unmixing matrix is split into a rotation and a whitening matrix,
+    // U = R * C0^(-1/2), where C0 is the covariance of the input over a baseline period
+    // after tracking starts. After that, R is kept fixed and the whitening matrix follows an
+    // exponentially weighted running covariance C of the input, so the operation becomes
+    // R * C^(-1/2). (If the covariance doesn't change, neither does the operation.)
+    //
+    // This is done separately for each group of channels that the unmixing matrix doesn't mix
+    // (each of its diagonal blocks, up to the order of channels), so that the result of a
+    // grouped run stays block-diagonal, and is still applied in sparse form. For an operation
+    // trained in two levels, the tracker is given the first level (the local unmixing matrix),
+    // and the global level is composed with its output as before.
+    //
+    // Like PreviewEngine, the audio thread only copies every <stride>th input sample of the
+    // included channels into a FIFO; a worker thread does the rest, and periodically passes
+    // the updated unmixing matrix to a callback (on the worker thread).
+    class WhiteningTracker : public Thread
+    {
+    public:
+        using UpdateCallback = std::function<void(WhiteningTracker& source, MatrixConstRef unmixing)>;
+
+        // inputChans: buffer channels to copy (the included channels, in order)
+        // sampleRate: of the downsampled input (i.e. after taking every <stride>th sample)
+        // unmixing: of the learned operation (or its first level, see above)
+        WhiteningTracker(const String& name, const std::vector<int>& inputChans, int stride,
+            float sampleRate, MatrixConstRef unmixing, UpdateCallback onUpdate);
+        ~WhiteningTracker();
+
+        int getNumChannels() const;
+
+        // Audio thread: copy the input that is about to be processed.
+        void pushInput(const float* const* data, int numSamples);
+
+        // worker thread
+        void run() override;
+
+        // duration of data used for the baseline covariance
+        static const float baselineSec;
+
+        // time constant of the running covariance
+        static const float timeConstantSec;
+
+        // how often to publish an updated operation
+        static const float updateIntervalSec;
+
+    private:
+        // worker thread - returns false if there was nothing to process
+        bool processNextChunk();
+
+        // running covariance -> new unmixing matrix
+        Matrix computeUnmixing() const;
+
+        // a diagonal block of the learned unmixing matrix
+        struct Block
+        {
+            std::vector<int> chans; // columns
+            std::vector<int> comps; // rows
+            Eigen::MatrixXd rotation; // R of this block, once the baseline is done
+        };
+
+        const std::vector<int> inputChans;
+        const int stride;
+        const UpdateCallback onUpdate;
+
+        // audio thread state
+        int strideOffset;
+
+        AbstractFifo fifo; // whole interleaved frames
+        HeapBlock<float> fifoData;
+
+        // worker thread state
+        const int baselineFrames;
+        const int updateFrames;
+        const double decayPerFrame; // of the running estimates
+        const Eigen::MatrixXd learnedUnmixing;
+
+        std::vector<Block> blocks;
+        Eigen::VectorXd mean;       // running mean
+        Eigen::MatrixXd cov;        // running covariance
+        StreamStats baselineStats;
+        StreamStats chunkStats;
+        int baselineFramesLeft;
+        int framesUntilUpdate;
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(WhiteningTracker);
+    };
+}
+
+#endif // ICA_WHITENING_TRACKER_H_DEFINED
@@ -17,6 +17,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <PluginInfo.h>
 #include "ICANode.h"
+#include "ICAApplyNode.h"
 #include <string>
 
 #ifdef WIN32
@@ -28,7 +29,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 using namespace Plugin;
 //Number of plugins defined on the library. Can be of different types (Processors, RecordEngines, etc...)
-#define NUM_PLUGINS 1
+#define NUM_PLUGINS 2
 
 extern "C" EXPORT void getLibInfo(Plugin::LibraryInfo* info)
 {
@@ -63,6 +64,13 @@ extern "C" EXPORT int getPluginInfo(int index, Plugin::PluginInfo* info)
 		info->processor.creator = &(Plugin::createProcessor<ICA::ICANode>);
 		break;
 
+	case 1:
+		info->type = PluginType::PLUGIN_TYPE_PROCESSOR;
+		info->processor.name = "ICA Apply";
+		info->processor.type = ProcessorType::FilterProcessor;
+		info->processor.creator = &(Plugin::createProcessor<ICA::ICAApplyNode>);
+		break;
+
 	default:
 		return -1;
 		break;
@@ -0,0 +1,308 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../ICAAsyncWriter.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#ifdef ICA_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+using namespace ICA;
+
+static Result errnoResult(const String& what, int err)
+{
+    return Result::fail(what + " (" + String(std::strerror(err)) + ")");
+}
+
+// opens the file and closes it at the end; shared by both backends.
+class PosixFile
+{
+public:
+    PosixFile(const File& file, bool direct, Result& res)
+        : name(file.getFileName())
+    {
+        const String pathString = file.getFullPathName();
+        const char* path = pathString.toRawUTF8();
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+#ifdef O_DIRECT
+        if (direct)
+        {
+            fd = ::open(path, flags | O_DIRECT, 0644);
+
+            // some file systems (e.g. tmpfs) don't support it
+            isDirect = fd != -1;
+        }
+#endif
+
+        if (fd == -1)
+        {
+            fd = ::open(path, flags, 0644);
+        }
+
+        if (fd == -1)
+        {
+            res = errnoResult("Failed to open " + name, errno);
+            return;
+        }
+
+#ifdef F_NOCACHE
+        // (macOS equivalent of O_DIRECT)
+        if (direct && fcntl(fd, F_NOCACHE, 1) != -1)
+        {
+            isDirect = true;
+        }
+#endif
+    }
+
+    ~PosixFile()
+    {
+        if (fd != -1)
+        {
+            ::close(fd);
+        }
+    }
+
+    Result close(int64 size)
+    {
+        Result res = Result::ok();
+
+        // remove any padding from the last aligned write
+        if (ftruncate(fd, off_t(size)) == -1)
+        {
+            res = errnoResult("Failed to set size of " + name, errno);
+        }
+
+#if defined(POSIX_FADV_DONTNEED) && !defined(__APPLE__)
+        if (!isDirect)
+        {
+            // at least don't leave the data in the cache once it's written
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+#endif
+
+        if (::close(fd) == -1 && res.wasOk())
+        {
+            res = errnoResult("Failed to close " + name, errno);
+        }
+        fd = -1;
+
+        return res;
+    }
+
+    Result pwriteAll(const char* data, size_t numBytes, int64 offset)
+    {
+        while (numBytes > 0)
+        {
+            ssize_t written = pwrite(fd, data, numBytes, off_t(offset));
+            if (written == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return errnoResult("Failed to write " + name, errno);
+            }
+
+            data += written;
+            numBytes -= size_t(written);
+            offset += written;
+        }
+
+        return Result::ok();
+    }
+
+    const String name;
+    int fd = -1;
+    bool isDirect = false;
+};
+
+
+class PosixPooledWriteBackend : public PooledWriteBackend
+{
+public:
+    PosixPooledWriteBackend(const File& file, bool direct, Result& res)
+        : file(file, direct, res)
+    {}
+
+    ~PosixPooledWriteBackend()
+    {
+        waitForAllJobs();
+    }
+
+    Result close(int64 size) override
+    {
+        waitForAllJobs();
+        return file.close(size);
+    }
+
+    bool isDirect() const override
+    {
+        return file.isDirect;
+    }
+
+    bool isOpen() const
+    {
+        return file.fd != -1;
+    }
+
+protected:
+    Result writeAt(const char* data, size_t numBytes, int64 offset) override
+    {
+        return file.pwriteAll(data, numBytes, offset);
+    }
+
+private:
+    PosixFile file;
+};
+
+
+#ifdef ICA_HAVE_LIBURING
+
+class UringWriteBackend : public AsyncWriteBackend
+{
+public:
+    UringWriteBackend(const File& file, bool direct, int maxPending, Result& res)
+        : file(file, direct, res)
+    {
+        ringOk = io_uring_queue_init(unsigned(maxPending), &ring, 0) == 0;
+    }
+
+    ~UringWriteBackend()
+    {
+        if (ringOk)
+        {
+            io_uring_queue_exit(&ring);
+        }
+    }
+
+    // whether io_uring is actually available (e.g. it can be disabled in the kernel)
+    bool isOpen() const
+    {
+        return ringOk && file.fd != -1;
+    }
+
+    Result submit(int tag, const char* data, size_t numBytes, int64 offset) override
+    {
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        if (sqe == nullptr)
+        {
+            return Result::fail("Too many writes in progress to " + file.name);
+        }
+
+        io_uring_prep_write(sqe, file.fd, data, unsigned(numBytes), uint64_t(offset));
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(intptr_t(tag)));
+        sizes.set(tag, numBytes);
+
+        int submitted = io_uring_submit(&ring);
+        if (submitted < 0)
+        {
+            return errnoResult("Failed to write " + file.name, -submitted);
+        }
+
+        return Result::ok();
+    }
+
+    int waitForCompletion(Result& res) override
+    {
+        io_uring_cqe* cqe = nullptr;
+        int err;
+        while ((err = io_uring_wait_cqe(&ring, &cqe)) == -EINTR) {}
+
+        if (err < 0)
+        {
+            // shouldn't happen with writes in progress
+            jassertfalse;
+            res = errnoResult("Failed to write " + file.name, -err);
+            return 0;
+        }
+
+        int tag = int(reinterpret_cast<intptr_t>(io_uring_cqe_get_data(cqe)));
+        int written = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+
+        if (written < 0)
+        {
+            res = errnoResult("Failed to write " + file.name, -written);
+        }
+        else if (size_t(written) != sizes[tag])
+        {
+            // for regular files, this means the disk is full
+            res = Result::fail("Failed to write " + file.name + " (short write)");
+        }
+        else
+        {
+            res = Result::ok();
+        }
+
+        return tag;
+    }
+
+    Result close(int64 size) override
+    {
+        return file.close(size);
+    }
+
+    bool isDirect() const override
+    {
+        return file.isDirect;
+    }
+
+private:
+    PosixFile file;
+    io_uring ring;
+    bool ringOk = false;
+    HashMap<int, size_t> sizes; // requested size of each write in progress, by tag
+};
+
+#endif // ICA_HAVE_LIBURING
+
+
+AsyncWriteBackend* AsyncWriteBackend::open(const File& file, bool direct, int maxPending, Result& res)
+{
+#ifdef ICA_HAVE_LIBURING
+    {
+        ScopedPointer<UringWriteBackend> uringBackend = new UringWriteBackend(file, direct, maxPending, res);
+        if (uringBackend->isOpen())
+        {
+            return uringBackend.release();
+        }
+
+        if (res.failed())
+        {
+            return nullptr;
+        }
+        // otherwise, io_uring isn't available - fall back to the thread pool
+    }
+#endif
+
+    ScopedPointer<PosixPooledWriteBackend> pooledBackend = new PosixPooledWriteBackend(file, direct, res);
+    if (!pooledBackend->isOpen())
+    {
+        return nullptr;
+    }
+
+    return pooledBackend.release();
+}
@@ -0,0 +1,138 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../ICAAsyncWriter.h"
+
+#include <Windows.h>
+
+using namespace ICA;
+
+// Positioned WriteFile calls on the thread pool. With direct = true, the file is opened
+// with FILE_FLAG_NO_BUFFERING, which has the same alignment requirements as O_DIRECT
+// (sector size, which 4096 is a multiple of).
+class Win32WriteBackend : public PooledWriteBackend
+{
+public:
+    Win32WriteBackend(const File& file, bool direct, Result& res)
+        : name(file.getFileName())
+    {
+        const String path = file.getFullPathName();
+
+        if (direct)
+        {
+            handle = CreateFile(path.toWideCharPointer(), GENERIC_WRITE, 0, nullptr,
+                CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, nullptr);
+            isDirectFlag = handle != INVALID_HANDLE_VALUE;
+        }
+
+        if (handle == INVALID_HANDLE_VALUE)
+        {
+            handle = CreateFile(path.toWideCharPointer(), GENERIC_WRITE, 0, nullptr,
+                CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        }
+
+        if (handle == INVALID_HANDLE_VALUE)
+        {
+            res = Result::fail("Failed to open " + name);
+        }
+    }
+
+    ~Win32WriteBackend()
+    {
+        waitForAllJobs();
+
+        if (handle != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(handle);
+        }
+    }
+
+    bool isOpen() const
+    {
+        return handle != INVALID_HANDLE_VALUE;
+    }
+
+    Result close(int64 size) override
+    {
+        waitForAllJobs();
+
+        Result res = Result::ok();
+
+        // remove any padding from the last aligned write
+        FILE_END_OF_FILE_INFO eofInfo;
+        eofInfo.EndOfFile.QuadPart = size;
+        if (!SetFileInformationByHandle(handle, FileEndOfFileInfo, &eofInfo, sizeof(eofInfo)))
+        {
+            res = Result::fail("Failed to set size of " + name);
+        }
+
+        if (!CloseHandle(handle) && res.wasOk())
+        {
+            res = Result::fail("Failed to close " + name);
+        }
+        handle = INVALID_HANDLE_VALUE;
+
+        return res;
+    }
+
+    bool isDirect() const override
+    {
+        return isDirectFlag;
+    }
+
+protected:
+    Result writeAt(const char* data, size_t numBytes, int64 offset) override
+    {
+        while (numBytes > 0)
+        {
+            // (with a synchronous handle, this writes at the offset and waits)
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = DWORD(offset & 0xffffffff);
+            overlapped.OffsetHigh = DWORD(offset >> 32);
+
+            DWORD toWrite = DWORD(jmin(numBytes, size_t(1) << 30));
+            DWORD written = 0;
+            if (!WriteFile(handle, data, toWrite, &written, &overlapped) || written == 0)
+            {
+                return Result::fail("Failed to write " + name);
+            }
+
+            data += written;
+            numBytes -= written;
+            offset += written;
+        }
+
+        return Result::ok();
+    }
+
+private:
+    const String name;
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    bool isDirectFlag = false;
+};
+
+
+AsyncWriteBackend* AsyncWriteBackend::open(const File& file, bool direct, int, Result& res)
+{
+    ScopedPointer<Win32WriteBackend> backend = new Win32WriteBackend(file, direct, res);
+    if (!backend->isOpen())
+    {
+        return nullptr;
+    }
+
+    return backend.release();
+}
@@ -0,0 +1,1395 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// ica_batch: apply saved ICA decompositions to recorded sessions offline.
+//
+// Usage: ica_batch <manifest> [--jobs N] [--memory-mb M] [--summary <file>] [--force]
+//
+// Each non-empty line of the manifest (other than # comments) is one job, given as
+// tab-separated key=value fields:
+//   input=<path>     continuous.dat file from the binary record engine (interleaved int16)
+//   channels=<n>     number of channels in the input file
+//   ica=<path>       binica.sc file of the ICA run, or the directory containing it
+//   map=<list>       input file channels corresponding to the channels of the subprocessor
+//                    the ICA was run on (e.g. 0-31); defaults to 0, 1, 2...
+//   reject=<list>    components to remove, numbered from 1 as in the visualizer
+//   output=<path>    .dat file to write (same format as the input)
+//   bit_volts=<v,..> microvolts per bit of each input file channel, or one value for all of
+//                    them; defaults to the values in the recording's structure.oebin
+// Lists are comma-separated indices and/or ranges (e.g. 0-15,32,33).
+//
+// The plugin trains on data in microvolts, so each channel is scaled by its bit-volts before
+// the operation is applied, and back afterwards. This matters when the mapped channels are of
+// different types (e.g. headstage and ADC channels). The bit-volts are read from the
+// structure.oebin of the recording the input is in (<recording>/continuous/<stream>/
+// continuous.dat); if there is none and they aren't given, all channels are assumed to have
+// the same bit-volts, and the raw values are used. Channels not covered by the ICA are copied.
+//
+// Jobs run in parallel on up to N threads, and are only started while their buffers fit
+// in the memory budget. Inputs are memory-mapped. Each output is written to <output>.part
+// and renamed when it is complete, and progress is checkpointed next to it
+// (<output>.progress), so an interrupted batch resumes where it left off when run again.
+// A checkpoint records what the output is computed from (the ICA run and its matrices, the
+// channel map, the rejected components, the bit-volts and the input size); if any of these
+// changed, the job starts over. Outputs that exist without a checkpoint are considered done
+// and skipped. --force reprocesses them, and starts every job over. A summary is written to
+// <manifest>.summary.tsv by default.
+
+#include "ICAApplyPlan.h"
+#include "ICABinicaFiles.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace ICA;
+
+// samples per channel processed (and checkpointed) at a time, at most
+static const int64_t maxChunkFrames = 1 << 16;
+
+struct Job
+{
+    int lineNumber = 0;
+    std::string input;
+    int numChannels = 0;
+    std::string ica;
+    std::vector<int> map;
+    std::vector<int> reject; // 0-based
+    std::string output;
+    std::vector<float> bitVolts; // per input channel, or one for all; empty if not given
+};
+
+struct JobResult
+{
+    enum Status { pending, done, skipped, failed };
+
+    Status status = pending;
+    int64_t frames = 0;        // processed in this run
+    int64_t resumedFrom = 0;   // frames that had already been done in a previous run
+    double seconds = 0;
+    std::string error;
+};
+
+static const char* statusName(JobResult::Status status)
+{
+    switch (status)
+    {
+    case JobResult::done:    return "done";
+    case JobResult::skipped: return "skipped";
+    case JobResult::failed:  return "failed";
+    default:                 return "pending";
+    }
+}
+
+/**** parsing ****/
+
+static bool parseInt(const std::string& text, int& value)
+{
+    if (text.empty())
+    {
+        return false;
+    }
+
+    char* end;
+    long parsed = std::strtol(text.c_str(), &end, 10);
+    if (*end != '\0' || parsed < 0 || parsed > 1000000)
+    {
+        return false;
+    }
+
+    value = int(parsed);
+    return true;
+}
+
+// comma-separated indices and ranges (a-b, inclusive)
+static bool parseList(const std::string& text, std::vector<int>& list)
+{
+    list.clear();
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (item.empty())
+        {
+            continue;
+        }
+
+        size_t dash = item.find('-');
+        int first, last;
+        if (dash == std::string::npos)
+        {
+            if (!parseInt(item, first))
+            {
+                return false;
+            }
+            last = first;
+        }
+        else if (!parseInt(item.substr(0, dash), first)
+            || !parseInt(item.substr(dash + 1), last) || last < first)
+        {
+            return false;
+        }
+
+        for (int i = first; i <= last; ++i)
+        {
+            list.push_back(i);
+        }
+    }
+    return true;
+}
+
+// comma-separated positive numbers
+static bool parsePositiveList(const std::string& text, std::vector<float>& list)
+{
+    list.clear();
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        char* end;
+        double value = std::strtod(item.c_str(), &end);
+        if (item.empty() || *end != '\0' || !(value > 0) || !std::isfinite(value))
+        {
+            return false;
+        }
+        list.push_back(float(value));
+    }
+    return !list.empty();
+}
+
+static bool parseJob(const std::string& line, Job& job, std::string& error)
+{
+    bool hasMap = false;
+    std::istringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, '\t'))
+    {
+        if (field.empty())
+        {
+            continue;
+        }
+
+        size_t eq = field.find('=');
+        if (eq == std::string::npos)
+        {
+            error = "expected key=value, got \"" + field + "\"";
+            return false;
+        }
+
+        std::string key = field.substr(0, eq);
+        std::string value = field.substr(eq + 1);
+
+        if (key == "input")
+        {
+            job.input = value;
+        }
+        else if (key == "channels")
+        {
+            if (!parseInt(value, job.numChannels) || job.numChannels == 0)
+            {
+                error = "invalid number of channels";
+                return false;
+            }
+        }
+        else if (key == "ica")
+        {
+            job.ica = value;
+        }
+        else if (key == "map")
+        {
+            if (!parseList(value, job.map))
+            {
+                error = "invalid channel map";
+                return false;
+            }
+            hasMap = true;
+        }
+        else if (key == "reject")
+        {
+            std::vector<int> comps;
+            if (!parseList(value, comps))
+            {
+                error = "invalid component list";
+                return false;
+            }
+
+            job.reject.clear();
+            for (int comp : comps)
+            {
+                if (comp == 0)
+                {
+                    error = "components are numbered from 1";
+                    return false;
+                }
+                job.reject.push_back(comp - 1);
+            }
+        }
+        else if (key == "output")
+        {
+            job.output = value;
+        }
+        else if (key == "bit_volts")
+        {
+            if (!parsePositiveList(value, job.bitVolts))
+            {
+                error = "invalid bit-volts";
+                return false;
+            }
+        }
+        else
+        {
+            error = "unknown key \"" + key + "\"";
+            return false;
+        }
+    }
+
+    if (job.input.empty() || job.ica.empty() || job.output.empty() || job.numChannels == 0)
+    {
+        error = "input, channels, ica and output are required";
+        return false;
+    }
+
+    if (!hasMap)
+    {
+        for (int i = 0; i < job.numChannels; ++i)
+        {
+            job.map.push_back(i);
+        }
+    }
+
+    for (int chan : job.map)
+    {
+        if (chan >= job.numChannels)
+        {
+            error = "channel map refers to channel " + std::to_string(chan)
+                + " of " + std::to_string(job.numChannels);
+            return false;
+        }
+    }
+
+    if (job.bitVolts.size() > 1 && int(job.bitVolts.size()) != job.numChannels)
+    {
+        error = "expected 1 or " + std::to_string(job.numChannels) + " bit-volts values";
+        return false;
+    }
+
+    return true;
+}
+
+static bool readManifest(const std::string& path, std::vector<Job>& jobs)
+{
+    std::ifstream stream(path);
+    if (!stream)
+    {
+        std::cerr << "Failed to open manifest " << path << std::endl;
+        return false;
+    }
+
+    bool ok = true;
+    std::string line;
+    for (int lineNumber = 1; std::getline(stream, line); ++lineNumber)
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t") == std::string::npos)
+        {
+            continue;
+        }
+
+        Job job;
+        job.lineNumber = lineNumber;
+        std::string error;
+        if (!parseJob(line, job, error))
+        {
+            std::cerr << path << ":" << lineNumber << ": " << error << std::endl;
+            ok = false;
+            continue;
+        }
+        jobs.push_back(job);
+    }
+
+    return ok;
+}
+
+/**** files ****/
+
+static bool fileExists(const std::string& path)
+{
+    std::ifstream stream(path);
+    return bool(stream);
+}
+
+static bool isDirectory(const std::string& path)
+{
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(path.c_str());
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+}
+
+// directory containing a path (without the separator), or "" if there is none
+static std::string parentPath(const std::string& path)
+{
+    size_t sep = path.find_last_of("/\\");
+    return sep == std::string::npos ? std::string() : path.substr(0, sep);
+}
+
+static std::string fileName(const std::string& path)
+{
+    size_t sep = path.find_last_of("/\\");
+    return sep == std::string::npos ? path : path.substr(sep + 1);
+}
+
+// just enough of JSON to read a structure.oebin file
+struct JsonValue
+{
+    enum Type { nullValue, boolValue, numberValue, stringValue, arrayValue, objectValue };
+
+    Type type = nullValue;
+    double number = 0;
+    std::string text;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue>> members;
+
+    // the member with the given name, or null if this isn't an object that has one
+    const JsonValue* get(const std::string& name) const
+    {
+        for (const auto& member : members)
+        {
+            if (member.first == name)
+            {
+                return &member.second;
+            }
+        }
+        return nullptr;
+    }
+};
+
+class JsonParser
+{
+public:
+    explicit JsonParser(const std::string& text)
+        : text(text)
+    {}
+
+    bool parse(JsonValue& value)
+    {
+        if (!parseValue(value, 0))
+        {
+            return false;
+        }
+        skipSpace();
+        return pos == text.size();
+    }
+
+private:
+    void skipSpace()
+    {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+        {
+            ++pos;
+        }
+    }
+
+    bool consume(char c)
+    {
+        skipSpace();
+        if (pos < text.size() && text[pos] == c)
+        {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    bool parseLiteral(const char* literal)
+    {
+        size_t length = std::strlen(literal);
+        if (text.compare(pos, length, literal) != 0)
+        {
+            return false;
+        }
+        pos += length;
+        return true;
+    }
+
+    // (escaped non-ASCII characters are replaced by '?', which is fine for comparing names)
+    bool parseString(std::string& dest)
+    {
+        if (!consume('"'))
+        {
+            return false;
+        }
+
+        dest.clear();
+        while (pos < text.size() && text[pos] != '"')
+        {
+            char c = text[pos++];
+            if (c == '\\')
+            {
+                if (pos >= text.size())
+                {
+                    return false;
+                }
+
+                char escaped = text[pos++];
+                switch (escaped)
+                {
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'u':
+                {
+                    if (pos + 4 > text.size())
+                    {
+                        return false;
+                    }
+                    long code = std::strtol(text.substr(pos, 4).c_str(), nullptr, 16);
+                    c = code < 0x80 ? char(code) : '?';
+                    pos += 4;
+                    break;
+                }
+                default: c = escaped; break;
+                }
+            }
+            dest += c;
+        }
+
+        if (pos >= text.size())
+        {
+            return false;
+        }
+        ++pos;
+        return true;
+    }
+
+    bool parseValue(JsonValue& value, int depth)
+    {
+        skipSpace();
+        if (pos >= text.size() || depth > maxDepth)
+        {
+            return false;
+        }
+
+        char c = text[pos];
+        if (c == '{')
+        {
+            ++pos;
+            value.type = JsonValue::objectValue;
+            if (consume('}'))
+            {
+                return true;
+            }
+
+            do
+            {
+                value.members.emplace_back();
+                if (!parseString(value.members.back().first) || !consume(':')
+                    || !parseValue(value.members.back().second, depth + 1))
+                {
+                    return false;
+                }
+            } while (consume(','));
+            return consume('}');
+        }
+
+        if (c == '[')
+        {
+            ++pos;
+            value.type = JsonValue::arrayValue;
+            if (consume(']'))
+            {
+                return true;
+            }
+
+            do
+            {
+                value.items.emplace_back();
+                if (!parseValue(value.items.back(), depth + 1))
+                {
+                    return false;
+                }
+            } while (consume(','));
+            return consume(']');
+        }
+
+        if (c == '"')
+        {
+            value.type = JsonValue::stringValue;
+            return parseString(value.text);
+        }
+
+        if (c == 't' || c == 'f')
+        {
+            value.type = JsonValue::boolValue;
+            value.number = c == 't';
+            return parseLiteral(c == 't' ? "true" : "false");
+        }
+
+        if (c == 'n')
+        {
+            return parseLiteral("null");
+        }
+
+        char* end;
+        value.type = JsonValue::numberValue;
+        value.number = std::strtod(text.c_str() + pos, &end);
+        if (end == text.c_str() + pos)
+        {
+            return false;
+        }
+        pos = size_t(end - text.c_str());
+        return true;
+    }
+
+    static const int maxDepth = 64;
+
+    const std::string& text;
+    size_t pos = 0;
+};
+
+// read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile(const std::string& path, std::string& error)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        LARGE_INTEGER fileSize;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize))
+        {
+            error = "Failed to open " + path;
+            return;
+        }
+        size = int64_t(fileSize.QuadPart);
+
+        if (size > 0)
+        {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr)
+            {
+                data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            }
+        }
+#else
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if (fd == -1 || fstat(fd, &info) == -1)
+        {
+            error = "Failed to open " + path + " (" + std::strerror(errno) + ")";
+            return;
+        }
+        size = int64_t(info.st_size);
+
+        if (size > 0)
+        {
+            void* addr = mmap(nullptr, size_t(size), PROT_READ, MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                data = static_cast<const char*>(addr);
+                madvise(addr, size_t(size), MADV_SEQUENTIAL);
+            }
+        }
+#endif
+        if (size > 0 && data == nullptr)
+        {
+            error = "Failed to map " + path;
+        }
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (data != nullptr)
+        {
+            UnmapViewOfFile(data);
+        }
+        if (mapping != nullptr)
+        {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+        }
+#else
+        if (data != nullptr)
+        {
+            munmap(const_cast<char*>(data), size_t(size));
+        }
+        if (fd != -1)
+        {
+            ::close(fd);
+        }
+#endif
+    }
+
+    // let the OS drop pages that have been processed
+    void release(int64_t offset, int64_t length)
+    {
+#ifndef _WIN32
+        static const int64_t pageSize = sysconf(_SC_PAGESIZE);
+        int64_t start = offset / pageSize * pageSize;
+        madvise(const_cast<char*>(data) + start, size_t(offset + length - start), MADV_DONTNEED);
+#else
+        (void)offset;
+        (void)length;
+#endif
+    }
+
+    const char* data = nullptr;
+    int64_t size = 0;
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+static bool syncFile(std::FILE* file)
+{
+    if (std::fflush(file) != 0)
+    {
+        return false;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+static bool seekFile(std::FILE* file, int64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+// last modification time of a file (in the platform's units), or -1 if it can't be read
+static int64_t modificationTime(const std::string& path)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes))
+    {
+        return -1;
+    }
+    return (int64_t(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? int64_t(info.st_mtime) : -1;
+#endif
+}
+
+static std::string checkpointPath(const Job& job)
+{
+    return job.output + ".progress";
+}
+
+// where the output is written until it is complete
+static std::string partialPath(const Job& job)
+{
+    return job.output + ".part";
+}
+
+// rename, replacing dest if it exists
+static bool replaceFile(const std::string& source, const std::string& dest)
+{
+#ifdef _WIN32
+    return MoveFileExA(source.c_str(), dest.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return std::rename(source.c_str(), dest.c_str()) == 0;
+#endif
+}
+
+// A checkpoint is the number of frames done, then the fingerprint of the job (see
+// jobFingerprint) on the next line. Returns -1 if there's no valid checkpoint with the
+// given fingerprint.
+static int64_t readCheckpoint(const Job& job, const std::string& fingerprint)
+{
+    std::ifstream stream(checkpointPath(job));
+    long long frames;
+    std::string line;
+    if (!(stream >> frames) || frames < 0 || !std::getline(stream, line) || !std::getline(stream, line)
+        || line != fingerprint)
+    {
+        return -1;
+    }
+    return int64_t(frames);
+}
+
+static bool writeCheckpoint(const Job& job, const std::string& fingerprint, int64_t frames)
+{
+    // write a new file and swap it in, so that there's always a complete checkpoint
+    std::string path = checkpointPath(job);
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream stream(tempPath, std::ios::trunc);
+        stream << frames << "\n" << fingerprint << "\n";
+        if (!stream.flush())
+        {
+            return false;
+        }
+    }
+
+    return replaceFile(tempPath, path);
+}
+
+/**** scheduling ****/
+
+// admits jobs while the total of their memory estimates stays within the budget
+// (a job that doesn't fit even on its own still runs, once nothing else is)
+class MemoryBudget
+{
+public:
+    explicit MemoryBudget(int64_t total)
+        : total(total)
+    {}
+
+    void acquire(int64_t bytes)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [&] { return inUse == 0 || inUse + bytes <= total; });
+        inUse += bytes;
+    }
+
+    void release(int64_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            inUse -= bytes;
+        }
+        available.notify_all();
+    }
+
+private:
+    const int64_t total;
+    int64_t inUse = 0;
+    std::mutex mutex;
+    std::condition_variable available;
+};
+
+static std::mutex logMutex;
+
+static void logLine(const std::string& line)
+{
+    std::lock_guard<std::mutex> lock(logMutex);
+    std::cout << line << std::endl;
+}
+
+/**** processing ****/
+
+static int64_t chunkBytesPerFrame(const Job& job)
+{
+    // int16 output chunk + planar float working channels
+    return int64_t(job.numChannels) * sizeof(int16_t) + int64_t(job.map.size()) * sizeof(float);
+}
+
+static int64_t estimateMemory(const Job& job, int64_t chunkFrames)
+{
+    int64_t nChans = int64_t(job.map.size());
+    int64_t scratch = int64_t(ApplyPlan::tileSize) * nChans * 3 * sizeof(float);
+    int64_t matrices = nChans * nChans * 4 * sizeof(float);
+
+    // plus the output stream buffer and mapped input pages in flight, roughly one chunk each
+    return chunkFrames * chunkBytesPerFrame(job) * 3 + scratch + matrices;
+}
+
+static std::string icaConfigPath(const Job& job)
+{
+    return isDirectory(job.ica) ? job.ica + "/binica.sc" : job.ica;
+}
+
+// what the output of a job is computed from (on one line)
+static std::string jobFingerprint(const Job& job, const BinicaResults& ica, const std::vector<float>& bitVolts,
+    int64_t inputSize)
+{
+    // (FNV-1a of the unmixing matrix, in case the results were replaced without the config)
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(ica.unmixing.data());
+    for (size_t i = 0; i < size_t(ica.unmixing.size()) * sizeof(float); ++i)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    std::ostringstream stream;
+    stream << "ica=" << icaConfigPath(job) << "\tmtime=" << modificationTime(icaConfigPath(job))
+        << "\tunmixing=" << std::hex << hash << std::dec << "\tmap=";
+    for (int chan : job.map)
+    {
+        stream << chan << ',';
+    }
+    stream << "\treject=";
+    for (int comp : job.reject)
+    {
+        stream << comp << ',';
+    }
+    stream << "\tbit_volts=" << std::setprecision(9);
+    for (float chanBitVolts : bitVolts)
+    {
+        stream << chanBitVolts << ',';
+    }
+    stream << "\tinput_bytes=" << inputSize;
+    return stream.str();
+}
+
+static bool loadDecomposition(const Job& job, BinicaResults& results, std::string& error)
+{
+    std::string configPath = icaConfigPath(job);
+
+    if (!loadBinicaResults(configPath, results, error))
+    {
+        error = configPath + ": " + error;
+        return false;
+    }
+
+    for (int chan : results.enabledChannels)
+    {
+        if (chan >= int(job.map.size()))
+        {
+            error = "ICA uses channel " + std::to_string(chan) + " but the channel map only has "
+                + std::to_string(job.map.size()) + " channels";
+            return false;
+        }
+    }
+
+    for (int comp : job.reject)
+    {
+        if (comp >= int(results.enabledChannels.size()))
+        {
+            error = "component " + std::to_string(comp + 1) + " does not exist (ICA has "
+                + std::to_string(results.enabledChannels.size()) + " components)";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// The bit-volts of each input file channel, from the job or from the structure.oebin of the
+// recording the input is in. Leaves bitVolts empty if neither has them.
+static bool readBitVolts(const Job& job, std::vector<float>& bitVolts, std::string& error)
+{
+    bitVolts.clear();
+    if (!job.bitVolts.empty())
+    {
+        bitVolts.assign(size_t(job.numChannels), job.bitVolts[0]);
+        if (job.bitVolts.size() > 1)
+        {
+            bitVolts = job.bitVolts;
+        }
+        return true;
+    }
+
+    std::string streamDir = parentPath(job.input);
+    std::string continuousDir = parentPath(streamDir);
+    if (fileName(continuousDir) != "continuous")
+    {
+        return true;
+    }
+
+    std::string structurePath = parentPath(continuousDir);
+    structurePath += structurePath.empty() ? "structure.oebin" : "/structure.oebin";
+    std::ifstream stream(structurePath);
+    if (!stream)
+    {
+        return true;
+    }
+
+    std::stringstream contents;
+    contents << stream.rdbuf();
+    std::string text = contents.str();
+    JsonValue structure;
+    if (!JsonParser(text).parse(structure))
+    {
+        error = "Failed to parse " + structurePath;
+        return false;
+    }
+
+    const JsonValue* streams = structure.get("continuous");
+    if (streams == nullptr)
+    {
+        error = structurePath + " has no continuous streams";
+        return false;
+    }
+
+    std::string folder = fileName(streamDir);
+    for (const JsonValue& streamInfo : streams->items)
+    {
+        const JsonValue* folderName = streamInfo.get("folder_name");
+        std::string name = folderName ? folderName->text : std::string();
+        while (!name.empty() && (name.back() == '/' || name.back() == '\\'))
+        {
+            name.pop_back();
+        }
+        if (name != folder)
+        {
+            continue;
+        }
+
+        const JsonValue* channels = streamInfo.get("channels");
+        if (channels == nullptr || int(channels->items.size()) < job.numChannels)
+        {
+            error = structurePath + " describes fewer than " + std::to_string(job.numChannels)
+                + " channels for " + folder;
+            return false;
+        }
+
+        for (int chan = 0; chan < job.numChannels; ++chan)
+        {
+            const JsonValue* chanBitVolts = channels->items[chan].get("bit_volts");
+            if (chanBitVolts == nullptr || !(chanBitVolts->number > 0))
+            {
+                error = structurePath + " has no valid bit_volts for channel " + std::to_string(chan);
+                bitVolts.clear();
+                return false;
+            }
+            bitVolts.push_back(float(chanBitVolts->number));
+        }
+        return true;
+    }
+
+    error = structurePath + " doesn't describe stream " + folder;
+    return false;
+}
+
+// (with startOver, any checkpoint is ignored)
+static void runJob(const Job& job, int64_t chunkFrames, bool startOver, JobResult& result)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    std::string error;
+    BinicaResults ica;
+    if (!loadDecomposition(job, ica, error))
+    {
+        result.status = JobResult::failed;
+        result.error = error;
+        return;
+    }
+
+    MappedFile input(job.input, error);
+    if (!error.empty())
+    {
+        result.status = JobResult::failed;
+        result.error = error;
+        return;
+    }
+
+    const int64_t frameBytes = int64_t(job.numChannels) * sizeof(int16_t);
+    if (input.size % frameBytes != 0)
+    {
+        result.status = JobResult::failed;
+        result.error = "input size is not a multiple of " + std::to_string(job.numChannels) + " channels";
+        return;
+    }
+    const int64_t totalFrames = input.size / frameBytes;
+
+    std::vector<float> bitVolts;
+    if (!readBitVolts(job, bitVolts, error))
+    {
+        result.status = JobResult::failed;
+        result.error = error;
+        return;
+    }
+
+    // (the output itself only appears once it's complete, so a partial one is never skipped)
+    const std::string partPath = partialPath(job);
+    const std::string fingerprint = jobFingerprint(job, ica, bitVolts, input.size);
+    int64_t startFrame = startOver ? -1 : readCheckpoint(job, fingerprint);
+    if (startFrame < 0 && !startOver && fileExists(checkpointPath(job)))
+    {
+        logLine("[" + job.output + "] decomposition, channels or input changed since the checkpoint, starting over");
+    }
+    std::FILE* output = nullptr;
+    if (startFrame > 0)
+    {
+        // resume - anything past the checkpoint gets overwritten
+        startFrame = std::min(startFrame, totalFrames);
+        output = std::fopen(partPath.c_str(), "r+b");
+        if (output != nullptr && !seekFile(output, startFrame * frameBytes))
+        {
+            std::fclose(output);
+            output = nullptr;
+        }
+    }
+
+    if (output == nullptr)
+    {
+        startFrame = 0;
+        output = std::fopen(partPath.c_str(), "wb");
+    }
+
+    if (output == nullptr)
+    {
+        result.status = JobResult::failed;
+        result.error = "Failed to open " + partPath + " (" + std::strerror(errno) + ")";
+        return;
+    }
+    std::unique_ptr<std::FILE, int(*)(std::FILE*)> outputCloser(output, std::fclose);
+
+    result.resumedFrom = startFrame;
+    if (startFrame > 0)
+    {
+        logLine("[" + job.output + "] resuming at frame " + std::to_string(startFrame));
+    }
+
+    // operate on the local channels 0..k-1 (one planar buffer per enabled channel)
+    int nComps = int(ica.enabledChannels.size());
+    std::vector<int> localChans(nComps);
+    std::vector<int> fileChans(nComps);
+    for (int i = 0; i < nComps; ++i)
+    {
+        localChans[i] = i;
+        fileChans[i] = job.map[ica.enabledChannels[i]];
+    }
+
+    // scale to microvolts and back, unless all the channels have the same bit-volts
+    // (then, since the operation is linear, the raw values give the same result)
+    std::vector<float> gains(nComps, 1.0f);
+    if (bitVolts.empty())
+    {
+        logLine("[" + job.output + "] no bit-volts given or found in structure.oebin,"
+            " assuming they're the same for all channels");
+    }
+    else
+    {
+        bool uniform = true;
+        for (int i = 0; i < nComps; ++i)
+        {
+            gains[i] = bitVolts[fileChans[i]];
+            uniform = uniform && gains[i] == gains[0];
+        }
+
+        if (uniform)
+        {
+            gains.assign(nComps, 1.0f);
+        }
+    }
+
+    // (in factored form, if it was trained in two levels and that's cheaper)
+    ApplyPlan plan(std::make_shared<const ApplyKernel>(ica.mixing, ica.unmixing, job.reject,
+        ica.factors.get()), localChans);
+    ApplyPlan::Scratch scratch;
+    scratch.ensureSize(nComps);
+
+    std::vector<int16_t> outChunk(size_t(chunkFrames * job.numChannels));
+    std::vector<float> planar(size_t(chunkFrames * nComps));
+    std::vector<float*> planarPtrs(nComps);
+    for (int i = 0; i < nComps; ++i)
+    {
+        planarPtrs[i] = planar.data() + size_t(i) * chunkFrames;
+    }
+
+    for (int64_t frame = startFrame; frame < totalFrames; frame += chunkFrames)
+    {
+        int64_t len = std::min(chunkFrames, totalFrames - frame);
+        const int16_t* in = reinterpret_cast<const int16_t*>(input.data + frame * frameBytes);
+        std::memcpy(outChunk.data(), in, size_t(len * frameBytes));
+
+        if (!plan.isIdentity())
+        {
+            for (int i = 0; i < nComps; ++i)
+            {
+                const int16_t* src = in + fileChans[i];
+                float* dest = planarPtrs[i];
+                for (int64_t t = 0; t < len; ++t)
+                {
+                    dest[t] = float(src[t * job.numChannels]) * gains[i];
+                }
+            }
+
+            plan.apply(planarPtrs.data(), int(len), scratch);
+
+            for (int i = 0; i < nComps; ++i)
+            {
+                int16_t* dest = outChunk.data() + fileChans[i];
+                const float* src = planarPtrs[i];
+                for (int64_t t = 0; t < len; ++t)
+                {
+                    float val = std::max(-32768.0f, std::min(32767.0f, std::round(src[t] / gains[i])));
+                    dest[t * job.numChannels] = int16_t(val);
+                }
+            }
+        }
+
+        input.release(frame * frameBytes, len * frameBytes);
+
+        if (std::fwrite(outChunk.data(), size_t(frameBytes), size_t(len), output) != size_t(len)
+            || !syncFile(output))
+        {
+            result.status = JobResult::failed;
+            result.error = "Failed to write " + partPath + " (" + std::strerror(errno) + ")";
+            return;
+        }
+
+        result.frames += len;
+        if (!writeCheckpoint(job, fingerprint, frame + len))
+        {
+            result.status = JobResult::failed;
+            result.error = "Failed to write checkpoint for " + job.output;
+            return;
+        }
+    }
+
+    if (std::fclose(outputCloser.release()) != 0)
+    {
+        result.status = JobResult::failed;
+        result.error = "Failed to close " + partPath;
+        return;
+    }
+
+    if (!replaceFile(partPath, job.output))
+    {
+        result.status = JobResult::failed;
+        result.error = "Failed to rename " + partPath + " to " + job.output;
+        return;
+    }
+
+    std::remove(checkpointPath(job).c_str());
+
+    result.status = JobResult::done;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+/**** main ****/
+
+static void printUsage()
+{
+    std::cerr << "Usage: ica_batch <manifest> [--jobs N] [--memory-mb M] [--summary <file>] [--force]\n"
+        << "  --jobs N        number of jobs to run at once (default: number of cores)\n"
+        << "  --memory-mb M   approximate limit on buffer memory used by all jobs (default: 1024)\n"
+        << "  --summary FILE  where to write the summary (default: <manifest>.summary.tsv)\n"
+        << "  --force         reprocess outputs that already exist, and start over rather than resume\n";
+}
+
+int main(int argc, char* argv[])
+{
+    std::string manifestPath;
+    std::string summaryPath;
+    int numThreads = int(std::max(1u, std::thread::hardware_concurrency()));
+    int memoryMB = 1024;
+    bool force = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--jobs" && i + 1 < argc)
+        {
+            if (!parseInt(argv[++i], numThreads) || numThreads == 0)
+            {
+                printUsage();
+                return 2;
+            }
+        }
+        else if (arg == "--memory-mb" && i + 1 < argc)
+        {
+            if (!parseInt(argv[++i], memoryMB) || memoryMB == 0)
+            {
+                printUsage();
+                return 2;
+            }
+        }
+        else if (arg == "--summary" && i + 1 < argc)
+        {
+            summaryPath = argv[++i];
+        }
+        else if (arg == "--force")
+        {
+            force = true;
+        }
+        else if (manifestPath.empty() && arg.compare(0, 2, "--") != 0)
+        {
+            manifestPath = arg;
+        }
+        else
+        {
+            printUsage();
+            return 2;
+        }
+    }
+
+    if (manifestPath.empty())
+    {
+        printUsage();
+        return 2;
+    }
+
+    if (summaryPath.empty())
+    {
+        summaryPath = manifestPath + ".summary.tsv";
+    }
+
+    std::vector<Job> jobs;
+    if (!readManifest(manifestPath, jobs))
+    {
+        return 2;
+    }
+
+    // single-threaded Eigen; parallelism is across jobs
+    Eigen::setNbThreads(1);
+
+    const int64_t memoryBudget = int64_t(memoryMB) << 20;
+    numThreads = std::min(numThreads, std::max(1, int(jobs.size())));
+
+    MemoryBudget budget(memoryBudget);
+    std::vector<JobResult> results(jobs.size());
+    std::atomic<size_t> nextJob(0);
+
+    auto worker = [&]()
+    {
+        for (size_t j = nextJob++; j < jobs.size(); j = nextJob++)
+        {
+            const Job& job = jobs[j];
+            JobResult& result = results[j];
+
+            if (!force && fileExists(job.output) && !fileExists(checkpointPath(job)))
+            {
+                result.status = JobResult::skipped;
+                logLine("[" + job.output + "] already done, skipping");
+                continue;
+            }
+
+            // split the budget evenly between the threads for sizing chunks
+            int64_t perThread = memoryBudget / numThreads;
+            int64_t chunkFrames = perThread / (chunkBytesPerFrame(job) * 3);
+            chunkFrames = std::max(int64_t(ApplyPlan::tileSize), std::min(maxChunkFrames, chunkFrames));
+            chunkFrames = chunkFrames / ApplyPlan::tileSize * ApplyPlan::tileSize;
+
+            int64_t memory = estimateMemory(job, chunkFrames);
+            budget.acquire(memory);
+            logLine("[" + job.output + "] started");
+
+            try
+            {
+                runJob(job, chunkFrames, force, result);
+            }
+            catch (const std::bad_alloc&)
+            {
+                result.status = JobResult::failed;
+                result.error = "Out of memory";
+            }
+
+            budget.release(memory);
+            logLine("[" + job.output + "] " + statusName(result.status)
+                + (result.error.empty() ? "" : ": " + result.error));
+        }
+    };
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; ++t)
+    {
+        threads.emplace_back(worker);
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    double totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    // summary
+    std::ostringstream summary;
+    summary << std::fixed << std::setprecision(2);
+    summary << "line\tinput\toutput\tstatus\tframes\tresumed_from\tseconds\tMB_per_s\terror\n";
+
+    int nDone = 0, nSkipped = 0, nFailed = 0;
+    double totalMB = 0;
+    for (size_t j = 0; j < jobs.size(); ++j)
+    {
+        const Job& job = jobs[j];
+        const JobResult& result = results[j];
+
+        double mb = double(result.frames) * job.numChannels * sizeof(int16_t) / (1 << 20);
+        totalMB += mb;
+
+        summary << job.lineNumber << "\t" << job.input << "\t" << job.output << "\t"
+            << statusName(result.status) << "\t" << result.frames << "\t" << result.resumedFrom << "\t"
+            << result.seconds << "\t" << (result.seconds > 0 ? mb / result.seconds : 0.0) << "\t"
+            << result.error << "\n";
+
+        nDone += result.status == JobResult::done;
+        nSkipped += result.status == JobResult::skipped;
+        nFailed += result.status == JobResult::failed;
+    }
+
+    std::ostringstream totals;
+    totals << std::fixed << std::setprecision(2)
+        << jobs.size() << " jobs: " << nDone << " done, " << nSkipped << " skipped, " << nFailed << " failed; "
+        << totalMB << " MB in " << totalSeconds << " s ("
+        << (totalSeconds > 0 ? totalMB / totalSeconds : 0.0) << " MB/s)";
+
+    summary << "# " << totals.str() << "\n";
+
+    std::ofstream summaryStream(summaryPath, std::ios::trunc);
+    summaryStream << summary.str();
+    if (!summaryStream.flush())
+    {
+        std::cerr << "Failed to write summary to " << summaryPath << std::endl;
+    }
+
+    std::cout << totals.str() << std::endl;
+    return nFailed > 0 ? 1 : 0;
+}
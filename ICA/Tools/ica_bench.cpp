@@ -0,0 +1,309 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// ica_bench: time the per-block work of the ICA processor on synthetic data.
+//
+// Usage: ica_bench [--channels N] [--rate HZ] [--block N] [--seconds S] [--rejected R]
+//                  [--groups G] [--dense]
+//
+// Compares two ways of filling the training cache (every <rate / 500>th sample of every
+// channel) while applying a plan that removes R random components:
+//   separate  the cache is filled from the buffer one frame at a time (as ICANode did before),
+//             then the plan reads the buffer again
+//   fused     the plan passes each tile it reads to a DecimatingCapture, so the input is
+//             only read from memory once
+// and, for reference, applying the plan alone. Blocks are rotated through a pool larger than
+// the last-level cache, as if each came fresh from the acquisition thread. Reports the time
+// per second of data and an estimate of the memory traffic on the input buffer (in 64-byte
+// cache lines), and checks that both methods fill the cache identically.
+//
+// With --groups, the operation is block-diagonal with G blocks, like one from grouped
+// training, so the kernel uses its sparse form if it can. --dense fills in the zeros with
+// tiny values to time the same operation in dense form.
+
+#include "ICAApplyPlan.h"
+#include "ICATileCapture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace ICA;
+
+// (about the target rate of the training cache)
+static const float cacheFs = 500.0f;
+
+// total size of the block pool, so it doesn't stay in cache between uses
+static const size_t poolBytes = size_t(128) << 20;
+
+static const int cacheLineBytes = 64;
+
+// like ICANode's AudioBufferFifo, without JUCE: channel-major ring buffer
+class RingCache : public FrameSink
+{
+public:
+    RingCache(int numChans, int numSamps)
+        : data      (numChans, std::vector<float>(numSamps))
+        , numSamps  (numSamps)
+        , writePos  (0)
+    {}
+
+    void writeFrames(const float* const* sources, int stride, int numFrames) override
+    {
+        for (int c = 0; c < int(data.size()); ++c)
+        {
+            int pos = writePos;
+            for (int i = 0; i < numFrames; ++i)
+            {
+                data[c][pos] = sources[c][i * stride];
+                if (++pos == numSamps)
+                {
+                    pos = 0;
+                }
+            }
+        }
+        writePos = (writePos + numFrames) % numSamps;
+    }
+
+    // the old way: one frame of all channels at a time
+    void writeFrame(const float* const* data, int sample)
+    {
+        for (int c = 0; c < int(this->data.size()); ++c)
+        {
+            this->data[c][writePos] = data[c][sample];
+        }
+        writePos = (writePos + 1) % numSamps;
+    }
+
+    std::vector<std::vector<float>> data;
+    int numSamps;
+    int writePos;
+};
+
+static bool parseInt(const std::string& text, int& value)
+{
+    char* end;
+    long parsed = std::strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || parsed <= 0 || parsed > 100000000)
+    {
+        return false;
+    }
+
+    value = int(parsed);
+    return true;
+}
+
+static void printUsage()
+{
+    std::cerr << "Usage: ica_bench [--channels N] [--rate HZ] [--block N] [--seconds S] [--rejected R]\n"
+        << "                 [--groups G] [--dense]\n"
+        << "  --channels N   number of channels (default: 384)\n"
+        << "  --rate HZ      sample rate (default: 30000)\n"
+        << "  --block N      samples per block (default: 1024)\n"
+        << "  --seconds S    amount of data to process per method (default: 20)\n"
+        << "  --rejected R   number of components to remove (default: 8)\n"
+        << "  --groups G     make the operation block-diagonal with G blocks (default: 1)\n"
+        << "  --dense        don't let the kernel skip the zeros of a block-diagonal operation\n";
+}
+
+int main(int argc, char* argv[])
+{
+    int numChans = 384;
+    int rate = 30000;
+    int blockSize = 1024;
+    int seconds = 20;
+    int numRejected = 8;
+    int numGroups = 1;
+    bool forceDense = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--dense")
+        {
+            forceDense = true;
+            continue;
+        }
+
+        int* dest = arg == "--channels" ? &numChans
+            : arg == "--rate" ? &rate
+            : arg == "--block" ? &blockSize
+            : arg == "--seconds" ? &seconds
+            : arg == "--rejected" ? &numRejected
+            : arg == "--groups" ? &numGroups
+            : nullptr;
+
+        if (dest == nullptr || i + 1 >= argc || !parseInt(argv[++i], *dest))
+        {
+            printUsage();
+            return 2;
+        }
+    }
+
+    numRejected = std::min(numRejected, numChans);
+    numGroups = std::min(numGroups, numChans);
+    int stride = std::max(int(rate / cacheFs), 1);
+
+    // random operation
+    std::mt19937 rng(1);
+    std::normal_distribution<float> normal;
+    Matrix mixing = Matrix::Zero(numChans, numChans);
+    for (int g = 0; g < numGroups; ++g)
+    {
+        int begin = g * numChans / numGroups;
+        int size = (g + 1) * numChans / numGroups - begin;
+        mixing.block(begin, begin, size, size) = Matrix::NullaryExpr(size, size, [&]() { return normal(rng); });
+    }
+    Matrix unmixing = mixing.inverse();
+
+    if (forceDense)
+    {
+        for (Matrix* m : { &mixing, &unmixing })
+        {
+            *m = m->unaryExpr([&](float x) { return x != 0 ? x : 1e-5f * normal(rng); });
+        }
+    }
+
+    // (spread over the groups)
+    std::vector<int> rejected(numRejected);
+    for (int r = 0; r < numRejected; ++r)
+    {
+        rejected[r] = r * numChans / numRejected;
+    }
+
+    std::vector<int> chans(numChans);
+    for (int c = 0; c < numChans; ++c)
+    {
+        chans[c] = c;
+    }
+
+    auto kernel = std::make_shared<const ApplyKernel>(mixing, unmixing, rejected);
+    ApplyPlan plan(kernel, chans);
+    ApplyPlan::Scratch scratch;
+    scratch.ensureSize(numChans);
+
+    // pool of blocks (channel-major, like an AudioSampleBuffer)
+    size_t blockFloats = size_t(numChans) * blockSize;
+    int numBlocks = int(std::max(poolBytes / (blockFloats * sizeof(float)), size_t(2)));
+    std::vector<std::vector<float>> pool(numBlocks, std::vector<float>(blockFloats));
+    for (auto& block : pool)
+    {
+        for (float& x : block)
+        {
+            x = normal(rng);
+        }
+    }
+
+    const std::vector<std::vector<float>> original = pool;
+
+    std::vector<std::vector<float*>> poolPointers(numBlocks, std::vector<float*>(numChans));
+    for (int b = 0; b < numBlocks; ++b)
+    {
+        for (int c = 0; c < numChans; ++c)
+        {
+            poolPointers[b][c] = pool[b].data() + size_t(c) * blockSize;
+        }
+    }
+
+    int64_t totalSamples = int64_t(seconds) * rate;
+    int totalBlocks = int((totalSamples + blockSize - 1) / blockSize);
+    int cacheSamps = int(60 * cacheFs);
+
+    enum Method { applyOnly, separate, fused, numMethods };
+    const char* names[numMethods] = { "apply only", "separate", "fused" };
+    double secPerDataSec[numMethods];
+    std::vector<std::vector<float>> finalCache[numMethods];
+
+    for (int m = 0; m < numMethods; ++m)
+    {
+        // (the same input for each method, since the plan changes it in place)
+        for (int b = 0; b < numBlocks; ++b)
+        {
+            std::copy(original[b].begin(), original[b].end(), pool[b].begin());
+        }
+
+        RingCache cache(numChans, cacheSamps);
+        DecimatingCapture capture(chans, stride);
+        int offset = 0;
+
+        auto startTime = std::chrono::steady_clock::now();
+
+        for (int b = 0; b < totalBlocks; ++b)
+        {
+            float* const* data = poolPointers[b % numBlocks].data();
+
+            if (m == separate)
+            {
+                int s;
+                for (s = offset; s < blockSize; s += stride)
+                {
+                    cache.writeFrame(data, s);
+                }
+                offset = s - blockSize;
+
+                plan.apply(data, blockSize, scratch);
+            }
+            else if (m == fused)
+            {
+                capture.beginBlock(cache, data, blockSize);
+                plan.apply(data, blockSize, scratch, nullptr, nullptr, &capture);
+                capture.finishBlock();
+            }
+            else
+            {
+                plan.apply(data, blockSize, scratch);
+            }
+        }
+
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime);
+        secPerDataSec[m] = elapsed.count() / (double(totalBlocks) * blockSize / rate);
+        finalCache[m].swap(cache.data);
+    }
+
+    // each decimated sample touches its own cache line if the stride is at least a line long
+    double applyLines = 2.0 * numChans * rate * sizeof(float) / cacheLineBytes; // read + write
+    double captureLines = double(numChans) * rate / std::max(stride, int(cacheLineBytes / sizeof(float)));
+
+    std::cout << numChans << " channels at " << rate << " Hz, blocks of " << blockSize
+        << ", cache every " << stride << "th sample, " << numRejected << " components removed\n"
+        << numGroups << " group(s), " << (kernel->isSparse() ? "sparse" : "dense") << " kernel\n\n";
+
+    std::cout << std::left << std::setw(12) << "method"
+        << std::right << std::setw(16) << "ms per data s"
+        << std::setw(14) << "% realtime"
+        << std::setw(22) << "buffer MB/s (est.)" << '\n';
+
+    for (int m = 0; m < numMethods; ++m)
+    {
+        double lines = applyLines + (m == separate ? captureLines : 0);
+        std::cout << std::left << std::setw(12) << names[m]
+            << std::right << std::fixed << std::setprecision(2)
+            << std::setw(16) << secPerDataSec[m] * 1000
+            << std::setw(14) << secPerDataSec[m] * 100
+            << std::setw(22) << std::setprecision(1) << lines * cacheLineBytes / (1 << 20) << '\n';
+    }
+
+    bool same = finalCache[separate] == finalCache[fused];
+    std::cout << "\ncache contents " << (same ? "match" : "DIFFER") << '\n';
+
+    return same ? 0 : 1;
+}
@@ -0,0 +1,443 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// ica_latency: measure the delay that the per-block processing of the ICA processors adds
+// to their output, for closed-loop use.
+//
+// Usage: ica_latency [--channels N] [--rate HZ] [--block N] [--seconds S] [--load T]
+//                    [--low HZ] [--high HZ]
+//
+// Synthetic channels are a random mix of noise sources, with two kinds of known events
+// injected into the sources: impulses in a kept component (standing in for spikes), at
+// random offsets relative to blocks and tiles, and steps in the component that is removed
+// (standing in for artifacts). Each configuration is run on the same data, a block at a time,
+// through the same calls that ICANode::process and ICAApplyNode::process make (ApplyPlan::apply,
+// ApplyPlan::crossfade and a fused ChannelFilter), and reports:
+//   delay      sample offset of each impulse's peak in the output from where it was injected
+//              (min/max over all impulses; 0/0 is sample-exact)
+//   error      largest difference from the exact result at zero delay (configurations without
+//              a filter only), to confirm the output isn't shifted at all
+//   step       size of the step left in the output, relative to the injected step (compared to
+//              the exact result, or to nothing for the band-pass configuration)
+//   group dly  group delay of the filter at the center of its band (analytic), in ms
+//   wall       time from the start of each callback to its output being written (p50/p99/max),
+//              in us, with blocks arriving in real time and T threads keeping the CPU busy
+//   total      worst-case latency of a sample: one block of buffering + max wall + group delay
+
+#include "ICAApplyPlan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ICA;
+
+using Clock = std::chrono::steady_clock;
+
+// events per second of each kind
+static const double impulsesPerSec = 10;
+static const double stepsPerSec = 2;
+
+// sizes of the injected events, in standard deviations of the sources
+static const float impulseSize = 200.0f;
+static const float stepSize = 50.0f;
+
+// impulse peaks are searched for this far after each impulse
+static const int maxDelaySearch = 256;
+
+// samples averaged on each side of a step to measure it
+static const int stepWindow = 32;
+
+// same as AsrEngine::stepSec (the crossfade length used when ASR updates)
+static const double crossfadeSec = 0.05;
+
+static const double pi = 3.14159265358979323846;
+
+struct Config
+{
+    const char* name;
+    int numGroups;  // > 1 for a block-diagonal operation
+    bool additive;  // remove all but a few components
+    bool filter;    // fuse a band-pass filter
+    bool crossfade; // keep crossfading between two copies of the operation (like ASR updates)
+};
+
+static const Config configs[] =
+{
+    { "subtractive", 1, false, false, false },
+    { "additive",    1, true,  false, false },
+    { "sparse",      8, false, false, false },
+    { "band-pass",   1, false, true,  false },
+    { "crossfade",   1, false, false, true  },
+};
+
+struct Result
+{
+    int minDelay = 0;
+    int maxDelay = 0;
+    double maxError = 0;
+    double stepResidual = 0;
+    double groupDelayMs = 0;
+    std::vector<double> wallUs;
+};
+
+static bool parseNumber(const std::string& text, double& value)
+{
+    char* end;
+    value = std::strtod(text.c_str(), &end);
+    return !text.empty() && *end == '\0' && value >= 0 && std::isfinite(value);
+}
+
+static void printUsage()
+{
+    std::cerr << "Usage: ica_latency [--channels N] [--rate HZ] [--block N] [--seconds S] [--load T]\n"
+        << "                   [--low HZ] [--high HZ]\n"
+        << "  --channels N   number of channels (default: 64)\n"
+        << "  --rate HZ      sample rate (default: 30000)\n"
+        << "  --block N      samples per callback (default: 512)\n"
+        << "  --seconds S    data per configuration, processed in real time (default: 5)\n"
+        << "  --load T       threads to keep busy during the run (default: 0)\n"
+        << "  --low HZ       low edge of the band-pass configuration (default: 300)\n"
+        << "  --high HZ      high edge of the band-pass configuration (default: 6000)\n";
+}
+
+// group delay of a biquad cascade at the given frequency, in samples
+static double groupDelay(const std::vector<Biquad>& sections, double freq, double sampleRate)
+{
+    auto phase = [&](double f)
+    {
+        std::complex<double> z = std::polar(1.0, -2 * pi * f / sampleRate); // z^-1
+        std::complex<double> h = 1;
+        for (const Biquad& bq : sections)
+        {
+            h *= (bq.b0 + bq.b1 * z + bq.b2 * z * z) / (1.0 + bq.a1 * z + bq.a2 * z * z);
+        }
+        return std::arg(h);
+    };
+
+    // -d(phase)/d(omega), by central difference (close enough that the phase doesn't wrap)
+    double df = sampleRate * 1e-6;
+    double dPhase = std::remainder(phase(freq + df) - phase(freq - df), 2 * pi);
+    return -dPhase / (2 * pi * 2 * df / sampleRate);
+}
+
+static double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+    return values[std::min(size_t(p * values.size()), values.size() - 1)];
+}
+
+int main(int argc, char* argv[])
+{
+    double numChansIn = 64;
+    double rate = 30000;
+    double blockSizeIn = 512;
+    double seconds = 5;
+    double numLoadIn = 0;
+    double lowHz = 300;
+    double highHz = 6000;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        double* dest = arg == "--channels" ? &numChansIn
+            : arg == "--rate" ? &rate
+            : arg == "--block" ? &blockSizeIn
+            : arg == "--seconds" ? &seconds
+            : arg == "--load" ? &numLoadIn
+            : arg == "--low" ? &lowHz
+            : arg == "--high" ? &highHz
+            : nullptr;
+
+        if (dest == nullptr || i + 1 >= argc || !parseNumber(argv[++i], *dest))
+        {
+            printUsage();
+            return 2;
+        }
+    }
+
+    int numChans = int(numChansIn);
+    int blockSize = int(blockSizeIn);
+    int numLoad = int(numLoadIn);
+    int numSamples = int(seconds * rate);
+
+    if (numChans < 8 || blockSize < 1 || rate <= 0 || numSamples < blockSize)
+    {
+        printUsage();
+        return 2;
+    }
+
+    std::mt19937 rng(1);
+    std::normal_distribution<float> normal;
+
+    // sources (channels x samples): component 0 gets the steps, component 1 the impulses
+    Matrix sources = Matrix::NullaryExpr(numChans, numSamples, [&]() { return normal(rng); });
+
+    std::vector<int> impulseTimes;
+    std::uniform_int_distribution<int> jitter(0, int(rate / impulsesPerSec) / 2);
+    for (double t = 0.1; t < seconds - 0.1; t += 1 / impulsesPerSec)
+    {
+        int sample = int(t * rate) + jitter(rng);
+        impulseTimes.push_back(sample);
+        sources(1, sample) += impulseSize;
+    }
+
+    std::vector<int> stepTimes;
+    float level = 0;
+    int prevStep = 0;
+    for (double t = 0.25; t < seconds - 0.1; t += 1 / stepsPerSec)
+    {
+        int sample = int(t * rate) + jitter(rng);
+        sources.block(0, prevStep, 1, sample - prevStep).array() += level;
+        level = level == 0 ? stepSize : 0;
+        stepTimes.push_back(sample);
+        prevStep = sample;
+    }
+    sources.block(0, prevStep, 1, numSamples - prevStep).array() += level;
+
+    std::vector<int> chans(numChans);
+    for (int c = 0; c < numChans; ++c)
+    {
+        chans[c] = c;
+    }
+
+    std::vector<Biquad> bandPass = ChannelFilter::designBandpass(lowHz, highHz, rate, 4);
+    double bandCenter = highHz > 0 && lowHz > 0 ? std::sqrt(lowHz * highHz) : std::max(lowHz, highHz);
+
+    // keep some threads busy, if requested
+    std::atomic<bool> stopLoad(false);
+    std::vector<std::thread> loadThreads;
+    for (int t = 0; t < numLoad; ++t)
+    {
+        loadThreads.emplace_back([&stopLoad]()
+        {
+            Matrix a = Matrix::Random(256, 256);
+            Matrix b = Matrix::Random(256, 256);
+            while (!stopLoad)
+            {
+                b = (a * b).normalized();
+            }
+        });
+    }
+
+    std::cout << numChans << " channels at " << rate << " Hz, callbacks of " << blockSize << " samples ("
+        << blockSize / rate * 1000 << " ms), " << numLoad << " load thread(s)\n\n";
+
+    std::cout << std::left << std::setw(13) << "config"
+        << std::right << std::setw(10) << "delay"
+        << std::setw(10) << "error"
+        << std::setw(9) << "step"
+        << std::setw(11) << "group dly"
+        << std::setw(26) << "wall p50/p99/max (us)"
+        << std::setw(12) << "total (ms)" << '\n';
+
+    bool allExact = true;
+
+    for (const Config& config : configs)
+    {
+        // mixing matrix (block-diagonal for the sparse configuration)
+        Matrix mixing = Matrix::Zero(numChans, numChans);
+        for (int g = 0; g < config.numGroups; ++g)
+        {
+            int begin = g * numChans / config.numGroups;
+            int size = (g + 1) * numChans / config.numGroups - begin;
+            mixing.block(begin, begin, size, size) = Matrix::NullaryExpr(size, size, [&]() { return normal(rng); });
+        }
+        Matrix unmixing = mixing.inverse();
+
+        // remove component 0 (the steps), or everything but a few including component 1
+        std::vector<int> rejected;
+        for (int comp = 0; comp < numChans; ++comp)
+        {
+            if (comp == 0 || (config.additive && comp >= 4))
+            {
+                rejected.push_back(comp);
+            }
+        }
+
+        ApplyPlan plan(mixing, unmixing, rejected, chans);
+        ApplyPlan otherPlan(mixing, unmixing, rejected, chans);
+        const ApplyPlan* fadeFrom = &otherPlan;
+        const ApplyPlan* fadeTo = &plan;
+        ApplyPlan::Scratch scratch;
+        scratch.ensureSize(numChans);
+
+        ChannelFilter filter(config.filter ? bandPass : std::vector<Biquad>(), chans);
+        int fadeLength = std::max(int(crossfadeSec * rate), 1);
+        int fadePos = 0;
+
+        // the data as it would arrive (channel-major, like an AudioSampleBuffer)
+        Matrix data = (mixing * sources).transpose();
+        std::vector<float*> pointers(numChans);
+
+        Matrix keep = Matrix::Identity(numChans, numChans);
+        for (int comp : rejected)
+        {
+            keep(comp, comp) = 0;
+        }
+        Matrix exact = (mixing.cast<double>() * keep.cast<double>() * unmixing.cast<double>()
+            * (mixing.cast<double>() * sources.cast<double>())).cast<float>().transpose();
+
+        Result result;
+        Clock::time_point startTime = Clock::now();
+
+        for (int start = 0; start + blockSize <= numSamples; start += blockSize)
+        {
+            // wait for the block to "arrive"
+            auto arrival = startTime + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>((start + blockSize) / rate));
+            std::this_thread::sleep_until(arrival);
+
+            for (int c = 0; c < numChans; ++c)
+            {
+                pointers[c] = data.col(c).data() + start;
+            }
+
+            Clock::time_point callbackStart = Clock::now();
+
+            if (config.crossfade)
+            {
+                ApplyPlan::crossfade(fadeFrom, fadeTo, pointers.data(), blockSize, scratch, fadePos, fadeLength);
+                fadePos += blockSize;
+                if (fadePos >= fadeLength)
+                {
+                    // (the blocks don't have to line up with the fades, but this is simpler)
+                    std::swap(fadeFrom, fadeTo);
+                    fadePos = 0;
+                }
+            }
+            else if (config.filter)
+            {
+                filter.beginBlock();
+                plan.apply(pointers.data(), blockSize, scratch, nullptr, &filter);
+                filter.finishBlock(pointers.data(), blockSize);
+            }
+            else
+            {
+                plan.apply(pointers.data(), blockSize, scratch);
+            }
+
+            result.wallUs.push_back(std::chrono::duration<double, std::micro>(Clock::now() - callbackStart).count());
+        }
+
+        int numProcessed = numSamples / blockSize * blockSize;
+
+        // impulses: find the peak on the channel the spike source is strongest on
+        int spikeChan;
+        mixing.col(1).cwiseAbs().maxCoeff(&spikeChan);
+        bool first = true;
+        for (int t : impulseTimes)
+        {
+            if (t + maxDelaySearch > numProcessed)
+            {
+                continue;
+            }
+
+            int peak;
+            data.col(spikeChan).segment(t, maxDelaySearch).cwiseAbs().maxCoeff(&peak);
+            result.minDelay = first ? peak : std::min(result.minDelay, peak);
+            result.maxDelay = first ? peak : std::max(result.maxDelay, peak);
+            first = false;
+        }
+
+        // difference from the exact result
+        Matrix diff = data.topRows(numProcessed) - exact.topRows(numProcessed);
+        if (!config.filter)
+        {
+            result.maxError = diff.cwiseAbs().maxCoeff() / exact.cwiseAbs().maxCoeff();
+        }
+
+        // steps, on the channel the artifact source is strongest on
+        int stepChan;
+        mixing.col(0).cwiseAbs().maxCoeff(&stepChan);
+        for (int t : stepTimes)
+        {
+            if (t - stepWindow < 0 || t + stepWindow > numProcessed)
+            {
+                continue;
+            }
+
+            const Matrix& left = config.filter ? data : diff;
+            double before = left.col(stepChan).segment(t - stepWindow, stepWindow).mean();
+            double after = left.col(stepChan).segment(t, stepWindow).mean();
+            double injected = std::abs(mixing(stepChan, 0)) * stepSize;
+            result.stepResidual = std::max(result.stepResidual, std::abs(after - before) / injected);
+        }
+
+        if (config.filter)
+        {
+            result.groupDelayMs = groupDelay(bandPass, bandCenter, rate) / rate * 1000;
+        }
+
+        double p50 = percentile(result.wallUs, 0.5);
+        double p99 = percentile(result.wallUs, 0.99);
+        double max = percentile(result.wallUs, 1.0);
+        double total = blockSize / rate * 1000 + max / 1000 + result.groupDelayMs;
+
+        // (the error allows for float rounding with a poorly conditioned mixing matrix)
+        bool sampleExact = result.minDelay == 0 && result.maxDelay == 0 && result.maxError < 1e-3;
+        allExact = allExact && (config.filter || sampleExact);
+
+        std::ostringstream delay, error, wall;
+        delay << result.minDelay << '/' << result.maxDelay;
+        if (config.filter)
+        {
+            error << '-';
+        }
+        else
+        {
+            error << std::scientific << std::setprecision(1) << result.maxError;
+        }
+        wall << std::fixed << std::setprecision(0) << p50 << '/' << p99 << '/' << max;
+
+        std::cout << std::left << std::setw(13) << config.name
+            << std::right << std::setw(10) << delay.str()
+            << std::setw(10) << error.str()
+            << std::setw(9) << std::fixed << std::setprecision(4) << result.stepResidual
+            << std::setw(11) << std::setprecision(2) << result.groupDelayMs
+            << std::setw(26) << wall.str()
+            << std::setw(12) << std::setprecision(2) << total << '\n';
+    }
+
+    stopLoad = true;
+    for (std::thread& thread : loadThreads)
+    {
+        thread.join();
+    }
+
+    if (!allExact)
+    {
+        std::cout << "\nsome configurations without a filter shifted the output\n";
+    }
+
+    return allExact ? 0 : 1;
+}
@@ -0,0 +1,984 @@
+/*
+------------------------------------------------------------------
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2019 Translational NeuroEngineering Laboratory
+------------------------------------------------------------------
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// ica_soak: run synthetic acquisition for a long time while randomly changing everything
+// that can change during a session, to find problems that only show up over time.
+//
+// Usage: ica_soak [--hours H] [--speed X] [--churn N] [--subprocs S] [--channels C]
+//                 [--rate HZ] [--block N] [--report S] [--binica EXE]
+//
+// The subprocessors are kept in a SubProcTable, as in ICANode, and used by the same threads
+// (the locks of each entry are standard library ones here, rather than JUCE's):
+//   audio thread    takes the callback lock for each block, then for each subprocessor
+//                   try-locks its data cache and its operation (as in ICANode::process),
+//                   applying the plan with a fused band-pass filter and cache capture
+//   message thread  randomly (N times per second on average) swaps in a new operation,
+//                   toggles a component, resizes a cache, replaces the subprocessor map
+//                   with different channel counts (as updateSettings does, sharing caches
+//                   and copying operations where they still fit), and starts training runs
+//   training thread goes through the steps of ICANode::run: gets the entry from the table,
+//                   copies its full cache out with a try-lock loop (as writeCacheData does),
+//                   computes its statistics and channel groups, trains on it, and sets the
+//                   result on the subprocessor's current entry (as setNewICAOp does) if it
+//                   still has the same channels. With --binica, training runs the binica
+//                   executable EXE on files in the current directory, with the config
+//                   written and the results loaded by the same code as ICANode; otherwise,
+//                   a whitening operation stands in for it.
+// Blocks arrive in real time times X (X = 0: as fast as possible). Every S seconds, a line
+// of counts for that interval is printed: xruns (callbacks that took longer than a block),
+// cache blocks dropped (the cache try-lock failed), unfiltered blocks (the operation's
+// try-lock failed), non-finite output, training runs (set, stale or failed), resident
+// memory, and callback time percentiles.
+// Exits nonzero if any output was non-finite.
+
+#include "ICAApplyPlan.h"
+#include "ICABinicaFiles.h"
+#include "ICAChannelGroups.h"
+#include "ICAStreamStats.h"
+#include "ICASubProcTable.h"
+#include "ICATileCapture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+using namespace ICA;
+
+using Clock = std::chrono::steady_clock;
+
+// as in ICANode
+static const float cacheFs = 500.0f;
+static const int filterOrder = 4;
+static const float filterLowHz = 300.0f;
+static const float filterHighHz = 6000.0f;
+static const int maxGroupChannels = 64;
+
+// range of cache lengths the message thread picks from, in seconds
+static const int minCacheSec = 10;
+static const int maxCacheSec = 60;
+
+// distinct blocks of noise the input is taken from
+static const int numNoiseBlocks = 16;
+
+// how long the training thread waits between try-locks (as in writeCacheData)
+static const int trainRetryMs = 100;
+
+// files of a binica run, in the current directory (named as ICANode names them)
+static const char* const binicaConfigFile = "binica.sc";
+static const char* const binicaInputFile = "input.floatdata";
+static const char* const binicaWeightFile = "output.wts";
+static const char* const binicaSphereFile = "output.sph";
+
+// ICANode's "fast" solver preset
+static const char* const binicaSettings = "maxsteps 128\nannealstep 0.9\n";
+
+// resident set size in bytes, or -1 if unknown
+static int64_t getResidentBytes()
+{
+#ifdef __linux__
+    long pages = 0, resident = 0;
+    FILE* statm = std::fopen("/proc/self/statm", "r");
+    if (statm)
+    {
+        int read = std::fscanf(statm, "%ld %ld", &pages, &resident);
+        std::fclose(statm);
+        if (read == 2)
+        {
+            return int64_t(resident) * sysconf(_SC_PAGESIZE);
+        }
+    }
+#endif
+    return -1;
+}
+
+// like ICANode's AudioBufferFifo
+class SoakCache : public FrameSink
+{
+public:
+    SoakCache(int numChans, int numSamps)
+        : data      (numChans, std::vector<float>(numSamps))
+        , numSamps  (numSamps)
+        , startPoint(0)
+        , numWritten(0)
+    {}
+
+    void writeFrames(const float* const* sources, int stride, int numFrames) override
+    {
+        int destStart = (startPoint + numWritten) % numSamps;
+        for (int c = 0; c < int(data.size()); ++c)
+        {
+            int dest = destStart;
+            for (int i = 0; i < numFrames; ++i)
+            {
+                data[c][dest] = sources[c][i * stride];
+                if (++dest == numSamps)
+                {
+                    dest = 0;
+                }
+            }
+        }
+
+        int total = numWritten + numFrames;
+        if (total > numSamps)
+        {
+            startPoint = (startPoint + total - numSamps) % numSamps;
+            numWritten = numSamps;
+        }
+        else
+        {
+            numWritten = total;
+        }
+    }
+
+    bool isFull() const
+    {
+        return numWritten == numSamps;
+    }
+
+    int getNumChannels() const
+    {
+        return int(data.size());
+    }
+
+    // keeps the most recent samples
+    void resizeKeepingData(int newNumSamps)
+    {
+        int keep = std::min(numWritten, newNumSamps);
+        for (auto& chan : data)
+        {
+            std::vector<float> resized(newNumSamps);
+            for (int i = 0; i < keep; ++i)
+            {
+                resized[i] = chan[(startPoint + numWritten - keep + i) % numSamps];
+            }
+            chan.swap(resized);
+        }
+
+        numSamps = newNumSamps;
+        startPoint = 0;
+        numWritten = keep;
+    }
+
+    // in chronological order
+    std::vector<std::vector<float>> copyAll() const
+    {
+        std::vector<std::vector<float>> copy(data.size(), std::vector<float>(numWritten));
+        for (int c = 0; c < int(data.size()); ++c)
+        {
+            for (int i = 0; i < numWritten; ++i)
+            {
+                copy[c][i] = data[c][(startPoint + i) % numSamps];
+            }
+        }
+        return copy;
+    }
+
+    std::mutex mutex;
+
+private:
+    std::vector<std::vector<float>> data;
+    int numSamps;
+    int startPoint;
+    int numWritten;
+};
+
+// like ICANode::SubProcData
+struct SubProc
+{
+    uint32_t id;
+    std::vector<int> chans; // buffer channels
+    std::shared_ptr<SoakCache> cache; // (shared with the entry that replaces this one, if it fits)
+    std::unique_ptr<DecimatingCapture> capture;
+
+    std::shared_timed_mutex opMutex;
+    Matrix mixing;
+    Matrix unmixing;
+    std::vector<int> rejected;
+    std::unique_ptr<ApplyPlan> plan;
+    std::unique_ptr<ChannelFilter> filter;
+};
+
+using SubProcMap = SubProcTable<SubProc>::Map;
+
+// counts for the current report interval (written by the audio thread)
+struct Counters
+{
+    std::atomic<int64_t> blocks{ 0 };
+    std::atomic<int64_t> xruns{ 0 };
+    std::atomic<int64_t> droppedCache{ 0 };
+    std::atomic<int64_t> unfiltered{ 0 };
+    std::atomic<int64_t> nonFinite{ 0 };
+};
+
+// message thread events
+struct Events
+{
+    std::atomic<int> opSwaps{ 0 };
+    std::atomic<int> toggles{ 0 };
+    std::atomic<int> resizes{ 0 };
+    std::atomic<int> settings{ 0 };
+    std::atomic<int> trainingRuns{ 0 };
+    std::atomic<int> staleResults{ 0 };
+    std::atomic<int> failedRuns{ 0 };
+};
+
+class Soak
+{
+public:
+    Soak(int numSubProcs, int maxChans, double sampleRate, int blockSize, double speed, double churn,
+        std::string binicaPath)
+        : numSubProcs   (numSubProcs)
+        , maxChans      (maxChans)
+        , sampleRate    (sampleRate)
+        , blockSize     (blockSize)
+        , speed         (speed)
+        , churn         (churn)
+        , binicaPath    (std::move(binicaPath))
+        , stride        (std::max(int(sampleRate / cacheFs), 1))
+        , bandPass      (ChannelFilter::designBandpass(filterLowHz, filterHighHz, sampleRate, filterOrder))
+        , buffer        (numSubProcs * maxChans, std::vector<float>(blockSize))
+        , rng           (1)
+        , running       (true)
+    {
+        std::normal_distribution<float> normal;
+        noise.resize(numNoiseBlocks, std::vector<float>(size_t(numSubProcs) * maxChans * blockSize));
+        for (auto& block : noise)
+        {
+            for (float& x : block)
+            {
+                x = normal(rng);
+            }
+        }
+
+        scratch.ensureSize(maxChans);
+        subProcs.replace(buildSubProcs());
+    }
+
+    void run(double hours, double reportSec)
+    {
+        std::thread audio([this, hours]() { runAudio(hours); });
+        std::thread training([this]() { runTraining(); });
+
+        Clock::time_point start = Clock::now();
+        Clock::time_point nextReport = start + toDuration(reportSec);
+        int64_t firstRss = getResidentBytes();
+        int64_t totalNonFinite = 0;
+
+        printHeader();
+
+        while (running)
+        {
+            doRandomEvent();
+
+            std::exponential_distribution<double> wait(churn);
+            std::this_thread::sleep_for(toDuration(std::min(wait(rng), reportSec)));
+
+            if (Clock::now() >= nextReport || !running)
+            {
+                totalNonFinite += report(std::chrono::duration<double>(Clock::now() - start).count());
+                nextReport += toDuration(reportSec);
+            }
+        }
+
+        audio.join();
+        {
+            std::lock_guard<std::mutex> lock(trainMutex);
+        }
+        trainCondition.notify_all();
+        training.join();
+
+        int64_t lastRss = getResidentBytes();
+        if (firstRss >= 0 && lastRss >= 0)
+        {
+            std::cout << "\nresident memory grew by " << (lastRss - firstRss) / double(1 << 20) << " MB\n";
+        }
+
+        status = totalNonFinite > 0 ? 1 : 0;
+    }
+
+    int getStatus() const
+    {
+        return status;
+    }
+
+private:
+    static Clock::duration toDuration(double sec)
+    {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(sec));
+    }
+
+    /**** audio thread ****/
+
+    void runAudio(double hours)
+    {
+        double blockSec = blockSize / sampleRate;
+        int64_t numBlocks = int64_t(hours * 3600 / blockSec);
+        std::vector<float*> pointers(buffer.size());
+        for (int c = 0; c < int(buffer.size()); ++c)
+        {
+            pointers[c] = buffer[c].data();
+        }
+
+        Clock::time_point start = Clock::now();
+        for (int64_t b = 0; b < numBlocks && running; ++b)
+        {
+            Clock::time_point due = start;
+            if (speed > 0)
+            {
+                due += toDuration(b * blockSec / speed);
+                std::this_thread::sleep_until(due);
+            }
+
+            // new input
+            const std::vector<float>& source = noise[b % numNoiseBlocks];
+            for (int c = 0; c < int(buffer.size()); ++c)
+            {
+                std::copy_n(source.begin() + size_t(c) * blockSize, blockSize, buffer[c].begin());
+            }
+
+            Clock::time_point callbackStart = Clock::now();
+            {
+                std::lock_guard<std::mutex> callbackLock(callbackMutex);
+                process(pointers.data());
+            }
+            Clock::time_point callbackEnd = Clock::now();
+
+            double callbackSec = std::chrono::duration<double>(callbackEnd - callbackStart).count();
+            {
+                std::lock_guard<std::mutex> lock(latencyMutex);
+                callbackUs.push_back(callbackSec * 1e6);
+            }
+
+            // (late if the output wasn't ready before the next block was due)
+            double lateSec = speed > 0 ? std::chrono::duration<double>(callbackEnd - due).count() : callbackSec;
+            if (lateSec > blockSec)
+            {
+                ++counters.xruns;
+            }
+            ++counters.blocks;
+        }
+
+        running = false;
+    }
+
+    // like ICANode::process
+    void process(float* const* data)
+    {
+        for (auto& entry : subProcs)
+        {
+            SubProc& sub = *entry.second;
+
+            std::unique_lock<std::mutex> cacheLock(sub.cache->mutex, std::try_to_lock);
+            DecimatingCapture* capture = cacheLock.owns_lock() ? sub.capture.get() : nullptr;
+            if (capture)
+            {
+                capture->beginBlock(*sub.cache, data, blockSize);
+            }
+            else
+            {
+                ++counters.droppedCache;
+            }
+
+            std::shared_lock<std::shared_timed_mutex> opLock(sub.opMutex, std::try_to_lock);
+            if (!opLock.owns_lock())
+            {
+                ++counters.unfiltered;
+            }
+            else if (sub.plan)
+            {
+                sub.filter->beginBlock();
+                sub.plan->apply(data, blockSize, scratch, nullptr, sub.filter.get(), capture);
+                sub.filter->finishBlock(data, blockSize);
+            }
+
+            if (capture)
+            {
+                capture->finishBlock();
+            }
+
+            for (int chan : sub.chans)
+            {
+                if (!std::all_of(data[chan], data[chan] + blockSize, [](float x) { return std::isfinite(x); }))
+                {
+                    ++counters.nonFinite;
+                    break;
+                }
+            }
+        }
+    }
+
+    /**** message thread ****/
+
+    void doRandomEvent()
+    {
+        std::uniform_int_distribution<int> pick(0, 99);
+        int event = pick(rng);
+
+        if (event < 30)
+        {
+            swapRandomOp();
+        }
+        else if (event < 60)
+        {
+            toggleRandomComponent();
+        }
+        else if (event < 75)
+        {
+            resizeRandomCache();
+        }
+        else if (event < 85)
+        {
+            updateSettings();
+        }
+        else
+        {
+            startTraining();
+        }
+    }
+
+    SubProc& randomSubProc()
+    {
+        std::uniform_int_distribution<int> pick(0, int(subProcs.size()) - 1);
+        auto it = subProcs.begin();
+        std::advance(it, pick(rng));
+        return *it->second;
+    }
+
+    // build the plan and filter for an operation (outside of the lock), then swap them in
+    // (message and training threads)
+    void setOperation(SubProc& sub, Matrix mixing, Matrix unmixing, std::vector<int> rejected)
+    {
+        std::unique_ptr<ApplyPlan> plan;
+        std::unique_ptr<ChannelFilter> filter(new ChannelFilter(bandPass, sub.chans));
+        if (mixing.rows() == int(sub.chans.size()))
+        {
+            plan.reset(new ApplyPlan(mixing, unmixing, rejected, sub.chans));
+        }
+
+        // (the old ones are destroyed after the lock is released)
+        {
+            std::unique_lock<std::shared_timed_mutex> lock(sub.opMutex);
+            sub.mixing.swap(mixing);
+            sub.unmixing.swap(unmixing);
+            sub.rejected.swap(rejected);
+            sub.plan.swap(plan);
+            sub.filter.swap(filter);
+        }
+    }
+
+    void swapRandomOp()
+    {
+        SubProc& sub = randomSubProc();
+        int n = int(sub.chans.size());
+
+        std::normal_distribution<float> normal;
+        Matrix mixing = Matrix::Identity(n, n) + 0.3f * Matrix::NullaryExpr(n, n, [&]() { return normal(rng); }) / std::sqrt(float(n));
+        Matrix unmixing = mixing.inverse();
+
+        std::uniform_int_distribution<int> pickComp(0, n - 1);
+        std::vector<int> rejected{ pickComp(rng), pickComp(rng) };
+
+        setOperation(sub, std::move(mixing), std::move(unmixing), std::move(rejected));
+        ++events.opSwaps;
+    }
+
+    void toggleRandomComponent()
+    {
+        SubProc& sub = randomSubProc();
+        if (!sub.plan)
+        {
+            return;
+        }
+
+        int n = int(sub.chans.size());
+        std::uniform_int_distribution<int> pickComp(0, n - 1);
+        int comp = pickComp(rng);
+
+        // (a training run may set a new operation meanwhile, which this then replaces)
+        Matrix mixing, unmixing;
+        std::vector<int> rejected;
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(sub.opMutex);
+            mixing = sub.mixing;
+            unmixing = sub.unmixing;
+            rejected = sub.rejected;
+        }
+
+        auto it = std::find(rejected.begin(), rejected.end(), comp);
+        if (it == rejected.end())
+        {
+            rejected.push_back(comp);
+        }
+        else
+        {
+            rejected.erase(it);
+        }
+
+        setOperation(sub, std::move(mixing), std::move(unmixing), std::move(rejected));
+        ++events.toggles;
+    }
+
+    void resizeRandomCache()
+    {
+        SubProc& sub = randomSubProc();
+        std::uniform_int_distribution<int> pickSec(minCacheSec, maxCacheSec);
+
+        std::lock_guard<std::mutex> lock(sub.cache->mutex);
+        sub.cache->resizeKeepingData(int(pickSec(rng) * cacheFs));
+        ++events.resizes;
+    }
+
+    // like ICANode::updateSettings: new channel counts, keeping what still fits
+    SubProcMap buildSubProcs()
+    {
+        // (either all or half of the channels, so caches are often kept)
+        std::bernoulli_distribution pickHalf(0.5);
+        std::uniform_int_distribution<int> pickSec(minCacheSec, maxCacheSec);
+
+        SubProcMap newSubProcs;
+        for (uint32_t id = 0; id < uint32_t(numSubProcs); ++id)
+        {
+            auto sub = std::make_shared<SubProc>();
+            sub->id = id;
+
+            int n = pickHalf(rng) ? std::max(maxChans / 2, 2) : maxChans;
+            for (int c = 0; c < n; ++c)
+            {
+                sub->chans.push_back(id * maxChans + c);
+            }
+
+            // (a training run may still be using the old entry, so it is left as it was)
+            auto old = subProcs.find(id);
+            if (old != subProcs.end() && old->second->cache->getNumChannels() == n)
+            {
+                SubProc& oldSub = *old->second;
+                sub->cache = oldSub.cache;
+
+                Matrix mixing, unmixing;
+                std::vector<int> rejected;
+                {
+                    std::shared_lock<std::shared_timed_mutex> lock(oldSub.opMutex);
+                    mixing = oldSub.mixing;
+                    unmixing = oldSub.unmixing;
+                    rejected = oldSub.rejected;
+                }
+                setOperation(*sub, std::move(mixing), std::move(unmixing), std::move(rejected));
+            }
+            else
+            {
+                sub->cache = std::make_shared<SoakCache>(n, int(pickSec(rng) * cacheFs));
+                setOperation(*sub, Matrix(), Matrix(), {});
+            }
+
+            sub->capture.reset(new DecimatingCapture(sub->chans, stride));
+            newSubProcs[id] = std::move(sub);
+        }
+
+        return newSubProcs;
+    }
+
+    void updateSettings()
+    {
+        SubProcMap newSubProcs = buildSubProcs();
+
+        // (the old map is destroyed after the lock is released, except for an entry that
+        // a training run is still using)
+        SubProcMap oldSubProcs;
+        {
+            std::lock_guard<std::mutex> callbackLock(callbackMutex);
+            oldSubProcs = subProcs.replace(std::move(newSubProcs));
+        }
+        ++events.settings;
+    }
+
+    void startTraining()
+    {
+        SubProc& sub = randomSubProc();
+
+        std::lock_guard<std::mutex> lock(trainMutex);
+        if (trainSubProc >= 0)
+        {
+            return; // one at a time, as with the START button
+        }
+
+        trainSubProc = int(sub.id);
+        trainCondition.notify_all();
+    }
+
+    /**** training thread ****/
+
+    void runTraining()
+    {
+        while (true)
+        {
+            uint32_t id;
+            {
+                std::unique_lock<std::mutex> lock(trainMutex);
+                trainCondition.wait(lock, [this]() { return trainSubProc >= 0 || !running; });
+                if (!running)
+                {
+                    return;
+                }
+                id = uint32_t(trainSubProc);
+            }
+
+            train(id);
+
+            std::lock_guard<std::mutex> lock(trainMutex);
+            trainSubProc = -1;
+        }
+    }
+
+    // like ICANode::run
+    void train(uint32_t id)
+    {
+        // like writeCacheData
+        // (if the entry is replaced meanwhile, its cache is resized or left to the old entry)
+        std::shared_ptr<SubProc> sub = subProcs.acquire(id);
+        if (!sub)
+        {
+            ++events.failedRuns;
+            return;
+        }
+
+        int n = int(sub->chans.size());
+        std::vector<std::vector<float>> data;
+        while (running)
+        {
+            std::unique_lock<std::mutex> lock(sub->cache->mutex, std::try_to_lock);
+            if (!lock.owns_lock())
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(trainRetryMs));
+                continue;
+            }
+
+            if (!sub->cache->isFull() || sub->cache->getNumChannels() != n)
+            {
+                ++events.failedRuns;
+                return;
+            }
+
+            data = sub->cache->copyAll();
+            break;
+        }
+
+        if (data.empty())
+        {
+            return;
+        }
+        sub = nullptr;
+
+        StreamStatsOptions options;
+        options.covariance = true;
+        StreamStats stats(n, options);
+
+        std::vector<const float*> pointers;
+        for (auto& chan : data)
+        {
+            pointers.push_back(chan.data());
+        }
+        stats.addChannels(pointers.data(), int(data[0].size()));
+
+        Eigen::MatrixXd cov = stats.getCovariance();
+        groupChannels(cov, maxGroupChannels);
+
+        // like performICA
+        Matrix mixing, unmixing;
+        if (binicaPath.empty())
+        {
+            unmixing = covariancePower(cov, -0.5).cast<float>();
+            mixing = covariancePower(cov, 0.5).cast<float>();
+        }
+        else if (!runBinica(data, mixing, unmixing))
+        {
+            ++events.failedRuns;
+            return;
+        }
+
+        if (!unmixing.allFinite() || !mixing.allFinite())
+        {
+            ++events.failedRuns;
+            return;
+        }
+
+        // like setNewICAOp: on the current entry, if it still fits
+        sub = subProcs.acquire(id);
+        if (!sub || int(sub->chans.size()) != n)
+        {
+            ++events.staleResults;
+            return;
+        }
+
+        setOperation(*sub, std::move(mixing), std::move(unmixing), {});
+        ++events.trainingRuns;
+    }
+
+    // train with binica on data (channels x samples), in the current directory
+    bool runBinica(const std::vector<std::vector<float>>& data, Matrix& mixing, Matrix& unmixing)
+    {
+        int nChans = int(data.size());
+        int nFrames = int(data[0].size());
+
+        {
+            std::ofstream input;
+            openFile(input, binicaInputFile, std::ios::binary | std::ios::trunc);
+            std::vector<float> frame(nChans);
+            for (int i = 0; i < nFrames && input; ++i)
+            {
+                for (int c = 0; c < nChans; ++c)
+                {
+                    frame[c] = data[c][i];
+                }
+                input.write(reinterpret_cast<const char*>(frame.data()), nChans * sizeof(float));
+            }
+
+            input.close();
+            if (!input)
+            {
+                std::cerr << "Failed to write " << binicaInputFile << std::endl;
+                return false;
+            }
+        }
+
+        BinicaConfig config;
+        config.numChannels = nChans;
+        for (int c = 0; c < nChans; ++c)
+        {
+            config.enabledChannels.push_back(c);
+        }
+        config.weightFile = binicaWeightFile;
+        config.sphereFile = binicaSphereFile;
+
+        std::string error;
+        if (!writeBinicaConfig(binicaConfigFile, config, binicaInputFile, nFrames, binicaSettings, error))
+        {
+            std::cerr << error << std::endl;
+            return false;
+        }
+
+        // (binica reads its config from stdin; the results of the last run must not be reused)
+        std::remove(mixingMatrixFilename);
+        std::remove(unmixingMatrixFilename);
+        std::remove(factorsFilename);
+        std::remove(binicaWeightFile);
+        std::string command = "\"" + binicaPath + "\" < " + binicaConfigFile;
+#ifdef _WIN32
+        command += " > NUL";
+#else
+        command += " > /dev/null";
+#endif
+        if (std::system(command.c_str()) != 0)
+        {
+            std::cerr << "binica failed" << std::endl;
+            return false;
+        }
+
+        BinicaResults results;
+        if (!loadBinicaResults(binicaConfigFile, results, error))
+        {
+            std::cerr << "Failed to load binica results (" << error << ")" << std::endl;
+            return false;
+        }
+
+        mixing.swap(results.mixing);
+        unmixing.swap(results.unmixing);
+        return true;
+    }
+
+    /**** reporting ****/
+
+    void printHeader()
+    {
+        std::cout << std::setw(8) << "time (s)"
+            << std::setw(9) << "blocks"
+            << std::setw(7) << "xruns"
+            << std::setw(9) << "dropped"
+            << std::setw(11) << "unfiltered"
+            << std::setw(10) << "nonfinite"
+            << std::setw(32) << "swaps/toggles/resizes/settings"
+            << std::setw(16) << "runs/stale/fail"
+            << std::setw(9) << "RSS MB"
+            << std::setw(24) << "callback p50/p99/max us" << '\n';
+    }
+
+    int64_t report(double elapsed)
+    {
+        std::vector<double> latency;
+        {
+            std::lock_guard<std::mutex> lock(latencyMutex);
+            latency.swap(callbackUs);
+        }
+        std::sort(latency.begin(), latency.end());
+
+        auto percentile = [&](double p)
+        {
+            return latency.empty() ? 0.0 : latency[std::min(size_t(p * latency.size()), latency.size() - 1)];
+        };
+
+        int64_t nonFinite = counters.nonFinite.exchange(0);
+        int64_t rss = getResidentBytes();
+
+        std::ostringstream changes, runs, callback;
+        changes << events.opSwaps.exchange(0) << '/' << events.toggles.exchange(0) << '/'
+            << events.resizes.exchange(0) << '/' << events.settings.exchange(0);
+        runs << events.trainingRuns.exchange(0) << '/' << events.staleResults.exchange(0) << '/'
+            << events.failedRuns.exchange(0);
+        callback << std::fixed << std::setprecision(0)
+            << percentile(0.5) << '/' << percentile(0.99) << '/' << percentile(1.0);
+
+        std::cout << std::setw(8) << std::fixed << std::setprecision(0) << elapsed
+            << std::setw(9) << counters.blocks.exchange(0)
+            << std::setw(7) << counters.xruns.exchange(0)
+            << std::setw(9) << counters.droppedCache.exchange(0)
+            << std::setw(11) << counters.unfiltered.exchange(0)
+            << std::setw(10) << nonFinite
+            << std::setw(32) << changes.str()
+            << std::setw(16) << runs.str()
+            << std::setw(9) << std::setprecision(1) << (rss >= 0 ? rss / double(1 << 20) : -1.0)
+            << std::setw(24) << callback.str() << std::endl;
+
+        return nonFinite;
+    }
+
+    const int numSubProcs;
+    const int maxChans;
+    const double sampleRate;
+    const int blockSize;
+    const double speed;
+    const double churn;
+    const std::string binicaPath; // empty to train a whitening operation instead
+    const int stride;
+    const std::vector<Biquad> bandPass;
+
+    std::vector<std::vector<float>> buffer;
+    std::vector<std::vector<float>> noise;
+    ApplyPlan::Scratch scratch; // audio thread
+    std::mt19937 rng;           // message thread
+
+    std::mutex callbackMutex;         // held by the audio thread while processing a block
+    SubProcTable<SubProc> subProcs;   // replaced by the message thread under callbackMutex
+
+    std::mutex trainMutex;
+    std::condition_variable trainCondition;
+    int trainSubProc = -1; // of the run that is pending or running, or -1
+
+    std::mutex latencyMutex;
+    std::vector<double> callbackUs;
+
+    Counters counters;
+    Events events;
+    std::atomic<bool> running;
+    int status = 0;
+};
+
+static bool parseNumber(const std::string& text, double& value)
+{
+    char* end;
+    value = std::strtod(text.c_str(), &end);
+    return !text.empty() && *end == '\0' && value >= 0 && std::isfinite(value);
+}
+
+static void printUsage()
+{
+    std::cerr << "Usage: ica_soak [--hours H] [--speed X] [--churn N] [--subprocs S] [--channels C]\n"
+        << "                [--rate HZ] [--block N] [--report S] [--binica EXE]\n"
+        << "  --hours H      amount of data to process (default: 4)\n"
+        << "  --speed X      multiple of real time to run at, or 0 for as fast as possible (default: 1)\n"
+        << "  --churn N      average number of random changes per second (default: 5)\n"
+        << "  --subprocs S   number of subprocessors (default: 2)\n"
+        << "  --channels C   maximum channels per subprocessor (default: 64)\n"
+        << "  --rate HZ      sample rate (default: 30000)\n"
+        << "  --block N      samples per callback (default: 512)\n"
+        << "  --report S     seconds between reports (default: 60)\n"
+        << "  --binica EXE   train with this binica executable, in the current directory\n"
+        << "                 (default: train a whitening operation instead)\n";
+}
+
+int main(int argc, char* argv[])
+{
+    double hours = 4;
+    double speed = 1;
+    double churn = 5;
+    double numSubProcs = 2;
+    double maxChans = 64;
+    double rate = 30000;
+    double blockSize = 512;
+    double reportSec = 60;
+    std::string binicaPath;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--binica" && i + 1 < argc)
+        {
+            binicaPath = argv[++i];
+            continue;
+        }
+
+        double* dest = arg == "--hours" ? &hours
+            : arg == "--speed" ? &speed
+            : arg == "--churn" ? &churn
+            : arg == "--subprocs" ? &numSubProcs
+            : arg == "--channels" ? &maxChans
+            : arg == "--rate" ? &rate
+            : arg == "--block" ? &blockSize
+            : arg == "--report" ? &reportSec
+            : nullptr;
+
+        if (dest == nullptr || i + 1 >= argc || !parseNumber(argv[++i], *dest))
+        {
+            printUsage();
+            return 2;
+        }
+    }
+
+    if (numSubProcs < 1 || maxChans < 4 || rate < cacheFs || blockSize < 1 || churn <= 0 || reportSec <= 0)
+    {
+        printUsage();
+        return 2;
+    }
+
+    std::cout << int(numSubProcs) << " subprocessor(s) of up to " << int(maxChans) << " channels at "
+        << rate << " Hz, callbacks of " << int(blockSize) << " samples, " << churn
+        << " changes per second, " << hours << " h of data at " << speed << "x"
+        << (binicaPath.empty() ? "" : ", training with " + binicaPath) << "\n\n";
+
+    Soak soak(int(numSubProcs), int(maxChans), rate, int(blockSize), speed, churn, binicaPath);
+    soak.run(hours, reportSec);
+
+    return soak.getStatus();
+}